@@ -85,6 +85,10 @@ typedef struct {
 	uintptr_t seq;
 
 	struct spa_audio_info_raw format;
+
+	/* areas of the PipeWire buffer, the addresses are updated for
+	 * each buffer in the process function */
+	snd_pcm_channel_area_t areas[MAX_CHANNELS];
 } snd_pcm_pipewire_t;
 
 static int snd_pcm_pipewire_stop(snd_pcm_ioplug_t *io);
@@ -248,21 +252,67 @@ static int snd_pcm_pipewire_delay(snd_pcm_ioplug_t *io, snd_pcm_sframes_t *delay
 	return 0;
 }
 
+/* check if the mmap areas of the plugin have the same layout as the
+ * PipeWire buffer. Interleaved frames and planar channels are then
+ * contiguous in both and can be copied with one memcpy per block. */
+static bool areas_match(snd_pcm_pipewire_t *pw, const snd_pcm_channel_area_t *areas)
+{
+	snd_pcm_ioplug_t *io = &pw->io;
+	unsigned int channel;
+
+	if (pw->sample_bits % 8)
+		return false;
+
+	for (channel = 0; channel < io->channels; channel++) {
+		const snd_pcm_channel_area_t *a = &areas[channel];
+		if (a->step != pw->areas[channel].step ||
+		    a->first % 8 != 0)
+			return false;
+		if (pw->blocks == 1 &&
+		    (a->addr != areas[0].addr ||
+		     a->first != areas[0].first + channel * pw->sample_bits))
+			return false;
+	}
+	return true;
+}
+
+static void copy_blocks(snd_pcm_pipewire_t *pw, const snd_pcm_channel_area_t *areas,
+		snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
+{
+	snd_pcm_ioplug_t *io = &pw->io;
+	snd_pcm_uframes_t avail = io->buffer_size - offset;
+	size_t l0 = SPA_MIN(frames, avail) * pw->stride;
+	size_t l1 = frames * pw->stride - l0;
+	uint32_t bl;
+
+	for (bl = 0; bl < pw->blocks; bl++) {
+		uint8_t *ring = SPA_PTROFF(areas[bl].addr, areas[bl].first / 8, uint8_t);
+		uint8_t *buf = SPA_PTROFF(pw->areas[bl].addr, pw->areas[bl].first / 8, uint8_t);
+
+		if (io->stream == SND_PCM_STREAM_PLAYBACK) {
+			memcpy(buf, ring + offset * pw->stride, l0);
+			if (SPA_UNLIKELY(l1 > 0))
+				memcpy(buf + l0, ring, l1);
+		} else {
+			memcpy(ring + offset * pw->stride, buf, l0);
+			if (SPA_UNLIKELY(l1 > 0))
+				memcpy(ring, buf + l0, l1);
+		}
+	}
+}
+
 static snd_pcm_uframes_t
 snd_pcm_pipewire_process(snd_pcm_pipewire_t *pw, struct pw_buffer *b,
 		snd_pcm_uframes_t *hw_avail,snd_pcm_uframes_t want)
 {
 	snd_pcm_ioplug_t *io = &pw->io;
-	snd_pcm_channel_area_t *pwareas;
+	snd_pcm_channel_area_t *pwareas = pw->areas;
 	snd_pcm_uframes_t xfer = 0;
 	snd_pcm_uframes_t nframes;
-	unsigned int channel;
 	struct spa_data *d;
-	void *ptr;
 	uint32_t bl, offset, size;
 
 	d = b->buffer->datas;
-	pwareas = alloca(io->channels * sizeof(snd_pcm_channel_area_t));
 
 	for (bl = 0; bl < pw->blocks; bl++) {
 		if (io->stream == SND_PCM_STREAM_PLAYBACK) {
@@ -275,33 +325,18 @@ snd_pcm_pipewire_process(snd_pcm_pipewire_t *pw, struct pw_buffer *b,
 	}
 	nframes = SPA_MIN(want, *hw_avail);
 
-	if (pw->blocks == 1) {
+	for (bl = 0; bl < pw->blocks; bl++) {
 		if (io->stream == SND_PCM_STREAM_PLAYBACK) {
-			d[0].chunk->size = want * pw->stride;
-			d[0].chunk->offset = offset = 0;
+			d[bl].chunk->size = want * pw->stride;
+			d[bl].chunk->offset = offset = 0;
 		} else {
-			offset = SPA_MIN(d[0].chunk->offset, d[0].maxsize);
-		}
-		ptr = SPA_PTROFF(d[0].data, offset, void);
-		for (channel = 0; channel < io->channels; channel++) {
-			pwareas[channel].addr = ptr;
-			pwareas[channel].first = channel * pw->sample_bits;
-			pwareas[channel].step = io->channels * pw->sample_bits;
-		}
-	} else {
-		for (channel = 0; channel < io->channels; channel++) {
-			if (io->stream == SND_PCM_STREAM_PLAYBACK) {
-				d[channel].chunk->size = want * pw->stride;
-				d[channel].chunk->offset = offset = 0;
-			} else {
-				offset = SPA_MIN(d[channel].chunk->offset, d[channel].maxsize);
-			}
-			ptr = SPA_PTROFF(d[channel].data, offset, void);
-			pwareas[channel].addr = ptr;
-			pwareas[channel].first = 0;
-			pwareas[channel].step = pw->sample_bits;
+			offset = SPA_MIN(d[bl].chunk->offset, d[bl].maxsize);
 		}
+		pwareas[bl].addr = SPA_PTROFF(d[bl].data, offset, void);
 	}
+	/* interleaved channels share the address of the first block */
+	for (; bl < io->channels; bl++)
+		pwareas[bl].addr = pwareas[0].addr;
 
 	if (io->state == SND_PCM_STATE_RUNNING ||
 		io->state == SND_PCM_STATE_DRAINING) {
@@ -311,7 +346,9 @@ snd_pcm_pipewire_process(snd_pcm_pipewire_t *pw, struct pw_buffer *b,
 			const snd_pcm_channel_area_t *areas = snd_pcm_ioplug_mmap_areas(io);
 			const snd_pcm_uframes_t offset = hw_ptr % io->buffer_size;
 
-			if (io->stream == SND_PCM_STREAM_PLAYBACK)
+			if (areas_match(pw, areas))
+				copy_blocks(pw, areas, offset, xfer);
+			else if (io->stream == SND_PCM_STREAM_PLAYBACK)
 				snd_pcm_areas_copy_wrap(pwareas, 0, nframes,
 						areas, offset,
 						io->buffer_size,
@@ -667,6 +704,7 @@ static int snd_pcm_pipewire_hw_params(snd_pcm_ioplug_t * io,
 				snd_pcm_hw_params_t * params)
 {
 	snd_pcm_pipewire_t *pw = io->private_data;
+	unsigned int i;
 	bool planar;
 
 	snd_pcm_hw_params_dump(params, pw->output);
@@ -726,6 +764,10 @@ static int snd_pcm_pipewire_hw_params(snd_pcm_ioplug_t * io,
 		SNDERR("PipeWire: invalid format: %d\n", io->format);
 		return -EINVAL;
 	}
+	if (io->channels > MAX_CHANNELS) {
+		SNDERR("PipeWire: invalid channels: %d\n", io->channels);
+		return -EINVAL;
+	}
 	pw->format.channels = io->channels;
 	pw->format.rate = io->rate;
 
@@ -739,6 +781,11 @@ static int snd_pcm_pipewire_hw_params(snd_pcm_ioplug_t * io,
 		pw->blocks = 1;
 		pw->stride = (io->channels * pw->sample_bits) / 8;
 	}
+	for (i = 0; i < io->channels; i++) {
+		pw->areas[i].addr = NULL;
+		pw->areas[i].first = planar ? 0 : i * pw->sample_bits;
+		pw->areas[i].step = planar ? pw->sample_bits : io->channels * pw->sample_bits;
+	}
 	pw->hw_params_changed = true;
 	pw_log_info("%p: format:%s channels:%d rate:%d stride:%d blocks:%d", pw,
 			spa_debug_type_find_name(spa_type_audio_format, pw->format.format),
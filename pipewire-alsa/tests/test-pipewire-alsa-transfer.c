@@ -0,0 +1,309 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 PipeWire authors */
+/* SPDX-License-Identifier: MIT */
+
+/*
+ [title]
+ Compare the mmap and read/write transfer of pipewire-alsa.
+ [title]
+ */
+
+#include <alsa/asoundlib.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#define DEFAULT_PCM		"pipewire"
+#define DEFAULT_RATE		48000
+#define DEFAULT_CHANNELS	2
+#define DEFAULT_PERIOD		256
+#define DEFAULT_SECONDS		5
+
+#define IMPULSE_INTERVAL	(DEFAULT_RATE / 2)
+#define IMPULSE_THRESHOLD	0.5f
+
+struct data {
+	const char *playback;
+	const char *capture;
+	snd_pcm_access_t access;
+	unsigned int rate;
+	unsigned int channels;
+	snd_pcm_uframes_t period;
+	unsigned int seconds;
+
+	snd_pcm_t *out;
+	snd_pcm_t *in;
+
+	uint64_t written;
+	uint64_t read;
+	uint64_t impulse_at;
+	uint64_t latency_sum;
+	uint32_t latency_count;
+	uint32_t xruns;
+};
+
+static uint64_t get_time(clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int setup_pcm(struct data *d, snd_pcm_t *pcm)
+{
+	snd_pcm_hw_params_t *params;
+	snd_pcm_uframes_t buffer = d->period * 4;
+	unsigned int rate = d->rate;
+	int res;
+
+	snd_pcm_hw_params_alloca(&params);
+	if ((res = snd_pcm_hw_params_any(pcm, params)) < 0 ||
+	    (res = snd_pcm_hw_params_set_access(pcm, params, d->access)) < 0 ||
+	    (res = snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_FLOAT)) < 0 ||
+	    (res = snd_pcm_hw_params_set_rate_near(pcm, params, &rate, 0)) < 0 ||
+	    (res = snd_pcm_hw_params_set_channels(pcm, params, d->channels)) < 0 ||
+	    (res = snd_pcm_hw_params_set_period_size_near(pcm, params, &d->period, 0)) < 0 ||
+	    (res = snd_pcm_hw_params_set_buffer_size_near(pcm, params, &buffer)) < 0 ||
+	    (res = snd_pcm_hw_params(pcm, params)) < 0) {
+		fprintf(stderr, "hw_params failed: %s\n", snd_strerror(res));
+		return res;
+	}
+	return snd_pcm_prepare(pcm);
+}
+
+static void fill(struct data *d, float *samples, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t i;
+	unsigned int c;
+
+	for (i = 0; i < frames; i++) {
+		uint64_t pos = d->written + i;
+		float v = (pos % IMPULSE_INTERVAL) == 0 ? 1.0f :
+			0.1f * sinf(2.0f * M_PI * 440.0f * pos / d->rate);
+		if ((pos % IMPULSE_INTERVAL) == 0)
+			d->impulse_at = pos;
+		for (c = 0; c < d->channels; c++)
+			samples[i * d->channels + c] = v;
+	}
+}
+
+static void scan(struct data *d, const float *samples, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t i;
+
+	for (i = 0; i < frames; i++) {
+		if (samples[i * d->channels] < IMPULSE_THRESHOLD || d->impulse_at == UINT64_MAX)
+			continue;
+		if (d->read + i >= d->impulse_at) {
+			d->latency_sum += d->read + i - d->impulse_at;
+			d->latency_count++;
+		}
+		d->impulse_at = UINT64_MAX;
+	}
+}
+
+static int recover(struct data *d, snd_pcm_t *pcm, int res)
+{
+	if (res == -EPIPE)
+		d->xruns++;
+	return snd_pcm_recover(pcm, res, 1);
+}
+
+static void *area_ptr(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t offset)
+{
+	return (uint8_t *)area->addr + (area->first + offset * area->step) / 8;
+}
+
+static snd_pcm_sframes_t mmap_avail(struct data *d, snd_pcm_t *pcm)
+{
+	snd_pcm_sframes_t avail;
+	int res;
+
+	while ((avail = snd_pcm_avail_update(pcm)) >= 0 &&
+	    avail < (snd_pcm_sframes_t)d->period) {
+		if (snd_pcm_state(pcm) != SND_PCM_STATE_RUNNING)
+			break;
+		if ((res = snd_pcm_wait(pcm, 1000)) < 0)
+			return res;
+	}
+	return avail;
+}
+
+static snd_pcm_sframes_t write_frames(struct data *d, float *samples)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames = d->period;
+	snd_pcm_sframes_t res;
+
+	fill(d, samples, frames);
+
+	if (d->access == SND_PCM_ACCESS_RW_INTERLEAVED)
+		return snd_pcm_writei(d->out, samples, frames);
+
+	if ((res = mmap_avail(d, d->out)) < 0)
+		return res;
+	if ((res = snd_pcm_mmap_begin(d->out, &areas, &offset, &frames)) < 0)
+		return res;
+	memcpy(area_ptr(&areas[0], offset), samples,
+			frames * d->channels * sizeof(float));
+	return snd_pcm_mmap_commit(d->out, offset, frames);
+}
+
+static snd_pcm_sframes_t read_frames(struct data *d, float *samples)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames = d->period;
+	snd_pcm_sframes_t res;
+
+	if (d->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
+		if ((res = snd_pcm_readi(d->in, samples, frames)) > 0)
+			scan(d, samples, res);
+		return res;
+	}
+	if ((res = mmap_avail(d, d->in)) < 0)
+		return res;
+	if ((res = snd_pcm_mmap_begin(d->in, &areas, &offset, &frames)) < 0)
+		return res;
+	scan(d, area_ptr(&areas[0], offset), frames);
+	return snd_pcm_mmap_commit(d->in, offset, frames);
+}
+
+static void show_help(const char *name)
+{
+	printf("%s [options]\n"
+		"  -h, --help            Show this help\n"
+		"  -D, --playback        Playback PCM (default %s)\n"
+		"  -C, --capture         Capture PCM, looped back from the playback\n"
+		"                        PCM to measure the latency (default none)\n"
+		"  -m, --mmap            Use mmap transfer instead of read/write\n"
+		"  -p, --period          Period size in frames (default %d)\n"
+		"  -s, --seconds         Duration in seconds (default %d)\n",
+		name, DEFAULT_PCM, DEFAULT_PERIOD, DEFAULT_SECONDS);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct data data = {
+		.playback = DEFAULT_PCM,
+		.access = SND_PCM_ACCESS_RW_INTERLEAVED,
+		.rate = DEFAULT_RATE,
+		.channels = DEFAULT_CHANNELS,
+		.period = DEFAULT_PERIOD,
+		.seconds = DEFAULT_SECONDS,
+		.impulse_at = UINT64_MAX,
+	};
+	static const struct option long_options[] = {
+		{ "help",	no_argument,		NULL, 'h' },
+		{ "playback",	required_argument,	NULL, 'D' },
+		{ "capture",	required_argument,	NULL, 'C' },
+		{ "mmap",	no_argument,		NULL, 'm' },
+		{ "period",	required_argument,	NULL, 'p' },
+		{ "seconds",	required_argument,	NULL, 's' },
+		{ NULL, 0, NULL, 0}
+	};
+	uint64_t total, start_cpu, start_time, cpu, elapsed;
+	float *samples;
+	int c, res;
+
+	/* avoid rtkit in this test */
+	setenv("PIPEWIRE_CONFIG_NAME", "client.conf", false);
+
+	while ((c = getopt_long(argc, argv, "hD:C:mp:s:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			show_help(argv[0]);
+			return EXIT_SUCCESS;
+		case 'D':
+			data.playback = optarg;
+			break;
+		case 'C':
+			data.capture = optarg;
+			break;
+		case 'm':
+			data.access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+			break;
+		case 'p':
+			data.period = atoi(optarg);
+			break;
+		case 's':
+			data.seconds = atoi(optarg);
+			break;
+		default:
+			show_help(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((res = snd_pcm_open(&data.out, data.playback, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+		fprintf(stderr, "open %s failed: %s\n", data.playback, snd_strerror(res));
+		return EXIT_FAILURE;
+	}
+	if ((res = setup_pcm(&data, data.out)) < 0)
+		return EXIT_FAILURE;
+
+	if (data.capture != NULL) {
+		if ((res = snd_pcm_open(&data.in, data.capture, SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+			fprintf(stderr, "open %s failed: %s\n", data.capture, snd_strerror(res));
+			return EXIT_FAILURE;
+		}
+		if ((res = setup_pcm(&data, data.in)) < 0)
+			return EXIT_FAILURE;
+		if ((res = snd_pcm_link(data.out, data.in)) < 0)
+			fprintf(stderr, "link failed: %s\n", snd_strerror(res));
+	}
+
+	samples = calloc(data.period * data.channels, sizeof(float));
+	if (samples == NULL)
+		return EXIT_FAILURE;
+
+	total = (uint64_t)data.rate * data.seconds;
+	start_cpu = get_time(CLOCK_PROCESS_CPUTIME_ID);
+	start_time = get_time(CLOCK_MONOTONIC);
+
+	while (data.written < total) {
+		snd_pcm_sframes_t n;
+
+		if ((n = write_frames(&data, samples)) < 0) {
+			if ((res = recover(&data, data.out, n)) < 0)
+				break;
+		} else {
+			data.written += n;
+		}
+		if (data.in == NULL)
+			continue;
+
+		if ((n = read_frames(&data, samples)) < 0) {
+			if ((res = recover(&data, data.in, n)) < 0)
+				break;
+		} else {
+			data.read += n;
+		}
+	}
+	snd_pcm_drain(data.out);
+
+	cpu = get_time(CLOCK_PROCESS_CPUTIME_ID) - start_cpu;
+	elapsed = get_time(CLOCK_MONOTONIC) - start_time;
+
+	printf("access: %s period: %lu frames: %"PRIu64" xruns: %u\n",
+			snd_pcm_access_name(data.access), data.period,
+			data.written, data.xruns);
+	printf("cpu: %.3f ms in %.3f s (%.3f%%)\n",
+			cpu / 1e6, elapsed / 1e9, cpu * 100.0 / elapsed);
+	if (data.latency_count > 0)
+		printf("latency: %.3f ms (%u impulses)\n",
+			data.latency_sum * 1000.0 / data.latency_count / data.rate,
+			data.latency_count);
+	else if (data.in != NULL)
+		printf("latency: no impulses detected, is the capture looped back?\n");
+
+	free(samples);
+	if (data.in)
+		snd_pcm_close(data.in);
+	snd_pcm_close(data.out);
+
+	return EXIT_SUCCESS;
+}
@@ -14,8 +14,10 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <pthread.h>
+#include <sched.h>
 #include <limits.h>
 #include <linux/videodev2.h>
+#include <linux/dma-buf.h>
 
 #include "pipewire-v4l2.h"
 
@@ -74,6 +76,8 @@ struct buffer {
 	struct v4l2_buffer v4l2;
 	struct pw_buffer *buf;
 	uint32_t id;
+	uint64_t sync;		/* DMA_BUF_SYNC_ flags of a mapped dmabuf */
+	bool cpu_access;	/* between DQBUF and QBUF of a mapped dmabuf */
 };
 
 struct file {
@@ -115,6 +119,14 @@ struct file {
 
 	uint32_t sequence;
 
+	/* QBUF and DQBUF hand buffers to the stream without the thread loop
+	 * lock. queue_lock serializes the application threads, handoff_seq
+	 * is odd while the stream changes the buffers and handoff_users counts
+	 * the application threads that use them. */
+	pthread_mutex_t queue_lock;
+	int handoff_seq;
+	int handoff_users;
+
 	struct pw_array buffer_maps;
 
 	uint32_t last_fourcc;
@@ -262,6 +274,8 @@ static struct file *make_file(void)
 	file->fd = -1;
 	file->reqbufs_fd = -1;
 	file->priority = V4L2_PRIORITY_DEFAULT;
+	file->handoff_seq = 1;
+	pthread_mutex_init(&file->queue_lock, NULL);
 	spa_list_init(&file->globals);
 	pw_array_init(&file->buffer_maps, sizeof(struct buffer_map) * MAX_BUFFERS);
 	return file;
@@ -294,6 +308,7 @@ static void free_file(struct file *file)
 		pw_thread_loop_destroy(file->loop);
 
 	pw_array_clear(&file->buffer_maps);
+	pthread_mutex_destroy(&file->queue_lock);
 	free(file);
 }
 
@@ -1288,7 +1303,8 @@ static void on_stream_param_changed(void *data, uint32_t id, const struct spa_po
 			SPA_PARAM_BUFFERS_blocks,  SPA_POD_Int(1),
 			SPA_PARAM_BUFFERS_size,    SPA_POD_CHOICE_RANGE_Int(size, 0, INT_MAX),
 			SPA_PARAM_BUFFERS_stride,  SPA_POD_CHOICE_RANGE_Int(stride, 0, INT_MAX),
-			SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int((1<<SPA_DATA_MemFd)));
+			SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(
+						(1<<SPA_DATA_MemFd) | (1<<SPA_DATA_DmaBuf)));
 
 
 	pw_stream_update_params(file->stream, params, n_params);
@@ -1315,6 +1331,38 @@ static void on_stream_state_changed(void *data, enum pw_stream_state old,
 	pw_thread_loop_signal(file->loop, false);
 }
 
+/* Called on the thread that changes the buffers, with the thread loop lock.
+ * Wait for the application threads to leave the handoff, they take the lock
+ * and open it again on their next QBUF or DQBUF. */
+static void handoff_close(struct file *file)
+{
+	if ((SPA_ATOMIC_LOAD(file->handoff_seq) & 1) == 0)
+		SPA_ATOMIC_INC(file->handoff_seq);
+	while (SPA_ATOMIC_LOAD(file->handoff_users) > 0)
+		sched_yield();
+}
+
+static void handoff_open(struct file *file)
+{
+	if (SPA_ATOMIC_LOAD(file->handoff_seq) & 1)
+		SPA_ATOMIC_INC(file->handoff_seq);
+}
+
+static bool handoff_enter(struct file *file)
+{
+	SPA_ATOMIC_INC(file->handoff_users);
+	if (SPA_ATOMIC_LOAD(file->handoff_seq) & 1) {
+		SPA_ATOMIC_DEC(file->handoff_users);
+		return false;
+	}
+	return true;
+}
+
+static void handoff_leave(struct file *file)
+{
+	SPA_ATOMIC_DEC(file->handoff_users);
+}
+
 static void on_stream_add_buffer(void *data, struct pw_buffer *b)
 {
 	struct file *file = data;
@@ -1323,10 +1371,12 @@ static void on_stream_add_buffer(void *data, struct pw_buffer *b)
 	struct v4l2_buffer vb;
 	struct spa_data *d = &b->buffer->datas[0];
 
+	handoff_close(file);
+
 	file->size = d->maxsize;
 
-	pw_log_info("file:%d: id:%d fd:%"PRIi64" size:%u offset:%u", file->fd,
-			id, d->fd, file->size, id * file->size);
+	pw_log_info("file:%d: id:%d type:%u fd:%"PRIi64" size:%u offset:%u", file->fd,
+			id, d->type, d->fd, file->size, id * file->size);
 
 	spa_zero(vb);
 	vb.index = id;
@@ -1339,6 +1389,8 @@ static void on_stream_add_buffer(void *data, struct pw_buffer *b)
 	buf->v4l2 = vb;
 	buf->id = id;
 	buf->buf = b;
+	buf->sync = 0;
+	buf->cpu_access = false;
 	b->user_data = buf;
 
 	file->n_buffers++;
@@ -1347,6 +1399,8 @@ static void on_stream_add_buffer(void *data, struct pw_buffer *b)
 static void on_stream_remove_buffer(void *data, struct pw_buffer *b)
 {
 	struct file *file = data;
+	/* the stream clears its queues after this */
+	handoff_close(file);
 	file->n_buffers--;
 }
 
@@ -1899,6 +1953,8 @@ static int vidioc_reqbufs(struct file *file, int fd, struct v4l2_requestbuffers
 	arg->flags = 0;
 #endif
 #ifdef V4L2_BUF_CAP_SUPPORTS_MMAP
+	/* DMABUF import is not supported, the producer fills its own
+	 * buffers, they can be exported with VIDIOC_EXPBUF instead */
 	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
 #endif
 	memset(arg->reserved, 0, sizeof(arg->reserved));
@@ -1924,7 +1980,9 @@ static int vidioc_querybuf(struct file *file, struct v4l2_buffer *arg)
 		res = -EINVAL;
 		goto exit_unlock;
 	}
+	pthread_mutex_lock(&file->queue_lock);
 	*arg = file->buffers[arg->index].v4l2;
+	pthread_mutex_unlock(&file->queue_lock);
 
 	res = 0;
 
@@ -1934,83 +1992,114 @@ exit_unlock:
 	return res;
 }
 
-static int vidioc_qbuf(struct file *file, struct v4l2_buffer *arg)
+static void sync_dmabuf(struct file *file, struct buffer *buf, uint64_t flags)
+{
+	struct spa_data *d = &buf->buf->buffer->datas[0];
+	struct dma_buf_sync sync;
+	int res;
+
+	sync.flags = buf->sync | flags;
+	do {
+		res = globals.old_fops.ioctl(d->fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (res < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (res < 0)
+		pw_log_warn("file:%d: buffer %u: dmabuf sync %08"PRIx64" failed: %m",
+				file->fd, buf->id, (uint64_t)sync.flags);
+}
+
+/* Run func with the queue lock in the handoff, or with the thread loop lock
+ * when the stream changed the buffers since the last call. */
+static int with_buffers(struct file *file,
+		int (*func) (struct file *file, struct v4l2_buffer *arg),
+		struct v4l2_buffer *arg)
+{
+	int res;
+
+	pthread_mutex_lock(&file->queue_lock);
+	if (handoff_enter(file)) {
+		res = func(file, arg);
+		handoff_leave(file);
+		pthread_mutex_unlock(&file->queue_lock);
+		return res;
+	}
+	pthread_mutex_unlock(&file->queue_lock);
+
+	pw_thread_loop_lock(file->loop);
+	pthread_mutex_lock(&file->queue_lock);
+	handoff_open(file);
+	res = func(file, arg);
+	pthread_mutex_unlock(&file->queue_lock);
+	pw_thread_loop_unlock(file->loop);
+	return res;
+}
+
+static int queue_frame(struct file *file, struct v4l2_buffer *arg)
 {
-	int res = 0;
 	struct buffer *buf;
 
-	if (arg->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
-		return -EINVAL;
-	if (arg->memory != V4L2_MEMORY_MMAP)
+	if (arg->index >= file->n_buffers)
 		return -EINVAL;
 
-	pw_thread_loop_lock(file->loop);
-	if (arg->index >= file->n_buffers) {
-		res = -EINVAL;
-		goto exit;
-	}
 	buf = &file->buffers[arg->index];
 
-	if (SPA_FLAG_IS_SET(buf->v4l2.flags, V4L2_BUF_FLAG_QUEUED)) {
-		res = -EINVAL;
-		goto exit;
+	if (SPA_FLAG_IS_SET(buf->v4l2.flags, V4L2_BUF_FLAG_QUEUED))
+		return -EINVAL;
+
+	/* the application is done with the mapped dmabuf */
+	if (buf->cpu_access) {
+		sync_dmabuf(file, buf, DMA_BUF_SYNC_END);
+		buf->cpu_access = false;
 	}
 
 	SPA_FLAG_SET(buf->v4l2.flags, V4L2_BUF_FLAG_QUEUED);
 	arg->flags = buf->v4l2.flags;
 
 	pw_stream_queue_buffer(file->stream, buf->buf);
-exit:
-	pw_log_debug("file:%d %d -> %d (%s)", file->fd, arg->index, res, spa_strerror(res));
-	pw_thread_loop_unlock(file->loop);
-
-	return res;
+	return 0;
 }
-static int vidioc_dqbuf(struct file *file, int fd, struct v4l2_buffer *arg)
+
+static int vidioc_qbuf(struct file *file, struct v4l2_buffer *arg)
 {
-	int res = 0;
-	struct pw_buffer *b;
-	struct buffer *buf;
-	uint64_t val;
-	struct spa_data *d;
-	struct timespec ts;
+	int res;
 
 	if (arg->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 		return -EINVAL;
 	if (arg->memory != V4L2_MEMORY_MMAP)
 		return -EINVAL;
 
-	pw_log_debug("file:%d (%d) %d", file->fd, fd,
-			arg->index);
+	res = with_buffers(file, queue_frame, arg);
 
-	pw_thread_loop_lock(file->loop);
-	if (arg->index >= file->n_buffers) {
-		res = -EINVAL;
-		goto exit_unlock;
-	}
+	pw_log_debug("file:%d %d -> %d (%s)", file->fd, arg->index, res, spa_strerror(res));
 
-	while (true) {
-		if (!file->running) {
-			res = -EINVAL;
-			goto exit_unlock;
-		}
+	return res;
+}
 
-		b = pw_stream_dequeue_buffer(file->stream);
-		if (b != NULL)
-			break;
+static int dequeue_frame(struct file *file, struct v4l2_buffer *arg)
+{
+	struct pw_buffer *b;
+	struct buffer *buf;
+	struct spa_data *d;
+	struct timespec ts;
 
-		pw_thread_loop_unlock(file->loop);
-		res = spa_system_eventfd_read(file->l->system, fd, &val);
-		pw_thread_loop_lock(file->loop);
-		if (res < 0)
-			goto exit_unlock;
-	}
+	if (arg->index >= file->n_buffers)
+		return -EINVAL;
+	if (!file->running)
+		return -EINVAL;
 
+	if ((b = pw_stream_dequeue_buffer(file->stream)) == NULL)
+		return -EAGAIN;
 
 	buf = b->user_data;
 	d = &buf->buf->buffer->datas[0];
 	SPA_FLAG_CLEAR(buf->v4l2.flags, V4L2_BUF_FLAG_QUEUED);
 
+	/* the application reads the mapped dmabuf from now on */
+	if (buf->sync != 0) {
+		sync_dmabuf(file, buf, DMA_BUF_SYNC_START);
+		buf->cpu_access = true;
+	}
+
 	SPA_FLAG_UPDATE(buf->v4l2.flags, V4L2_BUF_FLAG_ERROR,
 		SPA_FLAG_IS_SET(d->chunk->flags, SPA_CHUNK_FLAG_CORRUPTED));
 
@@ -2024,9 +2113,85 @@ static int vidioc_dqbuf(struct file *file, int fd, struct v4l2_buffer *arg)
 	buf->v4l2.sequence = file->sequence++;
 	*arg = buf->v4l2;
 
-exit_unlock:
+	return 0;
+}
+
+static int vidioc_dqbuf(struct file *file, int fd, struct v4l2_buffer *arg)
+{
+	int res;
+	uint64_t val;
+
+	if (arg->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+	if (arg->memory != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+
+	pw_log_debug("file:%d (%d) %d", file->fd, fd,
+			arg->index);
+
+	while (true) {
+		res = with_buffers(file, dequeue_frame, arg);
+		if (res != -EAGAIN)
+			break;
+
+		res = spa_system_eventfd_read(file->l->system, fd, &val);
+		if (res < 0)
+			break;
+	}
+
 	pw_log_debug("file:%d (%d) %d -> %d (%s)", file->fd, fd,
 			arg->index, res, spa_strerror(res));
+	return res;
+}
+
+static int vidioc_expbuf(struct file *file, struct v4l2_exportbuffer *arg)
+{
+	int res;
+	struct buffer *buf;
+	struct spa_data *d;
+
+	pw_log_info("type: %u", arg->type);
+	pw_log_info("index: %u", arg->index);
+	pw_log_info("plane: %u", arg->plane);
+	pw_log_info("flags: %08x", arg->flags);
+
+	if (arg->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+	if (arg->plane != 0)
+		return -EINVAL;
+	if (arg->flags & ~(O_CLOEXEC | O_ACCMODE))
+		return -EINVAL;
+
+	pw_thread_loop_lock(file->loop);
+	if (arg->index >= file->n_buffers) {
+		res = -EINVAL;
+		goto exit_unlock;
+	}
+	buf = &file->buffers[arg->index];
+	d = &buf->buf->buffer->datas[0];
+
+	/* only hand out real dmabufs of the producer, the memfd of a
+	 * MemFd buffer is shared with other buffers and can't be
+	 * imported as a dmabuf */
+	if (d->type != SPA_DATA_DmaBuf || d->fd < 0) {
+		res = -EINVAL;
+		goto exit_unlock;
+	}
+	res = fcntl(d->fd, (arg->flags & O_CLOEXEC) ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+	if (res < 0) {
+		res = -errno;
+		goto exit_unlock;
+	}
+	arg->fd = res;
+	memset(arg->reserved, 0, sizeof(arg->reserved));
+	res = 0;
+
+	pw_log_info("file:%d index:%u fd:%"PRIi64" -> %d", file->fd,
+			arg->index, d->fd, arg->fd);
+
+exit_unlock:
+	if (res < 0)
+		pw_log_info("error : %s", spa_strerror(res));
 	pw_thread_loop_unlock(file->loop);
 	return res;
 }
@@ -2048,8 +2213,11 @@ static int vidioc_streamon(struct file *file, int *arg)
 		goto exit_unlock;
 	}
 	res = pw_stream_set_active(file->stream, true);
-	if (res >= 0)
+	if (res >= 0) {
+		pthread_mutex_lock(&file->queue_lock);
 		file->running = true;
+		pthread_mutex_unlock(&file->queue_lock);
+	}
 exit_unlock:
 	pw_thread_loop_unlock(file->loop);
 
@@ -2065,17 +2233,21 @@ static int vidioc_streamoff(struct file *file, int *arg)
 		return -EINVAL;
 
 	pw_thread_loop_lock(file->loop);
+	pthread_mutex_lock(&file->queue_lock);
 	for (i = 0; i < file->n_buffers; i++) {
 		struct buffer *buf = &file->buffers[i];
 		SPA_FLAG_CLEAR(buf->v4l2.flags, V4L2_BUF_FLAG_QUEUED);
 	}
+	pthread_mutex_unlock(&file->queue_lock);
 	if (!file->running) {
 		res = 0;
 		goto exit_unlock;
 	}
 	res = pw_stream_set_active(file->stream, false);
+	pthread_mutex_lock(&file->queue_lock);
 	file->running = false;
 	file->sequence = 0;
+	pthread_mutex_unlock(&file->queue_lock);
 
 exit_unlock:
 	pw_thread_loop_unlock(file->loop);
@@ -2412,6 +2584,9 @@ static int v4l2_ioctl(int fd, unsigned long int request, void *arg)
 	case VIDIOC_DQBUF:
 		res = vidioc_dqbuf(file, fd, (struct v4l2_buffer *)arg);
 		break;
+	case VIDIOC_EXPBUF:
+		res = vidioc_expbuf(file, (struct v4l2_exportbuffer *)arg);
+		break;
 	case VIDIOC_STREAMON:
 		res = vidioc_streamon(file, (int *)arg);
 		break;
@@ -2487,9 +2662,16 @@ static void *v4l2_mmap(void *addr, size_t length, int prot,
 	else
 		res = data->data;
 
+	/* the stream does not map dmabufs, the application accesses the
+	 * mapping we made and needs it synced around DQBUF and QBUF */
+	pthread_mutex_lock(&file->queue_lock);
+	if (data->data == NULL && data->type == SPA_DATA_DmaBuf && res != MAP_FAILED)
+		buf->sync |= (prot & PROT_WRITE) ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ;
+	SPA_FLAG_SET(buf->v4l2.flags, V4L2_BUF_FLAG_MAPPED);
+	pthread_mutex_unlock(&file->queue_lock);
+
 	add_file_map(file, res);
 	add_buffer_map(file, res, id);
-	SPA_FLAG_SET(buf->v4l2.flags, V4L2_BUF_FLAG_MAPPED);
 
 	pw_log_info("file:%d addr:%p length:%zu prot:%d flags:%d fd:%"PRIi64
 			" offset:%"PRIi64" (%u - %u) -> %p (%s)" ,
@@ -2524,6 +2706,14 @@ static int v4l2_munmap(void *addr, size_t length)
 	buf = &file->buffers[bmap->id];
 	data = &buf->buf->buffer->datas[0];
 
+	pthread_mutex_lock(&file->queue_lock);
+	if (buf->cpu_access) {
+		sync_dmabuf(file, buf, DMA_BUF_SYNC_END);
+		buf->cpu_access = false;
+	}
+	buf->sync = 0;
+	pthread_mutex_unlock(&file->queue_lock);
+
 	if (data->data == NULL)
 		res = globals.old_fops.munmap(addr, length);
 	else
@@ -2532,7 +2722,9 @@ static int v4l2_munmap(void *addr, size_t length)
 	pw_log_info("addr:%p length:%zu -> %d (%s)", addr, length,
 			res, strerror(res < 0 ? errno : 0));
 
+	pthread_mutex_lock(&file->queue_lock);
 	buf->v4l2.flags &= ~V4L2_BUF_FLAG_MAPPED;
+	pthread_mutex_unlock(&file->queue_lock);
 	remove_buffer_map(file, bmap);
 
 exit_unlock:
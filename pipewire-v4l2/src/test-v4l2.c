@@ -0,0 +1,527 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
+#include <linux/videodev2.h>
+
+#include "pwtest.h"
+
+#include <spa/param/video/format-utils.h>
+#include <spa/utils/keys.h>
+#include <spa/utils/string.h>
+
+#include <pipewire/pipewire.h>
+
+#define N_BUFFERS	4
+#define N_FRAMES	30
+
+#define WIDTH		320
+#define HEIGHT		240
+#define STRIDE		(WIDTH * 2)
+
+struct shim {
+	void *handle;
+	int (*open) (const char *path, int oflag, ...);
+	int (*close) (int fd);
+	int (*ioctl) (int fd, unsigned long int request, ...);
+	void *(*mmap) (void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+	int (*munmap) (void *addr, size_t length);
+};
+
+struct camera {
+	struct pw_thread_loop *loop;
+	struct pw_context *context;
+	struct pw_core *core;
+	uint32_t serial;
+
+	/* videotestsrc node in the daemon */
+	struct pw_proxy *proxy;
+	struct spa_hook proxy_listener;
+
+	/* stream in this process that produces dmabufs */
+	struct pw_stream *stream;
+	struct spa_hook stream_listener;
+	struct spa_source *timer;
+	uint8_t frame;
+};
+
+static void load_shim(struct shim *shim)
+{
+	/* use the functions of the library directly instead of preloading
+	 * it so that only the calls below go through the emulation */
+	shim->handle = dlopen(PW_V4L2_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+	pwtest_ptr_notnull(shim->handle);
+
+	shim->open = dlsym(shim->handle, "open");
+	shim->close = dlsym(shim->handle, "close");
+	shim->ioctl = dlsym(shim->handle, "ioctl");
+	shim->mmap = dlsym(shim->handle, "mmap");
+	shim->munmap = dlsym(shim->handle, "munmap");
+	pwtest_ptr_notnull(shim->open);
+	pwtest_ptr_notnull(shim->close);
+	pwtest_ptr_notnull(shim->ioctl);
+	pwtest_ptr_notnull(shim->mmap);
+	pwtest_ptr_notnull(shim->munmap);
+}
+
+static void proxy_bound_props(void *data, uint32_t global_id, const struct spa_dict *props)
+{
+	struct camera *cam = data;
+	const char *str;
+
+	if ((str = spa_dict_lookup(props, PW_KEY_OBJECT_SERIAL)) != NULL)
+		spa_atou32(str, &cam->serial, 10);
+	pw_thread_loop_signal(cam->loop, false);
+}
+
+static const struct pw_proxy_events proxy_events = {
+	PW_VERSION_PROXY_EVENTS,
+	.bound_props = proxy_bound_props,
+};
+
+static void camera_connect(struct camera *cam)
+{
+	spa_zero(*cam);
+	cam->serial = SPA_ID_INVALID;
+	cam->loop = pw_thread_loop_new("camera", NULL);
+	pwtest_ptr_notnull(cam->loop);
+	cam->context = pw_context_new(pw_thread_loop_get_loop(cam->loop), NULL, 0);
+	pwtest_ptr_notnull(cam->context);
+
+	pwtest_neg_errno_ok(pw_thread_loop_start(cam->loop));
+	pw_thread_loop_lock(cam->loop);
+
+	cam->core = pw_context_connect(cam->context, NULL, 0);
+	pwtest_ptr_notnull(cam->core);
+}
+
+static void camera_start(struct camera *cam)
+{
+	struct pw_properties *props;
+
+	camera_connect(cam);
+
+	/* the default config has no library for the test source */
+	props = pw_properties_new(
+			SPA_KEY_LIBRARY_NAME, "videotestsrc/libspa-videotestsrc",
+			SPA_KEY_FACTORY_NAME, "videotestsrc",
+			PW_KEY_NODE_NAME, "test-camera",
+			PW_KEY_NODE_DESCRIPTION, "Test Camera",
+			PW_KEY_MEDIA_CLASS, "Video/Source",
+			PW_KEY_NODE_DRIVER, "true",
+			NULL);
+	cam->proxy = pw_core_create_object(cam->core, "adapter",
+			PW_TYPE_INTERFACE_Node, PW_VERSION_NODE,
+			&props->dict, 0);
+	pw_properties_free(props);
+	pwtest_ptr_notnull(cam->proxy);
+
+	pw_proxy_add_listener(cam->proxy, &cam->proxy_listener, &proxy_events, cam);
+
+	while (cam->serial == SPA_ID_INVALID)
+		pw_thread_loop_wait(cam->loop);
+
+	pw_thread_loop_unlock(cam->loop);
+}
+
+/* a dmabuf from the system heap or, failing that, from a memfd with
+ * udmabuf, returns -errno when neither is available */
+static int alloc_dmabuf(size_t size)
+{
+	struct dma_heap_allocation_data heap;
+	struct udmabuf_create create;
+	int fd, memfd, res;
+
+	size = SPA_ROUND_UP_N(size, (size_t)sysconf(_SC_PAGESIZE));
+
+	if ((fd = open("/dev/dma_heap/system", O_RDONLY | O_CLOEXEC)) >= 0) {
+		spa_zero(heap);
+		heap.len = size;
+		heap.fd_flags = O_RDWR | O_CLOEXEC;
+		res = ioctl(fd, DMA_HEAP_IOCTL_ALLOC, &heap);
+		close(fd);
+		if (res == 0)
+			return heap.fd;
+	}
+
+	if ((fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC)) < 0)
+		return -errno;
+
+	res = memfd = memfd_create("test-v4l2", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (res >= 0 && (res = ftruncate(memfd, size)) >= 0 &&
+	    (res = fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK)) >= 0) {
+		spa_zero(create);
+		create.memfd = memfd;
+		create.flags = UDMABUF_FLAGS_CLOEXEC;
+		create.size = size;
+		res = ioctl(fd, UDMABUF_CREATE, &create);
+	}
+	if (res < 0)
+		res = -errno;
+	if (memfd >= 0)
+		close(memfd);
+	close(fd);
+	return res;
+}
+
+static void sync_dmabuf(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = { .flags = flags };
+	int res;
+
+	while ((res = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync)) < 0 &&
+	    (errno == EINTR || errno == EAGAIN));
+	pwtest_errno_ok(res);
+}
+
+static void on_timeout(void *data, uint64_t expirations)
+{
+	struct camera *cam = data;
+	pw_stream_trigger_process(cam->stream);
+}
+
+static void camera_state_changed(void *data, enum pw_stream_state old,
+		enum pw_stream_state state, const char *error)
+{
+	struct camera *cam = data;
+	struct timespec timeout = { 0, 1 }, interval = { 0, 10 * SPA_NSEC_PER_MSEC };
+	const char *str;
+
+	if (state == PW_STREAM_STATE_PAUSED && cam->serial == SPA_ID_INVALID &&
+	    (str = pw_properties_get(pw_stream_get_properties(cam->stream),
+				PW_KEY_OBJECT_SERIAL)) != NULL)
+		spa_atou32(str, &cam->serial, 10);
+
+	if (state == PW_STREAM_STATE_STREAMING && pw_stream_is_driving(cam->stream))
+		pw_loop_update_timer(pw_thread_loop_get_loop(cam->loop),
+				cam->timer, &timeout, &interval, false);
+	else
+		pw_loop_update_timer(pw_thread_loop_get_loop(cam->loop),
+				cam->timer, NULL, NULL, false);
+
+	pw_thread_loop_signal(cam->loop, false);
+}
+
+static void camera_param_changed(void *data, uint32_t id, const struct spa_pod *param)
+{
+	struct camera *cam = data;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+
+	if (param == NULL || id != SPA_PARAM_Format)
+		return;
+
+	params[0] = spa_pod_builder_add_object(&b,
+			SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+			SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(N_BUFFERS, 1, N_BUFFERS),
+			SPA_PARAM_BUFFERS_blocks,  SPA_POD_Int(1),
+			SPA_PARAM_BUFFERS_size,    SPA_POD_Int(STRIDE * HEIGHT),
+			SPA_PARAM_BUFFERS_stride,  SPA_POD_Int(STRIDE),
+			SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(1<<SPA_DATA_DmaBuf));
+
+	pw_stream_update_params(cam->stream, params, 1);
+}
+
+static void camera_add_buffer(void *data, struct pw_buffer *b)
+{
+	struct spa_data *d = &b->buffer->datas[0];
+
+	pwtest_bool_true(d->type & (1<<SPA_DATA_DmaBuf));
+
+	d->type = SPA_DATA_DmaBuf;
+	d->flags = SPA_DATA_FLAG_READWRITE;
+	d->fd = alloc_dmabuf(STRIDE * HEIGHT);
+	pwtest_neg_errno_ok(d->fd);
+	d->mapoffset = 0;
+	d->maxsize = STRIDE * HEIGHT;
+	d->data = mmap(NULL, d->maxsize, PROT_READ | PROT_WRITE, MAP_SHARED, d->fd, 0);
+	pwtest_ptr_ne(d->data, MAP_FAILED);
+}
+
+static void camera_remove_buffer(void *data, struct pw_buffer *b)
+{
+	struct spa_data *d = &b->buffer->datas[0];
+
+	munmap(d->data, d->maxsize);
+	close(d->fd);
+}
+
+static void camera_process(void *data)
+{
+	struct camera *cam = data;
+	struct pw_buffer *b;
+	struct spa_data *d;
+
+	if ((b = pw_stream_dequeue_buffer(cam->stream)) == NULL)
+		return;
+
+	/* every frame is filled with its number, which is never 0 */
+	cam->frame = cam->frame % 255 + 1;
+	d = &b->buffer->datas[0];
+	sync_dmabuf(d->fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+	memset(d->data, cam->frame, d->maxsize);
+	sync_dmabuf(d->fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+
+	d->chunk->offset = 0;
+	d->chunk->size = d->maxsize;
+	d->chunk->stride = STRIDE;
+
+	pw_stream_queue_buffer(cam->stream, b);
+}
+
+static const struct pw_stream_events camera_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = camera_state_changed,
+	.param_changed = camera_param_changed,
+	.add_buffer = camera_add_buffer,
+	.remove_buffer = camera_remove_buffer,
+	.process = camera_process,
+};
+
+static void camera_start_dmabuf(struct camera *cam)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+
+	camera_connect(cam);
+
+	cam->timer = pw_loop_add_timer(pw_thread_loop_get_loop(cam->loop), on_timeout, cam);
+	pwtest_ptr_notnull(cam->timer);
+
+	cam->stream = pw_stream_new(cam->core, "dmabuf-camera",
+			pw_properties_new(
+				PW_KEY_MEDIA_TYPE, "Video",
+				PW_KEY_MEDIA_CATEGORY, "Source",
+				PW_KEY_MEDIA_CLASS, "Video/Source",
+				PW_KEY_NODE_DESCRIPTION, "Dmabuf Camera",
+				NULL));
+	pwtest_ptr_notnull(cam->stream);
+	pw_stream_add_listener(cam->stream, &cam->stream_listener, &camera_events, cam);
+
+	params[0] = spa_format_video_raw_build(&b, SPA_PARAM_EnumFormat,
+			&SPA_VIDEO_INFO_RAW_INIT(
+				.format = SPA_VIDEO_FORMAT_UYVY,
+				.size = SPA_RECTANGLE(WIDTH, HEIGHT),
+				.framerate = SPA_FRACTION(30, 1)));
+
+	/* we allocate the dmabufs ourselves, nothing in the daemon does */
+	pwtest_neg_errno_ok(pw_stream_connect(cam->stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+			PW_STREAM_FLAG_DRIVER | PW_STREAM_FLAG_ALLOC_BUFFERS,
+			params, 1));
+
+	while (cam->serial == SPA_ID_INVALID)
+		pw_thread_loop_wait(cam->loop);
+
+	pw_thread_loop_unlock(cam->loop);
+}
+
+static void camera_stop(struct camera *cam)
+{
+	pw_thread_loop_lock(cam->loop);
+	if (cam->proxy)
+		pw_proxy_destroy(cam->proxy);
+	if (cam->stream)
+		pw_stream_destroy(cam->stream);
+	if (cam->timer)
+		pw_loop_destroy_source(pw_thread_loop_get_loop(cam->loop), cam->timer);
+	pw_core_disconnect(cam->core);
+	pw_thread_loop_unlock(cam->loop);
+	pw_thread_loop_stop(cam->loop);
+	pw_context_destroy(cam->context);
+	pw_thread_loop_destroy(cam->loop);
+}
+
+static void capture(struct camera *cam, const char *card, bool dmabuf)
+{
+	struct shim shim;
+	struct v4l2_capability cap;
+	struct v4l2_format fmt;
+	struct v4l2_requestbuffers reqbuf;
+	struct v4l2_buffer buf;
+	struct v4l2_exportbuffer expbuf;
+	void *maps[N_BUFFERS], *exported[N_BUFFERS];
+	int exported_fds[N_BUFFERS];
+	uint32_t i, n_buffers, sequence;
+	uint8_t *p;
+	int fd, type;
+	char target[16];
+
+	spa_scnprintf(target, sizeof(target), "%u", cam->serial);
+	setenv("PIPEWIRE_V4L2_TARGET", target, 1);
+
+	load_shim(&shim);
+
+	fd = shim.open("/dev/video0", O_RDWR);
+	pwtest_errno_ok(fd);
+
+	spa_zero(cap);
+	pwtest_errno_ok(shim.ioctl(fd, VIDIOC_QUERYCAP, &cap));
+	pwtest_str_eq((char*)cap.driver, "PipeWire");
+	pwtest_str_eq((char*)cap.card, card);
+	pwtest_bool_true(cap.device_caps & V4L2_CAP_VIDEO_CAPTURE);
+	pwtest_bool_true(cap.device_caps & V4L2_CAP_STREAMING);
+
+	spa_zero(fmt);
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width = WIDTH;
+	fmt.fmt.pix.height = HEIGHT;
+	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
+	pwtest_errno_ok(shim.ioctl(fd, VIDIOC_S_FMT, &fmt));
+	pwtest_int_eq(fmt.fmt.pix.pixelformat, V4L2_PIX_FMT_UYVY);
+	pwtest_int_gt(fmt.fmt.pix.sizeimage, 0u);
+
+	spa_zero(reqbuf);
+	reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqbuf.memory = V4L2_MEMORY_DMABUF;
+	reqbuf.count = N_BUFFERS;
+	pwtest_errno(shim.ioctl(fd, VIDIOC_REQBUFS, &reqbuf), EINVAL);
+
+	reqbuf.memory = V4L2_MEMORY_MMAP;
+	reqbuf.count = N_BUFFERS;
+	pwtest_errno_ok(shim.ioctl(fd, VIDIOC_REQBUFS, &reqbuf));
+	pwtest_int_ge(reqbuf.count, 1u);
+	pwtest_int_le(reqbuf.count, (uint32_t)N_BUFFERS);
+	n_buffers = reqbuf.count;
+
+	for (i = 0; i < n_buffers; i++) {
+		spa_zero(buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		pwtest_errno_ok(shim.ioctl(fd, VIDIOC_QUERYBUF, &buf));
+		pwtest_bool_false(buf.flags & V4L2_BUF_FLAG_QUEUED);
+
+		maps[i] = shim.mmap(NULL, buf.length, PROT_READ, MAP_SHARED, fd, buf.m.offset);
+		pwtest_ptr_ne(maps[i], MAP_FAILED);
+
+		/* only dmabufs of the producer can be exported, the memfd of
+		 * the test source is refused */
+		spa_zero(expbuf);
+		expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		expbuf.index = i;
+		expbuf.flags = O_CLOEXEC | O_RDONLY;
+		if (dmabuf) {
+			pwtest_errno_ok(shim.ioctl(fd, VIDIOC_EXPBUF, &expbuf));
+			pwtest_int_ge(expbuf.fd, 0);
+			exported_fds[i] = expbuf.fd;
+			exported[i] = mmap(NULL, buf.length, PROT_READ, MAP_SHARED, expbuf.fd, 0);
+			pwtest_ptr_ne(exported[i], MAP_FAILED);
+		} else {
+			pwtest_errno(shim.ioctl(fd, VIDIOC_EXPBUF, &expbuf), EINVAL);
+		}
+
+		pwtest_errno_ok(shim.ioctl(fd, VIDIOC_QBUF, &buf));
+		pwtest_bool_true(buf.flags & V4L2_BUF_FLAG_QUEUED);
+
+		/* queueing twice is an error */
+		pwtest_errno(shim.ioctl(fd, VIDIOC_QBUF, &buf), EINVAL);
+	}
+
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	pwtest_errno_ok(shim.ioctl(fd, VIDIOC_STREAMON, &type));
+
+	for (sequence = 0; sequence < N_FRAMES; sequence++) {
+		spa_zero(buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		pwtest_errno_ok(shim.ioctl(fd, VIDIOC_DQBUF, &buf));
+		pwtest_int_lt(buf.index, n_buffers);
+		pwtest_int_eq(buf.sequence, sequence);
+		pwtest_int_gt(buf.bytesused, 0u);
+		pwtest_bool_false(buf.flags & V4L2_BUF_FLAG_QUEUED);
+
+		if (dmabuf) {
+			/* the frame is filled with one value and is the same
+			 * through the mapping of the shim and the exported fd */
+			p = maps[buf.index];
+			pwtest_int_eq(buf.bytesused, fmt.fmt.pix.sizeimage);
+			pwtest_int_ne(p[0], 0);
+			pwtest_int_eq(p[buf.bytesused - 1], p[0]);
+
+			sync_dmabuf(exported_fds[buf.index], DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+			pwtest_int_eq(memcmp(p, exported[buf.index], buf.bytesused), 0);
+			sync_dmabuf(exported_fds[buf.index], DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+		}
+
+		pwtest_errno_ok(shim.ioctl(fd, VIDIOC_QBUF, &buf));
+	}
+
+	pwtest_errno_ok(shim.ioctl(fd, VIDIOC_STREAMOFF, &type));
+
+	for (i = 0; i < n_buffers; i++) {
+		spa_zero(buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		pwtest_errno_ok(shim.ioctl(fd, VIDIOC_QUERYBUF, &buf));
+		pwtest_errno_ok(shim.munmap(maps[i], buf.length));
+		if (dmabuf) {
+			munmap(exported[i], buf.length);
+			close(exported_fds[i]);
+		}
+	}
+
+	spa_zero(reqbuf);
+	reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqbuf.memory = V4L2_MEMORY_MMAP;
+	reqbuf.count = 0;
+	pwtest_errno_ok(shim.ioctl(fd, VIDIOC_REQBUFS, &reqbuf));
+
+	pwtest_errno_ok(shim.close(fd));
+}
+
+PWTEST(v4l2_capture)
+{
+	struct camera cam;
+
+	pw_init(0, NULL);
+
+	camera_start(&cam);
+	capture(&cam, "Test Camera", false);
+	camera_stop(&cam);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
+PWTEST(v4l2_capture_dmabuf)
+{
+	struct camera cam;
+	int fd;
+
+	/* needs a dma heap or udmabuf to make the buffers */
+	if ((fd = alloc_dmabuf(STRIDE * HEIGHT)) < 0)
+		return PWTEST_SKIP;
+	close(fd);
+
+	pw_init(0, NULL);
+
+	camera_start_dmabuf(&cam);
+	capture(&cam, "Dmabuf Camera", true);
+	camera_stop(&cam);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
+PWTEST_SUITE(v4l2)
+{
+	pwtest_add(v4l2_capture, PWTEST_ARG_DAEMON);
+	pwtest_add(v4l2_capture_dmabuf, PWTEST_ARG_DAEMON);
+
+	return PWTEST_PASS;
+}
@@ -0,0 +1,123 @@
+/* Simple Plugin API */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SPA_BUFFER_DAMAGE_H
+#define SPA_BUFFER_DAMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include <spa/buffer/meta.h>
+
+/**
+ * \addtogroup spa_buffer
+ * \{
+ */
+
+/**
+ * Clip a damage region to a frame of \a width x \a height pixels.
+ * Returns false when nothing of the region is inside the frame.
+ */
+static inline bool spa_damage_clip(struct spa_region *r, uint32_t width, uint32_t height)
+{
+	int64_t x1 = SPA_MAX((int64_t)r->position.x, (int64_t)0);
+	int64_t y1 = SPA_MAX((int64_t)r->position.y, (int64_t)0);
+	int64_t x2 = SPA_MIN((int64_t)r->position.x + r->size.width, (int64_t)width);
+	int64_t y2 = SPA_MIN((int64_t)r->position.y + r->size.height, (int64_t)height);
+
+	if (x2 <= x1 || y2 <= y1)
+		return false;
+
+	r->position.x = (int32_t)x1;
+	r->position.y = (int32_t)y1;
+	r->size.width = (uint32_t)(x2 - x1);
+	r->size.height = (uint32_t)(y2 - y1);
+	return true;
+}
+
+/**
+ * Copy the rows of a region of a packed video frame with \a bpp bytes
+ * per pixel.
+ */
+static inline size_t spa_damage_copy_region(void *dst, uint32_t dst_stride,
+		const void *src, uint32_t src_stride, uint32_t bpp,
+		const struct spa_region *r)
+{
+	const uint8_t *s = (const uint8_t*)src + (size_t)r->position.y * src_stride +
+		(size_t)r->position.x * bpp;
+	uint8_t *d = (uint8_t*)dst + (size_t)r->position.y * dst_stride +
+		(size_t)r->position.x * bpp;
+	size_t len = (size_t)r->size.width * bpp;
+	uint32_t i;
+
+	if (len == dst_stride && len == src_stride) {
+		memcpy(d, s, len * r->size.height);
+	} else {
+		for (i = 0; i < r->size.height; i++) {
+			memcpy(d, s, len);
+			d += dst_stride;
+			s += src_stride;
+		}
+	}
+	return len * r->size.height;
+}
+
+/**
+ * Update a packed video frame in \a dst with the damaged regions of \a src.
+ *
+ * \a damage is the SPA_META_VideoDamage metadata of the source buffer. When
+ * it is NULL or the damage covers the whole frame, the complete frame is
+ * copied. The regions are clipped to the frame and an empty damage array
+ * copies nothing.
+ *
+ * \a dst must contain the previous frame of the same producer, the damage is
+ * relative to that.
+ *
+ * \return the number of bytes copied
+ */
+static inline size_t spa_damage_copy(void *dst, uint32_t dst_stride,
+		const void *src, uint32_t src_stride,
+		uint32_t width, uint32_t height, uint32_t bpp,
+		const struct spa_meta *damage)
+{
+	struct spa_region full = SPA_REGION(0, 0, width, height);
+	struct spa_meta_region *m;
+	uint64_t area = 0;
+	size_t copied = 0;
+
+	if (damage != NULL) {
+		spa_meta_for_each(m, damage) {
+			struct spa_region r = m->region;
+			if (!spa_meta_region_is_valid(m))
+				break;
+			if (spa_damage_clip(&r, width, height))
+				area += (uint64_t)r.size.width * r.size.height;
+		}
+		if (area < (uint64_t)width * height) {
+			spa_meta_for_each(m, damage) {
+				struct spa_region r = m->region;
+				if (!spa_meta_region_is_valid(m))
+					break;
+				if (spa_damage_clip(&r, width, height))
+					copied += spa_damage_copy_region(dst, dst_stride,
+							src, src_stride, bpp, &r);
+			}
+			return copied;
+		}
+	}
+	return spa_damage_copy_region(dst, dst_stride, src, src_stride, bpp, &full);
+}
+
+/**
+ * \}
+ */
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* SPA_BUFFER_DAMAGE_H */
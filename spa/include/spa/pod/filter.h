@@ -125,6 +125,47 @@ static inline int spa_pod_filter_is_step_of(uint32_t type, const void *r1,
 	return 0;
 }
 
+/* Intersect two arrays of 32 bit values that compare equal when their bit
+ * patterns are equal (Id, Int and Bool). This is the common case for audio
+ * and video formats, rates and channels and avoids the generic compare. */
+static inline int spa_pod_filter_enum_32(struct spa_pod_builder *b,
+		const uint32_t *v1, uint32_t n1, const uint32_t *v2, uint32_t n2,
+		bool copy_first)
+{
+	uint32_t j, k;
+	int n_copied = 0;
+
+	for (j = 0; j < n1; j++) {
+		const uint32_t v = v1[j];
+		for (k = 0; k < n2; k++) {
+			if (v != v2[k])
+				continue;
+			if (copy_first || j > 0)
+				spa_pod_builder_raw(b, &v1[j], sizeof(uint32_t));
+			n_copied++;
+		}
+	}
+	return n_copied;
+}
+
+/* Copy all Int values that are inside the [min, max] range, this is used
+ * for matching enumerated rates and channels against a range. */
+static inline int spa_pod_filter_range_int32(struct spa_pod_builder *b,
+		const int32_t *v, uint32_t n, const int32_t *range)
+{
+	const int32_t min = range[0], max = range[1];
+	uint32_t j;
+	int n_copied = 0;
+
+	for (j = 0; j < n; j++) {
+		if (v[j] < min || v[j] > max)
+			continue;
+		spa_pod_builder_raw(b, &v[j], sizeof(int32_t));
+		n_copied++;
+	}
+	return n_copied;
+}
+
 static inline int
 spa_pod_filter_prop(struct spa_pod_builder *b,
 	    const struct spa_pod_prop *p1,
@@ -177,12 +218,20 @@ spa_pod_filter_prop(struct spa_pod_builder *b,
 	    (p1c == SPA_CHOICE_Enum && p2c == SPA_CHOICE_Enum)) {
 		int n_copied = 0;
 		/* copy all equal values but don't copy the default value again */
-		for (j = 0, a1 = alt1; j < nalt1; j++, a1 = SPA_PTROFF(a1, size, void)) {
-			for (k = 0, a2 = alt2; k < nalt2; k++, a2 = SPA_PTROFF(a2,size,void)) {
-				if (spa_pod_compare_value(type, a1, a2, size) == 0) {
-					if (p1c == SPA_CHOICE_Enum || j > 0)
-						spa_pod_builder_raw(b, a1, size);
-					n_copied++;
+		if (size == sizeof(uint32_t) &&
+		    (type == SPA_TYPE_Id || type == SPA_TYPE_Int || type == SPA_TYPE_Bool)) {
+			n_copied = spa_pod_filter_enum_32(b,
+					(const uint32_t*)alt1, nalt1,
+					(const uint32_t*)alt2, nalt2,
+					p1c == SPA_CHOICE_Enum);
+		} else {
+			for (j = 0, a1 = alt1; j < nalt1; j++, a1 = SPA_PTROFF(a1, size, void)) {
+				for (k = 0, a2 = alt2; k < nalt2; k++, a2 = SPA_PTROFF(a2,size,void)) {
+					if (spa_pod_compare_value(type, a1, a2, size) == 0) {
+						if (p1c == SPA_CHOICE_Enum || j > 0)
+							spa_pod_builder_raw(b, a1, size);
+						n_copied++;
+					}
 				}
 			}
 		}
@@ -195,13 +244,18 @@ spa_pod_filter_prop(struct spa_pod_builder *b,
 	    (p1c == SPA_CHOICE_Enum && p2c == SPA_CHOICE_Range)) {
 		int n_copied = 0;
 		/* copy all values inside the range */
-		for (j = 0, a1 = alt1, a2 = alt2; j < nalt1; j++, a1 = SPA_PTROFF(a1,size,void)) {
-			if (spa_pod_compare_value(type, a1, a2, size) < 0)
-				continue;
-			if (spa_pod_compare_value(type, a1, SPA_PTROFF(a2,size,void), size) > 0)
-				continue;
-			spa_pod_builder_raw(b, a1, size);
-			n_copied++;
+		if (type == SPA_TYPE_Int && size == sizeof(int32_t)) {
+			n_copied = spa_pod_filter_range_int32(b,
+					(const int32_t*)alt1, nalt1, (const int32_t*)alt2);
+		} else {
+			for (j = 0, a1 = alt1, a2 = alt2; j < nalt1; j++, a1 = SPA_PTROFF(a1,size,void)) {
+				if (spa_pod_compare_value(type, a1, a2, size) < 0)
+					continue;
+				if (spa_pod_compare_value(type, a1, SPA_PTROFF(a2,size,void), size) > 0)
+					continue;
+				spa_pod_builder_raw(b, a1, size);
+				n_copied++;
+			}
 		}
 		if (n_copied == 0)
 			return -EINVAL;
@@ -236,13 +290,18 @@ spa_pod_filter_prop(struct spa_pod_builder *b,
 	    (p1c == SPA_CHOICE_Range && p2c == SPA_CHOICE_Enum)) {
 		int n_copied = 0;
 		/* copy all values inside the range */
-		for (k = 0, a1 = alt1, a2 = alt2; k < nalt2; k++, a2 = SPA_PTROFF(a2,size,void)) {
-			if (spa_pod_compare_value(type, a2, a1, size) < 0)
-				continue;
-			if (spa_pod_compare_value(type, a2, SPA_PTROFF(a1,size,void), size) > 0)
-				continue;
-			spa_pod_builder_raw(b, a2, size);
-			n_copied++;
+		if (type == SPA_TYPE_Int && size == sizeof(int32_t)) {
+			n_copied = spa_pod_filter_range_int32(b,
+					(const int32_t*)alt2, nalt2, (const int32_t*)alt1);
+		} else {
+			for (k = 0, a1 = alt1, a2 = alt2; k < nalt2; k++, a2 = SPA_PTROFF(a2,size,void)) {
+				if (spa_pod_compare_value(type, a2, a1, size) < 0)
+					continue;
+				if (spa_pod_compare_value(type, a2, SPA_PTROFF(a1,size,void), size) > 0)
+					continue;
+				spa_pod_builder_raw(b, a2, size);
+				n_copied++;
+			}
 		}
 		if (n_copied == 0)
 			return -EINVAL;
@@ -243,7 +243,7 @@ typedef void (*spa_source_signal_func_t) (void *data, int signal_number);
 struct spa_loop_utils_methods {
 	/* the version of this structure. This can be used to expand this
 	 * structure in the future */
-#define SPA_VERSION_LOOP_UTILS_METHODS	0
+#define SPA_VERSION_LOOP_UTILS_METHODS	1
 	uint32_t version;
 
 	struct spa_source *(*add_io) (void *object,
@@ -278,6 +278,21 @@ struct spa_loop_utils_methods {
 	 * should only be called when the loop is not running or from the
 	 * context of the running loop */
 	void (*destroy_source) (void *object, struct spa_source *source);
+
+	/** add a timer that shares one timerfd with the other shared timers
+	 * of the loop. The timer is set with update_timer and uses
+	 * CLOCK_MONOTONIC. Like other timers, it can be updated from any
+	 * thread but should only be destroyed when the loop is not running
+	 * or from the context of the running loop.
+	 *
+	 * \param slack the time in nanoseconds the timer is allowed to expire
+	 *    late so that it can be handled together with other timers.
+	 *    Use 0 for timers that need to be exact.
+	 *
+	 * Since version 1 */
+	struct spa_source *(*add_shared_timer) (void *object,
+					 uint64_t slack,
+					 spa_source_timer_func_t func, void *data);
 };
 
 #define spa_loop_utils_method_v(o,method,version,...)			\
@@ -318,6 +333,7 @@ struct spa_loop_utils_methods {
 #define spa_loop_utils_update_timer(l,...)	spa_loop_utils_method_r(l,update_timer,0,__VA_ARGS__)
 #define spa_loop_utils_add_signal(l,...)	spa_loop_utils_method_s(l,add_signal,0,__VA_ARGS__)
 #define spa_loop_utils_destroy_source(l,...)	spa_loop_utils_method_v(l,destroy_source,0,__VA_ARGS__)
+#define spa_loop_utils_add_shared_timer(l,...)	spa_loop_utils_method_s(l,add_shared_timer,1,__VA_ARGS__)
 
 /**
  * \}
@@ -587,6 +587,7 @@ static int do_probe(struct data *data)
 	uint32_t n_items = 0;
 	struct acp_dict_item items[64];
 	struct acp_dict props;
+	struct timespec t1, t2;
 
 	acp_set_log_func(log_func, data);
 	acp_set_log_level(data->verbose);
@@ -624,9 +625,15 @@ static int do_probe(struct data *data)
 	}
 	props = ACP_DICT_INIT(items, n_items);
 
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 	data->card = acp_card_new(data->card_index, &props);
 	if (data->card == NULL)
 		return -errno;
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	if (data->verbose)
+		fprintf(stderr, "probed card %d in %.3f ms\n", data->card_index,
+				(SPA_TIMESPEC_TO_NSEC(&t2) - SPA_TIMESPEC_TO_NSEC(&t1)) / 1e6);
 	return 0;
 }
 
@@ -6,7 +6,11 @@
 #include "alsa-mixer.h"
 #include "alsa-ucm.h"
 
+#include <sys/stat.h>
+#include <inttypes.h>
+
 #include <spa/utils/string.h>
+#include <spa/utils/result.h>
 
 int _acp_log_level = 1;
 acp_log_func _acp_log_func;
@@ -1538,10 +1542,279 @@ static const char *acp_dict_lookup(const struct acp_dict *dict, const char *key)
 	return NULL;
 }
 
+/* The probe cache remembers the profiles that failed to probe so that
+ * their PCMs are not opened again on the next start or hotplug. It is only
+ * used when the card, its controls and the profile set are unchanged. */
+#define PROBE_CACHE_VERSION	1
+
+struct probe_cache {
+	char *dir;
+	char *path;
+	uint64_t key;
+	bool hit;
+};
+
+static uint64_t hash_add(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *d = data;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		h ^= d[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t hash_str(uint64_t h, const char *str)
+{
+	if (str == NULL)
+		str = "";
+	return hash_add(h, str, strlen(str) + 1);
+}
+
+static int probe_cache_key(pa_card *impl, const struct acp_dict *props,
+		char *id, size_t id_size, uint64_t *key)
+{
+	pa_alsa_profile_set *ps = impl->profile_set;
+	snd_ctl_t *ctl;
+	snd_ctl_card_info_t *info;
+	snd_ctl_elem_list_t *list;
+	pa_alsa_mapping *m;
+	pa_alsa_profile *p;
+	struct stat st;
+	char name[16];
+	uint64_t h = 0xcbf29ce484222325ULL;
+	uint32_t i, params[4];
+	void *state;
+	int res;
+
+	snprintf(name, sizeof(name), "hw:%u", impl->card.index);
+	if ((res = snd_ctl_open(&ctl, name, 0)) < 0)
+		return res;
+
+	snd_ctl_card_info_alloca(&info);
+	if ((res = snd_ctl_card_info(ctl, info)) < 0)
+		goto exit;
+
+	snprintf(id, id_size, "%s", snd_ctl_card_info_get_id(info));
+	h = hash_str(h, snd_ctl_card_info_get_id(info));
+	h = hash_str(h, snd_ctl_card_info_get_driver(info));
+	h = hash_str(h, snd_ctl_card_info_get_name(info));
+	h = hash_str(h, snd_ctl_card_info_get_longname(info));
+	h = hash_str(h, snd_ctl_card_info_get_mixername(info));
+	h = hash_str(h, snd_ctl_card_info_get_components(info));
+
+	/* the control elements of the card */
+	snd_ctl_elem_list_alloca(&list);
+	if ((res = snd_ctl_elem_list(ctl, list)) < 0)
+		goto exit;
+	if ((res = snd_ctl_elem_list_alloc_space(list,
+			snd_ctl_elem_list_get_count(list))) < 0)
+		goto exit;
+	if ((res = snd_ctl_elem_list(ctl, list)) >= 0) {
+		for (i = 0; i < snd_ctl_elem_list_get_used(list); i++) {
+			uint32_t v[2] = {
+				snd_ctl_elem_list_get_interface(list, i),
+				snd_ctl_elem_list_get_index(list, i) };
+			h = hash_str(h, snd_ctl_elem_list_get_name(list, i));
+			h = hash_add(h, v, sizeof(v));
+		}
+	}
+	snd_ctl_elem_list_free_space(list);
+	if (res < 0)
+		goto exit;
+
+	if (props) {
+		h = hash_str(h, acp_dict_lookup(props, "device.vendor.id"));
+		h = hash_str(h, acp_dict_lookup(props, "device.product.id"));
+	}
+
+	/* the probe parameters and the profile set */
+	params[0] = PROBE_CACHE_VERSION;
+	params[1] = impl->use_ucm;
+	params[2] = impl->rate;
+	params[3] = impl->pro_channels;
+	h = hash_add(h, params, sizeof(params));
+
+	if (ps->fname && stat(ps->fname, &st) == 0) {
+		int64_t mtime = st.st_mtime;
+		h = hash_str(h, ps->fname);
+		h = hash_add(h, &mtime, sizeof(mtime));
+	}
+	PA_HASHMAP_FOREACH(m, ps->mappings, state) {
+		h = hash_str(h, m->name);
+		for (i = 0; m->device_strings && m->device_strings[i]; i++)
+			h = hash_str(h, m->device_strings[i]);
+		h = hash_add(h, &m->channel_map, sizeof(m->channel_map));
+	}
+	PA_HASHMAP_FOREACH(p, ps->profiles, state)
+		h = hash_str(h, p->name);
+	*key = h;
+exit:
+	snd_ctl_close(ctl);
+	return res;
+}
+
+static int probe_cache_load(pa_alsa_profile_set *ps, const char *path, uint64_t key)
+{
+	FILE *f;
+	char line[1024];
+	uint64_t k;
+	int res = -ENODATA, count = 0;
+
+	if ((f = fopen(path, "re")) == NULL)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *name;
+
+		line[strcspn(line, "\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+
+		if (sscanf(line, "key %" SCNx64, &k) == 1) {
+			if (k != key) {
+				res = -ESTALE;
+				break;
+			}
+			res = 0;
+			ps->probe_skip = pa_hashmap_new_full(pa_idxset_string_hash_func,
+					pa_idxset_string_compare_func, pa_xfree, NULL);
+		} else if (res == 0 && spa_strstartswith(line, "unsupported ")) {
+			name = pa_xstrdup(line + strlen("unsupported "));
+			if (pa_hashmap_put(ps->probe_skip, name, name) < 0)
+				pa_xfree(name);
+			else
+				count++;
+		}
+	}
+	fclose(f);
+
+	if (res < 0 && ps->probe_skip) {
+		pa_hashmap_free(ps->probe_skip);
+		ps->probe_skip = NULL;
+	}
+	return res < 0 ? res : count;
+}
+
+static int mkdir_p(const char *dir)
+{
+	char *d = pa_xstrdup(dir), *p = d;
+	int res = 0;
+
+	while (res == 0 && p != NULL) {
+		if ((p = strchr(p + 1, '/')) != NULL)
+			*p = '\0';
+		if (mkdir(d, 0700) < 0 && errno != EEXIST)
+			res = -errno;
+		if (p != NULL)
+			*p = '/';
+	}
+	pa_xfree(d);
+	return res;
+}
+
+static int probe_cache_save(pa_alsa_profile_set *ps, const char *dir,
+		const char *path, uint64_t key)
+{
+	char *tmp, *name;
+	FILE *f;
+	void *state;
+	int res = 0;
+
+	if ((res = mkdir_p(dir)) < 0)
+		return res;
+
+	tmp = pa_sprintf_malloc("%s.tmp", path);
+	if ((f = fopen(tmp, "we")) == NULL) {
+		res = -errno;
+		goto exit;
+	}
+	fprintf(f, "# ACP probe cache, do not edit\n");
+	fprintf(f, "key %016" PRIx64 "\n", key);
+	PA_HASHMAP_FOREACH(name, ps->probe_failed, state)
+		fprintf(f, "unsupported %s\n", name);
+
+	if (fclose(f) != 0 || rename(tmp, path) < 0) {
+		res = -errno;
+		unlink(tmp);
+	}
+exit:
+	pa_xfree(tmp);
+	return res;
+}
+
+static char *probe_cache_dir(const struct acp_dict *props)
+{
+	const char *s;
+
+	if (props) {
+		if ((s = acp_dict_lookup(props, "api.acp.probe-cache")) != NULL &&
+		    !spa_atob(s))
+			return NULL;
+		if ((s = acp_dict_lookup(props, "api.acp.probe-cache-dir")) != NULL)
+			return s[0] ? pa_xstrdup(s) : NULL;
+	}
+	if ((s = getenv("XDG_STATE_HOME")) != NULL && s[0] == '/')
+		return pa_sprintf_malloc("%s/pipewire/acp", s);
+	if ((s = getenv("HOME")) != NULL && s[0] == '/')
+		return pa_sprintf_malloc("%s/.local/state/pipewire/acp", s);
+	return NULL;
+}
+
+static void probe_cache_prepare(pa_card *impl, const struct acp_dict *props,
+		struct probe_cache *cache)
+{
+	pa_alsa_profile_set *ps = impl->profile_set;
+	char id[64];
+	int res;
+
+	spa_zero(*cache);
+
+	if ((cache->dir = probe_cache_dir(props)) == NULL)
+		return;
+
+	if ((res = probe_cache_key(impl, props, id, sizeof(id), &cache->key)) < 0) {
+		pa_log_info("can't make probe cache key: %s", snd_strerror(res));
+		goto error;
+	}
+	cache->path = pa_sprintf_malloc("%s/%s.cache", cache->dir, id);
+
+	if ((res = probe_cache_load(ps, cache->path, cache->key)) >= 0) {
+		pa_log_info("using probe cache %s: %d unsupported profiles",
+				cache->path, res);
+		cache->hit = true;
+	} else {
+		pa_log_debug("no valid probe cache %s: %s", cache->path, spa_strerror(res));
+		ps->probe_failed = pa_hashmap_new_full(pa_idxset_string_hash_func,
+				pa_idxset_string_compare_func, pa_xfree, NULL);
+	}
+	return;
+error:
+	pa_xfree(cache->dir);
+	cache->dir = NULL;
+}
+
+static void probe_cache_finish(pa_card *impl, struct probe_cache *cache)
+{
+	pa_alsa_profile_set *ps = impl->profile_set;
+	int res;
+
+	if (cache->path != NULL && !cache->hit) {
+		if (ps->probe_incomplete)
+			pa_log_info("not saving probe cache %s: probe not final", cache->path);
+		else if ((res = probe_cache_save(ps, cache->dir, cache->path, cache->key)) < 0)
+			pa_log_warn("can't save probe cache %s: %s", cache->path, spa_strerror(res));
+	}
+	pa_xfree(cache->path);
+	pa_xfree(cache->dir);
+}
+
 struct acp_card *acp_card_new(uint32_t index, const struct acp_dict *props)
 {
 	pa_card *impl;
 	struct acp_card *card;
+	struct probe_cache cache;
 	const char *s, *profile_set = NULL, *profile = NULL;
 	char device_id[16];
 	uint32_t profile_index;
@@ -1628,12 +1901,16 @@ struct acp_card *acp_card_new(uint32_t index, const struct acp_dict *props)
 
 	impl->profile_set->ignore_dB = impl->ignore_dB;
 
+	probe_cache_prepare(impl, props, &cache);
+
 	pa_alsa_profile_set_probe(impl->profile_set, impl->ucm.mixers,
 			device_id,
 			&impl->ucm.default_sample_spec,
 			impl->ucm.default_n_fragments,
 			impl->ucm.default_fragment_size_msec);
 
+	probe_cache_finish(impl, &cache);
+
 	pa_alsa_init_proplist_card(NULL, impl->proplist, impl->card.index);
 	pa_proplist_sets(impl->proplist, PA_PROP_DEVICE_STRING, device_id);
 	pa_alsa_init_description(impl->proplist, NULL);
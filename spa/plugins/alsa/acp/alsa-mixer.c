@@ -3849,6 +3849,13 @@ void pa_alsa_profile_set_free(pa_alsa_profile_set *ps) {
     if (ps->decibel_fixes)
         pa_hashmap_free(ps->decibel_fixes);
 
+    if (ps->probe_skip)
+        pa_hashmap_free(ps->probe_skip);
+
+    if (ps->probe_failed)
+        pa_hashmap_free(ps->probe_failed);
+
+    pa_xfree(ps->fname);
     pa_xfree(ps);
 }
 
@@ -4904,7 +4911,7 @@ pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel
 	}
     }
     r = pa_config_parse(fn, NULL, items, NULL, false, ps);
-    pa_xfree(fn);
+    ps->fname = fn;
 
     if (r < 0)
         goto fail;
@@ -5010,6 +5017,13 @@ static snd_pcm_t* mapping_open_pcm(pa_alsa_mapping *m,
     return handle;
 }
 
+/* Only an invalid configuration says that the device can't do this
+ * mapping. Errors like EBUSY, EACCES before the ACL is applied or
+ * ENOENT/ENODEV while the card is being added may go away later. */
+static bool probe_failure_is_final(int err) {
+    return err == EINVAL;
+}
+
 static void paths_drop_unused(pa_hashmap* h, pa_hashmap *keep) {
 
     void* state = NULL;
@@ -5115,6 +5129,12 @@ void pa_alsa_profile_set_probe(
         /* Skip if this is already marked that it is supported (i.e. from the config file) */
         if (!p->supported) {
 
+            /* Skip if an earlier probe of this card found it to be unsupported */
+            if (ps->probe_skip && pa_hashmap_get(ps->probe_skip, p->name)) {
+                pa_log_debug("Skipping profile %s - cached as unsupported", p->name);
+                continue;
+            }
+
             profile_finalize_probing(last, p);
             p->supported = true;
 
@@ -5153,6 +5173,8 @@ void pa_alsa_profile_set_probe(
                                                            SND_PCM_STREAM_PLAYBACK,
                                                            default_n_fragments,
                                                            default_fragment_size_msec))) {
+                        if (!probe_failure_is_final(errno))
+                            ps->probe_incomplete = true;
                         p->supported = false;
                         if (pa_idxset_size(p->output_mappings) == 1 &&
                             ((!p->input_mappings) || pa_idxset_size(p->input_mappings) == 0)) {
@@ -5177,6 +5199,8 @@ void pa_alsa_profile_set_probe(
                                                           SND_PCM_STREAM_CAPTURE,
                                                           default_n_fragments,
                                                           default_fragment_size_msec))) {
+                        if (!probe_failure_is_final(errno))
+                            ps->probe_incomplete = true;
                         p->supported = false;
                         if (pa_idxset_size(p->input_mappings) == 1 &&
                             ((!p->output_mappings) || pa_idxset_size(p->output_mappings) == 0)) {
@@ -5192,8 +5216,13 @@ void pa_alsa_profile_set_probe(
 
             last = p;
 
-            if (!p->supported)
+            if (!p->supported) {
+                if (ps->probe_failed && !pa_hashmap_get(ps->probe_failed, p->name)) {
+                    char *name = pa_xstrdup(p->name);
+                    pa_hashmap_put(ps->probe_failed, name, name);
+                }
                 continue;
+            }
         }
 
         pa_log_debug("Profile %s supported.", p->name);
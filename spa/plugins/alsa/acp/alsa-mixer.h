@@ -412,9 +412,14 @@ struct pa_alsa_profile_set {
     pa_hashmap *input_paths;
     pa_hashmap *output_paths;
 
+    char *fname;            /* the profile-set file, NULL for UCM */
+    pa_hashmap *probe_skip; /* profiles known to be unsupported, not probed */
+    pa_hashmap *probe_failed; /* profiles that failed to probe */
+
     bool auto_profiles;
     bool ignore_dB:1;
     bool probed:1;
+    bool probe_incomplete:1; /* a PCM failed for a reason that may go away */
 };
 
 void pa_alsa_mapping_dump(pa_alsa_mapping *m);
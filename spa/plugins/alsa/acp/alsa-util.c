@@ -766,6 +766,8 @@ snd_pcm_t *pa_alsa_open_by_device_string(
 fail:
     pa_xfree(d);
 
+    /* let the caller know why, EBUSY is not a permanent failure */
+    errno = err < 0 ? -err : EINVAL;
     return NULL;
 }
 
@@ -785,6 +787,7 @@ snd_pcm_t *pa_alsa_open_by_template(
 
     snd_pcm_t *pcm_handle;
     char **i;
+    int err = EINVAL;
 
     for (i = template; *i; i++) {
         char *d;
@@ -804,12 +807,18 @@ snd_pcm_t *pa_alsa_open_by_template(
                 use_tsched,
                 require_exact_channel_number);
 
-        pa_xfree(d);
-
-        if (pcm_handle)
+        if (pcm_handle) {
+            pa_xfree(d);
             return pcm_handle;
+        }
+        /* report the error of a device that might work later */
+        if (errno != EINVAL)
+            err = errno;
+
+        pa_xfree(d);
     }
 
+    errno = err;
     return NULL;
 }
 
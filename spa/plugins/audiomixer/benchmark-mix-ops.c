@@ -18,6 +18,9 @@ static uint32_t cpu_flags;
 
 typedef void (*mix_func_t) (struct mix_ops *ops, void * SPA_RESTRICT dst,
 		const void * SPA_RESTRICT src[], uint32_t n_src, uint32_t n_samples);
+typedef void (*mix_gain_func_t) (struct mix_ops *ops, void * SPA_RESTRICT dst,
+		const void * SPA_RESTRICT src[], const struct mix_gain gain[],
+		uint32_t n_src, uint32_t n_samples);
 struct stats {
 	uint32_t n_samples;
 	uint32_t n_src;
@@ -33,11 +36,13 @@ struct stats {
 
 static uint8_t samp_in[MAX_SAMPLES * MAX_SRC * 8];
 static uint8_t samp_out[MAX_SAMPLES * 8];
+static uint8_t samp_tmp[MAX_SAMPLES * MAX_SRC * 8 + 32];
+static struct mix_gain gains[MAX_SRC];
 
 static const int sample_sizes[] = { 0, 1, 128, 513, 4096 };
 static const int src_counts[] = { 1, 2, 4, 6, 8, 11 };
 
-#define MAX_RESULTS	SPA_N_ELEMENTS(sample_sizes) * SPA_N_ELEMENTS(src_counts) * 70
+#define MAX_RESULTS	SPA_N_ELEMENTS(sample_sizes) * SPA_N_ELEMENTS(src_counts) * 90
 
 static uint32_t n_results = 0;
 static struct stats results[MAX_RESULTS];
@@ -91,6 +96,77 @@ static void run_test(const char *name, const char *impl, mix_func_t func)
 	}
 }
 
+/* with mix == NULL the gain is applied while mixing, else the gain is
+ * applied to each input first and then the inputs are mixed, like when the
+ * volume is done in a separate pass before the mixer */
+static void run_test1_gain(const char *name, const char *impl, mix_gain_func_t func,
+		mix_func_t mix, int n_src, int n_samples)
+{
+	int i, j;
+	const void *ip[n_src], *tp[n_src];
+	void *op;
+	struct timespec ts;
+	uint64_t count, t1, t2;
+	struct mix_ops ops;
+
+	ops.n_channels = 1;
+
+	for (j = 0; j < n_src; j++) {
+		ip[j] = SPA_PTR_ALIGN(&samp_in[j * n_samples * 4], 32, void);
+		tp[j] = SPA_PTR_ALIGN(&samp_tmp[j * n_samples * 4], 32, void);
+	}
+	op = SPA_PTR_ALIGN(samp_out, 32, void);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t1 = SPA_TIMESPEC_TO_NSEC(&ts);
+
+	count = 0;
+	for (i = 0; i < MAX_COUNT; i++) {
+		if (mix == NULL) {
+			func(&ops, op, ip, gains, n_src, n_samples);
+		} else {
+			for (j = 0; j < n_src; j++)
+				func(&ops, (void*)tp[j], &ip[j], &gains[j], 1, n_samples);
+			mix(&ops, op, tp, n_src, n_samples);
+		}
+		count++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t2 = SPA_TIMESPEC_TO_NSEC(&ts);
+
+	spa_assert(n_results < MAX_RESULTS);
+
+	results[n_results++] = (struct stats) {
+		.n_samples = n_samples,
+		.n_src = n_src,
+		.perf = count * (uint64_t)SPA_NSEC_PER_SEC / (t2 - t1),
+		.name = name,
+		.impl = impl
+	};
+}
+
+static void run_test_gain(const char *name, const char *impl, mix_gain_func_t func,
+		mix_func_t mix)
+{
+	size_t i, j;
+
+	for (i = 0; i < SPA_N_ELEMENTS(sample_sizes); i++) {
+		for (j = 0; j < SPA_N_ELEMENTS(src_counts); j++) {
+			run_test1_gain(name, impl, func, mix, src_counts[j],
+				(sample_sizes[i] + (src_counts[j] -1)) / src_counts[j]);
+		}
+	}
+}
+
+static void set_gains(bool ramp)
+{
+	uint32_t i;
+	for (i = 0; i < MAX_SRC; i++) {
+		gains[i].gain = 0.5f + i * 0.05f;
+		gains[i].step = ramp ? 0.0001f : 0.0f;
+	}
+}
+
 static void test_s8(void)
 {
 	run_test("test_s8", "c", mix_s8_c);
@@ -160,6 +236,45 @@ static void test_f64(void)
 #endif
 }
 
+static void test_gain_f32(void)
+{
+	set_gains(false);
+	run_test_gain("test_gain_f32", "c", mix_gain_f32_c, NULL);
+	run_test_gain("test_gain_f32", "c-2pass", mix_gain_f32_c, mix_f32_c);
+#if defined (HAVE_SSE)
+	if (cpu_flags & SPA_CPU_FLAG_SSE) {
+		run_test_gain("test_gain_f32", "sse", mix_gain_f32_sse, NULL);
+		run_test_gain("test_gain_f32", "sse-2pass", mix_gain_f32_sse, mix_f32_sse);
+	}
+#endif
+#if defined (HAVE_AVX) && defined (HAVE_FMA)
+	if (SPA_FLAG_IS_SET(cpu_flags, SPA_CPU_FLAG_AVX | SPA_CPU_FLAG_FMA3)) {
+		run_test_gain("test_gain_f32", "avx", mix_gain_f32_avx, NULL);
+		run_test_gain("test_gain_f32", "avx-2pass", mix_gain_f32_avx, mix_f32_avx);
+	}
+#endif
+#if defined (HAVE_NEON)
+	if (cpu_flags & SPA_CPU_FLAG_NEON) {
+		run_test_gain("test_gain_f32", "neon", mix_gain_f32_neon, NULL);
+		run_test_gain("test_gain_f32", "neon-2pass", mix_gain_f32_neon, mix_f32_c);
+	}
+#endif
+	set_gains(true);
+	run_test_gain("test_gain_ramp_f32", "c", mix_gain_f32_c, NULL);
+#if defined (HAVE_SSE)
+	if (cpu_flags & SPA_CPU_FLAG_SSE)
+		run_test_gain("test_gain_ramp_f32", "sse", mix_gain_f32_sse, NULL);
+#endif
+#if defined (HAVE_AVX) && defined (HAVE_FMA)
+	if (SPA_FLAG_IS_SET(cpu_flags, SPA_CPU_FLAG_AVX | SPA_CPU_FLAG_FMA3))
+		run_test_gain("test_gain_ramp_f32", "avx", mix_gain_f32_avx, NULL);
+#endif
+#if defined (HAVE_NEON)
+	if (cpu_flags & SPA_CPU_FLAG_NEON)
+		run_test_gain("test_gain_ramp_f32", "neon", mix_gain_f32_neon, NULL);
+#endif
+}
+
 static int compare_func(const void *_a, const void *_b)
 {
 	const struct stats *a = _a, *b = _b;
@@ -190,6 +305,7 @@ int main(int argc, char *argv[])
 	test_u24_32();
 	test_f32();
 	test_f64();
+	test_gain_f32();
 
 	qsort(results, n_results, sizeof(struct stats), compare_func);
 
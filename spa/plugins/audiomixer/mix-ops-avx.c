@@ -66,3 +66,84 @@ mix_f32_avx(struct mix_ops *ops, void * SPA_RESTRICT dst, const void * SPA_RESTR
 		}
 	}
 }
+
+static inline void gain_avx(const struct mix_gain *gain, bool ramp, uint32_t n, __m256 g[4])
+{
+	if (ramp) {
+		__m256 base = _mm256_set1_ps(gain->gain);
+		__m256 step = _mm256_set1_ps(gain->step);
+		__m256 idx = _mm256_add_ps(_mm256_set1_ps((float)n),
+				_mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+		__m256 eight = _mm256_set1_ps(8.0f);
+
+		g[0] = _mm256_add_ps(base, _mm256_mul_ps(step, idx));
+		idx = _mm256_add_ps(idx, eight);
+		g[1] = _mm256_add_ps(base, _mm256_mul_ps(step, idx));
+		idx = _mm256_add_ps(idx, eight);
+		g[2] = _mm256_add_ps(base, _mm256_mul_ps(step, idx));
+		idx = _mm256_add_ps(idx, eight);
+		g[3] = _mm256_add_ps(base, _mm256_mul_ps(step, idx));
+	} else {
+		g[0] = g[1] = g[2] = g[3] = _mm256_set1_ps(gain->gain);
+	}
+}
+
+void
+mix_gain_f32_avx(struct mix_ops *ops, void * SPA_RESTRICT dst, const void * SPA_RESTRICT src[],
+		const struct mix_gain gain[], uint32_t n_src, uint32_t n_samples)
+{
+	uint32_t i, n, unrolled;
+	const float **s = (const float **)src;
+	float *d = dst;
+	bool ramp;
+
+	if (mix_gain_is_unity(gain, n_src)) {
+		mix_f32_avx(ops, dst, src, n_src, n_samples);
+		return;
+	}
+	ramp = mix_gain_has_ramp(gain, n_src);
+	if (ramp && ops->n_channels != 1) {
+		/* interleaved ramps change the gain per frame, not per sample */
+		mix_gain_f32_c(ops, dst, src, gain, n_src, n_samples);
+		return;
+	}
+	n_samples *= ops->n_channels;
+
+	if (SPA_LIKELY(SPA_IS_ALIGNED(dst, 32))) {
+		unrolled = n_samples & ~31;
+		for (i = 0; i < n_src; i++) {
+			if (SPA_UNLIKELY(!SPA_IS_ALIGNED(src[i], 32))) {
+				unrolled = 0;
+				break;
+			}
+		}
+	} else
+		unrolled = 0;
+
+	for (n = 0; n < unrolled; n += 32) {
+		__m256 in[4], g[4];
+
+		gain_avx(&gain[0], ramp, n, g);
+		in[0] = _mm256_mul_ps(_mm256_load_ps(&s[0][n +  0]), g[0]);
+		in[1] = _mm256_mul_ps(_mm256_load_ps(&s[0][n +  8]), g[1]);
+		in[2] = _mm256_mul_ps(_mm256_load_ps(&s[0][n + 16]), g[2]);
+		in[3] = _mm256_mul_ps(_mm256_load_ps(&s[0][n + 24]), g[3]);
+		for (i = 1; i < n_src; i++) {
+			gain_avx(&gain[i], ramp, n, g);
+			in[0] = _mm256_fmadd_ps(_mm256_load_ps(&s[i][n +  0]), g[0], in[0]);
+			in[1] = _mm256_fmadd_ps(_mm256_load_ps(&s[i][n +  8]), g[1], in[1]);
+			in[2] = _mm256_fmadd_ps(_mm256_load_ps(&s[i][n + 16]), g[2], in[2]);
+			in[3] = _mm256_fmadd_ps(_mm256_load_ps(&s[i][n + 24]), g[3], in[3]);
+		}
+		_mm256_store_ps(&d[n +  0], in[0]);
+		_mm256_store_ps(&d[n +  8], in[1]);
+		_mm256_store_ps(&d[n + 16], in[2]);
+		_mm256_store_ps(&d[n + 24], in[3]);
+	}
+	for (; n < n_samples; n++) {
+		float ac = 0.0f;
+		for (i = 0; i < n_src; i++)
+			ac += s[i][n] * (gain[i].gain + gain[i].step * (float)n);
+		d[n] = ac;
+	}
+}
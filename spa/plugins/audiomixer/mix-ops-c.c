@@ -46,3 +46,29 @@ MAKE_FUNC(s24_32, int32_t, int32_t, S24_32_ACCUM, S24_32_CLAMP, true);
 MAKE_FUNC(u24_32, uint32_t, int32_t, U24_32_ACCUM, U24_32_CLAMP, false);
 MAKE_FUNC(f32, float, float, F32_ACCUM, F32_CLAMP, true);
 MAKE_FUNC(f64, double, double, F64_ACCUM, F64_CLAMP, true);
+
+#define MAKE_GAIN_FUNC(name,type)						\
+void mix_gain_ ##name## _c(struct mix_ops *ops,				\
+		void * SPA_RESTRICT dst, const void * SPA_RESTRICT src[],	\
+		const struct mix_gain gain[], uint32_t n_src,			\
+		uint32_t n_samples)						\
+{										\
+	uint32_t i, n, c, o, n_channels = ops->n_channels;			\
+	type *d = dst;								\
+	const type **s = (const type **)src;					\
+	if (n_src == 0) {							\
+		memset(dst, 0, n_samples * n_channels * sizeof(type));		\
+		return;								\
+	}									\
+	for (n = 0, o = 0; n < n_samples; n++) {				\
+		for (c = 0; c < n_channels; c++, o++) {				\
+			type ac = 0;						\
+			for (i = 0; i < n_src; i++)				\
+				ac += s[i][o] * (gain[i].gain + gain[i].step * (float)n); \
+			d[o] = ac;						\
+		}								\
+	}									\
+}
+
+MAKE_GAIN_FUNC(f32, float);
+MAKE_GAIN_FUNC(f64, double);
@@ -0,0 +1,88 @@
+/* Spa */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <spa/utils/defs.h>
+
+#include "mix-ops.h"
+
+#include <arm_neon.h>
+
+static inline void gain_neon(const struct mix_gain *gain, bool ramp, uint32_t n,
+		float32x4_t g[4])
+{
+	if (ramp) {
+		static const float offs[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+		float32x4_t base = vdupq_n_f32(gain->gain);
+		float32x4_t step = vdupq_n_f32(gain->step);
+		float32x4_t idx = vaddq_f32(vdupq_n_f32((float)n), vld1q_f32(offs));
+		float32x4_t four = vdupq_n_f32(4.0f);
+
+		g[0] = vaddq_f32(base, vmulq_f32(step, idx));
+		idx = vaddq_f32(idx, four);
+		g[1] = vaddq_f32(base, vmulq_f32(step, idx));
+		idx = vaddq_f32(idx, four);
+		g[2] = vaddq_f32(base, vmulq_f32(step, idx));
+		idx = vaddq_f32(idx, four);
+		g[3] = vaddq_f32(base, vmulq_f32(step, idx));
+	} else {
+		g[0] = g[1] = g[2] = g[3] = vdupq_n_f32(gain->gain);
+	}
+}
+
+void
+mix_gain_f32_neon(struct mix_ops *ops, void * SPA_RESTRICT dst, const void * SPA_RESTRICT src[],
+		const struct mix_gain gain[], uint32_t n_src, uint32_t n_samples)
+{
+	uint32_t n, i, unrolled;
+	const float **s = (const float **)src;
+	float *d = dst;
+	bool ramp;
+
+	if (mix_gain_is_unity(gain, n_src)) {
+		mix_f32_c(ops, dst, src, n_src, n_samples);
+		return;
+	}
+	ramp = mix_gain_has_ramp(gain, n_src);
+	if (ramp && ops->n_channels != 1) {
+		/* interleaved ramps change the gain per frame, not per sample */
+		mix_gain_f32_c(ops, dst, src, gain, n_src, n_samples);
+		return;
+	}
+	n_samples *= ops->n_channels;
+
+	/* the neon loads and stores don't need aligned memory */
+	unrolled = n_samples & ~15;
+
+	for (n = 0; n < unrolled; n += 16) {
+		float32x4_t in[4], g[4];
+
+		gain_neon(&gain[0], ramp, n, g);
+		in[0] = vmulq_f32(vld1q_f32(&s[0][n+ 0]), g[0]);
+		in[1] = vmulq_f32(vld1q_f32(&s[0][n+ 4]), g[1]);
+		in[2] = vmulq_f32(vld1q_f32(&s[0][n+ 8]), g[2]);
+		in[3] = vmulq_f32(vld1q_f32(&s[0][n+12]), g[3]);
+
+		for (i = 1; i < n_src; i++) {
+			gain_neon(&gain[i], ramp, n, g);
+			in[0] = vmlaq_f32(in[0], vld1q_f32(&s[i][n+ 0]), g[0]);
+			in[1] = vmlaq_f32(in[1], vld1q_f32(&s[i][n+ 4]), g[1]);
+			in[2] = vmlaq_f32(in[2], vld1q_f32(&s[i][n+ 8]), g[2]);
+			in[3] = vmlaq_f32(in[3], vld1q_f32(&s[i][n+12]), g[3]);
+		}
+		vst1q_f32(&d[n+ 0], in[0]);
+		vst1q_f32(&d[n+ 4], in[1]);
+		vst1q_f32(&d[n+ 8], in[2]);
+		vst1q_f32(&d[n+12], in[3]);
+	}
+	for (; n < n_samples; n++) {
+		float ac = 0.0f;
+		for (i = 0; i < n_src; i++)
+			ac += s[i][n] * (gain[i].gain + gain[i].step * (float)n);
+		d[n] = ac;
+	}
+}
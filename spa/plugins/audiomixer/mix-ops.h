@@ -97,6 +97,14 @@ static inline int24_t s32_to_s24(int32_t src)
 #define F64_ACCUM(a,b)		((a) + (b))
 #define F64_CLAMP(a)		(a)
 
+/** Gain of one mixer input. Frame n of the mixed block is multiplied
+ * with gain + step * n so that volume changes can be ramped linearly
+ * without clicks. step is 0.0 for a constant gain. */
+struct mix_gain {
+	float gain;
+	float step;
+};
+
 struct mix_ops {
 	uint32_t fmt;
 	uint32_t n_channels;
@@ -107,6 +115,11 @@ struct mix_ops {
 			void * SPA_RESTRICT dst,
 			const void * SPA_RESTRICT src[], uint32_t n_src,
 			uint32_t n_samples);
+	/* mix with a gain per input, NULL when not supported by the format */
+	void (*process_gain) (struct mix_ops *ops,
+			void * SPA_RESTRICT dst,
+			const void * SPA_RESTRICT src[], const struct mix_gain gain[],
+			uint32_t n_src, uint32_t n_samples);
 	void (*free) (struct mix_ops *ops);
 
 	const void *priv;
@@ -114,8 +127,27 @@ struct mix_ops {
 
 int mix_ops_init(struct mix_ops *ops);
 
+static inline bool mix_gain_is_unity(const struct mix_gain gain[], uint32_t n_src)
+{
+	uint32_t i;
+	for (i = 0; i < n_src; i++)
+		if (gain[i].gain != 1.0f || gain[i].step != 0.0f)
+			return false;
+	return true;
+}
+
+static inline bool mix_gain_has_ramp(const struct mix_gain gain[], uint32_t n_src)
+{
+	uint32_t i;
+	for (i = 0; i < n_src; i++)
+		if (gain[i].step != 0.0f)
+			return true;
+	return false;
+}
+
 #define mix_ops_clear(ops,...)		(ops)->clear(ops, __VA_ARGS__)
 #define mix_ops_process(ops,...)	(ops)->process(ops, __VA_ARGS__)
+#define mix_ops_process_gain(ops,...)	(ops)->process_gain(ops, __VA_ARGS__)
 #define mix_ops_free(ops)		(ops)->free(ops)
 
 #define DEFINE_FUNCTION(name,arch) \
@@ -123,6 +155,11 @@ void mix_##name##_##arch(struct mix_ops *ops, void * SPA_RESTRICT dst,	\
 		const void * SPA_RESTRICT src[], uint32_t n_src,		\
 		uint32_t n_samples)						\
 
+#define DEFINE_GAIN_FUNCTION(name,arch) \
+void mix_gain_##name##_##arch(struct mix_ops *ops, void * SPA_RESTRICT dst,	\
+		const void * SPA_RESTRICT src[], const struct mix_gain gain[],	\
+		uint32_t n_src, uint32_t n_samples)				\
+
 #define MIX_OPS_MAX_ALIGN	32
 
 DEFINE_FUNCTION(s8, c);
@@ -137,13 +174,20 @@ DEFINE_FUNCTION(s24_32, c);
 DEFINE_FUNCTION(u24_32, c);
 DEFINE_FUNCTION(f32, c);
 DEFINE_FUNCTION(f64, c);
+DEFINE_GAIN_FUNCTION(f32, c);
+DEFINE_GAIN_FUNCTION(f64, c);
 
 #if defined(HAVE_SSE)
 DEFINE_FUNCTION(f32, sse);
+DEFINE_GAIN_FUNCTION(f32, sse);
 #endif
 #if defined(HAVE_SSE2)
 DEFINE_FUNCTION(f64, sse2);
 #endif
 #if defined(HAVE_AVX)
 DEFINE_FUNCTION(f32, avx);
+DEFINE_GAIN_FUNCTION(f32, avx);
+#endif
+#if defined(HAVE_NEON)
+DEFINE_GAIN_FUNCTION(f32, neon);
 #endif
@@ -29,12 +29,12 @@ static struct spa_log_topic *log_topic = &SPA_LOG_TOPIC(0, "spa.mixer-dsp");
 #define MAX_PORTS	512
 #define MAX_ALIGN	MIX_OPS_MAX_ALIGN
 
-#define PORT_DEFAULT_VOLUME	1.0
+#define PORT_DEFAULT_VOLUME	1.0f
 #define PORT_DEFAULT_MUTE	false
 
 struct port_props {
-	double volume;
-	int32_t mute;
+	float volume;
+	bool mute;
 };
 
 static void port_props_reset(struct port_props *props)
@@ -59,6 +59,9 @@ struct port {
 	uint32_t id;
 
 	struct port_props props;
+	/* the gain that was used for the last cycle, a change to the volume
+	 * is ramped from this value over the next cycle */
+	float gain;
 
 	struct spa_io_buffers *io;
 
@@ -102,6 +105,7 @@ struct impl {
 
 	struct buffer *mix_buffers[MAX_PORTS];
 	const void *mix_datas[MAX_PORTS];
+	struct mix_gain mix_gains[MAX_PORTS];
 
 	int n_formats;
 	struct spa_audio_info format;
@@ -235,6 +239,7 @@ static int impl_node_add_port(void *object, enum spa_direction direction, uint32
 	port->id = port_id;
 
 	port_props_reset(&port->props);
+	port->gain = port->props.volume;
 
 	spa_list_init(&port->queue);
 	port->info_all = SPA_PORT_CHANGE_MASK_FLAGS |
@@ -249,8 +254,9 @@ static int impl_node_add_port(void *object, enum spa_direction direction, uint32
 	port->params[2] = SPA_PARAM_INFO(SPA_PARAM_IO, SPA_PARAM_INFO_READ);
 	port->params[3] = SPA_PARAM_INFO(SPA_PARAM_Format, SPA_PARAM_INFO_WRITE);
 	port->params[4] = SPA_PARAM_INFO(SPA_PARAM_Buffers, 0);
+	port->params[5] = SPA_PARAM_INFO(SPA_PARAM_Props, SPA_PARAM_INFO_READWRITE);
 	port->info.params = port->params;
-	port->info.n_params = 5;
+	port->info.n_params = 6;
 
 	this->port_count++;
 	if (this->last_port <= port_id)
@@ -412,6 +418,18 @@ next:
 			return 0;
 		}
 		break;
+
+	case SPA_PARAM_Props:
+		if (direction != SPA_DIRECTION_INPUT)
+			return -ENOENT;
+		if (result.index > 0)
+			return 0;
+
+		param = spa_pod_builder_add_object(&b,
+			SPA_TYPE_OBJECT_Props, id,
+			SPA_PROP_volume, SPA_POD_Float(port->props.volume),
+			SPA_PROP_mute,   SPA_POD_Bool(port->props.mute));
+		break;
 	default:
 		return -ENOENT;
 	}
@@ -529,6 +547,30 @@ static int port_set_format(void *object,
 	return 0;
 }
 
+static int port_set_props(struct impl *this, struct port *port,
+		const struct spa_pod *param)
+{
+	struct port_props *p = &port->props;
+
+	if (port->direction != SPA_DIRECTION_INPUT)
+		return -ENOENT;
+
+	if (param == NULL)
+		port_props_reset(p);
+	else if (spa_pod_parse_object(param,
+			SPA_TYPE_OBJECT_Props, NULL,
+			SPA_PROP_volume, SPA_POD_OPT_Float(&p->volume),
+			SPA_PROP_mute,   SPA_POD_OPT_Bool(&p->mute)) < 0)
+		return -EINVAL;
+
+	spa_log_debug(this->log, "%p: port %d volume:%f mute:%d", this,
+			port->id, p->volume, p->mute);
+
+	port->info.change_mask |= SPA_PORT_CHANGE_MASK_PARAMS;
+	port->params[5].user++;
+	emit_port_info(this, port, false);
+	return 0;
+}
 
 static int
 impl_node_port_set_param(void *object,
@@ -541,11 +583,14 @@ impl_node_port_set_param(void *object,
 	spa_return_val_if_fail(this != NULL, -EINVAL);
 	spa_return_val_if_fail(CHECK_PORT(this, direction, port_id), -EINVAL);
 
-	if (id == SPA_PARAM_Format) {
+	switch (id) {
+	case SPA_PARAM_Format:
 		return port_set_format(this, direction, port_id, flags, param);
-	}
-	else
+	case SPA_PARAM_Props:
+		return port_set_props(this, GET_PORT(this, direction, port_id), param);
+	default:
 		return -ENOENT;
+	}
 }
 
 static int
@@ -653,10 +698,12 @@ static int impl_node_process(void *object)
 	struct impl *this = object;
 	struct port *outport;
 	struct spa_io_buffers *outio;
-	uint32_t n_buffers, i, maxsize;
+	uint32_t n_buffers, i, maxsize, n_samples;
 	struct buffer **buffers;
 	struct buffer *outb;
 	const void **datas;
+	struct mix_gain *gains;
+	bool unity = true;
 
 	spa_return_val_if_fail(this != NULL, -EINVAL);
 
@@ -678,6 +725,7 @@ static int impl_node_process(void *object)
 
 	buffers = this->mix_buffers;
 	datas = this->mix_datas;
+	gains = this->mix_gains;
 	n_buffers = 0;
 
 	maxsize = UINT32_MAX;
@@ -688,6 +736,7 @@ static int impl_node_process(void *object)
 		struct buffer *inb;
 		struct spa_data *bd;
 		uint32_t size, offs;
+		float target;
 
 		if (SPA_UNLIKELY(!PORT_VALID(inport) ||
 		    (inio = inport->io) == NULL ||
@@ -714,10 +763,20 @@ static int impl_node_process(void *object)
 				offs, size, (int)sizeof(float),
 				bd->chunk->flags);
 
+		target = inport->props.mute ? 0.0f : inport->props.volume;
+
 		if (!SPA_FLAG_IS_SET(bd->chunk->flags, SPA_CHUNK_FLAG_EMPTY)) {
+			/* the step is the target gain for now, it is made
+			 * into a ramp when the number of samples is known */
+			gains[n_buffers].gain = inport->gain;
+			gains[n_buffers].step = target;
+			if (inport->gain != 1.0f || target != 1.0f)
+				unity = false;
+
 			datas[n_buffers] = SPA_PTROFF(bd->data, offs, void);
 			buffers[n_buffers++] = inb;
 		}
+		inport->gain = target;
 		inio->status = SPA_STATUS_NEED_DATA;
 	}
 
@@ -729,7 +788,7 @@ static int impl_node_process(void *object)
 		return -EPIPE;
 	}
 
-	if (n_buffers == 1) {
+	if (n_buffers == 1 && unity) {
 		*outb->buffer = *buffers[0]->buffer;
 	} else {
 		struct spa_data *d = outb->buf.datas;
@@ -745,8 +804,18 @@ static int impl_node_process(void *object)
 
 		spa_log_trace_fp(this->log, "%p: %d mix %d", this, n_buffers, maxsize);
 
-		mix_ops_process(&this->ops, d[0].data,
-				datas, n_buffers, maxsize / sizeof(float));
+		n_samples = maxsize / sizeof(float);
+
+		if (unity || n_samples == 0) {
+			mix_ops_process(&this->ops, d[0].data,
+					datas, n_buffers, n_samples);
+		} else {
+			for (i = 0; i < n_buffers; i++)
+				gains[i].step = (gains[i].step - gains[i].gain) / n_samples;
+
+			mix_ops_process_gain(&this->ops, d[0].data,
+					datas, gains, n_buffers, n_samples);
+		}
 	}
 
 	outio->buffer_id = outb->id;
@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <math.h>
 
 #include <spa/debug/mem.h>
 
@@ -251,6 +252,106 @@ static void test_f64(void)
 #endif
 }
 
+#define N_GAIN_SAMPLES	515
+
+static float gain_in[4][N_GAIN_SAMPLES * 2 + 8] SPA_ALIGNED(32);
+static float gain_out[N_GAIN_SAMPLES * 2 + 8] SPA_ALIGNED(32);
+static float gain_ref[N_GAIN_SAMPLES * 2] SPA_ALIGNED(32);
+
+static void test_gain_f32_c(void)
+{
+	struct mix_ops ops;
+	float in_2[] = { 1.0f, -1.0f, 0.5f, -0.5f };
+	float in_3[] = { 0.5f, -0.5f, -0.5f, 0.5f };
+	float out_2[] = { 0.5f, -0.75f, -0.25f, 0.5f };
+	const void *src[2] = { in_2, in_3 };
+	const struct mix_gain gain[2] = { { 0.5f, 0.0f }, { 0.0f, 0.5f } };
+
+	ops.fmt = SPA_AUDIO_FORMAT_F32;
+	ops.n_channels = 1;
+	ops.cpu_flags = 0;
+	mix_ops_init(&ops);
+	spa_assert_se(ops.process_gain == mix_gain_f32_c);
+
+	fprintf(stderr, "test_gain_f32_2\n");
+	mix_ops_process_gain(&ops, samp_out, src, gain, 2, SPA_N_ELEMENTS(out_2));
+	compare_mem(0, 0, samp_out, out_2, sizeof(out_2));
+}
+
+/* compare the optimized version against the C version, with ramps,
+ * unaligned memory and interleaved channels */
+static void run_test_gain(const char *name, uint32_t n_channels, uint32_t offs,
+		mix_gain_func_t mix)
+{
+	static const struct mix_gain gains[][4] = {
+		{ { 1.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 0.0f } },
+		{ { 0.5f, 0.0f }, { 2.0f, 0.0f }, { 0.0f, 0.0f }, { -1.0f, 0.0f } },
+		{ { 1.0f, -1.0f / N_GAIN_SAMPLES }, { 0.0f, 1.0f / N_GAIN_SAMPLES },
+		  { 0.5f, 0.0f }, { 0.25f, 0.001f } },
+	};
+	struct mix_ops ops;
+	const void *src[4];
+	uint32_t i, j, n_src, n_samples = N_GAIN_SAMPLES * n_channels;
+
+	ops.fmt = SPA_AUDIO_FORMAT_F32;
+	ops.n_channels = n_channels;
+	ops.cpu_flags = cpu_flags;
+
+	fprintf(stderr, "%s_%d_%d\n", name, n_channels, offs);
+
+	for (i = 0; i < 4; i++)
+		src[i] = &gain_in[i][offs];
+
+	for (i = 0; i < SPA_N_ELEMENTS(gains); i++) {
+		for (n_src = 0; n_src <= 4; n_src++) {
+			mix_gain_f32_c(&ops, gain_ref, src, gains[i], n_src, N_GAIN_SAMPLES);
+			mix(&ops, &gain_out[offs], src, gains[i], n_src, N_GAIN_SAMPLES);
+
+			for (j = 0; j < n_samples; j++) {
+				float diff = fabsf(gain_out[offs + j] - gain_ref[j]);
+				if (diff > 1e-6f) {
+					fprintf(stderr, "%d %d %d: %f != %f\n", i, n_src, j,
+							gain_out[offs + j], gain_ref[j]);
+				}
+				spa_assert_se(diff <= 1e-6f);
+			}
+		}
+	}
+}
+
+static void test_gain_f32(void)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < SPA_N_ELEMENTS(gain_in[i]); j++)
+			gain_in[i][j] = drand48() - 0.5;
+
+	test_gain_f32_c();
+
+#if defined(HAVE_SSE)
+	if (cpu_flags & SPA_CPU_FLAG_SSE) {
+		run_test_gain("test_gain_f32_sse", 1, 0, mix_gain_f32_sse);
+		run_test_gain("test_gain_f32_sse", 1, 1, mix_gain_f32_sse);
+		run_test_gain("test_gain_f32_sse", 2, 0, mix_gain_f32_sse);
+	}
+#endif
+#if defined(HAVE_AVX) && defined(HAVE_FMA)
+	if (SPA_FLAG_IS_SET(cpu_flags, SPA_CPU_FLAG_AVX | SPA_CPU_FLAG_FMA3)) {
+		run_test_gain("test_gain_f32_avx", 1, 0, mix_gain_f32_avx);
+		run_test_gain("test_gain_f32_avx", 1, 1, mix_gain_f32_avx);
+		run_test_gain("test_gain_f32_avx", 2, 0, mix_gain_f32_avx);
+	}
+#endif
+#if defined(HAVE_NEON)
+	if (cpu_flags & SPA_CPU_FLAG_NEON) {
+		run_test_gain("test_gain_f32_neon", 1, 0, mix_gain_f32_neon);
+		run_test_gain("test_gain_f32_neon", 1, 1, mix_gain_f32_neon);
+		run_test_gain("test_gain_f32_neon", 2, 0, mix_gain_f32_neon);
+	}
+#endif
+}
+
 int main(int argc, char *argv[])
 {
 	cpu_flags = get_cpu_flags();
@@ -268,6 +369,7 @@ int main(int argc, char *argv[])
 	test_u24_32();
 	test_f32();
 	test_f64();
+	test_gain_f32();
 
 	return 0;
 }
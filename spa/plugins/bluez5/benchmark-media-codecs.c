@@ -0,0 +1,664 @@
+/* Spa Bluez5 media codec benchmark */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <spa/support/log-impl.h>
+#include <spa/support/plugin.h>
+#include <spa/support/plugin-loader.h>
+#include <spa/utils/dict.h>
+#include <spa/utils/names.h>
+#include <spa/utils/result.h>
+#include <spa/utils/string.h>
+#include <spa/param/audio/type-info.h>
+#include <spa/debug/types.h>
+
+#include "codec-loader.h"
+
+/* length of the reference signal */
+#define DURATION	2
+#define MAX_RATE	96000
+#define MAX_CHANNELS	8
+#define MAX_SAMPLES	(DURATION * MAX_RATE)
+#define MAX_FRAME_SIZE	(MAX_CHANNELS * 4)
+
+#define MTU		1024
+#define MAX_PACKET	8192
+
+/* the codec delay we search for and the part of the signal used for it */
+#define MAX_DELAY	8192
+#define DELAY_WINDOW	4096
+/* a decoder that outputs silence or garbage ends up below this */
+#define MIN_SNR		3.0
+
+SPA_LOG_IMPL(logger);
+
+#define MAX_PLUGINS	16
+
+struct plugin {
+	void *hnd;
+	struct spa_handle *handle;
+};
+
+static struct plugin plugins[MAX_PLUGINS];
+static struct spa_support support[1];
+static uint32_t n_support;
+
+struct config {
+	uint32_t rate;
+	uint32_t channels;
+};
+
+/* the audio info that is passed to select_config, the codec picks the
+ * closest configuration it supports */
+static const struct config configs[] = {
+	{ 44100, 2 },
+	{ 48000, 2 },
+	{ 96000, 2 },
+	{ 48000, 1 },
+	{ 48000, 6 },
+	{ 48000, 8 },
+};
+
+/* the settings of the codecs that change the bitrate or quality, each
+ * value is benchmarked with all the configurations */
+struct variant {
+	const char *codec;
+	const char *key;
+	const char *value;
+	const char *label;
+};
+
+static const struct variant variants[] = {
+	{ "ldac", "bluez5.a2dp.ldac.quality", "hq", "990k" },
+	{ "ldac", "bluez5.a2dp.ldac.quality", "sq", "660k" },
+	{ "ldac", "bluez5.a2dp.ldac.quality", "mq", "330k" },
+	{ "aac", "bluez5.a2dp.aac.bitratemode", "1", "vbr1" },
+	{ "aac", "bluez5.a2dp.aac.bitratemode", "3", "vbr3" },
+	{ "aac", "bluez5.a2dp.aac.bitratemode", "5", "vbr5" },
+	{ "opus_05_pro", "bluez5.a2dp.opus.pro.max-bitrate", "96000", "96k" },
+	{ "opus_05_pro", "bluez5.a2dp.opus.pro.max-bitrate", "192000", "192k" },
+	{ "opus_05_pro", "bluez5.a2dp.opus.pro.max-bitrate", "320000", "320k" },
+};
+
+/* the number of times the bitpool is reduced, like media-sink does when
+ * the socket can't keep up, for the codecs that report the new level */
+static const uint32_t bitpool_steps[] = { 0, 4, 8, 16 };
+
+struct stats {
+	const struct media_codec *codec;
+	char label[20];
+	struct spa_audio_info info;
+	uint32_t block_frames;
+	uint32_t n_blocks;
+	uint64_t encode_ns;
+	uint64_t decode_ns;
+	uint64_t bytes;
+	uint32_t delay;
+	double snr;
+};
+
+static float ref[MAX_SAMPLES * MAX_CHANNELS];
+static float out[MAX_SAMPLES * MAX_CHANNELS];
+static uint8_t in_data[MAX_SAMPLES * MAX_FRAME_SIZE];
+static uint8_t out_data[(MAX_SAMPLES + MAX_DELAY) * MAX_FRAME_SIZE];
+static uint8_t packets[MAX_SAMPLES * MAX_FRAME_SIZE];
+static uint32_t packet_sizes[MAX_SAMPLES];
+
+static const struct spa_handle_factory *find_factory(spa_handle_factory_enum_func_t enum_func,
+		const char *name)
+{
+	const struct spa_handle_factory *factory;
+	uint32_t i;
+
+	for (i = 0; enum_func(&factory, &i) > 0;) {
+		if (factory->version >= SPA_VERSION_HANDLE_FACTORY &&
+		    spa_streq(factory->name, name))
+			return factory;
+	}
+	return NULL;
+}
+
+static struct spa_handle *loader_load(void *object, const char *factory_name,
+		const struct spa_dict *info)
+{
+	const struct spa_handle_factory *factory;
+	spa_handle_factory_enum_func_t enum_func;
+	struct plugin *p = NULL;
+	const char *dir, *lib;
+	char path[PATH_MAX];
+	uint32_t i;
+	int res;
+
+	for (i = 0; i < MAX_PLUGINS; i++) {
+		if (plugins[i].handle == NULL) {
+			p = &plugins[i];
+			break;
+		}
+	}
+	if (p == NULL || info == NULL ||
+	    (lib = spa_dict_lookup(info, SPA_KEY_LIBRARY_NAME)) == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL)
+		dir = PLUGINDIR;
+
+	spa_scnprintf(path, sizeof(path), "%s/%s.so", dir, lib);
+
+	/* not all codecs are built */
+	if ((p->hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		errno = ENOENT;
+		return NULL;
+	}
+	if ((enum_func = dlsym(p->hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL ||
+	    (factory = find_factory(enum_func, factory_name)) == NULL) {
+		fprintf(stderr, "can't find factory %s in %s\n", factory_name, path);
+		res = -ENOENT;
+		goto error;
+	}
+	if ((p->handle = calloc(1, spa_handle_factory_get_size(factory, NULL))) == NULL) {
+		res = -errno;
+		goto error;
+	}
+	if ((res = spa_handle_factory_init(factory, p->handle, info, support, n_support)) < 0) {
+		fprintf(stderr, "can't make factory instance %s: %s\n",
+				factory_name, spa_strerror(res));
+		free(p->handle);
+		p->handle = NULL;
+		goto error;
+	}
+	return p->handle;
+
+error:
+	dlclose(p->hnd);
+	errno = -res;
+	return NULL;
+}
+
+static int loader_unload(void *object, struct spa_handle *handle)
+{
+	uint32_t i;
+
+	for (i = 0; i < MAX_PLUGINS; i++) {
+		if (plugins[i].handle == handle) {
+			spa_handle_clear(handle);
+			free(handle);
+			dlclose(plugins[i].hnd);
+			spa_zero(plugins[i]);
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+static const struct spa_plugin_loader_methods loader_methods = {
+	SPA_VERSION_PLUGIN_LOADER_METHODS,
+	.load = loader_load,
+	.unload = loader_unload,
+};
+
+static struct spa_plugin_loader loader;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+/* logarithmic sweep from 50Hz to 0.4 * rate with a different phase on each
+ * channel, it does not repeat so the codec delay can be found */
+static void make_reference(uint32_t rate, uint32_t channels, uint32_t n_samples)
+{
+	const double f0 = 50.0, f1 = 0.4 * rate, len = (double)n_samples / rate;
+	const double k = log(f1 / f0);
+	uint32_t i, j;
+
+	for (i = 0; i < n_samples; i++) {
+		double t = (double)i / rate;
+		double phase = 2.0 * M_PI * f0 * len / k * (exp(t / len * k) - 1.0);
+
+		for (j = 0; j < channels; j++)
+			ref[i * channels + j] = 0.5f * (float)sin(phase + j * M_PI / 4.0);
+	}
+}
+
+static int to_format(uint32_t format, void *dst, const float *src, uint32_t n_samples)
+{
+	uint32_t i;
+
+	switch (format) {
+	case SPA_AUDIO_FORMAT_S16:
+		for (i = 0; i < n_samples; i++)
+			((int16_t*)dst)[i] = (int16_t)lrintf(src[i] * 32767.0f);
+		break;
+	case SPA_AUDIO_FORMAT_S24:
+		for (i = 0; i < n_samples; i++) {
+			int32_t v = lrintf(src[i] * 8388607.0f);
+			uint8_t *d = SPA_PTROFF(dst, i * 3, uint8_t);
+			d[0] = v;
+			d[1] = v >> 8;
+			d[2] = v >> 16;
+		}
+		break;
+	case SPA_AUDIO_FORMAT_S24_32:
+		for (i = 0; i < n_samples; i++)
+			((int32_t*)dst)[i] = lrintf(src[i] * 8388607.0f);
+		break;
+	case SPA_AUDIO_FORMAT_S32:
+		for (i = 0; i < n_samples; i++)
+			((int32_t*)dst)[i] = lrint(src[i] * 2147483647.0);
+		break;
+	case SPA_AUDIO_FORMAT_F32:
+		memcpy(dst, src, n_samples * sizeof(float));
+		break;
+	default:
+		return -ENOTSUP;
+	}
+	return 0;
+}
+
+static void from_format(uint32_t format, float *dst, const void *src, uint32_t n_samples)
+{
+	uint32_t i;
+
+	switch (format) {
+	case SPA_AUDIO_FORMAT_S16:
+		for (i = 0; i < n_samples; i++)
+			dst[i] = ((const int16_t*)src)[i] / 32768.0f;
+		break;
+	case SPA_AUDIO_FORMAT_S24:
+		for (i = 0; i < n_samples; i++) {
+			const uint8_t *s = SPA_PTROFF(src, i * 3, const uint8_t);
+			int32_t v = (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 |
+					(uint32_t)s[2] << 24) >> 8;
+			dst[i] = v / 8388608.0f;
+		}
+		break;
+	case SPA_AUDIO_FORMAT_S24_32:
+		for (i = 0; i < n_samples; i++)
+			dst[i] = ((const int32_t*)src)[i] / 8388608.0f;
+		break;
+	case SPA_AUDIO_FORMAT_S32:
+		for (i = 0; i < n_samples; i++)
+			dst[i] = (float)(((const int32_t*)src)[i] / 2147483648.0);
+		break;
+	case SPA_AUDIO_FORMAT_F32:
+		memcpy(dst, src, n_samples * sizeof(float));
+		break;
+	}
+}
+
+static uint32_t sample_size(uint32_t format)
+{
+	switch (format) {
+	case SPA_AUDIO_FORMAT_S16:
+		return 2;
+	case SPA_AUDIO_FORMAT_S24:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+/* encode the input like media-sink does, returns the number of packets */
+static int encode(const struct media_codec *codec, void *data,
+		const uint8_t *src, uint32_t size, uint32_t block_size, uint64_t *bytes)
+{
+	uint8_t *dst = packets;
+	uint32_t n_packets = 0, used;
+	uint16_t seqnum = 0;
+	int processed, need_flush = 0, res;
+	size_t out_size;
+
+	*bytes = 0;
+
+	res = codec->start_encode(data, dst, MAX_PACKET, seqnum++, 0);
+	if (res < 0)
+		return res;
+	used = res;
+
+	while (size >= block_size || need_flush == NEED_FLUSH_FRAGMENT) {
+		if (need_flush == NEED_FLUSH_FRAGMENT) {
+			need_flush = 0;
+			processed = codec->encode(data, NULL, 0, dst + used,
+					MAX_PACKET - used, &out_size, &need_flush);
+		} else {
+			processed = codec->encode(data, src, size, dst + used,
+					MAX_PACKET - used, &out_size, &need_flush);
+		}
+		if (processed < 0)
+			return processed;
+
+		src += processed;
+		size -= processed;
+		used += out_size;
+
+		if (need_flush != NEED_FLUSH_NO) {
+			if (n_packets >= SPA_N_ELEMENTS(packet_sizes) ||
+			    dst + used + MAX_PACKET > packets + sizeof(packets))
+				return -ENOSPC;
+
+			packet_sizes[n_packets++] = used;
+			*bytes += used;
+			dst += used;
+
+			if (need_flush == NEED_FLUSH_ALL)
+				need_flush = 0;
+
+			res = codec->start_encode(data, dst, MAX_PACKET, seqnum++, 0);
+			if (res < 0)
+				return res;
+			used = res;
+		} else if (processed == 0) {
+			break;
+		}
+	}
+	return n_packets;
+}
+
+/* decode the packets like media-source does, returns the decoded size */
+static int decode(const struct media_codec *codec, void *data,
+		uint32_t n_packets, uint8_t *dst, uint32_t dst_size)
+{
+	const uint8_t *src = packets;
+	uint32_t i, total = 0;
+	size_t written;
+	int processed;
+
+	for (i = 0; i < n_packets; i++) {
+		const uint8_t *p = src;
+		uint32_t size = packet_sizes[i];
+
+		src += size;
+
+		if ((processed = codec->start_decode(data, p, size, NULL, NULL)) < 0)
+			return processed;
+		p += processed;
+		size -= processed;
+
+		while (size > 0) {
+			if ((processed = codec->decode(data, p, size, dst + total,
+						dst_size - total, &written)) < 0)
+				return processed;
+			if (processed == 0)
+				break;
+			p += processed;
+			size -= processed;
+			total += written;
+			if (total >= dst_size)
+				return -ENOSPC;
+		}
+	}
+	return total;
+}
+
+/* find the delay of the codec as the shift of the output with the least
+ * error on the first channel and compute the SNR of the aligned signals */
+static double compute_snr(uint32_t channels, uint32_t n_ref, uint32_t n_out, uint32_t *delay)
+{
+	const uint32_t start = n_ref / 8;
+	double best = INFINITY, sig = 0.0, noise = 0.0;
+	uint32_t i, d, n;
+
+	*delay = 0;
+	if (n_ref < start + DELAY_WINDOW)
+		return 0.0;
+
+	for (d = 0; d < MAX_DELAY && start + d + DELAY_WINDOW <= n_out; d++) {
+		double err = 0.0;
+		for (i = start; i < start + DELAY_WINDOW && err < best; i++) {
+			double e = ref[i * channels] - out[(i + d) * channels];
+			err += e * e;
+		}
+		if (err < best) {
+			best = err;
+			*delay = d;
+		}
+	}
+
+	n = SPA_MIN(n_ref, n_out - SPA_MIN(n_out, *delay));
+	for (i = start; i < n; i++) {
+		uint32_t j;
+		for (j = 0; j < channels; j++) {
+			double s = ref[i * channels + j];
+			double e = s - out[(i + *delay) * channels + j];
+			sig += s * s;
+			noise += e * e;
+		}
+	}
+	if (sig == 0.0)
+		return 0.0;
+	if (noise == 0.0)
+		return INFINITY;
+	return 10.0 * log10(sig / noise);
+}
+
+/* returns the size of the configuration the codec picks for the audio info */
+static int select_config(const struct media_codec *codec, const struct config *conf,
+		const struct spa_dict *settings, uint8_t config[A2DP_MAX_CAPS_SIZE])
+{
+	struct media_codec_audio_info audio_info = { .rate = conf->rate, .channels = conf->channels };
+	uint8_t caps[A2DP_MAX_CAPS_SIZE];
+	int caps_size, config_size;
+
+	/* pretend the other side supports everything we do */
+	if ((caps_size = codec->fill_caps(codec, 0, caps)) < 0)
+		return -ENOTSUP;
+
+	if ((config_size = codec->select_config(codec, 0, caps, caps_size,
+					&audio_info, settings, config)) < 0)
+		return -ENOTSUP;
+
+	return config_size;
+}
+
+/* benchmark a configuration with the bitpool reduced n_reduce times.
+ * Returns 0 when the codec can't reduce the bitpool (further) */
+static int run_config(const struct media_codec *codec, const uint8_t *config,
+		int config_size, const struct spa_dict *settings, const char *label,
+		uint32_t n_reduce, int *last_bitpool, struct stats *s)
+{
+	void *props = NULL, *enc = NULL, *dec = NULL;
+	uint32_t i, n_samples, frame_size, block_size, n_in, n_out;
+	int res, n_packets, bitpool = 0;
+	uint64_t t1, t2;
+
+	spa_zero(*s);
+	s->codec = codec;
+
+	if (codec->validate_config(codec, 0, config, config_size, &s->info) < 0)
+		return -ENOTSUP;
+
+	if (s->info.info.raw.rate == 0 || s->info.info.raw.rate > MAX_RATE ||
+	    s->info.info.raw.channels == 0 || s->info.info.raw.channels > MAX_CHANNELS)
+		return -ENOTSUP;
+
+	frame_size = s->info.info.raw.channels * sample_size(s->info.info.raw.format);
+	n_samples = DURATION * s->info.info.raw.rate;
+	n_in = n_samples * s->info.info.raw.channels;
+
+	make_reference(s->info.info.raw.rate, s->info.info.raw.channels, n_samples);
+	if ((res = to_format(s->info.info.raw.format, in_data, ref, n_in)) < 0)
+		return res;
+
+	if (codec->init_props)
+		props = codec->init_props(codec, 0, settings);
+
+	/* media-sink encodes, media-source decodes with a separate instance */
+	enc = codec->init(codec, 0, (void *)config, config_size, &s->info, props, MTU);
+	dec = codec->init(codec, MEDIA_CODEC_FLAG_SINK, (void *)config, config_size,
+			&s->info, props, MTU);
+	if (enc == NULL || dec == NULL) {
+		res = -errno;
+		goto done;
+	}
+
+	if (n_reduce > 0) {
+		for (i = 0; i < n_reduce && codec->reduce_bitpool; i++)
+			bitpool = codec->reduce_bitpool(enc);
+		/* no bitpool or no lower bitpool than the previous step */
+		if (bitpool <= 0 || bitpool == *last_bitpool) {
+			res = 0;
+			goto done;
+		}
+		*last_bitpool = bitpool;
+		spa_scnprintf(s->label, sizeof(s->label), "%s bp:%d", label, bitpool);
+	} else {
+		spa_scnprintf(s->label, sizeof(s->label), "%s", label);
+	}
+
+	block_size = codec->get_block_size(enc);
+	s->block_frames = block_size / frame_size;
+
+	t1 = get_time_ns();
+	n_packets = encode(codec, enc, in_data, n_samples * frame_size,
+			SPA_MAX(block_size, 1u), &s->bytes);
+	t2 = get_time_ns();
+	if (n_packets < 0) {
+		res = n_packets;
+		goto done;
+	}
+	s->encode_ns = t2 - t1;
+	s->n_blocks = s->block_frames ? n_samples / s->block_frames : 0;
+
+	t1 = get_time_ns();
+	res = decode(codec, dec, n_packets, out_data, sizeof(out_data));
+	t2 = get_time_ns();
+	if (res < 0)
+		goto done;
+	s->decode_ns = t2 - t1;
+
+	n_out = SPA_MIN((uint32_t)res / frame_size, (uint32_t)(MAX_SAMPLES));
+	from_format(s->info.info.raw.format, out, out_data, n_out * s->info.info.raw.channels);
+
+	s->snr = compute_snr(s->info.info.raw.channels, n_samples, n_out, &s->delay);
+	res = 1;
+
+done:
+	if (enc)
+		codec->deinit(enc);
+	if (dec)
+		codec->deinit(dec);
+	if (props && codec->clear_props)
+		codec->clear_props(props);
+	return res;
+}
+
+static void print_stats(const struct stats *s)
+{
+	double duration = (double)DURATION;
+	uint32_t n_blocks = SPA_MAX(s->n_blocks, 1u);
+
+	printf("%-22.22s %-14.14s %6u %2u %-7.7s %5u %10.2f %10.2f %8.1f %6u %7.2f\n",
+			s->codec->name, s->label,
+			s->info.info.raw.rate, s->info.info.raw.channels,
+			spa_debug_type_find_short_name(spa_type_audio_format, s->info.info.raw.format),
+			s->block_frames,
+			s->encode_ns / 1000.0 / n_blocks,
+			s->decode_ns / 1000.0 / n_blocks,
+			s->bytes * 8 / duration / 1000.0,
+			s->delay, s->snr);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct media_codec * const *codecs;
+	uint32_t i, j, k, v;
+	int res, failed = 0;
+
+	logger.log.level = SPA_LOG_LEVEL_WARN;
+	loader.iface = SPA_INTERFACE_INIT(SPA_TYPE_INTERFACE_PluginLoader,
+			SPA_VERSION_PLUGIN_LOADER, &loader_methods, NULL);
+	support[n_support++] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_Log, &logger.log);
+
+	if ((codecs = load_media_codecs(&loader, &logger.log)) == NULL) {
+		fprintf(stderr, "can't load codecs: %m\n");
+		return -1;
+	}
+
+	printf("%-22s %-14s %6s %2s %-7s %5s %10s %10s %8s %6s %7s\n",
+			"codec", "props", "rate", "ch", "format", "frame",
+			"enc us/f", "dec us/f", "kbit/s", "delay", "SNR dB");
+
+	for (i = 0; codecs[i]; i++) {
+		const struct media_codec *c = codecs[i];
+		uint32_t n_run = 0;
+
+		if (c->fill_caps == NULL || c->select_config == NULL ||
+		    c->validate_config == NULL || c->start_encode == NULL ||
+		    c->encode == NULL || c->start_decode == NULL || c->decode == NULL)
+			continue;
+
+		/* the default settings first, then the variants of the codec */
+		for (v = 0; v <= SPA_N_ELEMENTS(variants); v++) {
+			const struct variant *var = v > 0 ? &variants[v - 1] : NULL;
+			struct spa_dict_item items[1];
+			struct spa_dict settings;
+			uint8_t last_config[A2DP_MAX_CAPS_SIZE];
+			int last_config_size = -1;
+
+			if (var != NULL && !spa_streq(var->codec, c->name))
+				continue;
+			if (var != NULL)
+				items[0] = SPA_DICT_ITEM_INIT(var->key, var->value);
+			settings = SPA_DICT_INIT(items, var ? 1 : 0);
+
+			for (j = 0; j < SPA_N_ELEMENTS(configs); j++) {
+				uint8_t config[A2DP_MAX_CAPS_SIZE];
+				int config_size, last_bitpool = 0;
+
+				if ((config_size = select_config(c, &configs[j], &settings, config)) < 0)
+					continue;
+
+				/* the codec picked the same configuration for another audio info */
+				if (config_size == last_config_size &&
+				    memcmp(config, last_config, config_size) == 0)
+					continue;
+				memcpy(last_config, config, config_size);
+				last_config_size = config_size;
+
+				for (k = 0; k < SPA_N_ELEMENTS(bitpool_steps); k++) {
+					struct stats s;
+
+					res = run_config(c, config, config_size, &settings,
+							var ? var->label : "default",
+							bitpool_steps[k], &last_bitpool, &s);
+					if (res == 0 || res == -ENOTSUP)
+						break;
+					if (res < 0) {
+						fprintf(stderr, "%s %u/%u: %s\n", c->name,
+								configs[j].rate, configs[j].channels,
+								spa_strerror(res));
+						failed++;
+						break;
+					}
+					print_stats(&s);
+					n_run++;
+
+					if (s.snr < MIN_SNR) {
+						fprintf(stderr, "%s %s: SNR %.2f dB too low\n",
+								c->name, s.label, s.snr);
+						failed++;
+					}
+				}
+			}
+		}
+		if (n_run == 0)
+			fprintf(stderr, "%s: no usable configuration\n", c->name);
+	}
+	free_media_codecs(codecs);
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,148 @@
+/* Spa Bluez5 codec worker */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <spa/support/plugin.h>
+#include <spa/utils/names.h>
+#include <spa/utils/result.h>
+
+#include "config.h"
+#include "codec-worker.h"
+
+static struct spa_log_topic log_topic = SPA_LOG_TOPIC(0, "spa.bluez5.codec-worker");
+#undef SPA_LOG_TOPIC_DEFAULT
+#define SPA_LOG_TOPIC_DEFAULT &log_topic
+
+struct impl {
+	struct spa_bt_codec_worker this;
+
+	struct spa_log *log;
+	struct spa_plugin_loader *loader;
+	struct spa_thread_utils *thread_utils;
+	struct spa_handle *handle;
+	struct spa_loop_control *control;
+
+	struct spa_thread *thread;
+	unsigned int started:1;
+	unsigned int running:1;
+};
+
+static void *worker_thread(void *data)
+{
+	struct impl *impl = data;
+	int res;
+
+	spa_log_debug(impl->log, "%p: enter thread", impl);
+	spa_loop_control_enter(impl->control);
+
+	while (impl->running) {
+		if ((res = spa_loop_control_iterate(impl->control, -1)) < 0) {
+			if (res == -EINTR)
+				continue;
+			spa_log_error(impl->log, "%p: iterate error %d (%s)",
+					impl, res, spa_strerror(res));
+		}
+	}
+	spa_loop_control_leave(impl->control);
+	spa_log_debug(impl->log, "%p: leave thread", impl);
+
+	return NULL;
+}
+
+static int do_stop(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	impl->running = false;
+	return 0;
+}
+
+struct spa_bt_codec_worker *spa_bt_codec_worker_create(struct spa_log *log,
+		struct spa_plugin_loader *loader, struct spa_thread_utils *thread_utils,
+		const char *name)
+{
+	struct impl *impl;
+	struct spa_dict_item info_items[] = {
+		{ SPA_KEY_LIBRARY_NAME, "support/libspa-support" },
+	};
+	struct spa_dict info = SPA_DICT_INIT_ARRAY(info_items);
+	struct spa_dict_item thread_items[] = {
+		{ SPA_KEY_THREAD_NAME, name },
+	};
+	struct spa_dict thread_props = SPA_DICT_INIT_ARRAY(thread_items);
+	void *iface;
+	int res;
+
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
+		return NULL;
+
+	impl->log = log;
+	impl->loader = loader;
+	impl->thread_utils = thread_utils;
+
+	spa_log_topic_init(impl->log, &log_topic);
+
+	impl->handle = spa_plugin_loader_load(loader, SPA_NAME_SUPPORT_LOOP, &info);
+	if (impl->handle == NULL) {
+		spa_log_error(impl->log, "can't load %s", SPA_NAME_SUPPORT_LOOP);
+		res = -ENOENT;
+		goto error;
+	}
+	if ((res = spa_handle_get_interface(impl->handle,
+				SPA_TYPE_INTERFACE_Loop, &iface)) < 0) {
+		spa_log_error(impl->log, "can't get loop interface: %s", spa_strerror(res));
+		goto error;
+	}
+	impl->this.loop = iface;
+
+	if ((res = spa_handle_get_interface(impl->handle,
+				SPA_TYPE_INTERFACE_LoopControl, &iface)) < 0) {
+		spa_log_error(impl->log, "can't get loop control interface: %s", spa_strerror(res));
+		goto error;
+	}
+	impl->control = iface;
+
+	/* the worker feeds the socket before its deadline, it needs the
+	 * same priority as the data loop */
+	impl->running = true;
+	impl->thread = spa_thread_utils_create(impl->thread_utils,
+			name ? &thread_props : NULL, worker_thread, impl);
+	if (impl->thread == NULL) {
+		res = -errno;
+		spa_log_error(impl->log, "can't create thread: %m");
+		goto error;
+	}
+	if ((res = spa_thread_utils_acquire_rt(impl->thread_utils, impl->thread, -1)) < 0)
+		spa_log_warn(impl->log, "can't acquire realtime priority: %s",
+				spa_strerror(res));
+	impl->started = true;
+
+	spa_log_info(impl->log, "%p: started codec worker %s", impl, name);
+
+	return &impl->this;
+
+error:
+	if (impl->handle)
+		spa_plugin_loader_unload(impl->loader, impl->handle);
+	free(impl);
+	errno = -res;
+	return NULL;
+}
+
+void spa_bt_codec_worker_destroy(struct spa_bt_codec_worker *worker)
+{
+	struct impl *impl = SPA_CONTAINER_OF(worker, struct impl, this);
+
+	if (impl->started) {
+		spa_loop_invoke(impl->this.loop, do_stop, 0, NULL, 0, false, impl);
+		spa_thread_utils_join(impl->thread_utils, impl->thread, NULL);
+		impl->started = false;
+	}
+	spa_plugin_loader_unload(impl->loader, impl->handle);
+	free(impl);
+}
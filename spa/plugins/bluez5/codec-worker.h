@@ -0,0 +1,32 @@
+/* Spa Bluez5 codec worker */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef SPA_BLUEZ5_CODEC_WORKER_H
+#define SPA_BLUEZ5_CODEC_WORKER_H
+
+#include <spa/support/loop.h>
+#include <spa/support/log.h>
+#include <spa/support/plugin-loader.h>
+#include <spa/support/thread.h>
+
+/**
+ * Codec worker.
+ *
+ * A thread with its own loop to run the codec outside of the data loop,
+ * so that a slow codec does not take time from the graph cycle. The
+ * nodes exchange the audio with the worker through single producer,
+ * single consumer ringbuffers and add the sources of the codec to the
+ * worker loop.
+ */
+struct spa_bt_codec_worker
+{
+	struct spa_loop *loop;	/**< Loop of the worker thread */
+};
+
+struct spa_bt_codec_worker *spa_bt_codec_worker_create(struct spa_log *log,
+		struct spa_plugin_loader *loader, struct spa_thread_utils *thread_utils,
+		const char *name);
+void spa_bt_codec_worker_destroy(struct spa_bt_codec_worker *worker);
+
+#endif
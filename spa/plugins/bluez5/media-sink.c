@@ -12,10 +12,12 @@
 #include <spa/support/loop.h>
 #include <spa/support/log.h>
 #include <spa/support/system.h>
+#include <spa/utils/atomic.h>
 #include <spa/utils/list.h>
 #include <spa/utils/keys.h>
 #include <spa/utils/names.h>
 #include <spa/utils/result.h>
+#include <spa/utils/ringbuffer.h>
 #include <spa/utils/string.h>
 #include <spa/monitor/device.h>
 
@@ -40,6 +42,7 @@
 #include "media-codecs.h"
 #include "rate-control.h"
 #include "iso-io.h"
+#include "codec-worker.h"
 
 static struct spa_log_topic log_topic = SPA_LOG_TOPIC(0, "spa.bluez5.sink.media");
 #undef SPA_LOG_TOPIC_DEFAULT
@@ -62,6 +65,16 @@ struct props {
  * first cycle may have strange number of samples. */
 #define RESYNC_CYCLES 2
 
+/* The codec worker queue holds this many cycles of audio */
+#define WORKER_CYCLES	16
+
+struct worker_cycle {
+	uint64_t time;
+	uint64_t duration;
+	uint64_t rate;
+	uint32_t end;		/* write index of the audio after this cycle */
+};
+
 struct buffer {
 	uint32_t id;
 #define BUFFER_FLAG_OUT	(1<<0)
@@ -108,6 +121,8 @@ struct impl {
 	struct spa_log *log;
 	struct spa_loop *data_loop;
 	struct spa_system *data_system;
+	struct spa_plugin_loader *loader;
+	struct spa_thread_utils *thread_utils;
 
 	struct spa_hook_list hooks;
 	struct spa_callbacks callbacks;
@@ -132,12 +147,16 @@ struct impl {
 	unsigned int transport_started:1;
 	unsigned int following:1;
 	unsigned int is_output:1;
-	unsigned int flush_pending:1;
 	unsigned int iso_pending:1;
 	unsigned int own_codec_data:1;
 
 	unsigned int is_duplex:1;
 	unsigned int is_internal:1;
+	unsigned int use_worker:1;
+
+	/* not a bitfield, the codec worker writes this while the data
+	 * loop updates the flags above */
+	bool flush_pending;
 
 	struct spa_source source;
 	int timerfd;
@@ -178,6 +197,23 @@ struct impl {
 	uint8_t tmp_buffer[BUFFER_SIZE];
 	uint32_t tmp_buffer_used;
 	uint32_t fd_buffer_size;
+
+	/* the loop that runs the encoder, the data loop or the worker loop */
+	struct spa_loop *codec_loop;
+	struct spa_bt_codec_worker *worker;
+	struct spa_source worker_source;
+	int worker_fd;
+	int worker_error;
+	uint64_t worker_delay;
+
+	/* audio from the data loop to the worker */
+	struct spa_ringbuffer worker_ring;
+	uint8_t *worker_data;
+	uint32_t worker_size;
+	uint32_t worker_end;
+
+	struct spa_ringbuffer worker_cycle_ring;
+	struct worker_cycle worker_cycles[WORKER_CYCLES];
 };
 
 #define CHECK_PORT(this,d,p)	((d) == SPA_DIRECTION_INPUT && (p) == 0)
@@ -376,6 +412,7 @@ static void set_latency(struct impl *this, bool emit_latency)
 
 	delay = spa_bt_transport_get_delay_nsec(this->transport);
 	delay += SPA_CLAMP(this->props.latency_offset, -delay, INT64_MAX / 2);
+	delay += this->worker_delay;
 	port->latency.min_ns = port->latency.max_ns = delay;
 
 	if (emit_latency) {
@@ -444,16 +481,23 @@ static uint32_t get_queued_frames(struct impl *this)
 	uint32_t bytes = 0;
 	struct buffer *b;
 
-	spa_list_for_each(b, &port->ready, link) {
-		struct spa_data *d = b->buf->datas;
+	if (this->worker_data != NULL) {
+		uint32_t index;
 
-		bytes += d[0].chunk->size;
-	}
+		spa_ringbuffer_get_read_index(&this->worker_ring, &index);
+		bytes = this->worker_end - index;
+	} else {
+		spa_list_for_each(b, &port->ready, link) {
+			struct spa_data *d = b->buf->datas;
 
-	if (bytes > port->ready_offset)
-		bytes -= port->ready_offset;
-	else
-		bytes = 0;
+			bytes += d[0].chunk->size;
+		}
+
+		if (bytes > port->ready_offset)
+			bytes -= port->ready_offset;
+		else
+			bytes = 0;
+	}
 
 	/* Count (partially) encoded packet */
 	bytes += this->tmp_buffer_used;
@@ -710,6 +754,39 @@ static void enable_flush_timer(struct impl *this, bool enabled)
 	this->flush_pending = enabled;
 }
 
+static uint32_t add_worker_data(struct impl *this)
+{
+	struct port *port = &this->port;
+	uint32_t index, offs, avail, total_frames = 0;
+	int written;
+
+	while (!this->need_flush) {
+		spa_ringbuffer_get_read_index(&this->worker_ring, &index);
+
+		avail = this->worker_end - index;
+		if (avail == 0)
+			break;
+
+		offs = index & (this->worker_size - 1);
+		avail = SPA_MIN(avail, this->worker_size - offs);
+
+		written = add_data(this, this->worker_data + offs, avail);
+		if (written <= 0) {
+			if (written < 0 && written != -ENOSPC) {
+				spa_log_warn(this->log, "%p: error %s, drop %u frames",
+						this, spa_strerror(written),
+						(this->worker_end - index) / port->frame_size);
+				spa_ringbuffer_read_update(&this->worker_ring, this->worker_end);
+			}
+			break;
+		}
+		spa_ringbuffer_read_update(&this->worker_ring, index + written);
+
+		total_frames += written / port->frame_size;
+	}
+	return total_frames;
+}
+
 static int flush_data(struct impl *this, uint64_t now_time)
 {
 	int written;
@@ -740,7 +817,11 @@ again:
 			return res;
 		}
 	}
-	while (!spa_list_is_empty(&port->ready) && !this->need_flush) {
+	if (this->worker_data != NULL)
+		total_frames += add_worker_data(this);
+
+	while (this->worker_data == NULL &&
+			!spa_list_is_empty(&port->ready) && !this->need_flush) {
 		uint8_t *src;
 		uint32_t n_bytes, n_frames;
 		struct buffer *b;
@@ -890,6 +971,11 @@ again:
 			this->next_flush_time += SPA_MIN(packet_time,
 					duration_ns * (port->n_buffers - 1));
 #endif
+			/*
+			 * Give the codec worker one block of time to encode
+			 * the next packet, this is included in the latency.
+			 */
+			this->next_flush_time += this->worker_delay;
 		} else {
 			if (this->next_flush_time == 0)
 				this->next_flush_time = this->process_time;
@@ -1040,10 +1126,10 @@ static void media_on_flush_error(struct spa_source *source)
 	if (source->rmask & (SPA_IO_ERR | SPA_IO_HUP)) {
 		spa_log_warn(this->log, "%p: error %d", this, source->rmask);
 		if (this->flush_source.loop)
-			spa_loop_remove_source(this->data_loop, &this->flush_source);
+			spa_loop_remove_source(this->codec_loop, &this->flush_source);
 		enable_flush_timer(this, false);
 		if (this->flush_timer_source.loop)
-			spa_loop_remove_source(this->data_loop, &this->flush_timer_source);
+			spa_loop_remove_source(this->codec_loop, &this->flush_timer_source);
 		if (this->transport && this->transport->iso_io)
 			spa_bt_iso_io_set_cb(this->transport->iso_io, NULL, NULL);
 		return;
@@ -1053,7 +1139,7 @@ static void media_on_flush_error(struct spa_source *source)
 static void media_on_flush_timeout(struct spa_source *source)
 {
 	struct impl *this = source->data;
-	uint64_t exp;
+	uint64_t exp, now_time;
 	int res;
 
 	spa_log_trace(this->log, "%p: flush on timeout", this);
@@ -1069,10 +1155,129 @@ static void media_on_flush_timeout(struct spa_source *source)
 		return;
 	}
 
+	/* the worker only knows the time of the last cycle it received */
+	now_time = this->worker_data != NULL ? this->process_time : this->current_time;
+
 	while (exp-- > 0) {
 		this->flush_pending = false;
-		flush_data(this, this->current_time);
+		flush_data(this, now_time);
+	}
+}
+
+static int read_worker_cycles(struct impl *this)
+{
+	struct worker_cycle *c;
+	uint32_t index;
+	int32_t avail;
+
+	avail = spa_ringbuffer_get_read_index(&this->worker_cycle_ring, &index);
+	if (avail <= 0)
+		return 0;
+
+	/* encode everything that was queued with the time of the last cycle,
+	 * like the data loop does with the buffers on the ready queue */
+	c = &this->worker_cycles[(index + avail - 1) & (WORKER_CYCLES - 1)];
+	this->process_time = c->time;
+	this->process_duration = c->duration;
+	this->process_rate = c->rate;
+	this->worker_end = c->end;
+
+	spa_ringbuffer_read_update(&this->worker_cycle_ring, index + avail);
+
+	return avail;
+}
+
+static void media_on_worker(struct spa_source *source)
+{
+	struct impl *this = source->data;
+	uint64_t count;
+	int res;
+
+	if ((res = spa_system_eventfd_read(this->data_system, this->worker_fd, &count)) < 0) {
+		if (res != -EAGAIN)
+			spa_log_warn(this->log, "error reading eventfd: %s", spa_strerror(res));
+		return;
+	}
+
+	if (read_worker_cycles(this) == 0)
+		return;
+
+	spa_log_trace(this->log, "%p: worker process time:%"PRIu64, this, this->process_time);
+
+	if ((res = flush_data(this, this->process_time)) < 0)
+		SPA_ATOMIC_STORE(this->worker_error, res);
+}
+
+static int queue_worker_data(struct impl *this, uint64_t time, uint64_t duration,
+		uint64_t rate)
+{
+	struct port *port = &this->port;
+	struct worker_cycle *c;
+	uint32_t index, cycle_index;
+	int32_t filled;
+	bool overrun;
+	int res;
+
+	if ((res = SPA_ATOMIC_XCHG(this->worker_error, 0)) < 0)
+		return res;
+
+	filled = spa_ringbuffer_get_write_index(&this->worker_ring, &index);
+	overrun = spa_ringbuffer_get_write_index(&this->worker_cycle_ring,
+			&cycle_index) >= WORKER_CYCLES;
+
+	while (!spa_list_is_empty(&port->ready)) {
+		struct buffer *b;
+		struct spa_data *d;
+		uint32_t offs, n_bytes, l0, l1;
+
+		b = spa_list_first(&port->ready, struct buffer, link);
+		d = b->buf->datas;
+
+		offs = d[0].chunk->offset % d[0].maxsize;
+		n_bytes = SPA_MIN(d[0].chunk->size, d[0].maxsize);
+		n_bytes -= n_bytes % port->frame_size;
+
+		if (overrun || filled + n_bytes > this->worker_size) {
+			spa_log_warn(this->log, "%p: codec worker overrun, drop %u frames",
+					this, n_bytes / port->frame_size);
+		} else {
+			l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
+			l1 = n_bytes - l0;
+
+			spa_ringbuffer_write_data(&this->worker_ring,
+					this->worker_data, this->worker_size,
+					index & (this->worker_size - 1),
+					SPA_PTROFF(d[0].data, offs, void), l0);
+			if (l1 > 0)
+				spa_ringbuffer_write_data(&this->worker_ring,
+						this->worker_data, this->worker_size,
+						(index + l0) & (this->worker_size - 1),
+						d[0].data, l1);
+			index += n_bytes;
+			filled += n_bytes;
+		}
+
+		spa_list_remove(&b->link);
+		SPA_FLAG_SET(b->flags, BUFFER_FLAG_OUT);
+		spa_log_trace(this->log, "%p: reuse buffer %u", this, b->id);
+		this->port.io->buffer_id = b->id;
+
+		spa_node_call_reuse_buffer(&this->callbacks, 0, b->id);
+	}
+	spa_ringbuffer_write_update(&this->worker_ring, index);
+
+	if (!overrun) {
+		c = &this->worker_cycles[cycle_index & (WORKER_CYCLES - 1)];
+		c->time = time;
+		c->duration = duration;
+		c->rate = rate;
+		c->end = index;
+		spa_ringbuffer_write_update(&this->worker_cycle_ring, cycle_index + 1);
 	}
+
+	spa_system_eventfd_write(this->data_system, this->worker_fd, 1);
+
+	return 0;
 }
 
 static void media_on_timeout(struct spa_source *source)
@@ -1127,6 +1332,7 @@ static void media_on_timeout(struct spa_source *source)
 
 		/* Negative delay doesn't work properly, so disallow it */
 		delay_nsec += SPA_CLAMP(this->props.latency_offset, -delay_nsec, INT64_MAX / 2);
+		delay_nsec += this->worker_delay;
 
 		this->clock->delay = (delay_nsec * this->clock->rate.denom) / SPA_NSEC_PER_SEC;
 	}
@@ -1148,9 +1354,78 @@ static int do_start_iso_io(struct spa_loop *loop, bool async, uint32_t seq,
 	return 0;
 }
 
+static int setup_worker(struct impl *this)
+{
+	struct port *port = &this->port;
+	uint32_t size;
+	int res;
+
+	if (this->worker == NULL) {
+		if (this->loader == NULL || this->thread_utils == NULL) {
+			spa_log_warn(this->log, "%p: a plugin loader and thread utils are needed "
+					"for the codec worker", this);
+			return -ENOTSUP;
+		}
+		this->worker = spa_bt_codec_worker_create(this->log, this->loader,
+				this->thread_utils, "bluez5-codec");
+		if (this->worker == NULL)
+			return -errno;
+	}
+
+	/* room for two cycles of the largest quantum */
+	size = 2 * this->quantum_limit * port->frame_size;
+	this->worker_size = 1;
+	while (this->worker_size < size)
+		this->worker_size <<= 1;
+
+	if ((this->worker_data = calloc(1, this->worker_size)) == NULL)
+		return -errno;
+
+	if ((res = spa_system_eventfd_create(this->data_system,
+			SPA_FD_CLOEXEC | SPA_FD_NONBLOCK)) < 0) {
+		free(this->worker_data);
+		this->worker_data = NULL;
+		return res;
+	}
+	this->worker_fd = res;
+	this->worker_error = 0;
+	this->worker_end = 0;
+	spa_ringbuffer_init(&this->worker_ring);
+	spa_ringbuffer_init(&this->worker_cycle_ring);
+
+	this->worker_delay = (uint64_t)this->block_size / port->frame_size
+		* SPA_NSEC_PER_SEC / port->current_format.info.raw.rate;
+	this->codec_loop = this->worker->loop;
+
+	this->worker_source.data = this;
+	this->worker_source.fd = this->worker_fd;
+	this->worker_source.func = media_on_worker;
+	this->worker_source.mask = SPA_IO_IN;
+	this->worker_source.rmask = 0;
+	spa_loop_add_source(this->codec_loop, &this->worker_source);
+
+	spa_log_info(this->log, "%p: using codec worker, delay:%"PRIu64" us", this,
+			(uint64_t)(this->worker_delay / SPA_NSEC_PER_USEC));
+
+	return 0;
+}
+
+static void clear_worker(struct impl *this)
+{
+	if (this->worker_data == NULL)
+		return;
+
+	spa_system_close(this->data_system, this->worker_fd);
+	this->worker_fd = -1;
+	free(this->worker_data);
+	this->worker_data = NULL;
+	this->worker_delay = 0;
+	this->codec_loop = this->data_loop;
+}
+
 static int transport_start(struct impl *this)
 {
-	int val, size;
+	int val, size, res;
 	struct port *port;
 	socklen_t len;
 	uint8_t *conf;
@@ -1231,13 +1506,23 @@ static int transport_start(struct impl *this)
 
 	spa_bt_rate_control_init(&port->ratectl, 0);
 
+	/* ISO streams are paced by the ISO group, only A2DP can encode on the
+	 * worker */
+	if (this->use_worker && !this->transport->iso_io) {
+		if ((res = setup_worker(this)) < 0)
+			spa_log_warn(this->log, "%p: can't use codec worker: %s",
+					this, spa_strerror(res));
+		else
+			set_latency(this, true);
+	}
+
 	if (!this->transport->iso_io) {
 		this->flush_timer_source.data = this;
 		this->flush_timer_source.fd = this->flush_timerfd;
 		this->flush_timer_source.func = media_on_flush_timeout;
 		this->flush_timer_source.mask = SPA_IO_IN;
 		this->flush_timer_source.rmask = 0;
-		spa_loop_add_source(this->data_loop, &this->flush_timer_source);
+		spa_loop_add_source(this->codec_loop, &this->flush_timer_source);
 	}
 
 	this->flush_source.data = this;
@@ -1245,7 +1530,7 @@ static int transport_start(struct impl *this)
 	this->flush_source.func = media_on_flush_error;
 	this->flush_source.mask = SPA_IO_ERR | SPA_IO_HUP;
 	this->flush_source.rmask = 0;
-	spa_loop_add_source(this->data_loop, &this->flush_source);
+	spa_loop_add_source(this->codec_loop, &this->flush_source);
 
 	this->resync = RESYNC_CYCLES;
 	this->flush_pending = false;
@@ -1310,7 +1595,7 @@ static int do_remove_source(struct spa_loop *loop,
 	return 0;
 }
 
-static int do_remove_transport_source(struct spa_loop *loop,
+static int do_remove_codec_source(struct spa_loop *loop,
 			    bool async,
 			    uint32_t seq,
 			    const void *data,
@@ -1319,15 +1604,33 @@ static int do_remove_transport_source(struct spa_loop *loop,
 {
 	struct impl *this = user_data;
 
-	this->transport_started = false;
-
 	if (this->flush_source.loop)
-		spa_loop_remove_source(this->data_loop, &this->flush_source);
+		spa_loop_remove_source(this->codec_loop, &this->flush_source);
 
 	if (this->flush_timer_source.loop)
-		spa_loop_remove_source(this->data_loop, &this->flush_timer_source);
+		spa_loop_remove_source(this->codec_loop, &this->flush_timer_source);
 	enable_flush_timer(this, false);
 
+	if (this->worker_source.loop)
+		spa_loop_remove_source(this->codec_loop, &this->worker_source);
+
+	return 0;
+}
+
+static int do_remove_transport_source(struct spa_loop *loop,
+			    bool async,
+			    uint32_t seq,
+			    const void *data,
+			    size_t size,
+			    void *user_data)
+{
+	struct impl *this = user_data;
+
+	this->transport_started = false;
+
+	if (this->codec_loop == this->data_loop)
+		do_remove_codec_source(loop, async, seq, data, size, user_data);
+
 	if (this->transport->iso_io)
 		spa_bt_iso_io_set_cb(this->transport->iso_io, NULL, NULL);
 
@@ -1341,8 +1644,17 @@ static void transport_stop(struct impl *this)
 
 	spa_log_trace(this->log, "%p: stop transport", this);
 
+	/* stop the worker first, the data loop keeps queueing until the
+	 * transport is stopped there */
+	if (this->codec_loop != this->data_loop)
+		spa_loop_invoke(this->codec_loop, do_remove_codec_source, 0, NULL, 0, true, this);
 	spa_loop_invoke(this->data_loop, do_remove_transport_source, 0, NULL, 0, true, this);
 
+	if (this->worker_data != NULL) {
+		clear_worker(this);
+		set_latency(this, true);
+	}
+
 	if (this->codec_data && this->own_codec_data)
 		this->codec->deinit(this->codec_data);
 	this->codec_data = NULL;
@@ -1820,6 +2132,7 @@ static int impl_node_process(void *object)
 	struct impl *this = object;
 	struct port *port;
 	struct spa_io_buffers *io;
+	uint64_t duration, rate;
 	int res;
 
 	spa_return_val_if_fail(this != NULL, -EINVAL);
@@ -1868,21 +2181,31 @@ static int impl_node_process(void *object)
 	}
 
 	if (this->position) {
-		this->process_duration = this->position->clock.duration;
-		this->process_rate = this->position->clock.rate.denom;
+		duration = this->position->clock.duration;
+		rate = this->position->clock.rate.denom;
 	} else {
-		this->process_duration = 1024;
-		this->process_rate = 48000;
+		duration = 1024;
+		rate = 48000;
 	}
 
-	this->process_time = this->current_time;
 	if (this->resync)
 		--this->resync;
 
 	setup_matching(this);
 
-	spa_log_trace(this->log, "%p: on process time:%"PRIu64, this, this->process_time);
-	if ((res = flush_data(this, this->current_time)) < 0) {
+	spa_log_trace(this->log, "%p: on process time:%"PRIu64, this, this->current_time);
+
+	if (this->worker_data != NULL) {
+		/* the worker owns the encoder state, including the process time */
+		res = queue_worker_data(this, this->current_time, duration, rate);
+	} else {
+		this->process_duration = duration;
+		this->process_rate = rate;
+		this->process_time = this->current_time;
+
+		res = flush_data(this, this->current_time);
+	}
+	if (res < 0) {
 		io->status = res;
 		return SPA_STATUS_STOPPED;
 	}
@@ -1932,6 +2255,8 @@ static void transport_destroy(void *data)
 {
 	struct impl *this = data;
 	spa_log_debug(this->log, "transport %p destroy", this->transport);
+	if (this->codec_loop != this->data_loop)
+		spa_loop_invoke(this->codec_loop, do_transport_destroy, 0, NULL, 0, true, this);
 	spa_loop_invoke(this->data_loop, do_transport_destroy, 0, NULL, 0, true, this);
 }
 
@@ -2012,6 +2337,8 @@ static int impl_clear(struct spa_handle *handle)
 		spa_hook_remove(&this->transport_listener);
 	spa_system_close(this->data_system, this->timerfd);
 	spa_system_close(this->data_system, this->flush_timerfd);
+	if (this->worker)
+		spa_bt_codec_worker_destroy(this->worker);
 	return 0;
 }
 
@@ -2044,6 +2371,8 @@ impl_init(const struct spa_handle_factory *factory,
 	this->log = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_Log);
 	this->data_loop = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_DataLoop);
 	this->data_system = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_DataSystem);
+	this->loader = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_PluginLoader);
+	this->thread_utils = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_ThreadUtils);
 
 	spa_log_topic_init(this->log, &log_topic);
 
@@ -2119,6 +2448,12 @@ impl_init(const struct spa_handle_factory *factory,
 
 	this->codec = this->transport->media_codec;
 
+	if (this->transport->device->settings &&
+	    (str = spa_dict_lookup(this->transport->device->settings, "bluez5.codec-worker")) != NULL)
+		this->use_worker = spa_atob(str);
+	if (info && (str = spa_dict_lookup(info, "bluez5.codec-worker")) != NULL)
+		this->use_worker = spa_atob(str);
+
 	if (this->is_duplex) {
 		if (!this->codec->duplex_codec) {
 			spa_log_error(this->log, "transport codec doesn't support duplex");
@@ -2150,6 +2485,9 @@ impl_init(const struct spa_handle_factory *factory,
 	this->flush_timerfd = spa_system_timerfd_create(this->data_system,
 			CLOCK_MONOTONIC, SPA_FD_CLOEXEC | SPA_FD_NONBLOCK);
 
+	this->codec_loop = this->data_loop;
+	this->worker_fd = -1;
+
 	return 0;
 }
 
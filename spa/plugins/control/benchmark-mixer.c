@@ -0,0 +1,276 @@
+/* Spa */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <spa/support/plugin.h>
+#include <spa/utils/result.h>
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/buffer/buffer.h>
+#include <spa/param/format.h>
+#include <spa/pod/builder.h>
+#include <spa/control/control.h>
+
+extern const struct spa_handle_factory spa_control_mixer_factory;
+
+#define MAX_INPUTS	128
+#define MAX_EVENTS	8192
+#define N_SAMPLES	1024
+#define BUFFER_SIZE	(MAX_EVENTS * 32 + 1024)
+
+#define MAX_COUNT	1000
+
+struct input {
+	struct spa_io_buffers io;
+	struct spa_buffer buffer;
+	struct spa_buffer *buffers[1];
+	struct spa_data data;
+	struct spa_chunk chunk;
+	uint8_t mem[BUFFER_SIZE];
+};
+
+static struct input inputs[MAX_INPUTS];
+
+static struct spa_io_buffers out_io;
+static struct spa_buffer out_buffer;
+static struct spa_buffer *out_buffers[1] = { &out_buffer };
+static struct spa_data out_data;
+static struct spa_chunk out_chunk;
+static uint8_t out_mem[BUFFER_SIZE];
+
+static const uint32_t input_counts[] = { 1, 2, 8, 32, 128 };
+static const uint32_t event_counts[] = { 1024, 8192 };
+
+struct stats {
+	uint32_t n_inputs;
+	uint32_t n_events;
+	uint64_t perf;
+};
+
+#define MAX_RESULTS	(SPA_N_ELEMENTS(input_counts) * SPA_N_ELEMENTS(event_counts))
+
+static uint32_t n_results = 0;
+static struct stats results[MAX_RESULTS];
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static int compare_offset(const void *a, const void *b)
+{
+	return (int)*(const uint32_t*)a - (int)*(const uint32_t*)b;
+}
+
+/* MPE traffic: every input is a member channel that sends a note and then
+ * a dense stream of pitch bend, pressure and timbre (CC 74) changes */
+static void fill_input(struct input *in, uint32_t index, uint32_t n_events)
+{
+	struct spa_pod_builder b;
+	struct spa_pod_frame f;
+	uint32_t offsets[MAX_EVENTS], i;
+	uint8_t channel = (index % 15) + 1;
+
+	for (i = 0; i < n_events; i++)
+		offsets[i] = drand48() * N_SAMPLES;
+	qsort(offsets, n_events, sizeof(uint32_t), compare_offset);
+
+	spa_pod_builder_init(&b, in->mem, sizeof(in->mem));
+	spa_pod_builder_push_sequence(&b, &f, 0);
+	for (i = 0; i < n_events; i++) {
+		uint8_t ev[3];
+		uint32_t size = 3, v = drand48() * 0x3fff;
+
+		switch (i % 4) {
+		case 0:
+			ev[0] = 0x90 | channel;
+			ev[1] = 60 + (index % 24);
+			ev[2] = v >> 7;
+			break;
+		case 1:
+			ev[0] = 0xe0 | channel;
+			ev[1] = v & 0x7f;
+			ev[2] = v >> 7;
+			break;
+		case 2:
+			ev[0] = 0xd0 | channel;
+			ev[1] = v >> 7;
+			size = 2;
+			break;
+		default:
+			ev[0] = 0xb0 | channel;
+			ev[1] = 74;
+			ev[2] = v >> 7;
+			break;
+		}
+		spa_pod_builder_control(&b, offsets[i], SPA_CONTROL_Midi);
+		spa_pod_builder_bytes(&b, ev, size);
+	}
+	spa_pod_builder_pop(&b, &f);
+
+	in->chunk.offset = 0;
+	in->chunk.size = b.state.offset;
+	in->chunk.stride = 1;
+}
+
+static void setup_buffer(struct spa_buffer *buf, struct spa_data *d,
+		struct spa_chunk *chunk, void *mem, uint32_t size)
+{
+	*d = (struct spa_data) {
+		.type = SPA_DATA_MemPtr,
+		.maxsize = size,
+		.data = mem,
+		.chunk = chunk,
+	};
+	*buf = (struct spa_buffer) {
+		.n_datas = 1,
+		.datas = d,
+	};
+}
+
+static int set_format(struct spa_node *node, enum spa_direction direction, uint32_t port_id)
+{
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	struct spa_pod *format;
+
+	format = spa_pod_builder_add_object(&b,
+			SPA_TYPE_OBJECT_Format, SPA_PARAM_Format,
+			SPA_FORMAT_mediaType,    SPA_POD_Id(SPA_MEDIA_TYPE_application),
+			SPA_FORMAT_mediaSubtype, SPA_POD_Id(SPA_MEDIA_SUBTYPE_control));
+
+	return spa_node_port_set_param(node, direction, port_id,
+			SPA_PARAM_Format, 0, format);
+}
+
+/* check that no events got lost and that the output is sorted */
+static void check_output(uint32_t n_inputs, uint32_t n_events)
+{
+	struct spa_pod_sequence *seq;
+	struct spa_pod_control *c;
+	uint32_t count = 0, last = 0;
+
+	seq = spa_pod_from_data(out_data.data, out_data.maxsize,
+			out_chunk.offset, out_chunk.size);
+	spa_assert_se(seq != NULL && spa_pod_is_sequence(&seq->pod));
+
+	SPA_POD_SEQUENCE_FOREACH(seq, c) {
+		spa_assert_se(c->offset >= last);
+		last = c->offset;
+		count++;
+	}
+	spa_assert_se(count == n_inputs * n_events);
+}
+
+static void run_test(struct spa_node *node, uint32_t n_inputs, uint32_t n_events)
+{
+	uint64_t t1, t2;
+	uint32_t i, j;
+
+	for (i = 0; i < n_inputs; i++)
+		fill_input(&inputs[i], i, n_events);
+
+	t1 = get_time();
+	for (i = 0; i < MAX_COUNT; i++) {
+		for (j = 0; j < n_inputs; j++) {
+			inputs[j].io.status = SPA_STATUS_HAVE_DATA;
+			inputs[j].io.buffer_id = 0;
+		}
+		out_io.status = SPA_STATUS_NEED_DATA;
+		spa_node_process(node);
+	}
+	t2 = get_time();
+
+	check_output(n_inputs, n_events);
+
+	spa_assert(n_results < MAX_RESULTS);
+	results[n_results++] = (struct stats) {
+		.n_inputs = n_inputs,
+		.n_events = n_events,
+		.perf = MAX_COUNT * (uint64_t)SPA_NSEC_PER_SEC / (t2 - t1),
+	};
+}
+
+static int compare_func(const void *_a, const void *_b)
+{
+	const struct stats *a = _a, *b = _b;
+	int diff;
+	if ((diff = a->n_inputs * a->n_events - b->n_inputs * b->n_events) != 0) return diff;
+	if ((diff = a->n_inputs - b->n_inputs) != 0) return diff;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct spa_handle_factory *factory = &spa_control_mixer_factory;
+	struct spa_handle *handle;
+	struct spa_node *node;
+	uint32_t i, j, n_ports = 0;
+	void *iface;
+	int res;
+
+	handle = calloc(1, spa_handle_factory_get_size(factory, NULL));
+	spa_assert_se(handle != NULL);
+	if ((res = spa_handle_factory_init(factory, handle, NULL, NULL, 0)) < 0) {
+		fprintf(stderr, "can't make mixer: %s\n", spa_strerror(res));
+		return -1;
+	}
+	spa_assert_se(spa_handle_get_interface(handle, SPA_TYPE_INTERFACE_Node, &iface) >= 0);
+	node = iface;
+
+	setup_buffer(&out_buffer, &out_data, &out_chunk, out_mem, sizeof(out_mem));
+	out_io = SPA_IO_BUFFERS_INIT;
+	spa_assert_se(set_format(node, SPA_DIRECTION_OUTPUT, 0) >= 0);
+	spa_assert_se(spa_node_port_use_buffers(node, SPA_DIRECTION_OUTPUT, 0, 0,
+				out_buffers, 1) >= 0);
+	spa_assert_se(spa_node_port_set_io(node, SPA_DIRECTION_OUTPUT, 0,
+				SPA_IO_Buffers, &out_io, sizeof(out_io)) >= 0);
+
+	for (i = 0; i < SPA_N_ELEMENTS(input_counts); i++) {
+		uint32_t n_inputs = input_counts[i];
+
+		/* add the extra inputs for this run, they stay linked after */
+		for (; n_ports < n_inputs; n_ports++) {
+			struct input *in = &inputs[n_ports];
+
+			setup_buffer(&in->buffer, &in->data, &in->chunk, in->mem, sizeof(in->mem));
+			in->buffers[0] = &in->buffer;
+			in->io = SPA_IO_BUFFERS_INIT;
+
+			spa_assert_se(spa_node_add_port(node, SPA_DIRECTION_INPUT,
+						n_ports, NULL) >= 0);
+			spa_assert_se(set_format(node, SPA_DIRECTION_INPUT, n_ports) >= 0);
+			spa_assert_se(spa_node_port_use_buffers(node, SPA_DIRECTION_INPUT,
+						n_ports, 0, in->buffers, 1) >= 0);
+			spa_assert_se(spa_node_port_set_io(node, SPA_DIRECTION_INPUT,
+						n_ports, SPA_IO_Buffers, &in->io, sizeof(in->io)) >= 0);
+		}
+		for (j = 0; j < SPA_N_ELEMENTS(event_counts); j++)
+			run_test(node, n_inputs, event_counts[j] / n_inputs);
+	}
+
+	qsort(results, n_results, sizeof(struct stats), compare_func);
+
+	for (i = 0; i < n_results; i++) {
+		struct stats *s = &results[i];
+		fprintf(stderr, "%-12."PRIu64" \tinputs %d, events/input %d, events %d\n",
+				s->perf, s->n_inputs, s->n_events,
+				s->n_inputs * s->n_events);
+	}
+
+	spa_handle_clear(handle);
+	free(handle);
+
+	return 0;
+}
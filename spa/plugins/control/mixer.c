@@ -53,6 +53,13 @@ struct port {
 	struct spa_list queue;
 };
 
+/* read position in an input sequence */
+struct cursor {
+	struct spa_pod_sequence *seq;
+	struct spa_pod_control *ctrl;
+	uint32_t index;
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_node node;
@@ -70,8 +77,8 @@ struct impl {
 	struct port *in_ports[MAX_PORTS];
 	struct port out_ports[1];
 
-	struct spa_pod_control *mix_ctrl[MAX_PORTS];
-	struct spa_pod_sequence *mix_seq[MAX_PORTS];
+	struct cursor cursors[MAX_PORTS];
+	struct cursor *heap[MAX_PORTS];
 
 	int n_formats;
 
@@ -590,14 +597,45 @@ static inline int event_sort(struct spa_pod_control *a, struct spa_pod_control *
 	}
 }
 
+static inline bool cursor_valid(struct cursor *c)
+{
+	return spa_pod_control_is_inside(&c->seq->body,
+			SPA_POD_BODY_SIZE(c->seq), c->ctrl);
+}
+
+/* equal events are taken from the input with the highest index first */
+static inline bool cursor_before(struct cursor *a, struct cursor *b)
+{
+	int res = event_sort(a->ctrl, b->ctrl);
+	return res < 0 || (res == 0 && a->index > b->index);
+}
+
+static inline void heap_sift_down(struct cursor **heap, uint32_t n_heap, uint32_t i)
+{
+	struct cursor *c = heap[i];
+
+	while (true) {
+		uint32_t child = 2 * i + 1;
+
+		if (child >= n_heap)
+			break;
+		if (child + 1 < n_heap && cursor_before(heap[child + 1], heap[child]))
+			child++;
+		if (!cursor_before(heap[child], c))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = c;
+}
+
 static int impl_node_process(void *object)
 {
 	struct impl *this = object;
 	struct port *outport;
 	struct spa_io_buffers *outio;
-	uint32_t n_seq, i;
-        struct spa_pod_sequence **seq;
-        struct spa_pod_control **ctrl;
+	uint32_t n_seq, n_heap, i;
+	struct cursor *cursors, **heap;
 	struct spa_pod_builder builder;
 	struct spa_pod_frame f;
         struct buffer *outb;
@@ -629,9 +667,9 @@ static int impl_node_process(void *object)
                 return -EPIPE;
         }
 
-	ctrl = this->mix_ctrl;
-	seq = this->mix_seq;
-	n_seq = 0;
+	cursors = this->cursors;
+	heap = this->heap;
+	n_seq = n_heap = 0;
 
 	/* collect all sequence pod on input ports */
 	for (i = 0; i < this->last_port; i++) {
@@ -669,8 +707,11 @@ static int impl_node_process(void *object)
 			continue;
 		}
 
-		seq[n_seq] = pod;
-		ctrl[n_seq] = spa_pod_control_first(&seq[n_seq]->body);
+		cursors[n_seq].seq = pod;
+		cursors[n_seq].ctrl = spa_pod_control_first(&cursors[n_seq].seq->body);
+		cursors[n_seq].index = n_seq;
+		if (cursor_valid(&cursors[n_seq]))
+			heap[n_heap++] = &cursors[n_seq];
 		inio->status = SPA_STATUS_NEED_DATA;
 		n_seq++;
 	}
@@ -681,28 +722,30 @@ static int impl_node_process(void *object)
 	spa_pod_builder_init(&builder, d->data, d->maxsize);
 	spa_pod_builder_push_sequence(&builder, &f, 0);
 
-	/* merge sort all sequences into output buffer */
-	while (true) {
-		struct spa_pod_control *next = NULL;
-		uint32_t next_index = 0;
-
-		for (i = 0; i < n_seq; i++) {
-			if (!spa_pod_control_is_inside(&seq[i]->body,
-					SPA_POD_BODY_SIZE(seq[i]), ctrl[i]))
-				continue;
-
-			if (next == NULL || event_sort(ctrl[i], next) <= 0) {
-				next = ctrl[i];
-				next_index = i;
-			}
+	if (n_heap == 1) {
+		/* only one input has events, copy them */
+		struct cursor *c = heap[0];
+		spa_pod_builder_raw_padded(&builder, c->ctrl,
+				SPA_PTRDIFF(SPA_PTROFF(&c->seq->body, SPA_POD_BODY_SIZE(c->seq), void),
+					c->ctrl));
+	} else if (n_heap > 1) {
+		/* k-way merge of all sequences into output buffer */
+		for (i = n_heap / 2; i > 0; i--)
+			heap_sift_down(heap, n_heap, i - 1);
+
+		while (n_heap > 0) {
+			struct cursor *c = heap[0];
+			struct spa_pod_control *next = c->ctrl;
+
+			spa_pod_builder_control(&builder, next->offset, next->type);
+			spa_pod_builder_primitive(&builder, &next->value);
+
+			c->ctrl = spa_pod_control_next(next);
+			if (!cursor_valid(c))
+				heap[0] = heap[--n_heap];
+			if (n_heap > 0)
+				heap_sift_down(heap, n_heap, 0);
 		}
-		if (next == NULL)
-			break;
-
-		spa_pod_builder_control(&builder, next->offset, next->type);
-		spa_pod_builder_primitive(&builder, &next->value);
-
-		ctrl[next_index] = spa_pod_control_next(ctrl[next_index]);
 	}
 	spa_pod_builder_pop(&builder, &f);
 
@@ -14,6 +14,7 @@
 #include <spa/support/system.h>
 #include <spa/support/log.h>
 #include <spa/support/plugin.h>
+#include <spa/utils/atomic.h>
 #include <spa/utils/list.h>
 #include <spa/utils/names.h>
 #include <spa/utils/result.h>
@@ -29,6 +30,10 @@ static struct spa_log_topic log_topic = SPA_LOG_TOPIC(0, "spa.loop");
 #define ITEM_ALIGN	8
 #define DATAS_SIZE	(4096*8)
 #define MAX_EP		32
+#define MAX_QUEUES	128
+#define MAX_THREAD_QUEUES	16
+
+#define POLL_BUDGET_PERIOD	SPA_NSEC_PER_SEC
 
 /** \cond */
 
@@ -36,15 +41,36 @@ struct invoke_item {
 	size_t item_size;
 	spa_invoke_func_t func;
 	uint32_t seq;
+	uint32_t count;
 	void *data;
 	size_t size;
 	bool block;
 	void *user_data;
 	int res;
+	/* where to ack a blocking item of the shared queue */
+	struct invoke_ack *ack;
+};
+
+struct invoke_ack {
+	int fd;
+	int res;
 };
 
 static int loop_signal_event(void *object, struct spa_source *source);
 
+/* Every thread that invokes into the loop gets its own single producer
+ * queue, the loop thread consumes from all of them. */
+struct queue {
+	struct impl *impl;
+	uint32_t idx;
+	int ack_fd;
+	int in_use;
+
+	struct spa_ringbuffer buffer;
+	uint8_t *buffer_data;
+	uint8_t buffer_mem[DATAS_SIZE + MAX_ALIGN];
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_loop loop;
@@ -63,14 +89,37 @@ struct impl {
 	int enter_count;
 
 	struct spa_source *wakeup;
-	int ack_fd;
+	int wakeup_pending;
 
-	struct spa_ringbuffer buffer;
-	uint8_t *buffer_data;
-	uint8_t buffer_mem[DATAS_SIZE + MAX_ALIGN];
+	/* unique id of the loop and link in the list of loops */
+	uint64_t id;
+	struct spa_list link;
+
+	pthread_mutex_t queue_lock;
+	uint32_t n_queues;
+	struct queue *queues[MAX_QUEUES];
+	/* used when a thread can't get its own queue, written with the
+	 * queue_lock */
+	struct queue *shared_queue;
+	uint32_t count;
 
 	uint32_t flush_count;
 	unsigned int polling:1;
+
+	/* the timerfd of the shared timers, created on first use */
+	struct spa_source *timer;
+	/* the shared timers can be updated from any thread, like the
+	 * timerfds, the timer_lock protects the list and timer_next */
+	pthread_mutex_t timer_lock;
+	/* armed shared timers, sorted by deadline */
+	struct spa_list timer_list;
+	uint64_t timer_next;
+
+	/* busy polling before sleeping, disabled when poll_time is 0 */
+	uint64_t poll_time;
+	uint32_t poll_budget;
+	uint64_t poll_period_start;
+	uint64_t poll_period_used;
 };
 
 struct source_impl {
@@ -89,11 +138,22 @@ struct source_impl {
 
 	struct spa_source *fallback;
 
+	/* shared timers */
+	struct spa_list timer_link;
+	uint64_t deadline;
+	uint64_t interval;
+	uint64_t slack;
+
 	bool close;
 	bool enabled;
+	bool armed;
 };
 /** \endcond */
 
+static void source_shared_timer_func(struct spa_source *source);
+static int shared_timer_update(struct source_impl *s,
+		struct timespec *value, struct timespec *interval, bool absolute);
+
 static int loop_add_source(void *object, struct spa_source *source)
 {
 	struct impl *impl = object;
@@ -144,46 +204,225 @@ static int loop_remove_source(void *object, struct spa_source *source)
 	return res;
 }
 
+static struct queue *queue_new(struct impl *impl)
+{
+	struct queue *queue;
+	int res;
+
+	if ((queue = calloc(1, sizeof(struct queue))) == NULL)
+		return NULL;
+
+	if ((res = spa_system_eventfd_create(impl->system,
+			SPA_FD_EVENT_SEMAPHORE | SPA_FD_CLOEXEC)) < 0) {
+		spa_log_error(impl->log, "%p: can't create ack event: %s",
+				impl, spa_strerror(res));
+		free(queue);
+		errno = -res;
+		return NULL;
+	}
+	queue->impl = impl;
+	queue->ack_fd = res;
+	queue->buffer_data = SPA_PTR_ALIGN(queue->buffer_mem, MAX_ALIGN, uint8_t);
+	spa_ringbuffer_init(&queue->buffer);
+	return queue;
+}
+
+static void queue_free(struct queue *queue)
+{
+	struct impl *impl = queue->impl;
+
+	spa_system_close(impl->system, queue->ack_fd);
+	free(queue);
+}
+
+/* The queues a thread took from the loops it invoked into. All loops share
+ * one key so that many loops don't use up the keys of the process. */
+struct thread_queues {
+	uint32_t n_queues;
+	struct {
+		uint64_t loop_id;
+		struct queue *queue;
+	} queues[MAX_THREAD_QUEUES];
+};
+
+static pthread_once_t queue_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t queue_key;
+static int queue_key_res;
+
+/* the live loops, a thread that exits only releases the queues of these */
+static pthread_mutex_t loops_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct spa_list loops = { &loops, &loops };
+static uint64_t loops_id;
+
+/* must be called with the loops_lock */
+static bool loop_alive(uint64_t id)
+{
+	struct impl *l;
+	spa_list_for_each(l, &loops, link)
+		if (l->id == id)
+			return true;
+	return false;
+}
+
+/* called when the thread that owns the queues exits, the queues and the
+ * items in them stay around and other threads can take them over */
+static void thread_queues_free(void *data)
+{
+	struct thread_queues *tq = data;
+	uint32_t i;
+
+	pthread_mutex_lock(&loops_lock);
+	for (i = 0; i < tq->n_queues; i++) {
+		if (loop_alive(tq->queues[i].loop_id))
+			SPA_ATOMIC_STORE(tq->queues[i].queue->in_use, 0);
+	}
+	pthread_mutex_unlock(&loops_lock);
+	free(tq);
+}
+
+/* forget the queues of loops that were destroyed */
+static void thread_queues_prune(struct thread_queues *tq)
+{
+	uint32_t i, n = 0;
+
+	pthread_mutex_lock(&loops_lock);
+	for (i = 0; i < tq->n_queues; i++) {
+		if (loop_alive(tq->queues[i].loop_id))
+			tq->queues[n++] = tq->queues[i];
+	}
+	pthread_mutex_unlock(&loops_lock);
+	tq->n_queues = n;
+}
+
+static void queue_key_create(void)
+{
+	queue_key_res = pthread_key_create(&queue_key, thread_queues_free);
+}
+
+/* get the queue of the calling thread, with a new thread this takes over
+ * the queue of a thread that exited or makes a new queue */
+static struct queue *get_queue(struct impl *impl)
+{
+	struct thread_queues *tq;
+	struct queue *queue = NULL;
+	uint32_t i, n_queues;
+
+	if (pthread_once(&queue_key_once, queue_key_create) != 0 ||
+	    queue_key_res != 0)
+		return NULL;
+
+	if ((tq = pthread_getspecific(queue_key)) != NULL) {
+		for (i = 0; i < tq->n_queues; i++) {
+			if (tq->queues[i].loop_id == impl->id)
+				return tq->queues[i].queue;
+		}
+		if (tq->n_queues == MAX_THREAD_QUEUES)
+			thread_queues_prune(tq);
+		if (tq->n_queues == MAX_THREAD_QUEUES)
+			return NULL;
+	} else {
+		if ((tq = calloc(1, sizeof(*tq))) == NULL)
+			return NULL;
+		if (pthread_setspecific(queue_key, tq) != 0) {
+			free(tq);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_lock(&impl->queue_lock);
+	n_queues = impl->n_queues;
+	for (i = 0; i < n_queues; i++) {
+		if (SPA_ATOMIC_CAS(impl->queues[i]->in_use, 0, 1)) {
+			queue = impl->queues[i];
+			break;
+		}
+	}
+	if (queue == NULL && n_queues < MAX_QUEUES &&
+	    (queue = queue_new(impl)) != NULL) {
+		queue->idx = n_queues;
+		queue->in_use = 1;
+		impl->queues[n_queues] = queue;
+		/* publish the queue after it is set up */
+		SPA_ATOMIC_STORE(impl->n_queues, n_queues + 1);
+	}
+	pthread_mutex_unlock(&impl->queue_lock);
+
+	if (queue != NULL) {
+		tq->queues[tq->n_queues].loop_id = impl->id;
+		tq->queues[tq->n_queues].queue = queue;
+		tq->n_queues++;
+	}
+	return queue;
+}
+
+static inline struct invoke_item *queue_peek(struct queue *queue, uint32_t *index)
+{
+	if (spa_ringbuffer_get_read_index(&queue->buffer, index) <= 0)
+		return NULL;
+	return SPA_PTROFF(queue->buffer_data, *index & (DATAS_SIZE - 1), struct invoke_item);
+}
+
 static void flush_items(struct impl *impl)
 {
-	uint32_t index, flush_count;
-	int32_t avail;
+	uint32_t i, n_queues, flush_count;
 	int res;
 
 	flush_count = ++impl->flush_count;
-	avail = spa_ringbuffer_get_read_index(&impl->buffer, &index);
-	while (avail > 0) {
-		struct invoke_item *item;
+	while (true) {
+		struct queue *cqueue = NULL;
+		struct invoke_item *item, *citem = NULL;
+		uint32_t index, cindex = 0;
 		bool block;
 		spa_invoke_func_t func;
+		struct invoke_ack *ack;
+
+		/* take the oldest item of all queues so that the items are
+		 * handled in the order they were invoked */
+		n_queues = SPA_ATOMIC_LOAD(impl->n_queues);
+		for (i = 0; i < n_queues; i++) {
+			struct queue *queue = impl->queues[i];
+
+			if ((item = queue_peek(queue, &index)) == NULL)
+				continue;
+			if (citem == NULL || (int32_t)(item->count - citem->count) < 0) {
+				citem = item;
+				cqueue = queue;
+				cindex = index;
+			}
+		}
+		if (citem == NULL)
+			break;
 
-		item = SPA_PTROFF(impl->buffer_data, index & (DATAS_SIZE - 1), struct invoke_item);
-		block = item->block;
-		func = item->func;
+		block = citem->block;
+		func = citem->func;
+		ack = citem->ack;
 
-		spa_log_trace_fp(impl->log, "%p: flush item %p", impl, item);
+		spa_log_trace_fp(impl->log, "%p: flush item %p", cqueue, citem);
 		/* first we remove the function from the item so that recursive
 		 * calls don't call the callback again. We can't update the
 		 * read index before we call the function because then the item
 		 * might get overwritten. */
-		item->func = NULL;
+		citem->func = NULL;
 		if (func)
-			item->res = func(&impl->loop, true, item->seq, item->data,
-				item->size, item->user_data);
+			citem->res = func(&impl->loop, true, citem->seq, citem->data,
+				citem->size, citem->user_data);
 
 		/* if this function did a recursive invoke, it now flushed the
 		 * ringbuffer and we can exit */
 		if (flush_count != impl->flush_count)
 			break;
 
-		index += item->item_size;
-		avail -= item->item_size;
-		spa_ringbuffer_read_update(&impl->buffer, index);
+		/* the item can be overwritten after the read index is updated */
+		if (ack != NULL)
+			ack->res = citem->res;
+
+		spa_ringbuffer_read_update(&cqueue->buffer, cindex + citem->item_size);
 
 		if (block) {
-			if ((res = spa_system_eventfd_write(impl->system, impl->ack_fd, 1)) < 0)
+			int fd = ack ? ack->fd : cqueue->ack_fd;
+			if ((res = spa_system_eventfd_write(impl->system, fd, 1)) < 0)
 				spa_log_warn(impl->log, "%p: failed to write event fd:%d: %s",
-						impl, impl->ack_fd, spa_strerror(res));
+						cqueue, fd, spa_strerror(res));
 		}
 	}
 }
@@ -204,35 +443,32 @@ loop_invoke_inthread(struct impl *impl,
 	return func ? func(&impl->loop, true, seq, data, size, user_data) : 0;
 }
 
+/* with an ack, a blocking item is not waited for, the caller waits on the
+ * ack fd after it released the queue */
 static int
-loop_invoke(void *object,
+queue_invoke(struct queue *queue,
 	    spa_invoke_func_t func,
 	    uint32_t seq,
 	    const void *data,
 	    size_t size,
 	    bool block,
-	    void *user_data)
+	    void *user_data,
+	    struct invoke_ack *ack)
 {
-	struct impl *impl = object;
+	struct impl *impl = queue->impl;
 	struct invoke_item *item;
 	int res;
 	int32_t filled;
 	uint32_t avail, idx, offset, l0;
 
-	/* the ringbuffer can only be written to from one thread, if we are
-	 * in the same thread as the loop, don't write into the ringbuffer
-	 * but try to emit the calback right away after flushing what we have */
-	if (impl->thread == 0 || pthread_equal(impl->thread, pthread_self()))
-		return loop_invoke_inthread(impl, func, seq, data, size, block, user_data);
-
-	filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
+	filled = spa_ringbuffer_get_write_index(&queue->buffer, &idx);
 	if (filled < 0 || filled > DATAS_SIZE) {
-		spa_log_warn(impl->log, "%p: queue xrun %d", impl, filled);
+		spa_log_warn(impl->log, "%p: queue xrun %d", queue, filled);
 		return -EPIPE;
 	}
 	avail = DATAS_SIZE - filled;
 	if (avail < sizeof(struct invoke_item)) {
-		spa_log_warn(impl->log, "%p: queue full %d", impl, avail);
+		spa_log_warn(impl->log, "%p: queue full %d", queue, avail);
 		return -EPIPE;
 	}
 	offset = idx & (DATAS_SIZE - 1);
@@ -241,16 +477,17 @@ loop_invoke(void *object,
 	 * invoke_item, see below */
 	l0 = DATAS_SIZE - offset;
 
-	item = SPA_PTROFF(impl->buffer_data, offset, struct invoke_item);
+	item = SPA_PTROFF(queue->buffer_data, offset, struct invoke_item);
 	item->func = func;
 	item->seq = seq;
 	item->size = size;
 	item->block = block;
 	item->user_data = user_data;
 	item->res = 0;
+	item->ack = ack;
 	item->item_size = SPA_ROUND_UP_N(sizeof(struct invoke_item) + size, ITEM_ALIGN);
 
-	spa_log_trace_fp(impl->log, "%p: add item %p filled:%d", impl, item, filled);
+	spa_log_trace_fp(impl->log, "%p: add item %p filled:%d", queue, item, filled);
 
 	if (l0 >= item->item_size) {
 		/* item + size fit in current ringbuffer idx */
@@ -263,29 +500,37 @@ loop_invoke(void *object,
 	} else {
 		/* item does not fit, place the invoke_item at idx and start the
 		 * data at the start of the ringbuffer */
-		item->data = impl->buffer_data;
+		item->data = queue->buffer_data;
 		item->item_size = SPA_ROUND_UP_N(l0 + size, ITEM_ALIGN);
 	}
 	if (avail < item->item_size) {
-		spa_log_warn(impl->log, "%p: queue full %d, need %zd", impl, avail,
+		spa_log_warn(impl->log, "%p: queue full %d, need %zd", queue, avail,
 				item->item_size);
 		return -EPIPE;
 	}
 	if (data && size > 0)
 		memcpy(item->data, data, size);
 
-	spa_ringbuffer_write_update(&impl->buffer, idx + item->item_size);
+	item->count = SPA_ATOMIC_INC(impl->count);
 
-	loop_signal_event(impl, impl->wakeup);
+	spa_ringbuffer_write_update(&queue->buffer, idx + item->item_size);
 
-	if (block) {
+	/* only the first item after a flush wakes up the loop, the others are
+	 * handled in the same batch */
+	if (SPA_ATOMIC_CAS(impl->wakeup_pending, 0, 1))
+		loop_signal_event(impl, impl->wakeup);
+
+	if (block && ack != NULL) {
+		res = 0;
+	}
+	else if (block) {
 		uint64_t count = 1;
 
 		spa_loop_control_hook_before(&impl->hooks_list);
 
-		if ((res = spa_system_eventfd_read(impl->system, impl->ack_fd, &count)) < 0)
+		if ((res = spa_system_eventfd_read(impl->system, queue->ack_fd, &count)) < 0)
 			spa_log_warn(impl->log, "%p: failed to read event fd:%d: %s",
-					impl, impl->ack_fd, spa_strerror(res));
+					queue, queue->ack_fd, spa_strerror(res));
 
 		spa_loop_control_hook_after(&impl->hooks_list);
 
@@ -300,9 +545,64 @@ loop_invoke(void *object,
 	return res;
 }
 
+static int
+loop_invoke(void *object,
+	    spa_invoke_func_t func,
+	    uint32_t seq,
+	    const void *data,
+	    size_t size,
+	    bool block,
+	    void *user_data)
+{
+	struct impl *impl = object;
+	struct queue *queue;
+	struct invoke_ack ack = { .fd = -1 };
+	int res;
+
+	/* the ringbuffer can only be written to from one thread, if we are
+	 * in the same thread as the loop, don't write into the ringbuffer
+	 * but try to emit the calback right away after flushing what we have */
+	if (impl->thread == 0 || pthread_equal(impl->thread, pthread_self()))
+		return loop_invoke_inthread(impl, func, seq, data, size, block, user_data);
+
+	if (SPA_LIKELY((queue = get_queue(impl)) != NULL))
+		return queue_invoke(queue, func, seq, data, size, block, user_data, NULL);
+
+	/* no queue for this thread, share one queue between all those threads.
+	 * A blocking item is acked on an eventfd of the caller so that the
+	 * lock can be released before waiting. */
+	if (block) {
+		if ((res = spa_system_eventfd_create(impl->system, SPA_FD_CLOEXEC)) < 0)
+			return res;
+		ack.fd = res;
+	}
+
+	pthread_mutex_lock(&impl->queue_lock);
+	res = queue_invoke(impl->shared_queue, func, seq, data, size, block, user_data,
+			block ? &ack : NULL);
+	pthread_mutex_unlock(&impl->queue_lock);
+
+	if (block) {
+		if (res >= 0) {
+			uint64_t count = 1;
+
+			spa_loop_control_hook_before(&impl->hooks_list);
+			if ((res = spa_system_eventfd_read(impl->system, ack.fd, &count)) < 0)
+				spa_log_warn(impl->log, "%p: failed to read event fd:%d: %s",
+						impl, ack.fd, spa_strerror(res));
+			spa_loop_control_hook_after(&impl->hooks_list);
+			res = ack.res;
+		}
+		spa_system_close(impl->system, ack.fd);
+	}
+	return res;
+}
+
 static void wakeup_func(void *data, uint64_t count)
 {
 	struct impl *impl = data;
+	/* clear before flushing, items added after this will signal again */
+	SPA_ATOMIC_STORE(impl->wakeup_pending, 0);
 	flush_items(impl);
 }
 
@@ -381,6 +681,53 @@ static inline void process_destroy(struct impl *impl)
 	spa_list_init(&impl->destroy_list);
 }
 
+static inline uint64_t get_monotonic(struct impl *impl)
+{
+	struct timespec now;
+	spa_system_clock_gettime(impl->system, CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_NSEC(&now);
+}
+
+/* Poll without blocking for at most poll_time before going to sleep. The
+ * time spent spinning is limited to poll_budget percent of the CPU. */
+static int loop_wait_spin(struct impl *impl, struct spa_poll_event *ep, int n_ep, int timeout)
+{
+	uint64_t start, now, end, budget, spent;
+	int nfds;
+
+	now = start = get_monotonic(impl);
+	if (start - impl->poll_period_start >= POLL_BUDGET_PERIOD) {
+		impl->poll_period_start = start;
+		impl->poll_period_used = 0;
+	}
+	budget = POLL_BUDGET_PERIOD * impl->poll_budget / 100;
+	budget = budget > impl->poll_period_used ? budget - impl->poll_period_used : 0;
+	end = start + SPA_MIN(impl->poll_time, budget);
+
+	while (now < end) {
+		nfds = spa_system_pollfd_wait(impl->system, impl->poll_fd, ep, n_ep, 0);
+		now = get_monotonic(impl);
+		if (nfds != 0) {
+			impl->poll_period_used += now - start;
+			return nfds;
+		}
+	}
+	spent = now - start;
+	impl->poll_period_used += spent;
+
+	if (timeout > 0)
+		timeout = SPA_MAX(timeout - (int)(spent / SPA_NSEC_PER_MSEC), 0);
+
+	return spa_system_pollfd_wait(impl->system, impl->poll_fd, ep, n_ep, timeout);
+}
+
+static inline int loop_wait(struct impl *impl, struct spa_poll_event *ep, int n_ep, int timeout)
+{
+	if (SPA_LIKELY(impl->poll_time == 0 || timeout == 0))
+		return spa_system_pollfd_wait(impl->system, impl->poll_fd, ep, n_ep, timeout);
+	return loop_wait_spin(impl, ep, n_ep, timeout);
+}
+
 struct cancellation_handler_data {
 	struct spa_poll_event *ep;
 	int ep_count;
@@ -408,7 +755,7 @@ static int loop_iterate_cancel(void *object, int timeout)
 	impl->polling = true;
 	spa_loop_control_hook_before(&impl->hooks_list);
 
-	nfds = spa_system_pollfd_wait(impl->system, impl->poll_fd, ep, SPA_N_ELEMENTS(ep), timeout);
+	nfds = loop_wait(impl, ep, SPA_N_ELEMENTS(ep), timeout);
 
 	spa_loop_control_hook_after(&impl->hooks_list);
 	impl->polling = false;
@@ -455,7 +802,7 @@ static int loop_iterate(void *object, int timeout)
 	impl->polling = true;
 	spa_loop_control_hook_before(&impl->hooks_list);
 
-	nfds = spa_system_pollfd_wait(impl->system, impl->poll_fd, ep, SPA_N_ELEMENTS(ep), timeout);
+	nfds = loop_wait(impl, ep, SPA_N_ELEMENTS(ep), timeout);
 
 	spa_loop_control_hook_after(&impl->hooks_list);
 	impl->polling = false;
@@ -766,6 +1113,10 @@ loop_update_timer(void *object, struct spa_source *source,
 	int flags = 0, res;
 
 	spa_assert(s->impl == object);
+
+	if (source->func == source_shared_timer_func)
+		return shared_timer_update(s, value, interval, absolute);
+
 	spa_assert(source->func == source_timer_func);
 
 	spa_zero(its);
@@ -786,6 +1137,169 @@ loop_update_timer(void *object, struct spa_source *source,
 	return 0;
 }
 
+static void timer_insert(struct impl *impl, struct source_impl *s)
+{
+	struct source_impl *t;
+
+	spa_list_for_each(t, &impl->timer_list, timer_link) {
+		if (t->deadline > s->deadline)
+			break;
+	}
+	spa_list_append(&t->timer_link, &s->timer_link);
+	s->armed = true;
+}
+
+static void timer_remove(struct source_impl *s)
+{
+	if (s->armed) {
+		spa_list_remove(&s->timer_link);
+		s->armed = false;
+	}
+}
+
+/* Set the timerfd to the first time one of the timers can't be delayed
+ * anymore. All the timers that have expired by then are handled in one
+ * wakeup. */
+static int timer_rearm(struct impl *impl)
+{
+	struct source_impl *t;
+	uint64_t next = UINT64_MAX;
+	struct timespec value;
+
+	spa_list_for_each(t, &impl->timer_list, timer_link) {
+		if (t->deadline >= next)
+			break;
+		next = SPA_MIN(next, t->slack > UINT64_MAX - t->deadline ?
+				UINT64_MAX : t->deadline + t->slack);
+	}
+	if (next == UINT64_MAX)
+		next = 0;
+	if (next == impl->timer_next)
+		return 0;
+
+	impl->timer_next = next;
+
+	/* a 0 value disarms the timer */
+	value.tv_sec = next / SPA_NSEC_PER_SEC;
+	value.tv_nsec = next % SPA_NSEC_PER_SEC;
+	return loop_update_timer(impl, impl->timer, &value, NULL, true);
+}
+
+/* never called, the shared timers are not in the poll set */
+static void source_shared_timer_func(struct spa_source *source)
+{
+}
+
+static void on_shared_timer(void *data, uint64_t expirations)
+{
+	struct impl *impl = data;
+	struct source_impl *s;
+	struct spa_list expired;
+	spa_source_timer_func_t func;
+	void *func_data;
+	uint64_t now, n;
+
+	pthread_mutex_lock(&impl->timer_lock);
+	impl->timer_next = 0;
+
+	now = get_monotonic(impl);
+
+	/* collect first, the callbacks can update and destroy timers. The
+	 * timers stay armed on the expired list so that an update from
+	 * another thread takes them off it again. */
+	spa_list_init(&expired);
+	spa_list_consume(s, &impl->timer_list, timer_link) {
+		if (s->deadline > now)
+			break;
+		spa_list_remove(&s->timer_link);
+		spa_list_append(&expired, &s->timer_link);
+	}
+	spa_list_consume(s, &expired, timer_link) {
+		spa_list_remove(&s->timer_link);
+		s->armed = false;
+
+		spa_log_trace_fp(impl->log, "%p: shared timer %p late:%"PRIu64,
+				impl, s, now - s->deadline);
+
+		n = 1;
+		if (s->interval > 0) {
+			n += (now - s->deadline) / s->interval;
+			s->deadline += n * s->interval;
+			timer_insert(impl, s);
+		}
+
+		func = s->func.timer;
+		func_data = s->source.data;
+
+		pthread_mutex_unlock(&impl->timer_lock);
+		func(func_data, n);
+		pthread_mutex_lock(&impl->timer_lock);
+	}
+	timer_rearm(impl);
+	pthread_mutex_unlock(&impl->timer_lock);
+}
+
+static struct spa_source *loop_add_shared_timer(void *object, uint64_t slack,
+					 spa_source_timer_func_t func, void *data)
+{
+	struct impl *impl = object;
+	struct source_impl *source;
+
+	if (impl->timer == NULL) {
+		impl->timer = loop_add_timer(impl, on_shared_timer, impl);
+		if (impl->timer == NULL)
+			return NULL;
+	}
+
+	source = calloc(1, sizeof(struct source_impl));
+	if (source == NULL)
+		return NULL;
+
+	source->source.loop = &impl->loop;
+	source->source.func = source_shared_timer_func;
+	source->source.data = data;
+	source->source.fd = -1;
+	source->impl = impl;
+	source->func.timer = func;
+	source->slack = slack;
+
+	spa_list_insert(&impl->source_list, &source->link);
+
+	return &source->source;
+}
+
+static int
+shared_timer_update(struct source_impl *s,
+		struct timespec *value, struct timespec *interval, bool absolute)
+{
+	struct impl *impl = s->impl;
+	uint64_t deadline = 0;
+	int res;
+
+	pthread_mutex_lock(&impl->timer_lock);
+	timer_remove(s);
+
+	/* same semantics as the timerfd */
+	if (SPA_LIKELY(value)) {
+		deadline = SPA_TIMESPEC_TO_NSEC(value);
+	} else if (interval) {
+		deadline = SPA_TIMESPEC_TO_NSEC(interval);
+		absolute = true;
+	}
+	s->interval = interval ? SPA_TIMESPEC_TO_NSEC(interval) : 0;
+
+	if (deadline > 0) {
+		if (!absolute)
+			deadline += get_monotonic(impl);
+		s->deadline = deadline;
+		timer_insert(impl, s);
+	}
+	res = timer_rearm(impl);
+	pthread_mutex_unlock(&impl->timer_lock);
+
+	return res;
+}
+
 static void source_signal_func(struct spa_source *source)
 {
 	struct source_impl *s = SPA_CONTAINER_OF(source, struct source_impl, source);
@@ -852,9 +1366,16 @@ static void loop_destroy_source(void *object, struct spa_source *source)
 
 	if (s->fallback)
 		loop_destroy_source(s->impl, s->fallback);
-	else
+	else if (source->func == source_shared_timer_func) {
+		pthread_mutex_lock(&s->impl->timer_lock);
+		timer_remove(s);
+		pthread_mutex_unlock(&s->impl->timer_lock);
+	} else
 		remove_from_poll(s->impl, source);
 
+	if (source == s->impl->timer)
+		s->impl->timer = NULL;
+
 	if (source->fd != -1 && s->close) {
 		spa_system_close(s->impl->system, source->fd);
 		source->fd = -1;
@@ -906,6 +1427,7 @@ static const struct spa_loop_utils_methods impl_loop_utils = {
 	.update_timer = loop_update_timer,
 	.add_signal = loop_add_signal,
 	.destroy_source = loop_destroy_source,
+	.add_shared_timer = loop_add_shared_timer,
 };
 
 static int impl_get_interface(struct spa_handle *handle, const char *type, void **interface)
@@ -933,6 +1455,7 @@ static int impl_clear(struct spa_handle *handle)
 {
 	struct impl *impl;
 	struct source_impl *source;
+	uint32_t i;
 
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
 
@@ -945,7 +1468,16 @@ static int impl_clear(struct spa_handle *handle)
 	spa_list_consume(source, &impl->source_list, link)
 		loop_destroy_source(impl, &source->source);
 
-	spa_system_close(impl->system, impl->ack_fd);
+	/* threads that exit from now on don't touch our queues */
+	pthread_mutex_lock(&loops_lock);
+	spa_list_remove(&impl->link);
+	pthread_mutex_unlock(&loops_lock);
+
+	for (i = 0; i < impl->n_queues; i++)
+		queue_free(impl->queues[i]);
+	pthread_mutex_destroy(&impl->queue_lock);
+	pthread_mutex_destroy(&impl->timer_lock);
+
 	spa_system_close(impl->system, impl->poll_fd);
 
 	return 0;
@@ -988,11 +1520,17 @@ impl_init(const struct spa_handle_factory *factory,
 			SPA_TYPE_INTERFACE_LoopUtils,
 			SPA_VERSION_LOOP_UTILS,
 			&impl_loop_utils, impl);
+	impl->poll_budget = 50;
 
 	if (info) {
 		if ((str = spa_dict_lookup(info, "loop.cancel")) != NULL &&
 		    spa_atob(str))
 			impl->control.iface.cb.funcs = &impl_loop_control_cancel;
+		if ((str = spa_dict_lookup(info, "loop.poll-time")) != NULL &&
+		    spa_atou64(str, &impl->poll_time, 0))
+			impl->poll_time *= SPA_NSEC_PER_USEC;
+		if ((str = spa_dict_lookup(info, "loop.poll-budget")) != NULL)
+			spa_atou32(str, &impl->poll_budget, 0);
 	}
 
 	impl->log = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_Log);
@@ -1012,26 +1550,40 @@ impl_init(const struct spa_handle_factory *factory,
 	}
 	impl->poll_fd = res;
 
+	impl->poll_budget = SPA_MIN(impl->poll_budget, 100u);
+	if (impl->poll_time > 0)
+		spa_log_info(impl->log, "%p: polling %"PRIu64" usec with %u%% budget",
+				impl, (uint64_t)(impl->poll_time / SPA_NSEC_PER_USEC), impl->poll_budget);
+
 	spa_list_init(&impl->source_list);
 	spa_list_init(&impl->destroy_list);
+	spa_list_init(&impl->timer_list);
 	spa_hook_list_init(&impl->hooks_list);
 
-	impl->buffer_data = SPA_PTR_ALIGN(impl->buffer_mem, MAX_ALIGN, uint8_t);
-	spa_ringbuffer_init(&impl->buffer);
+	pthread_mutex_init(&impl->queue_lock, NULL);
+	pthread_mutex_init(&impl->timer_lock, NULL);
+	if (pthread_once(&queue_key_once, queue_key_create) != 0 || queue_key_res != 0)
+		spa_log_warn(impl->log, "%p: can't create queue key, invoke from "
+				"threads will be serialized: %s", impl, strerror(queue_key_res));
 
 	impl->wakeup = loop_add_event(impl, wakeup_func, impl);
 	if (impl->wakeup == NULL) {
 		res = -errno;
 		spa_log_error(impl->log, "%p: can't create wakeup event: %m", impl);
-		goto error_exit_free_poll;
+		goto error_exit_free_mutex;
 	}
-	if ((res = spa_system_eventfd_create(impl->system,
-			SPA_FD_EVENT_SEMAPHORE | SPA_FD_CLOEXEC)) < 0) {
-		spa_log_error(impl->log, "%p: can't create ack event: %s",
-				impl, spa_strerror(res));
+	if ((impl->shared_queue = queue_new(impl)) == NULL) {
+		res = -errno;
 		goto error_exit_free_wakeup;
 	}
-	impl->ack_fd = res;
+	/* the shared queue is never handed out to a thread */
+	impl->shared_queue->in_use = 1;
+	impl->queues[impl->n_queues++] = impl->shared_queue;
+
+	pthread_mutex_lock(&loops_lock);
+	impl->id = ++loops_id;
+	spa_list_append(&loops, &impl->link);
+	pthread_mutex_unlock(&loops_lock);
 
 	spa_log_debug(impl->log, "%p: initialized", impl);
 
@@ -1039,7 +1591,9 @@ impl_init(const struct spa_handle_factory *factory,
 
 error_exit_free_wakeup:
 	loop_destroy_source(impl, impl->wakeup);
-error_exit_free_poll:
+error_exit_free_mutex:
+	pthread_mutex_destroy(&impl->queue_lock);
+	pthread_mutex_destroy(&impl->timer_lock);
 	spa_system_close(impl->system, impl->poll_fd);
 error_exit:
 	return res;
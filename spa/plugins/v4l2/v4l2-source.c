@@ -12,6 +12,7 @@
 #include <spa/support/plugin.h>
 #include <spa/support/log.h>
 #include <spa/support/loop.h>
+#include <spa/utils/atomic.h>
 #include <spa/utils/list.h>
 #include <spa/utils/keys.h>
 #include <spa/utils/names.h>
@@ -43,10 +44,12 @@ static void reset_props(struct props *props)
 }
 
 #define MAX_BUFFERS     32
+#define DEFAULT_BUFFERS	4
 
 #define BUFFER_FLAG_OUTSTANDING	(1<<0)
 #define BUFFER_FLAG_ALLOCATED	(1<<1)
 #define BUFFER_FLAG_MAPPED	(1<<2)
+#define BUFFER_FLAG_BUSY	(1<<3)	/* recycled but still used by a consumer */
 
 struct buffer {
 	uint32_t id;
@@ -54,6 +57,7 @@ struct buffer {
 	struct spa_list link;
 	struct spa_buffer *outbuf;
 	struct spa_meta_header *h;
+	struct spa_meta_busy *busy;
 	struct v4l2_buffer v4l2_buffer;
 	void *ptr;
 };
@@ -95,6 +99,8 @@ struct port {
 
 	struct buffer buffers[MAX_BUFFERS];
 	uint32_t n_buffers;
+	uint32_t n_busy;
+	uint32_t want_buffers;
 	struct spa_list queue;
 
 	struct spa_source source;
@@ -566,7 +572,7 @@ static int impl_node_port_enum_params(void *object, int seq,
 
 		param = spa_pod_builder_add_object(&b,
 			SPA_TYPE_OBJECT_ParamBuffers, id,
-			SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(4, 1, MAX_BUFFERS),
+			SPA_PARAM_BUFFERS_buffers, SPA_POD_CHOICE_RANGE_Int(port->want_buffers, 1, MAX_BUFFERS),
 			SPA_PARAM_BUFFERS_blocks,  SPA_POD_Int(1),
 			SPA_PARAM_BUFFERS_size,    SPA_POD_Int(port->fmt.fmt.pix.sizeimage),
 			SPA_PARAM_BUFFERS_stride,  SPA_POD_Int(port->fmt.fmt.pix.bytesperline));
@@ -580,6 +586,12 @@ static int impl_node_port_enum_params(void *object, int seq,
 				SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Header),
 				SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_header)));
 			break;
+		case 1:
+			param = spa_pod_builder_add_object(&b,
+				SPA_TYPE_OBJECT_ParamMeta, id,
+				SPA_PARAM_META_type, SPA_POD_Id(SPA_META_Busy),
+				SPA_PARAM_META_size, SPA_POD_Int(sizeof(struct spa_meta_busy)));
+			break;
 		default:
 			return 0;
 		}
@@ -874,6 +886,8 @@ static int impl_node_process(void *object)
 
 	spa_log_trace(this->log, "%p; status %d", this, io->status);
 
+	spa_v4l2_recycle_busy(this);
+
 	if (io->status == SPA_STATUS_HAVE_DATA)
 		return SPA_STATUS_HAVE_DATA;
 
@@ -1018,6 +1032,7 @@ impl_init(const struct spa_handle_factory *factory,
 	port->info.params = port->params;
 	port->info.n_params = N_PORT_PARAMS;
 
+	port->want_buffers = DEFAULT_BUFFERS;
 	port->alloc_buffers = true;
 	port->have_expbuf = true;
 	port->have_query_ext_ctrl = true;
@@ -110,6 +110,30 @@ static int spa_v4l2_buffer_recycle(struct impl *this, uint32_t buffer_id)
 	if (!SPA_FLAG_IS_SET(b->flags, BUFFER_FLAG_OUTSTANDING))
 		return 0;
 
+	if (b->busy && SPA_ATOMIC_LOAD(b->busy->count) > 0) {
+		/* a consumer still has the buffer, requeue it when it is
+		 * released. When the consumers keep more than half of the
+		 * buffers, ask for more buffers at the next negotiation. */
+		if (!SPA_FLAG_IS_SET(b->flags, BUFFER_FLAG_BUSY)) {
+			SPA_FLAG_SET(b->flags, BUFFER_FLAG_BUSY);
+			port->n_busy++;
+			if (port->n_busy * 2 > port->n_buffers &&
+			    port->want_buffers < MAX_BUFFERS &&
+			    port->want_buffers <= port->n_buffers) {
+				port->want_buffers = SPA_MIN(port->n_buffers * 2, (uint32_t)MAX_BUFFERS);
+				spa_log_info(this->log, "'%s' %d of %d buffers busy, want %d buffers",
+						this->props.device, port->n_busy, port->n_buffers,
+						port->want_buffers);
+			}
+		}
+		spa_log_trace(this->log, "v4l2 %p: buffer %d busy", this, buffer_id);
+		return 0;
+	}
+	if (SPA_FLAG_IS_SET(b->flags, BUFFER_FLAG_BUSY)) {
+		SPA_FLAG_CLEAR(b->flags, BUFFER_FLAG_BUSY);
+		port->n_busy--;
+	}
+
 	SPA_FLAG_CLEAR(b->flags, BUFFER_FLAG_OUTSTANDING);
 	spa_log_trace(this->log, "v4l2 %p: recycle buffer %d", this, buffer_id);
 
@@ -122,6 +146,20 @@ static int spa_v4l2_buffer_recycle(struct impl *this, uint32_t buffer_id)
 	return 0;
 }
 
+static void spa_v4l2_recycle_busy(struct impl *this)
+{
+	struct port *port = &this->out_ports[0];
+	uint32_t i;
+
+	if (port->n_busy == 0)
+		return;
+
+	for (i = 0; i < port->n_buffers; i++) {
+		if (SPA_FLAG_IS_SET(port->buffers[i].flags, BUFFER_FLAG_BUSY))
+			spa_v4l2_buffer_recycle(this, i);
+	}
+}
+
 static int spa_v4l2_clear_buffers(struct impl *this)
 {
 	struct port *port = &this->out_ports[0];
@@ -138,6 +176,8 @@ static int spa_v4l2_clear_buffers(struct impl *this)
 		b = &port->buffers[i];
 		d = b->outbuf->datas;
 
+		/* the consumers are gone with the buffers */
+		b->busy = NULL;
 		if (SPA_FLAG_IS_SET(b->flags, BUFFER_FLAG_OUTSTANDING)) {
 			spa_log_debug(this->log, "queueing outstanding buffer %p", b);
 			spa_v4l2_buffer_recycle(this, i);
@@ -161,6 +201,7 @@ static int spa_v4l2_clear_buffers(struct impl *this)
 		spa_log_warn(this->log, "VIDIOC_REQBUFS: %m");
 	}
 	port->n_buffers = 0;
+	port->n_busy = 0;
 
 	return 0;
 }
@@ -1382,6 +1423,8 @@ static void v4l2_on_fd_events(struct spa_source *source)
 	if (mmap_read(this) < 0)
 		return;
 
+	spa_v4l2_recycle_busy(this);
+
 	if (spa_list_is_empty(&port->queue))
 		return;
 
@@ -1392,17 +1435,28 @@ static void v4l2_on_fd_events(struct spa_source *source)
 		SPA_FLAG_SET(b->flags, BUFFER_FLAG_OUTSTANDING);
 		spa_v4l2_buffer_recycle(this, b->id);
 	}
-	else if (io->status != SPA_STATUS_HAVE_DATA) {
-		if (io->buffer_id < port->n_buffers)
-			spa_v4l2_buffer_recycle(this, io->buffer_id);
-
-		b = spa_list_first(&port->queue, struct buffer, link);
-		spa_list_remove(&b->link);
-		SPA_FLAG_SET(b->flags, BUFFER_FLAG_OUTSTANDING);
-
-		io->buffer_id = b->id;
-		io->status = SPA_STATUS_HAVE_DATA;
-		spa_log_trace(this->log, "v4l2 %p: now queued %d", this, b->id);
+	else {
+		/* only the latest frame is handed out, give the older ones
+		 * back to the camera so that it never runs out of buffers */
+		while ((b = spa_list_first(&port->queue, struct buffer, link)) !=
+		    spa_list_last(&port->queue, struct buffer, link)) {
+			spa_list_remove(&b->link);
+			SPA_FLAG_SET(b->flags, BUFFER_FLAG_OUTSTANDING);
+			spa_v4l2_buffer_recycle(this, b->id);
+		}
+		/* a pending frame stays in io, the latest one is handed out
+		 * when the pending one was consumed */
+		if (io->status != SPA_STATUS_HAVE_DATA) {
+			if (io->buffer_id < port->n_buffers)
+				spa_v4l2_buffer_recycle(this, io->buffer_id);
+
+			spa_list_remove(&b->link);
+			SPA_FLAG_SET(b->flags, BUFFER_FLAG_OUTSTANDING);
+
+			io->buffer_id = b->id;
+			io->status = SPA_STATUS_HAVE_DATA;
+			spa_log_trace(this->log, "v4l2 %p: now queued %d", this, b->id);
+		}
 	}
 	spa_node_call_ready(&this->callbacks, SPA_STATUS_HAVE_DATA);
 }
@@ -1453,6 +1507,7 @@ static int spa_v4l2_use_buffers(struct impl *this, struct spa_buffer **buffers,
 		b->outbuf = buffers[i];
 		b->flags = BUFFER_FLAG_OUTSTANDING;
 		b->h = spa_buffer_find_meta_data(buffers[i], SPA_META_Header, sizeof(*b->h));
+		b->busy = spa_buffer_find_meta_data(buffers[i], SPA_META_Busy, sizeof(*b->busy));
 
 		spa_log_debug(this->log, "import buffer %p", buffers[i]);
 
@@ -1548,6 +1603,7 @@ mmap_init(struct impl *this,
 		b->outbuf = buffers[i];
 		b->flags = BUFFER_FLAG_OUTSTANDING;
 		b->h = spa_buffer_find_meta_data(buffers[i], SPA_META_Header, sizeof(*b->h));
+		b->busy = spa_buffer_find_meta_data(buffers[i], SPA_META_Busy, sizeof(*b->busy));
 
 		spa_zero(b->v4l2_buffer);
 		b->v4l2_buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
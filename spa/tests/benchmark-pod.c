@@ -12,6 +12,8 @@
 #include <spa/pod/pod.h>
 #include <spa/pod/builder.h>
 #include <spa/pod/parser.h>
+#include <spa/pod/filter.h>
+#include <spa/param/audio/format-utils.h>
 #include <spa/param/video/format-utils.h>
 #include <spa/debug/pod.h>
 
@@ -264,11 +266,110 @@ static void test_parser(void)
 			t2 - t1, count, count * (uint64_t)SPA_NSEC_PER_SEC / (t2 - t1));
 }
 
+static struct spa_pod *build_dsp_enum_format(struct spa_pod_builder *b)
+{
+	/* what audioconvert exposes on its ports */
+	return spa_pod_builder_add_object(b,
+			SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
+			SPA_FORMAT_mediaType,      SPA_POD_Id(SPA_MEDIA_TYPE_audio),
+			SPA_FORMAT_mediaSubtype,   SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
+			SPA_FORMAT_AUDIO_format,   SPA_POD_CHOICE_ENUM_Id(25,
+					SPA_AUDIO_FORMAT_F32P,
+					SPA_AUDIO_FORMAT_F32P,
+					SPA_AUDIO_FORMAT_F32,
+					SPA_AUDIO_FORMAT_F32_OE,
+					SPA_AUDIO_FORMAT_F64P,
+					SPA_AUDIO_FORMAT_F64,
+					SPA_AUDIO_FORMAT_F64_OE,
+					SPA_AUDIO_FORMAT_S32P,
+					SPA_AUDIO_FORMAT_S32,
+					SPA_AUDIO_FORMAT_S32_OE,
+					SPA_AUDIO_FORMAT_S24_32P,
+					SPA_AUDIO_FORMAT_S24_32,
+					SPA_AUDIO_FORMAT_S24_32_OE,
+					SPA_AUDIO_FORMAT_S24P,
+					SPA_AUDIO_FORMAT_S24,
+					SPA_AUDIO_FORMAT_S24_OE,
+					SPA_AUDIO_FORMAT_S16P,
+					SPA_AUDIO_FORMAT_S16,
+					SPA_AUDIO_FORMAT_S16_OE,
+					SPA_AUDIO_FORMAT_U32,
+					SPA_AUDIO_FORMAT_U24_32,
+					SPA_AUDIO_FORMAT_U24,
+					SPA_AUDIO_FORMAT_U16,
+					SPA_AUDIO_FORMAT_S8,
+					SPA_AUDIO_FORMAT_U8),
+			SPA_FORMAT_AUDIO_rate,     SPA_POD_CHOICE_RANGE_Int(48000, 1, INT32_MAX),
+			SPA_FORMAT_AUDIO_channels, SPA_POD_CHOICE_RANGE_Int(2, 1, SPA_AUDIO_MAX_CHANNELS));
+}
+
+static struct spa_pod *build_device_enum_format(struct spa_pod_builder *b)
+{
+	/* what a typical ALSA device exposes */
+	return spa_pod_builder_add_object(b,
+			SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
+			SPA_FORMAT_mediaType,      SPA_POD_Id(SPA_MEDIA_TYPE_audio),
+			SPA_FORMAT_mediaSubtype,   SPA_POD_Id(SPA_MEDIA_SUBTYPE_raw),
+			SPA_FORMAT_AUDIO_format,   SPA_POD_CHOICE_ENUM_Id(4,
+					SPA_AUDIO_FORMAT_S32,
+					SPA_AUDIO_FORMAT_S32,
+					SPA_AUDIO_FORMAT_S24_32,
+					SPA_AUDIO_FORMAT_S16),
+			SPA_FORMAT_AUDIO_rate,     SPA_POD_CHOICE_ENUM_Int(9, 48000,
+					32000, 44100, 48000, 88200, 96000,
+					176400, 192000, 384000),
+			SPA_FORMAT_AUDIO_channels, SPA_POD_CHOICE_ENUM_Int(4, 2, 2, 4, 8));
+}
+
+static void test_filter(void)
+{
+	uint8_t buffer[4096], buffer2[4096], buffer3[4096];
+	struct spa_pod_builder b = { NULL, };
+	struct timespec ts;
+	uint64_t t1, t2;
+	uint64_t count = 0;
+	struct spa_pod *dsp, *dev, *res;
+
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	dsp = build_dsp_enum_format(&b);
+	spa_pod_builder_init(&b, buffer2, sizeof(buffer2));
+	dev = build_device_enum_format(&b);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t1 = SPA_TIMESPEC_TO_NSEC(&ts);
+
+	fprintf(stderr, "test_filter() : ");
+	for (count = 0; count < MAX_COUNT; count++) {
+		uint32_t format, rate, channels;
+
+		spa_pod_builder_init(&b, buffer3, sizeof(buffer3));
+		spa_assert(spa_pod_filter(&b, &res, dsp, dev) >= 0);
+		spa_pod_fixate(res);
+
+		spa_assert(spa_pod_parse_object(res,
+				SPA_TYPE_OBJECT_Format, NULL,
+				SPA_FORMAT_AUDIO_format,   SPA_POD_Id(&format),
+				SPA_FORMAT_AUDIO_rate,     SPA_POD_Int(&rate),
+				SPA_FORMAT_AUDIO_channels, SPA_POD_Int(&channels)) == 3);
+		spa_assert(format == SPA_AUDIO_FORMAT_S32);
+		spa_assert(rate == 48000);
+		spa_assert(channels == 2);
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		t2 = SPA_TIMESPEC_TO_NSEC(&ts);
+		if (t2 - t1 > 1 * SPA_NSEC_PER_SEC)
+			break;
+	}
+	fprintf(stderr, "elapsed %"PRIu64" count %"PRIu64" = %"PRIu64"/sec\n",
+			t2 - t1, count, count * (uint64_t)SPA_NSEC_PER_SEC / (t2 - t1));
+}
+
 int main(int argc, char *argv[])
 {
 	test_builder();
 	test_builder2();
 	test_parse();
 	test_parser();
+	test_filter();
 	return 0;
 }
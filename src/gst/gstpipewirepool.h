@@ -40,6 +40,7 @@ struct _GstPipeWirePoolData {
   gboolean queued;
   struct spa_meta_region *crop;
   struct spa_meta_videotransform *videotransform;
+  struct spa_meta *damage;
 };
 
 struct _GstPipeWirePool {
@@ -18,15 +18,20 @@
 #include "config.h"
 #include "gstpipewiresink.h"
 
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <spa/pod/builder.h>
 #include <spa/utils/result.h>
 
+#include <gst/allocators/gstdmabuf.h>
+#include <gst/allocators/gstfdmemory.h>
 #include <gst/video/video.h>
 
 #include "gstpipewireformat.h"
@@ -105,6 +110,8 @@ gst_pipewire_sink_finalize (GObject * object)
 
   g_object_unref (pwsink->pool);
 
+  if (pwsink->formats)
+    g_ptr_array_unref (pwsink->formats);
   if (pwsink->stream_properties)
     gst_structure_free (pwsink->stream_properties);
   if (pwsink->client_properties)
@@ -226,6 +233,26 @@ gst_pipewire_sink_class_init (GstPipeWireSinkClass * klass)
       "PipeWire Sink");
 }
 
+static const struct spa_pod *
+build_import_buffers_param (GstPipeWireSink *sink, struct spa_pod_builder *b)
+{
+  gsize maxsize = 0;
+  guint i;
+
+  /* one buffer for each of the upstream memories */
+  for (i = 0; i < sink->n_imports; i++)
+    maxsize = MAX (maxsize, sink->imports[i].maxsize);
+
+  return spa_pod_builder_add_object (b,
+      SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+      SPA_PARAM_BUFFERS_buffers, SPA_POD_Int(sink->n_imports),
+      SPA_PARAM_BUFFERS_blocks,  SPA_POD_Int(1),
+      SPA_PARAM_BUFFERS_size,    SPA_POD_Int((int) maxsize),
+      SPA_PARAM_BUFFERS_stride,  SPA_POD_CHOICE_RANGE_Int(0, 0, INT32_MAX),
+      SPA_PARAM_BUFFERS_dataType, SPA_POD_CHOICE_FLAGS_Int(
+          1 << (sink->import_dmabuf ? SPA_DATA_DmaBuf : SPA_DATA_MemFd)));
+}
+
 static void
 pool_activated (GstPipeWirePool *pool, GstPipeWireSink *sink)
 {
@@ -242,6 +269,9 @@ pool_activated (GstPipeWirePool *pool, GstPipeWireSink *sink)
   config = gst_buffer_pool_get_config (GST_BUFFER_POOL (pool));
   gst_buffer_pool_config_get_params (config, &caps, &size, &min_buffers, &max_buffers);
 
+  if (size > 0)
+    sink->buffer_size = size;
+
   spa_pod_builder_init (&b, buffer, sizeof (buffer));
   spa_pod_builder_push_object (&b, &f, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers);
   if (size == 0)
@@ -265,6 +295,9 @@ pool_activated (GstPipeWirePool *pool, GstPipeWireSink *sink)
       0);
   port_params[0] = spa_pod_builder_pop (&b, &f);
 
+  if (sink->import_active)
+    port_params[0] = build_import_buffers_param (sink, &b);
+
   port_params[1] = spa_pod_builder_add_object (&b,
       SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
       SPA_PARAM_META_type, SPA_POD_Int(SPA_META_Header),
@@ -433,10 +466,245 @@ gst_pipewire_sink_get_property (GObject * object, guint prop_id,
   }
 }
 
+/* Upstream elements with their own pool of fd memory, such as v4l2src,
+ * send the same few memories over and over. When we have seen all of them,
+ * the buffers are renegotiated to use these memories and the frames are
+ * sent without a copy. */
+static gboolean
+import_stat (GstPipeWireSink *pwsink, GstBuffer *buffer, GstMemory **mem,
+    struct stat *st)
+{
+  if (gst_buffer_n_memory (buffer) != 1)
+    return FALSE;
+
+  *mem = gst_buffer_peek_memory (buffer, 0);
+  if (!gst_is_fd_memory (*mem) ||
+      !!gst_is_dmabuf_memory (*mem) != !!pwsink->import_dmabuf)
+    return FALSE;
+
+  return fstat (gst_fd_memory_get_fd (*mem), st) == 0;
+}
+
+/* upstream can sub-allocate its memories from one fd */
+static GstPipeWireSinkImport *
+import_find (GstPipeWireSink *pwsink, GstMemory *mem, const struct stat *st)
+{
+  guint i;
+
+  for (i = 0; i < pwsink->n_imports; i++) {
+    GstPipeWireSinkImport *imp = &pwsink->imports[i];
+    if (imp->dev == st->st_dev && imp->ino == st->st_ino &&
+        imp->offset == mem->offset)
+      return imp;
+  }
+  return NULL;
+}
+
+static GstPipeWireSinkImport *
+import_find_buffer (GstPipeWireSink *pwsink, struct pw_buffer *b)
+{
+  guint i;
+
+  for (i = 0; i < pwsink->n_imports; i++) {
+    if (pwsink->imports[i].b == b)
+      return &pwsink->imports[i];
+  }
+  return NULL;
+}
+
+static void
+import_clear (GstPipeWireSink *pwsink)
+{
+  guint i;
+
+  for (i = 0; i < pwsink->n_imports; i++) {
+    GstPipeWireSinkImport *imp = &pwsink->imports[i];
+    gst_buffer_replace (&imp->held, NULL);
+    close (imp->fd);
+  }
+  pwsink->n_imports = 0;
+  pwsink->n_import_buffers = 0;
+}
+
+/* remember the upstream memory, returns TRUE when it was seen before and
+ * the stream can switch to the imported memory */
+static gboolean
+import_collect (GstPipeWireSink *pwsink, GstBuffer *buffer)
+{
+  GstPipeWireSinkImport *imp;
+  GstMemory *mem;
+  struct stat st;
+  int fd;
+
+  if (pwsink->import_failed)
+    return FALSE;
+
+  if (!import_stat (pwsink, buffer, &mem, &st)) {
+    import_clear (pwsink);
+    return FALSE;
+  }
+  if (import_find (pwsink, mem, &st) != NULL)
+    return pwsink->n_imports > 1;
+
+  if (pwsink->n_imports == GST_PIPEWIRE_SINK_MAX_IMPORTS) {
+    GST_INFO_OBJECT (pwsink, "too many upstream buffers, copying");
+    import_clear (pwsink);
+    pwsink->import_failed = TRUE;
+    return FALSE;
+  }
+  if ((fd = fcntl (gst_fd_memory_get_fd (mem), F_DUPFD_CLOEXEC, 0)) < 0)
+    return FALSE;
+
+  imp = &pwsink->imports[pwsink->n_imports++];
+  imp->dev = st.st_dev;
+  imp->ino = st.st_ino;
+  imp->offset = mem->offset;
+  imp->fd = fd;
+  imp->maxsize = mem->maxsize;
+  imp->dmabuf = pwsink->import_dmabuf;
+  imp->b = NULL;
+  imp->dequeued = FALSE;
+  imp->held = NULL;
+
+  GST_LOG_OBJECT (pwsink, "upstream memory %u fd:%d size:%" G_GSIZE_FORMAT,
+      pwsink->n_imports, fd, imp->maxsize);
+
+  return FALSE;
+}
+
+/* Get the buffer with the upstream memory. Returns 1 when found, 0 when the
+ * buffer is still in use and -1 when the memory was not imported. */
+static int
+import_acquire (GstPipeWireSink *pwsink, GstBuffer *buffer, GstPipeWirePoolData **data)
+{
+  GstPipeWireSinkImport *imp;
+  GstMemory *mem;
+  struct pw_buffer *b;
+  struct stat st;
+
+  if (!import_stat (pwsink, buffer, &mem, &st) ||
+      (imp = import_find (pwsink, mem, &st)) == NULL)
+    return -1;
+
+  /* let upstream reuse the buffers that were consumed */
+  while ((b = pw_stream_dequeue_buffer (pwsink->stream)) != NULL) {
+    GstPipeWireSinkImport *i = import_find_buffer (pwsink, b);
+    if (i != NULL) {
+      i->dequeued = TRUE;
+      gst_buffer_replace (&i->held, NULL);
+    }
+  }
+  if (imp->b == NULL || !imp->dequeued)
+    return 0;
+
+  imp->dequeued = FALSE;
+  gst_buffer_replace (&imp->held, buffer);
+  *data = imp->b->user_data;
+
+  return 1;
+}
+
+static gboolean
+import_add_buffer (GstPipeWireSink *pwsink, struct pw_buffer *b)
+{
+  struct spa_data *d = &b->buffer->datas[0];
+  GstPipeWireSinkImport *imp;
+  int fd;
+
+  if (pwsink->n_import_buffers >= pwsink->n_imports || b->buffer->n_datas != 1) {
+    GST_WARNING_OBJECT (pwsink, "can't import buffer %u", pwsink->n_import_buffers);
+    return FALSE;
+  }
+  imp = &pwsink->imports[pwsink->n_import_buffers];
+
+  /* the buffer owns its fd, the import can go away first */
+  if ((fd = fcntl (imp->fd, F_DUPFD_CLOEXEC, 0)) < 0)
+    return FALSE;
+
+  pwsink->n_import_buffers++;
+
+  d->type = imp->dmabuf ? SPA_DATA_DmaBuf : SPA_DATA_MemFd;
+  d->flags = SPA_DATA_FLAG_READABLE;
+  d->fd = fd;
+  d->mapoffset = 0;
+  d->maxsize = imp->maxsize;
+  d->data = NULL;
+
+  imp->b = b;
+  imp->dequeued = FALSE;
+
+  return TRUE;
+}
+
+/* we allocate the buffers, make memory to copy the frames into. When the
+ * peer does not take memfd memory, alloc_unsupported is set and the stream
+ * is connected again to allocate the buffers itself. */
+static gboolean
+alloc_buffer (GstPipeWireSink *pwsink, struct pw_buffer *b)
+{
+#ifdef HAVE_MEMFD_CREATE
+  gboolean have_memfd = TRUE;
+#else
+  gboolean have_memfd = FALSE;
+#endif
+  guint i;
+
+  for (i = 0; i < b->buffer->n_datas; i++) {
+    struct spa_data *d = &b->buffer->datas[i];
+
+    if (!have_memfd || (d->type & (1 << SPA_DATA_MemFd)) == 0) {
+      GST_WARNING_OBJECT (pwsink, "unsupported data type %08x", d->type);
+      pwsink->alloc_unsupported = TRUE;
+      return FALSE;
+    }
+    if (pwsink->buffer_size == 0)
+      return FALSE;
+
+    d->type = SPA_DATA_MemFd;
+    d->flags = SPA_DATA_FLAG_READWRITE;
+#ifdef HAVE_MEMFD_CREATE
+    d->fd = memfd_create ("gst-pipewire-sink", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    d->fd = -1;
+#endif
+    d->mapoffset = 0;
+    d->maxsize = pwsink->buffer_size;
+    d->data = NULL;
+
+    if (d->fd < 0 || ftruncate (d->fd, d->maxsize) < 0) {
+      GST_WARNING_OBJECT (pwsink, "can't allocate memory: %s", g_strerror (errno));
+      return FALSE;
+    }
+#ifdef HAVE_MEMFD_CREATE
+    if (fcntl (d->fd, F_ADD_SEALS, F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL) < 0)
+      GST_WARNING_OBJECT (pwsink, "can't add seals: %s", g_strerror (errno));
+#endif
+  }
+  return TRUE;
+}
+
 static void
 on_add_buffer (void *_data, struct pw_buffer *b)
 {
   GstPipeWireSink *pwsink = _data;
+
+  pwsink->renegotiating = FALSE;
+  pwsink->buffers_imported = FALSE;
+  pwsink->buffers_missing = FALSE;
+  if (!pwsink->alloc_buffers) {
+    gst_pipewire_pool_wrap_buffer (pwsink->pool, b);
+    return;
+  }
+
+  pwsink->buffers_imported = pwsink->import_active;
+  if (pwsink->import_active && !import_add_buffer (pwsink, b)) {
+    pwsink->import_failed = TRUE;
+    pwsink->buffers_imported = FALSE;
+  }
+  /* without memory the buffers are renegotiated when we know the size */
+  if (!pwsink->buffers_imported && !alloc_buffer (pwsink, b))
+    pwsink->buffers_missing = TRUE;
+
   gst_pipewire_pool_wrap_buffer (pwsink->pool, b);
 }
 
@@ -445,22 +713,38 @@ on_remove_buffer (void *_data, struct pw_buffer *b)
 {
   GstPipeWireSink *pwsink = _data;
   GstPipeWirePoolData *data = b->user_data;
+  GstPipeWireSinkImport *imp;
+  guint i;
 
   GST_LOG_OBJECT (pwsink, "remove buffer");
 
+  if ((imp = import_find_buffer (pwsink, b)) != NULL) {
+    gst_buffer_replace (&imp->held, NULL);
+    imp->b = NULL;
+    imp->dequeued = FALSE;
+  }
+
   gst_buffer_unref (data->buf);
+
+  if (!pwsink->alloc_buffers)
+    return;
+
+  for (i = 0; i < b->buffer->n_datas; i++) {
+    struct spa_data *d = &b->buffer->datas[i];
+    if ((d->type == SPA_DATA_MemFd || d->type == SPA_DATA_DmaBuf) && d->fd >= 0) {
+      close (d->fd);
+      d->fd = -1;
+    }
+  }
 }
 
 static void
-do_send_buffer (GstPipeWireSink *pwsink, GstBuffer *buffer)
+do_send_buffer (GstPipeWireSink *pwsink, GstPipeWirePoolData *data, GstBuffer *buffer)
 {
-  GstPipeWirePoolData *data;
   gboolean res;
   guint i;
   struct spa_buffer *b;
 
-  data = gst_pipewire_pool_get_data(buffer);
-
   b = data->b->buffer;
 
   if (data->header) {
@@ -551,11 +835,136 @@ on_param_changed (void *data, uint32_t id, const struct spa_pod *param)
     pool_activated (pwsink->pool, pwsink);
 }
 
+/* connect the stream with the formats of the caps and wait until it is
+ * ready, must be called with the loop lock. Once we sent upstream memory,
+ * we allocate the buffers ourselves so that we can switch between the
+ * upstream memory and our own memory without a new node. */
+static gboolean
+stream_connect (GstPipeWireSink *pwsink, const char **error)
+{
+  enum pw_stream_state state;
+  enum pw_stream_flags flags = 0;
+  uint32_t target_id;
+  struct timespec abstime;
+
+  if (pwsink->alloc_buffers)
+    flags |= PW_STREAM_FLAG_ALLOC_BUFFERS;
+  if (pwsink->mode != GST_PIPEWIRE_SINK_MODE_PROVIDE)
+    flags |= PW_STREAM_FLAG_AUTOCONNECT;
+  else
+    flags |= PW_STREAM_FLAG_DRIVER;
+
+  target_id = pwsink->path ? (uint32_t)atoi(pwsink->path) : PW_ID_ANY;
+
+  if (pwsink->target_object) {
+    struct spa_dict_item items[2] = {
+      SPA_DICT_ITEM_INIT(PW_KEY_TARGET_OBJECT, pwsink->target_object),
+      /* XXX deprecated but the portal and some example apps only
+       * provide the object id */
+      SPA_DICT_ITEM_INIT(PW_KEY_NODE_TARGET, NULL),
+    };
+    struct spa_dict dict = SPA_DICT_INIT_ARRAY(items);
+    uint64_t serial;
+
+    /* If target.object is a name, set it also to node.target */
+    if (spa_atou64(pwsink->target_object, &serial, 0)) {
+      dict.n_items = 1;
+    } else {
+      target_id = PW_ID_ANY;
+      items[1].value = pwsink->target_object;
+    }
+
+    pw_stream_update_properties (pwsink->stream, &dict);
+  }
+
+  pw_stream_connect (pwsink->stream,
+                        PW_DIRECTION_OUTPUT,
+                        target_id,
+                        flags,
+                        (const struct spa_pod **) pwsink->formats->pdata,
+                        pwsink->formats->len);
+
+  pw_thread_loop_get_time (pwsink->core->loop, &abstime,
+            GST_PIPEWIRE_DEFAULT_TIMEOUT * SPA_NSEC_PER_SEC);
+
+  while (TRUE) {
+    state = pw_stream_get_state (pwsink->stream, error);
+
+    if (state >= PW_STREAM_STATE_PAUSED)
+      break;
+
+    if (state == PW_STREAM_STATE_ERROR)
+      return FALSE;
+
+    if (pw_thread_loop_timed_wait_full (pwsink->core->loop, &abstime) < 0) {
+      *error = "timeout";
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* connect the stream again to change who allocates the buffers, must be
+ * called with the loop lock */
+static gboolean
+stream_reconnect (GstPipeWireSink *pwsink, gboolean alloc_buffers)
+{
+  const char *error = NULL;
+
+  pw_stream_disconnect (pwsink->stream);
+
+  pwsink->alloc_buffers = alloc_buffers;
+  pwsink->alloc_unsupported = FALSE;
+  pwsink->buffers_imported = FALSE;
+  pwsink->buffers_missing = FALSE;
+  pwsink->renegotiating = FALSE;
+
+  if (!stream_connect (pwsink, &error)) {
+    GST_ELEMENT_ERROR (pwsink, RESOURCE, FAILED,
+        ("could not reconnect stream: %s", error), (NULL));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* renegotiate the buffers to use the upstream memory or our own memory,
+ * must be called with the loop lock. The format is set again, after
+ * which pool_activated updates the Buffers param for the new mode. The
+ * node stays the same so the links to it stay. Only the first import
+ * connects the stream again, to allocate the buffers ourselves. */
+static gboolean
+import_set_active (GstPipeWireSink *pwsink, gboolean active)
+{
+  int res;
+
+  GST_INFO_OBJECT (pwsink, "%s sending %u upstream buffers without copy",
+      active ? "start" : "stop", pwsink->n_imports);
+
+  pwsink->import_active = active;
+  pwsink->n_import_buffers = 0;
+  if (!active)
+    import_clear (pwsink);
+
+  if (active && !pwsink->alloc_buffers)
+    return stream_reconnect (pwsink, TRUE);
+
+  pwsink->renegotiating = TRUE;
+  if ((res = pw_stream_update_params (pwsink->stream,
+          (const struct spa_pod **) pwsink->formats->pdata,
+          pwsink->formats->len)) < 0) {
+    GST_ELEMENT_ERROR (pwsink, RESOURCE, FAILED,
+        ("could not renegotiate buffers: %s", spa_strerror (res)), (NULL));
+    return FALSE;
+  }
+  return TRUE;
+}
+
 static gboolean
 gst_pipewire_sink_setcaps (GstBaseSink * bsink, GstCaps * caps)
 {
   GstPipeWireSink *pwsink;
-  GPtrArray *possible;
+  GstCapsFeatures *features;
+  GstVideoInfo info;
   enum pw_stream_state state;
   const char *error = NULL;
   gboolean res = FALSE;
@@ -563,11 +972,21 @@ gst_pipewire_sink_setcaps (GstBaseSink * bsink, GstCaps * caps)
   guint size;
   guint min_buffers;
   guint max_buffers;
-  struct timespec abstime;
 
   pwsink = GST_PIPEWIRE_SINK (bsink);
 
-  possible = gst_caps_to_format_all (caps, SPA_PARAM_EnumFormat);
+  if (pwsink->formats)
+    g_ptr_array_unref (pwsink->formats);
+  pwsink->formats = gst_caps_to_format_all (caps, SPA_PARAM_EnumFormat);
+
+  features = gst_caps_get_features (caps, 0);
+  pwsink->import_dmabuf = features != NULL &&
+      gst_caps_features_contains (features, GST_CAPS_FEATURE_MEMORY_DMABUF);
+  pwsink->import_failed = FALSE;
+
+  /* the buffers can be allocated before the pool is configured */
+  if (gst_video_info_from_caps (&info, caps))
+    pwsink->buffer_size = GST_VIDEO_INFO_SIZE (&info);
 
   pw_thread_loop_lock (pwsink->core->loop);
   state = pw_stream_get_state (pwsink->stream, &error);
@@ -575,63 +994,10 @@ gst_pipewire_sink_setcaps (GstBaseSink * bsink, GstCaps * caps)
   if (state == PW_STREAM_STATE_ERROR)
     goto start_error;
 
-  if (state == PW_STREAM_STATE_UNCONNECTED) {
-    enum pw_stream_flags flags = 0;
-    uint32_t target_id;
-
-    if (pwsink->mode != GST_PIPEWIRE_SINK_MODE_PROVIDE)
-      flags |= PW_STREAM_FLAG_AUTOCONNECT;
-    else
-      flags |= PW_STREAM_FLAG_DRIVER;
-
-    target_id = pwsink->path ? (uint32_t)atoi(pwsink->path) : PW_ID_ANY;
-
-    if (pwsink->target_object) {
-      struct spa_dict_item items[2] = {
-        SPA_DICT_ITEM_INIT(PW_KEY_TARGET_OBJECT, pwsink->target_object),
-	/* XXX deprecated but the portal and some example apps only
-	 * provide the object id */
-        SPA_DICT_ITEM_INIT(PW_KEY_NODE_TARGET, NULL),
-      };
-      struct spa_dict dict = SPA_DICT_INIT_ARRAY(items);
-      uint64_t serial;
-
-      /* If target.object is a name, set it also to node.target */
-      if (spa_atou64(pwsink->target_object, &serial, 0)) {
-        dict.n_items = 1;
-      } else {
-        target_id = PW_ID_ANY;
-        items[1].value = pwsink->target_object;
-      }
-
-      pw_stream_update_properties (pwsink->stream, &dict);
-    }
-
-    pw_stream_connect (pwsink->stream,
-                          PW_DIRECTION_OUTPUT,
-                          target_id,
-                          flags,
-                          (const struct spa_pod **) possible->pdata,
-                          possible->len);
-
-    pw_thread_loop_get_time (pwsink->core->loop, &abstime,
-              GST_PIPEWIRE_DEFAULT_TIMEOUT * SPA_NSEC_PER_SEC);
-
-    while (TRUE) {
-      state = pw_stream_get_state (pwsink->stream, &error);
-
-      if (state >= PW_STREAM_STATE_PAUSED)
-        break;
-
-      if (state == PW_STREAM_STATE_ERROR)
-        goto start_error;
+  if (state == PW_STREAM_STATE_UNCONNECTED &&
+      !stream_connect (pwsink, &error))
+    goto start_error;
 
-      if (pw_thread_loop_timed_wait_full (pwsink->core->loop, &abstime) < 0) {
-        error = "timeout";
-        goto start_error;
-      }
-    }
-  }
   res = TRUE;
 
   config = gst_buffer_pool_get_config (GST_BUFFER_POOL_CAST (pwsink->pool));
@@ -649,7 +1015,6 @@ start_error:
   {
     GST_ERROR ("could not start stream: %s", error);
     pw_thread_loop_unlock (pwsink->core->loop);
-    g_ptr_array_unref (possible);
     return FALSE;
   }
 }
@@ -658,6 +1023,7 @@ static GstFlowReturn
 gst_pipewire_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
 {
   GstPipeWireSink *pwsink;
+  GstPipeWirePoolData *data = NULL;
   GstFlowReturn res = GST_FLOW_OK;
   const char *error = NULL;
   gboolean unref_buffer = FALSE;
@@ -688,11 +1054,52 @@ gst_pipewire_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
   if (pw_stream_get_state (pwsink->stream, &error) != PW_STREAM_STATE_STREAMING)
     goto done_unlock;
 
+  if (pwsink->buffers_missing && !pwsink->renegotiating) {
+    /* the peer can't use our memory, stop importing and let the stream
+     * allocate the buffers again */
+    if (pwsink->alloc_unsupported) {
+      pwsink->import_failed = TRUE;
+      pwsink->import_active = FALSE;
+      import_clear (pwsink);
+      if (!stream_reconnect (pwsink, FALSE))
+        goto error_unlock;
+    } else if (pwsink->buffer_size > 0 &&
+        !import_set_active (pwsink, pwsink->import_active))
+      goto error_unlock;
+  }
+
   if (buffer->pool != GST_BUFFER_POOL_CAST (pwsink->pool)) {
+    if (pwsink->import_active) {
+      int r = pwsink->import_failed ? -1 : import_acquire (pwsink, buffer, &data);
+      if (r == 0) {
+        GST_DEBUG_OBJECT (pwsink, "upstream buffer %p is still in use", buffer);
+        goto done_unlock;
+      }
+      /* upstream changed its memory, go back to copying and don't try
+       * again until the caps change */
+      if (r < 0) {
+        pwsink->import_failed = TRUE;
+        if (!import_set_active (pwsink, FALSE))
+          goto error_unlock;
+      }
+    } else if (import_collect (pwsink, buffer)) {
+      if (!import_set_active (pwsink, TRUE))
+        goto error_unlock;
+    }
+    if (pw_stream_get_state (pwsink->stream, &error) != PW_STREAM_STATE_STREAMING)
+      goto done_unlock;
+  }
+
+  if (data == NULL && buffer->pool != GST_BUFFER_POOL_CAST (pwsink->pool)) {
     GstBuffer *b = NULL;
     GstMapInfo info = { 0, };
     GstBufferPoolAcquireParams params = { 0, };
 
+    if (pwsink->buffers_imported || pwsink->buffers_missing) {
+      GST_DEBUG_OBJECT (pwsink, "waiting for the buffers to copy into");
+      goto done_unlock;
+    }
+
     pw_thread_loop_unlock (pwsink->core->loop);
 
     if ((res = gst_buffer_pool_acquire_buffer (GST_BUFFER_POOL_CAST (pwsink->pool), &b, &params)) != GST_FLOW_OK)
@@ -709,9 +1116,11 @@ gst_pipewire_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
     if (pw_stream_get_state (pwsink->stream, &error) != PW_STREAM_STATE_STREAMING)
       goto done_unlock;
   }
+  if (data == NULL)
+    data = gst_pipewire_pool_get_data (buffer);
 
   GST_DEBUG ("push buffer");
-  do_send_buffer (pwsink, buffer);
+  do_send_buffer (pwsink, data, buffer);
   if (unref_buffer)
     gst_buffer_unref (buffer);
 
@@ -727,6 +1136,11 @@ not_negotiated:
   {
     return GST_FLOW_NOT_NEGOTIATED;
   }
+error_unlock:
+  {
+    pw_thread_loop_unlock (pwsink->core->loop);
+    return GST_FLOW_ERROR;
+  }
 }
 
 static gboolean
@@ -810,6 +1224,13 @@ gst_pipewire_sink_stop (GstBaseSink * basesink)
     pwsink->stream = NULL;
     pwsink->pool->stream = NULL;
   }
+  import_clear (pwsink);
+  pwsink->import_active = FALSE;
+  pwsink->buffers_imported = FALSE;
+  pwsink->buffers_missing = FALSE;
+  pwsink->renegotiating = FALSE;
+  pwsink->alloc_buffers = FALSE;
+  pwsink->alloc_unsupported = FALSE;
   pw_thread_loop_unlock (pwsink->core->loop);
 
   pwsink->negotiated = FALSE;
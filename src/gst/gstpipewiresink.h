@@ -5,6 +5,8 @@
 #ifndef __GST_PIPEWIRE_SINK_H__
 #define __GST_PIPEWIRE_SINK_H__
 
+#include <sys/types.h>
+
 #include <gst/gst.h>
 #include <gst/base/gstbasesink.h>
 
@@ -29,6 +31,9 @@ G_BEGIN_DECLS
 
 typedef struct _GstPipeWireSink GstPipeWireSink;
 typedef struct _GstPipeWireSinkClass GstPipeWireSinkClass;
+typedef struct _GstPipeWireSinkImport GstPipeWireSinkImport;
+
+#define GST_PIPEWIRE_SINK_MAX_IMPORTS   16
 
 
 /**
@@ -48,6 +53,21 @@ typedef enum
 
 #define GST_TYPE_PIPEWIRE_SINK_MODE (gst_pipewire_sink_mode_get_type ())
 
+/* An upstream fd memory that is sent in a PipeWire buffer of its own */
+struct _GstPipeWireSinkImport {
+  dev_t dev;
+  ino_t ino;
+  gsize offset;
+  int fd;
+  gsize maxsize;
+  gboolean dmabuf;
+
+  struct pw_buffer *b;
+  gboolean dequeued;
+  /* the upstream buffer, kept until the buffer is recycled */
+  GstBuffer *held;
+};
+
 /**
  * GstPipeWireSink:
  *
@@ -76,6 +96,26 @@ struct _GstPipeWireSink {
   GstPipeWireSinkMode mode;
 
   GstPipeWirePool *pool;
+  GPtrArray *formats;
+
+  /* upstream memory we send without copying */
+  GstPipeWireSinkImport imports[GST_PIPEWIRE_SINK_MAX_IMPORTS];
+  guint n_imports;
+  guint n_import_buffers;
+  gboolean import_dmabuf;
+  gboolean import_active;
+  gboolean import_failed;
+  /* the stream buffers use the upstream memory */
+  gboolean buffers_imported;
+  /* the stream buffers have no memory to copy into */
+  gboolean buffers_missing;
+  gboolean renegotiating;
+  /* we allocate the stream buffers, since the first import */
+  gboolean alloc_buffers;
+  /* the peer does not take the memory we allocate */
+  gboolean alloc_unsupported;
+  /* size of the memory we allocate for copying */
+  gsize buffer_size;
 };
 
 struct _GstPipeWireSinkClass {
@@ -25,6 +25,7 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <spa/buffer/damage.h>
 #include <spa/param/video/format.h>
 #include <spa/pod/builder.h>
 #include <spa/utils/result.h>
@@ -542,6 +543,81 @@ static const char *spa_transform_value_to_gst_image_orientation(uint32_t transfo
   return transform_map[transform_value];
 }
 
+static gboolean
+can_copy_damage (GstPipeWireSrc *pwsrc, GstPipeWirePoolData *data, struct spa_data *d)
+{
+  GstVideoInfo *info = &pwsrc->video_info;
+
+  /* only packed RGB frames in memory we can map have a simple layout
+   * to apply the damage to */
+  return pwsrc->is_video && data->damage != NULL &&
+      data->b->buffer->n_datas == 1 &&
+      d->type != SPA_DATA_DmaBuf &&
+      GST_VIDEO_INFO_N_PLANES (info) == 1 &&
+      GST_VIDEO_INFO_IS_RGB (info);
+}
+
+/* Copy only the damaged regions of the frame onto the copy of the previous
+ * frame. The whole frame is copied when the previous copy is still in use
+ * downstream or when we missed a frame. */
+static GstMemory *
+copy_damage (GstPipeWireSrc *pwsrc, GstPipeWirePoolData *data,
+    GstMemory *pmem, struct spa_data *d)
+{
+  GstVideoInfo *info = &pwsrc->video_info;
+  struct spa_meta *damage = data->damage;
+  struct spa_meta_header *h = data->header;
+  GstMemory *mem = pwsrc->damage_mem;
+  GstMapInfo src, dst;
+  guint32 stride = d->chunk->stride ? (guint32) d->chunk->stride :
+      (guint32) GST_VIDEO_INFO_PLANE_STRIDE (info, 0);
+  gsize copied;
+
+  if (mem == NULL ||
+      gst_memory_get_sizes (mem, NULL, NULL) != d->chunk->size ||
+      GST_MINI_OBJECT_REFCOUNT_VALUE (mem) != 1) {
+    if (mem)
+      gst_memory_unref (mem);
+    mem = pwsrc->damage_mem = gst_allocator_alloc (NULL, d->chunk->size, NULL);
+    damage = NULL;
+  }
+  if (h != NULL) {
+    if (h->seq != pwsrc->damage_seq + 1)
+      damage = NULL;
+    pwsrc->damage_seq = h->seq;
+  }
+
+  if (!gst_memory_map (pmem, &src, GST_MAP_READ))
+    goto error;
+  if (!gst_memory_map (mem, &dst, GST_MAP_WRITE)) {
+    gst_memory_unmap (pmem, &src);
+    goto error;
+  }
+  if (d->chunk->offset + (gsize) d->chunk->size > src.size ||
+      (gsize) stride * GST_VIDEO_INFO_HEIGHT (info) > d->chunk->size) {
+    /* not a layout we can apply the damage to, copy the chunk */
+    gsize offset = MIN (d->chunk->offset, src.size);
+    copied = MIN (src.size - offset, dst.size);
+    memcpy (dst.data, src.data + offset, copied);
+  } else {
+    copied = spa_damage_copy (dst.data, stride,
+        src.data + d->chunk->offset, stride,
+        GST_VIDEO_INFO_WIDTH (info), GST_VIDEO_INFO_HEIGHT (info),
+        GST_VIDEO_INFO_COMP_PSTRIDE (info, 0), damage);
+  }
+  gst_memory_unmap (mem, &dst);
+  gst_memory_unmap (pmem, &src);
+
+  GST_LOG_OBJECT (pwsrc, "copied %" G_GSIZE_FORMAT " of %u bytes", copied, d->chunk->size);
+
+  return gst_memory_ref (mem);
+
+error:
+  GST_WARNING_OBJECT (pwsrc, "can't map memory, copy the frame");
+  g_clear_pointer (&pwsrc->damage_mem, gst_memory_unref);
+  return gst_memory_copy (pmem, d->chunk->offset, d->chunk->size);
+}
+
 static GstBuffer *dequeue_buffer(GstPipeWireSrc *pwsrc)
 {
   struct pw_buffer *b;
@@ -645,6 +721,8 @@ static GstBuffer *dequeue_buffer(GstPipeWireSrc *pwsrc)
       GstMemory *mem;
       if (!pwsrc->always_copy)
         mem = gst_memory_share (pmem, d->chunk->offset, d->chunk->size);
+      else if (can_copy_damage (pwsrc, data, d))
+        mem = copy_damage (pwsrc, data, pmem, d);
       else
         mem = gst_memory_copy (pmem, d->chunk->offset, d->chunk->size);
       gst_buffer_insert_memory (buf, i, mem);
@@ -1000,9 +1078,9 @@ on_param_changed (void *data, uint32_t id,
   pwsrc->negotiated = pwsrc->caps != NULL;
 
   if (pwsrc->negotiated) {
-    const struct spa_pod *params[4];
+    const struct spa_pod *params[5];
     struct spa_pod_builder b = { NULL };
-    uint8_t buffer[512];
+    uint8_t buffer[1024];
     uint32_t buffers = CLAMP (16, pwsrc->min_buffers, pwsrc->max_buffers);
     int buffertypes;
 
@@ -1041,6 +1119,13 @@ on_param_changed (void *data, uint32_t id,
         SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
         SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoTransform),
         SPA_PARAM_META_size, SPA_POD_Int(sizeof (struct spa_meta_videotransform)));
+    params[4] = spa_pod_builder_add_object (&b,
+        SPA_TYPE_OBJECT_ParamMeta, SPA_PARAM_Meta,
+        SPA_PARAM_META_type, SPA_POD_Id(SPA_META_VideoDamage),
+        SPA_PARAM_META_size, SPA_POD_CHOICE_RANGE_Int(
+                                 sizeof (struct spa_meta_region) * 16,
+                                 sizeof (struct spa_meta_region) * 1,
+                                 sizeof (struct spa_meta_region) * 16));
 
     GST_DEBUG_OBJECT (pwsrc, "doing finish format");
     pw_stream_update_params (pwsrc->stream, params, SPA_N_ELEMENTS(params));
@@ -1299,6 +1384,7 @@ gst_pipewire_src_stop (GstBaseSrc * basesrc)
   pw_thread_loop_lock (pwsrc->core->loop);
   pwsrc->eos = false;
   gst_buffer_replace (&pwsrc->last_buffer, NULL);
+  g_clear_pointer (&pwsrc->damage_mem, gst_memory_unref);
   gst_caps_replace(&pwsrc->caps, NULL);
   pw_thread_loop_unlock (pwsrc->core->loop);
 
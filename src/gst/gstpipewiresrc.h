@@ -78,6 +78,10 @@ struct _GstPipeWireSrc {
   GstBuffer *last_buffer;
   GstStructure *stream_properties;
 
+  /* the last copied frame, updated with the damage of the next frames */
+  GstMemory *damage_mem;
+  guint64 damage_seq;
+
   GstPipeWirePool *pool;
   GstClock *clock;
   GstClockTime last_time;
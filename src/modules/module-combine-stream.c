@@ -20,6 +20,7 @@
 #include <spa/utils/string.h>
 #include <spa/utils/json.h>
 #include <spa/utils/ringbuffer.h>
+#include <spa/support/cpu.h>
 #include <spa/debug/types.h>
 #include <spa/pod/builder.h>
 #include <spa/param/audio/format-utils.h>
@@ -29,6 +30,8 @@
 #include <pipewire/impl.h>
 #include <pipewire/i18n.h>
 
+#include "module-combine-stream/mix.h"
+
 /** \page page_module_combine_stream PipeWire Module: Combine Stream
  *
  * The combine stream can make:
@@ -72,6 +75,9 @@
  * - `combine.audio.position`: map the combine audio positions to the stream positions.
  *                     combine input channels are mapped one-by-one to stream output channels.
  *
+ * When the combine stream is a source or capture, stream channels that map to
+ * the same combine channel are mixed together.
+ *
  * ## Example configuration
  *
  *\code{.unparsed}
@@ -271,12 +277,8 @@ struct impl {
 
 	struct spa_list streams;
 	uint32_t n_streams;
-};
 
-struct ringbuffer {
-	void *buf;
-	uint32_t idx;
-	uint32_t size;
+	struct combine_mix mix;
 };
 
 struct stream {
@@ -301,6 +303,8 @@ struct stream {
 	int64_t delay_nsec;		/* for main loop */
 	int64_t data_delay_nsec;	/* for data loop */
 
+	struct pw_buffer *buffer;	/* dequeued in the data loop */
+
 	unsigned int ready:1;
 	unsigned int added:1;
 	unsigned int have_latency:1;
@@ -346,53 +350,6 @@ static void parse_audio_info(const struct pw_properties *props, struct spa_audio
 		parse_position(info, DEFAULT_POSITION, strlen(DEFAULT_POSITION));
 }
 
-static void ringbuffer_init(struct ringbuffer *r, void *buf, uint32_t size)
-{
-	r->buf = buf;
-	r->idx = 0;
-	r->size = size;
-}
-
-static void ringbuffer_memcpy(struct ringbuffer *r, void *dst, void *src, uint32_t size)
-{
-	uint32_t avail;
-
-	avail = SPA_MIN(size, r->size);
-
-	/* buf to dst */
-	if (dst && avail > 0) {
-		spa_ringbuffer_read_data(NULL, r->buf, r->size, r->idx, dst, avail);
-		dst = SPA_PTROFF(dst, avail, void);
-	}
-
-	/* src to dst */
-	if (size > avail) {
-		if (dst)
-			memcpy(dst, src, size - avail);
-		src = SPA_PTROFF(src, size - avail, void);
-	}
-
-	/* src to buf */
-	if (avail > 0) {
-		spa_ringbuffer_write_data(NULL, r->buf, r->size, r->idx, src, avail);
-		r->idx = (r->idx + avail) % r->size;
-	}
-}
-
-static void ringbuffer_copy(struct ringbuffer *dst, struct ringbuffer *src)
-{
-	uint32_t l0, l1;
-
-	if (dst->size == 0 || src->size == 0)
-		return;
-
-	l0 = src->size - src->idx;
-	l1 = src->idx;
-
-	ringbuffer_memcpy(dst, NULL, SPA_PTROFF(src->buf, src->idx, void), l0);
-	ringbuffer_memcpy(dst, NULL, src->buf, l1);
-}
-
 static struct stream *find_stream(struct impl *impl, uint32_t id)
 {
 	struct stream *s;
@@ -966,22 +923,15 @@ static void combine_input_process(void *d)
 	struct stream *s;
 	bool delay_changed = false;
 
-	in = NULL;
-	while (true) {
-		struct pw_buffer *t;
-		if ((t = pw_stream_dequeue_buffer(impl->combine)) == NULL)
-			break;
-		if (in)
-			pw_stream_queue_buffer(impl->combine, in);
-		in = t;
-	}
+	in = pw_stream_dequeue_latest_buffer(impl->combine);
 	if (in == NULL) {
 		pw_log_debug("%p: out of input buffers: %m", impl);
 		return;
 	}
 
 	spa_list_for_each(s, &impl->streams, link) {
-		uint32_t j;
+		uint32_t j, outsize = 0;
+		int32_t stride = 0;
 
 		if (s->stream == NULL)
 			continue;
@@ -994,32 +944,36 @@ static void combine_input_process(void *d)
 			goto do_trigger;
 		}
 
+		for (j = 0; j < in->buffer->n_datas; j++) {
+			struct spa_data *ds = &in->buffer->datas[j];
+			uint32_t offs = SPA_MIN(ds->chunk->offset, ds->maxsize);
+			outsize = SPA_MAX(outsize, SPA_MIN(ds->chunk->size, ds->maxsize - offs));
+			stride = SPA_MAX(stride, ds->chunk->stride);
+		}
+
 		for (j = 0; j < out->buffer->n_datas; j++) {
 			struct spa_data *ds, *dd;
-			uint32_t outsize = 0, remap;
-			int32_t stride = 0;
+			uint32_t remap, size;
 
 			dd = &out->buffer->datas[j];
+			size = SPA_MIN(outsize, dd->maxsize);
 
 			remap = s->remap[j];
 			if (remap < in->buffer->n_datas) {
-				uint32_t offs, size;
+				uint32_t offs;
 
 				ds = &in->buffer->datas[remap];
 
 				offs = SPA_MIN(ds->chunk->offset, ds->maxsize);
-				size = SPA_MIN(ds->chunk->size, ds->maxsize - offs);
+				size = SPA_MIN(size, ds->maxsize - offs);
 
 				ringbuffer_memcpy(&s->delay[j],
 					dd->data, SPA_PTROFF(ds->data, offs, void), size);
-
-				outsize = SPA_MAX(outsize, size);
-				stride = SPA_MAX(stride, ds->chunk->stride);
 			} else {
-				memset(dd->data, 0, outsize);
+				memset(dd->data, 0, size);
 			}
 			dd->chunk->offset = 0;
-			dd->chunk->size = outsize;
+			dd->chunk->size = size;
 			dd->chunk->stride = stride;
 		}
 		pw_stream_queue_buffer(s->stream, out);
@@ -1041,6 +995,8 @@ static void combine_output_process(void *d)
 	struct pw_buffer *in, *out;
 	struct stream *s;
 	bool delay_changed = false;
+	uint32_t i, j, size = UINT32_MAX;
+	int32_t stride = 0;
 
 	if ((out = pw_stream_dequeue_buffer(impl->combine)) == NULL) {
 		pw_log_debug("%p: out of output buffers: %m", impl);
@@ -1048,7 +1004,7 @@ static void combine_output_process(void *d)
 	}
 
 	spa_list_for_each(s, &impl->streams, link) {
-		uint32_t j;
+		s->buffer = NULL;
 
 		if (s->stream == NULL)
 			continue;
@@ -1056,51 +1012,71 @@ static void combine_output_process(void *d)
 		if (check_stream_delay(s))
 			delay_changed = true;
 
-		in = NULL;
-		while (true) {
-			struct pw_buffer *t;
-			if ((t = pw_stream_dequeue_buffer(s->stream)) == NULL)
-				break;
-			if (in)
-				pw_stream_queue_buffer(s->stream, in);
-			in = t;
-		}
+		in = pw_stream_dequeue_latest_buffer(s->stream);
 		if (in == NULL) {
 			pw_log_debug("%p: out of input buffers: %m", s);
 			continue;
 		}
 		s->ready = false;
+		s->buffer = in;
 
+		/* mix the part that all streams provide */
 		for (j = 0; j < in->buffer->n_datas; j++) {
-			struct spa_data *ds, *dd;
-			uint32_t outsize = 0, remap;
-			int32_t stride = 0;
-
-			ds = &in->buffer->datas[j];
-
-			/* FIXME, need to do mixing for overlapping streams */
-			remap = s->remap[j];
-			if (remap < out->buffer->n_datas) {
-				uint32_t offs, size;
+			struct spa_data *ds = &in->buffer->datas[j];
+			uint32_t offs = SPA_MIN(ds->chunk->offset, ds->maxsize);
+			uint32_t sz = SPA_MIN(ds->chunk->size, ds->maxsize - offs);
+
+			if (s->remap[j] >= out->buffer->n_datas || sz == 0)
+				continue;
+			size = SPA_MIN(size, sz);
+			stride = SPA_MAX(stride, ds->chunk->stride);
+		}
+	}
+	if (size == UINT32_MAX)
+		size = 0;
 
-				dd = &out->buffer->datas[remap];
+	for (i = 0; i < out->buffer->n_datas; i++) {
+		struct spa_data *dd = &out->buffer->datas[i];
+		struct mix_src src[MIX_MAX_SRC];
+		uint32_t n_src = 0, outsize = SPA_MIN(size, dd->maxsize);
 
-				offs = SPA_MIN(ds->chunk->offset, ds->maxsize);
-				size = SPA_MIN(ds->chunk->size, ds->maxsize - offs);
-				size = SPA_MIN(size, dd->maxsize);
+		spa_list_for_each(s, &impl->streams, link) {
+			if (s->buffer == NULL)
+				continue;
 
-				ringbuffer_memcpy(&s->delay[j],
-					dd->data, SPA_PTROFF(ds->data, offs, void), size);
+			for (j = 0; j < s->buffer->buffer->n_datas; j++) {
+				struct spa_data *ds = &s->buffer->buffer->datas[j];
+				uint32_t offs;
 
-				outsize = SPA_MAX(outsize, size);
-				stride = SPA_MAX(stride, ds->chunk->stride);
+				if (s->remap[j] != i)
+					continue;
 
-				dd->chunk->offset = 0;
-				dd->chunk->size = outsize;
-				dd->chunk->stride = stride;
+				offs = SPA_MIN(ds->chunk->offset, ds->maxsize);
+				if (SPA_MIN(ds->chunk->size, ds->maxsize - offs) < outsize)
+					continue;
+
+				if (n_src == MIX_MAX_SRC) {
+					pw_log_trace("%p: too many sources for channel %d", impl, i);
+					continue;
+				}
+				src[n_src++] = (struct mix_src) {
+					.delay = &s->delay[j],
+					.data = SPA_PTROFF(ds->data, offs, const float),
+				};
 			}
 		}
-		pw_stream_queue_buffer(s->stream, in);
+		combine_mix_process(&impl->mix, dd->data, src, n_src,
+				outsize / sizeof(float));
+
+		dd->chunk->offset = 0;
+		dd->chunk->size = outsize;
+		dd->chunk->stride = stride;
+	}
+
+	spa_list_for_each(s, &impl->streams, link) {
+		if (s->buffer != NULL)
+			pw_stream_queue_buffer(s->stream, s->buffer);
+		s->buffer = NULL;
 	}
 	pw_stream_queue_buffer(impl->combine, out);
 
@@ -1272,6 +1248,8 @@ static void impl_destroy(struct impl *impl)
 	pw_properties_free(impl->combine_props);
 	pw_properties_free(impl->props);
 
+	combine_mix_free(&impl->mix);
+
 	free(impl);
 }
 
@@ -1304,6 +1282,9 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	struct pw_properties *props = NULL;
 	uint32_t id = pw_global_get_id(pw_impl_module_get_global(module));
 	uint32_t pid = getpid();
+	const struct spa_support *support;
+	uint32_t n_support;
+	struct spa_cpu *cpu_iface;
 	struct impl *impl;
 	const char *str, *prefix;
 	int res;
@@ -1320,6 +1301,14 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 
 	spa_list_init(&impl->streams);
 
+	support = pw_context_get_support(context, &n_support);
+	cpu_iface = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_CPU);
+	if ((res = combine_mix_init(&impl->mix,
+			cpu_iface ? spa_cpu_get_flags(cpu_iface) : 0)) < 0) {
+		pw_log_error("can't init mixer: %s", spa_strerror(res));
+		goto error;
+	}
+
 	if (args == NULL)
 		args = "";
 
@@ -0,0 +1,161 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <spa/support/cpu.h>
+
+#include <pipewire/pipewire.h>
+
+#include "mix.h"
+
+#define MAX_SAMPLES	1024
+#define MAX_STREAMS	8
+#define MAX_COUNT	10000
+
+#define DELAY_SAMPLES	240
+
+static float samp_in[MAX_STREAMS][MAX_SAMPLES];
+static float samp_out[MAX_SAMPLES];
+static float delay_buf[MAX_STREAMS][DELAY_SAMPLES];
+
+static const uint32_t stream_counts[] = { 1, 2, 4, 8 };
+
+struct stats {
+	uint32_t n_streams;
+	bool delay;
+	uint64_t perf;
+	const char *impl;
+};
+
+#define MAX_RESULTS	(SPA_N_ELEMENTS(stream_counts) * 2 * 3)
+
+static uint32_t n_results = 0;
+static struct stats results[MAX_RESULTS];
+
+static struct combine_mix mix;
+
+static void setup_delay(struct ringbuffer *delay, uint32_t n_streams, bool with_delay)
+{
+	uint32_t i;
+	for (i = 0; i < n_streams; i++)
+		ringbuffer_init(&delay[i], delay_buf[i],
+				with_delay ? sizeof(delay_buf[i]) : 0);
+}
+
+static void add_result(const char *impl, uint32_t n_streams, bool with_delay,
+		uint64_t t1, uint64_t t2)
+{
+	spa_assert(n_results < MAX_RESULTS);
+
+	results[n_results++] = (struct stats) {
+		.n_streams = n_streams,
+		.delay = with_delay,
+		.perf = MAX_COUNT * (uint64_t)SPA_NSEC_PER_SEC / (t2 - t1),
+		.impl = impl,
+	};
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+/* each stream copies over the previous one, as before mixing was done */
+static void run_copy(uint32_t n_streams, bool with_delay)
+{
+	struct ringbuffer delay[MAX_STREAMS];
+	uint64_t t1, t2;
+	uint32_t i, j;
+
+	setup_delay(delay, n_streams, with_delay);
+
+	t1 = get_time();
+	for (i = 0; i < MAX_COUNT; i++) {
+		for (j = 0; j < n_streams; j++)
+			ringbuffer_memcpy(&delay[j], samp_out, samp_in[j],
+					MAX_SAMPLES * sizeof(float));
+	}
+	t2 = get_time();
+
+	add_result("copy", n_streams, with_delay, t1, t2);
+}
+
+static void run_mix(const char *impl, uint32_t cpu_flags, uint32_t n_streams, bool with_delay)
+{
+	struct ringbuffer delay[MAX_STREAMS];
+	struct mix_src src[MAX_STREAMS];
+	uint64_t t1, t2;
+	uint32_t i;
+
+	combine_mix_free(&mix);
+	spa_assert_se(combine_mix_init(&mix, cpu_flags) >= 0);
+
+	setup_delay(delay, n_streams, with_delay);
+	for (i = 0; i < n_streams; i++)
+		src[i] = (struct mix_src) { .delay = &delay[i], .data = samp_in[i] };
+
+	t1 = get_time();
+	for (i = 0; i < MAX_COUNT; i++)
+		combine_mix_process(&mix, samp_out, src, n_streams, MAX_SAMPLES);
+	t2 = get_time();
+
+	add_result(impl, n_streams, with_delay, t1, t2);
+}
+
+static int compare_func(const void *_a, const void *_b)
+{
+	const struct stats *a = _a, *b = _b;
+	int diff;
+	if ((diff = (int)a->delay - (int)b->delay) != 0) return diff;
+	if ((diff = a->n_streams - b->n_streams) != 0) return diff;
+	if (a->perf != b->perf) return a->perf < b->perf ? 1 : -1;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct spa_support support[16];
+	uint32_t i, j, n_support, cpu_flags = 0;
+	struct spa_cpu *cpu;
+
+	pw_init(&argc, &argv);
+
+	n_support = pw_get_support(support, SPA_N_ELEMENTS(support));
+	cpu = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_CPU);
+	if (cpu != NULL)
+		cpu_flags = spa_cpu_get_flags(cpu);
+	printf("got get CPU flags %d\n", cpu_flags);
+
+	for (i = 0; i < MAX_STREAMS; i++)
+		for (j = 0; j < MAX_SAMPLES; j++)
+			samp_in[i][j] = drand48() - 0.5;
+
+	for (i = 0; i < SPA_N_ELEMENTS(stream_counts); i++) {
+		for (j = 0; j < 2; j++) {
+			run_copy(stream_counts[i], j);
+			run_mix("c", 0, stream_counts[i], j);
+			if (cpu_flags != 0)
+				run_mix("simd", cpu_flags, stream_counts[i], j);
+		}
+	}
+	combine_mix_free(&mix);
+
+	qsort(results, n_results, sizeof(struct stats), compare_func);
+
+	for (i = 0; i < n_results; i++) {
+		struct stats *s = &results[i];
+		fprintf(stderr, "%-12."PRIu64" \t%-8s samples %d, streams %d, delay %d\n",
+				s->perf, s->impl, MAX_SAMPLES, s->n_streams, s->delay);
+	}
+
+	pw_deinit();
+	return 0;
+}
@@ -0,0 +1,139 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PIPEWIRE_COMBINE_STREAM_MIX_H
+#define PIPEWIRE_COMBINE_STREAM_MIX_H
+
+#include <string.h>
+
+#include <spa/utils/defs.h>
+#include <spa/utils/ringbuffer.h>
+#include <spa/param/audio/raw.h>
+
+#include <spa/plugins/audiomixer/mix-ops.h>
+
+#define MIX_MAX_SRC	16
+#define MIX_CHUNK	1024
+
+struct ringbuffer {
+	void *buf;
+	uint32_t idx;
+	uint32_t size;
+};
+
+static inline void ringbuffer_init(struct ringbuffer *r, void *buf, uint32_t size)
+{
+	r->buf = buf;
+	r->idx = 0;
+	r->size = size;
+}
+
+static inline void ringbuffer_memcpy(struct ringbuffer *r, void *dst, const void *src, uint32_t size)
+{
+	uint32_t avail;
+
+	avail = SPA_MIN(size, r->size);
+
+	/* buf to dst */
+	if (dst && avail > 0) {
+		spa_ringbuffer_read_data(NULL, r->buf, r->size, r->idx, dst, avail);
+		dst = SPA_PTROFF(dst, avail, void);
+	}
+
+	/* src to dst */
+	if (size > avail) {
+		if (dst)
+			memcpy(dst, src, size - avail);
+		src = SPA_PTROFF(src, size - avail, void);
+	}
+
+	/* src to buf */
+	if (avail > 0) {
+		spa_ringbuffer_write_data(NULL, r->buf, r->size, r->idx, src, avail);
+		r->idx = (r->idx + avail) % r->size;
+	}
+}
+
+static inline void ringbuffer_copy(struct ringbuffer *dst, struct ringbuffer *src)
+{
+	uint32_t l0, l1;
+
+	if (dst->size == 0 || src->size == 0)
+		return;
+
+	l0 = src->size - src->idx;
+	l1 = src->idx;
+
+	ringbuffer_memcpy(dst, NULL, SPA_PTROFF(src->buf, src->idx, void), l0);
+	ringbuffer_memcpy(dst, NULL, src->buf, l1);
+}
+
+/** a source channel for the mixer, with its delay line */
+struct mix_src {
+	struct ringbuffer *delay;
+	const float *data;
+};
+
+struct combine_mix {
+	struct mix_ops ops;
+	float tmp[MIX_MAX_SRC][MIX_CHUNK];
+};
+
+static inline int combine_mix_init(struct combine_mix *mix, uint32_t cpu_flags)
+{
+	mix->ops.fmt = SPA_AUDIO_FORMAT_F32P;
+	mix->ops.n_channels = 1;
+	mix->ops.cpu_flags = cpu_flags;
+	return mix_ops_init(&mix->ops);
+}
+
+static inline void combine_mix_free(struct combine_mix *mix)
+{
+	if (mix->ops.free)
+		mix_ops_free(&mix->ops);
+}
+
+/** Mix n_src channels into dst.
+ *
+ * Sources without delay are mixed directly from their buffers. Sources with
+ * a delay line are passed through it in chunks. A single source is copied
+ * into dst without going through the mixer. */
+static inline void combine_mix_process(struct combine_mix *mix, float *dst,
+		struct mix_src *src, uint32_t n_src, uint32_t n_samples)
+{
+	const void *s[MIX_MAX_SRC];
+	uint32_t i, offs, chunk, n_delayed = 0;
+
+	n_src = SPA_MIN(n_src, (uint32_t)MIX_MAX_SRC);
+
+	if (n_src == 1) {
+		ringbuffer_memcpy(src[0].delay, dst, src[0].data,
+				n_samples * sizeof(float));
+		return;
+	}
+	for (i = 0; i < n_src; i++) {
+		if (src[i].delay->size > 0)
+			n_delayed++;
+		s[i] = src[i].data;
+	}
+	if (n_delayed == 0) {
+		mix_ops_process(&mix->ops, dst, s, n_src, n_samples);
+		return;
+	}
+	for (offs = 0; offs < n_samples; offs += chunk) {
+		chunk = SPA_MIN(n_samples - offs, (uint32_t)MIX_CHUNK);
+
+		for (i = 0; i < n_src; i++) {
+			s[i] = src[i].data + offs;
+			if (src[i].delay->size > 0) {
+				ringbuffer_memcpy(src[i].delay, mix->tmp[i],
+						s[i], chunk * sizeof(float));
+				s[i] = mix->tmp[i];
+			}
+		}
+		mix_ops_process(&mix->ops, dst + offs, s, n_src, chunk);
+	}
+}
+
+#endif /* PIPEWIRE_COMBINE_STREAM_MIX_H */
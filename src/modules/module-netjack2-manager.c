@@ -29,6 +29,7 @@
 #include <spa/param/audio/format-utils.h>
 #include <spa/param/latency-utils.h>
 #include <spa/param/audio/raw.h>
+#include <spa/support/cpu.h>
 
 #include <pipewire/impl.h>
 #include <pipewire/i18n.h>
@@ -180,7 +181,7 @@ struct stream {
 	uint32_t n_ports;
 	struct port *ports[MAX_PORTS];
 
-	struct volume volume;
+	struct netjack2_volume volume;
 
 	uint32_t active_audio_ports;
 	uint32_t active_midi_ports;
@@ -225,6 +226,7 @@ struct impl {
 	struct pw_loop *main_loop;
 	struct pw_loop *data_loop;
 	struct spa_system *system;
+	uint32_t cpu_flags;
 
 #define MODE_SINK	(1<<0)
 #define MODE_SOURCE	(1<<1)
@@ -260,7 +262,7 @@ struct impl {
 	unsigned int do_disconnect:1;
 };
 
-static void reset_volume(struct volume *vol, uint32_t n_volumes)
+static void reset_volume(struct netjack2_volume *vol, uint32_t n_volumes)
 {
 	uint32_t i;
 	vol->mute = false;
@@ -581,7 +583,7 @@ static void make_stream_ports(struct stream *s)
 }
 
 static struct spa_pod *make_props_param(struct spa_pod_builder *b,
-		struct volume *vol)
+		struct netjack2_volume *vol)
 {
 	return spa_pod_builder_add_object(b, SPA_TYPE_OBJECT_Props, SPA_PARAM_Props,
 			SPA_PROP_mute, SPA_POD_Bool(vol->mute),
@@ -1011,7 +1013,9 @@ static int handle_follower_available(struct impl *impl, struct nj2_session_param
 	peer->other_stream = 'r';
 	peer->send_volume = &follower->sink.volume;
 	peer->recv_volume = &follower->source.volume;
-	netjack2_init(peer);
+	peer->cpu_flags = impl->cpu_flags;
+	if ((res = netjack2_init(peer)) < 0)
+		goto init_failed;
 
 	int bufsize = NETWORK_MAX_LATENCY * (peer->params.mtu +
 		follower->period_size * sizeof(float) *
@@ -1043,6 +1047,9 @@ socket_failed:
 	res = fd;
 	pw_log_error("can't create socket: %s", spa_strerror(res));
 	goto cleanup;
+init_failed:
+	pw_log_error("can't init follower: %s", spa_strerror(res));
+	goto cleanup;
 cleanup:
 	follower_free(follower);
 	return res;
@@ -1254,6 +1261,9 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	struct pw_context *context = pw_impl_module_get_context(module);
 	struct pw_properties *props = NULL;
 	struct pw_data_loop *data_loop;
+	const struct spa_support *support;
+	struct spa_cpu *cpu_iface;
+	uint32_t n_support;
 	struct impl *impl;
 	const char *str;
 	int res;
@@ -1293,6 +1303,10 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	impl->main_loop = pw_context_get_main_loop(context);
 	impl->system = impl->main_loop->system;
 
+	support = pw_context_get_support(context, &n_support);
+	cpu_iface = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_CPU);
+	impl->cpu_flags = cpu_iface ? spa_cpu_get_flags(cpu_iface) : 0;
+
 	impl->mode = MODE_DUPLEX;
 	if ((str = pw_properties_get(props, "tunnel.mode")) != NULL) {
 		if (spa_streq(str, "source")) {
@@ -0,0 +1,202 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <spa/support/cpu.h>
+
+#include <pipewire/pipewire.h>
+
+#include "convert.h"
+
+#define MAX_SAMPLES	1024
+#define N_CHANNELS	128
+#define MAX_COUNT	2000
+
+#define VOLUME		0.8f
+
+static float samp_f32[N_CHANNELS][MAX_SAMPLES] SPA_ALIGNED(32);
+static float out_f32[N_CHANNELS][MAX_SAMPLES] SPA_ALIGNED(32);
+static int16_t samp_s16[N_CHANNELS][MAX_SAMPLES] SPA_ALIGNED(32);
+/* float packets have a 4 byte port id in front of the samples */
+static uint8_t packet[N_CHANNELS * (MAX_SAMPLES * sizeof(float) + sizeof(int32_t))];
+
+static const uint32_t sample_counts[] = { 64, 256, 1024 };
+
+enum {
+	OP_SEND_F32,
+	OP_RECV_F32,
+	OP_TO_S16,
+	OP_FROM_S16,
+	N_OPS,
+};
+static const char *op_names[] = { "send-f32", "recv-f32", "to-s16", "from-s16" };
+
+struct stats {
+	uint32_t op;
+	uint32_t n_samples;
+	uint64_t perf;
+	const char *impl;
+};
+
+#define MAX_RESULTS	(SPA_N_ELEMENTS(sample_counts) * N_OPS * 3)
+
+static uint32_t n_results = 0;
+static struct stats results[MAX_RESULTS];
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static inline float *packet_samples(uint32_t ch, uint32_t n_samples)
+{
+	return SPA_PTROFF(packet, ch * (n_samples * sizeof(float) + sizeof(int32_t)) +
+			sizeof(int32_t), float);
+}
+
+/* the scalar loops as they were used before */
+static void run_scalar(uint32_t op, uint32_t ch, uint32_t n_samples)
+{
+	float *p = packet_samples(ch, n_samples);
+	int16_t *s16 = (int16_t*)packet;
+	uint32_t i;
+
+	switch (op) {
+	case OP_SEND_F32:
+		for (i = 0; i < n_samples; i++)
+			p[i] = samp_f32[ch][i] * VOLUME;
+		break;
+	case OP_RECV_F32:
+		for (i = 0; i < n_samples; i++)
+			out_f32[ch][i] = p[i] * VOLUME;
+		break;
+	case OP_TO_S16:
+		for (i = 0; i < n_samples; i++)
+			s16[ch * n_samples + i] = (int16_t)SPA_CLAMPF(samp_f32[ch][i] * VOLUME * S16_SCALE,
+					S16_MIN, S16_MAX);
+		break;
+	case OP_FROM_S16:
+		for (i = 0; i < n_samples; i++)
+			out_f32[ch][i] = S16_TO_F32(samp_s16[ch][i]) * VOLUME;
+		break;
+	}
+}
+
+static void run_convert(struct netjack2_convert *c, struct netjack2_volume *vol,
+		uint32_t op, uint32_t ch, uint32_t n_samples)
+{
+	float *p = packet_samples(ch, n_samples);
+	int16_t *s16 = (int16_t*)packet;
+	uint32_t v = ch % SPA_AUDIO_MAX_CHANNELS;
+
+	switch (op) {
+	case OP_SEND_F32:
+		do_volume(c, p, samp_f32[ch], vol, v, n_samples, false);
+		break;
+	case OP_RECV_F32:
+		do_volume(c, out_f32[ch], p, vol, v, n_samples, true);
+		break;
+	case OP_TO_S16:
+		do_volume_to_s16(c, &s16[ch * n_samples], samp_f32[ch], vol, v, n_samples);
+		break;
+	case OP_FROM_S16:
+		do_volume_from_s16(c, out_f32[ch], samp_s16[ch], vol, v, n_samples);
+		break;
+	}
+}
+
+static void run_test(const char *impl, uint32_t cpu_flags, uint32_t op, uint32_t n_samples)
+{
+	struct netjack2_convert c;
+	struct netjack2_volume vol = { .n_volumes = SPA_AUDIO_MAX_CHANNELS, };
+	uint64_t t1, t2;
+	uint32_t i, j;
+
+	for (i = 0; i < SPA_AUDIO_MAX_CHANNELS; i++)
+		vol.volumes[i] = VOLUME;
+
+	if (impl != NULL)
+		spa_assert_se(netjack2_convert_init(&c, cpu_flags) == 0);
+
+	t1 = get_time();
+	for (i = 0; i < MAX_COUNT; i++) {
+		for (j = 0; j < N_CHANNELS; j++) {
+			if (impl == NULL)
+				run_scalar(op, j, n_samples);
+			else
+				run_convert(&c, &vol, op, j, n_samples);
+		}
+	}
+	t2 = get_time();
+
+	if (impl != NULL)
+		netjack2_convert_free(&c);
+
+	spa_assert(n_results < MAX_RESULTS);
+	results[n_results++] = (struct stats) {
+		.op = op,
+		.n_samples = n_samples,
+		.perf = MAX_COUNT * (uint64_t)SPA_NSEC_PER_SEC / (t2 - t1),
+		.impl = impl ? impl : "scalar",
+	};
+}
+
+static int compare_func(const void *_a, const void *_b)
+{
+	const struct stats *a = _a, *b = _b;
+	int diff;
+	if ((diff = (int)a->op - (int)b->op) != 0) return diff;
+	if ((diff = (int)a->n_samples - (int)b->n_samples) != 0) return diff;
+	if (a->perf != b->perf) return a->perf < b->perf ? 1 : -1;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct spa_support support[16];
+	uint32_t i, j, n_support, cpu_flags = 0;
+	struct spa_cpu *cpu;
+
+	pw_init(&argc, &argv);
+
+	n_support = pw_get_support(support, SPA_N_ELEMENTS(support));
+	cpu = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_CPU);
+	if (cpu != NULL)
+		cpu_flags = spa_cpu_get_flags(cpu);
+	printf("got get CPU flags %d\n", cpu_flags);
+
+	for (i = 0; i < N_CHANNELS; i++) {
+		for (j = 0; j < MAX_SAMPLES; j++) {
+			samp_f32[i][j] = drand48() - 0.5;
+			samp_s16[i][j] = (int16_t)(drand48() * 65535 - 32768);
+		}
+	}
+
+	for (i = 0; i < SPA_N_ELEMENTS(sample_counts); i++) {
+		for (j = 0; j < N_OPS; j++) {
+			run_test(NULL, 0, j, sample_counts[i]);
+			run_test("c", 0, j, sample_counts[i]);
+			if (cpu_flags != 0)
+				run_test("simd", cpu_flags, j, sample_counts[i]);
+		}
+	}
+
+	qsort(results, n_results, sizeof(struct stats), compare_func);
+
+	for (i = 0; i < n_results; i++) {
+		struct stats *s = &results[i];
+		fprintf(stderr, "%-12."PRIu64" \t%-8s %-10s samples %d, channels %d\n",
+				s->perf, s->impl, op_names[s->op], s->n_samples, N_CHANNELS);
+	}
+
+	pw_deinit();
+	return 0;
+}
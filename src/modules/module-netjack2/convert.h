@@ -0,0 +1,178 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PIPEWIRE_NETJACK2_CONVERT_H
+#define PIPEWIRE_NETJACK2_CONVERT_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <spa/utils/defs.h>
+#include <spa/param/audio/raw.h>
+
+#include <spa/plugins/audioconvert/fmt-ops.h>
+#include <spa/plugins/audioconvert/volume-ops.h>
+
+#define CONVERT_MAX_SAMPLES	8192
+
+struct netjack2_volume {
+	bool mute;
+	uint32_t n_volumes;
+	float volumes[SPA_AUDIO_MAX_CHANNELS];
+};
+
+/** per peer converters for the netjack2 sample encodings */
+struct netjack2_convert {
+	struct volume volume;
+	struct convert to_s16;
+	struct convert from_s16;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	struct convert to_le;
+	struct convert from_le;
+#endif
+	void *tmp_data;
+	float *tmp;
+};
+
+static inline int netjack2_convert_init_one(struct convert *conv,
+		uint32_t src_fmt, uint32_t dst_fmt, uint32_t cpu_flags)
+{
+	spa_zero(*conv);
+	conv->src_fmt = src_fmt;
+	conv->dst_fmt = dst_fmt;
+	conv->n_channels = 1;
+	conv->cpu_flags = cpu_flags;
+	return convert_init(conv);
+}
+
+static inline void netjack2_convert_free(struct netjack2_convert *c)
+{
+	if (c->volume.free)
+		volume_free(&c->volume);
+	if (c->to_s16.free)
+		convert_free(&c->to_s16);
+	if (c->from_s16.free)
+		convert_free(&c->from_s16);
+#if __BYTE_ORDER == __BIG_ENDIAN
+	if (c->to_le.free)
+		convert_free(&c->to_le);
+	if (c->from_le.free)
+		convert_free(&c->from_le);
+#endif
+	free(c->tmp_data);
+	spa_zero(*c);
+}
+
+static inline int netjack2_convert_init(struct netjack2_convert *c, uint32_t cpu_flags)
+{
+	int res;
+
+	spa_zero(*c);
+	c->volume.cpu_flags = cpu_flags;
+	if ((res = volume_init(&c->volume)) < 0)
+		goto error;
+	if ((res = netjack2_convert_init_one(&c->to_s16, SPA_AUDIO_FORMAT_F32P,
+			SPA_AUDIO_FORMAT_S16, cpu_flags)) < 0)
+		goto error;
+	if ((res = netjack2_convert_init_one(&c->from_s16, SPA_AUDIO_FORMAT_S16,
+			SPA_AUDIO_FORMAT_F32P, cpu_flags)) < 0)
+		goto error;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	if ((res = netjack2_convert_init_one(&c->to_le, SPA_AUDIO_FORMAT_F32P,
+			SPA_AUDIO_FORMAT_F32_OE, cpu_flags)) < 0)
+		goto error;
+	if ((res = netjack2_convert_init_one(&c->from_le, SPA_AUDIO_FORMAT_F32_OE,
+			SPA_AUDIO_FORMAT_F32P, cpu_flags)) < 0)
+		goto error;
+#endif
+	c->tmp_data = calloc(1, CONVERT_MAX_SAMPLES * sizeof(float) + FMT_OPS_MAX_ALIGN);
+	if (c->tmp_data == NULL) {
+		res = -errno;
+		goto error;
+	}
+	c->tmp = SPA_PTR_ALIGN(c->tmp_data, FMT_OPS_MAX_ALIGN, float);
+	return 0;
+error:
+	netjack2_convert_free(c);
+	return res;
+}
+
+static inline void do_convert(struct convert *conv, void *dst, const void *src,
+		uint32_t n_samples)
+{
+	void *d[1] = { dst };
+	const void *s[1] = { src };
+	convert_process(conv, d, s, n_samples);
+}
+
+/** Copy float samples from or to the wire with volume applied.
+ *
+ * The wire format is little endian float. The volume is applied on the host
+ * format: after swapping when receiving, before swapping when sending. */
+static inline void do_volume(struct netjack2_convert *c, float *dst, const float *src,
+		struct netjack2_volume *vol, uint32_t ch, uint32_t n_samples, bool recv)
+{
+	float v = vol->mute ? 0.0f : vol->volumes[ch];
+
+	if (v == 0.0f || src == NULL) {
+		memset(dst, 0, n_samples * sizeof(float));
+		return;
+	}
+#if __BYTE_ORDER == __BIG_ENDIAN
+	uint32_t i, n;
+	for (i = 0; i < n_samples; i += n) {
+		n = SPA_MIN(n_samples - i, (uint32_t)CONVERT_MAX_SAMPLES);
+		if (recv) {
+			do_convert(&c->from_le, c->tmp, &src[i], n);
+			volume_process(&c->volume, &dst[i], c->tmp, v, n);
+		} else {
+			volume_process(&c->volume, c->tmp, &src[i], v, n);
+			do_convert(&c->to_le, &dst[i], c->tmp, n);
+		}
+	}
+#else
+	volume_process(&c->volume, dst, src, v, n_samples);
+#endif
+}
+
+static inline void do_volume_to_s16(struct netjack2_convert *c, int16_t *dst, const float *src,
+		struct netjack2_volume *vol, uint32_t ch, uint32_t n_samples)
+{
+	float v = vol->mute ? 0.0f : vol->volumes[ch];
+	uint32_t i, n;
+
+	if (v == 0.0f || src == NULL)
+		memset(dst, 0, n_samples * sizeof(int16_t));
+	else if (v == 1.0f)
+		do_convert(&c->to_s16, dst, src, n_samples);
+	else {
+		for (i = 0; i < n_samples; i += n) {
+			n = SPA_MIN(n_samples - i, (uint32_t)CONVERT_MAX_SAMPLES);
+			volume_process(&c->volume, c->tmp, &src[i], v, n);
+			do_convert(&c->to_s16, &dst[i], c->tmp, n);
+		}
+	}
+}
+
+static inline void do_volume_from_s16(struct netjack2_convert *c, float *dst, const int16_t *src,
+		struct netjack2_volume *vol, uint32_t ch, uint32_t n_samples)
+{
+	float v = vol->mute ? 0.0f : vol->volumes[ch];
+	uint32_t i, n;
+
+	if (v == 0.0f || src == NULL)
+		memset(dst, 0, n_samples * sizeof(float));
+	else if (v == 1.0f)
+		do_convert(&c->from_s16, dst, src, n_samples);
+	else {
+		for (i = 0; i < n_samples; i += n) {
+			n = SPA_MIN(n_samples - i, (uint32_t)CONVERT_MAX_SAMPLES);
+			do_convert(&c->from_s16, c->tmp, &src[i], n);
+			volume_process(&c->volume, &dst[i], c->tmp, v, n);
+		}
+	}
+}
+
+#endif /* PIPEWIRE_NETJACK2_CONVERT_H */
@@ -1,106 +1,12 @@
 
-#include <byteswap.h>
-
 #ifdef HAVE_OPUS_CUSTOM
 #include <opus/opus.h>
 #include <opus/opus_custom.h>
 #endif
 
-#define MAX_BUFFER_FRAMES	8192
-
-struct volume {
-	bool mute;
-	uint32_t n_volumes;
-	float volumes[SPA_AUDIO_MAX_CHANNELS];
-};
-
-static inline float bswap_f32(float f)
-{
-	union {
-		float f;
-		uint32_t u;
-	} v;
-	v.f = f;
-	v.u = bswap_32(v.u);
-	return v.f;
-}
-
-static inline void do_volume(float *dst, const float *src, struct volume *vol,
-		uint32_t ch, uint32_t n_samples, bool recv)
-{
-	float v = vol->mute ? 0.0f : vol->volumes[ch];
-	uint32_t i;
-
-	if (v == 0.0f || src == NULL)
-		memset(dst, 0, n_samples * sizeof(float));
-	else if (v == 1.0f) {
-#if __BYTE_ORDER == __BIG_ENDIAN
-		for (i = 0; i < n_samples; i++)
-			dst[i] = bswap_f32(src[i]);
-#else
-		memcpy(dst, src, n_samples * sizeof(float));
-#endif
-
-	} else {
-#if __BYTE_ORDER == __BIG_ENDIAN
-		if (recv) {
-			for (i = 0; i < n_samples; i++)
-				dst[i] = bswap_f32(src[i]) * v;
-		} else {
-			for (i = 0; i < n_samples; i++)
-				dst[i] = bswap_f32(src[i] * v);
-		}
-#else
-		for (i = 0; i < n_samples; i++)
-			dst[i] = src[i] * v;
-#endif
-	}
-}
-
-#define ITOF(type,v,scale) \
-	(((type)(v)) * (1.0f / (scale)))
-#define FTOI(type,v,scale,min,max) \
-	(type)(SPA_CLAMPF((v) * (scale), min, max))
-
-#define S16_MIN			-32768
-#define S16_MAX			32767
-#define S16_SCALE		32768.0f
-#define S16_TO_F32(v)		ITOF(int16_t, v, S16_SCALE)
-#define F32_TO_S16(v)		FTOI(int16_t, v, S16_SCALE, S16_MIN, S16_MAX)
-
-static inline void do_volume_to_s16(int16_t *dst, const float *src, struct volume *vol,
-		uint32_t ch, uint32_t n_samples)
-{
-	float v = vol->mute ? 0.0f : vol->volumes[ch];
-	uint32_t i;
-
-	if (v == 0.0f || src == NULL)
-		memset(dst, 0, n_samples * sizeof(int16_t));
-	else if (v == 1.0f) {
-		for (i = 0; i < n_samples; i++)
-			dst[i] = F32_TO_S16(src[i]);
-	} else {
-		for (i = 0; i < n_samples; i++)
-			dst[i] = F32_TO_S16(src[i] * v);
-	}
-}
-
-static inline void do_volume_from_s16(float *dst, const int16_t *src, struct volume *vol,
-		uint32_t ch, uint32_t n_samples)
-{
-	float v = vol->mute ? 0.0f : vol->volumes[ch];
-	uint32_t i;
+#include "convert.h"
 
-	if (v == 0.0f || src == NULL)
-		memset(dst, 0, n_samples * sizeof(float));
-	else if (v == 1.0f) {
-		for (i = 0; i < n_samples; i++)
-			dst[i] = S16_TO_F32(src[i]);
-	} else {
-		for (i = 0; i < n_samples; i++)
-			dst[i] = S16_TO_F32(src[i]) * v;
-	}
-}
+#define MAX_BUFFER_FRAMES	8192
 
 struct netjack2_peer {
 	int fd;
@@ -111,8 +17,11 @@ struct netjack2_peer {
 	struct nj2_packet_header sync;
 	uint32_t cycle;
 
-	struct volume *send_volume;
-	struct volume *recv_volume;
+	struct netjack2_volume *send_volume;
+	struct netjack2_volume *recv_volume;
+
+	uint32_t cpu_flags;
+	struct netjack2_convert convert;
 
 	void *midi_data;
 	uint32_t midi_size;
@@ -136,6 +45,15 @@ static int netjack2_init(struct netjack2_peer *peer)
 
 	peer->empty = calloc(MAX_BUFFER_FRAMES, sizeof(float));
 
+	if ((res = netjack2_convert_init(&peer->convert, peer->cpu_flags)) < 0) {
+		pw_log_warn("can't init converters: %s", spa_strerror(res));
+		return res;
+	}
+	pw_log_debug("volume:%s to-s16:%s from-s16:%s",
+			peer->convert.volume.func_name,
+			peer->convert.to_s16.func_name,
+			peer->convert.from_s16.func_name);
+
 	peer->midi_size = peer->params.period_size * sizeof(float) *
 		SPA_MAX(peer->params.send_midi_channels, peer->params.recv_midi_channels);
 	peer->midi_data = calloc(1, peer->midi_size);
@@ -204,6 +122,7 @@ static void netjack2_cleanup(struct netjack2_peer *peer)
 
 	free(peer->empty);
 	free(peer->midi_data);
+	netjack2_convert_free(&peer->convert);
 #ifdef HAVE_OPUS_CUSTOM
 	int32_t i;
 	if (peer->opus_enc != NULL) {
@@ -476,7 +395,7 @@ static int netjack2_send_float(struct netjack2_peer *peer, uint32_t nframes,
 			ap[0] = htonl(info[j].id);
 
 			src = SPA_PTROFF(info[j].data, i * sub_period_size * sizeof(float), float);
-			do_volume((float*)&ap[1], src, peer->send_volume, info[j].id, sub_period_size, false);
+			do_volume(&peer->convert, (float*)&ap[1], src, peer->send_volume, info[j].id, sub_period_size, false);
 
 			ap = SPA_PTROFF(ap, sub_period_bytes, int32_t);
 		}
@@ -595,7 +514,7 @@ static int netjack2_send_int(struct netjack2_peer *peer, uint32_t nframes,
 		void *pcm;
 
 		if (i < n_info && (pcm = info[i].data) != NULL)
-			do_volume_to_s16(ap, pcm, peer->send_volume, i, nframes);
+			do_volume_to_s16(&peer->convert, ap, pcm, peer->send_volume, i, nframes);
 		else
 			memset(ap, 0, max_encoded);
 	}
@@ -822,7 +741,7 @@ static int netjack2_recv_float(struct netjack2_peer *peer, struct nj2_packet_hea
 			float *dst = SPA_PTROFF(data,
 					sub_cycle * sub_period_size * sizeof(float),
 					float);
-			do_volume(dst, (float*)&ap[1], peer->recv_volume, active_port, sub_period_size, true);
+			do_volume(&peer->convert, dst, (float*)&ap[1], peer->recv_volume, active_port, sub_period_size, true);
 			info[active_port].filled = true;
 		}
 	}
@@ -960,7 +879,7 @@ static int netjack2_recv_int(struct netjack2_peer *peer, struct nj2_packet_heade
 		if (i >= n_info || (pcm = info[i].data) == NULL)
 			continue;
 
-		do_volume_from_s16(pcm, ap, peer->recv_volume, i, peer->sync.frames);
+		do_volume_from_s16(&peer->convert, pcm, ap, peer->recv_volume, i, peer->sync.frames);
 		info[i].filled = true;
 	}
 	return 0;
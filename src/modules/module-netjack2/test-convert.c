@@ -0,0 +1,131 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <math.h>
+
+#include <spa/support/cpu.h>
+
+#include <pipewire/pipewire.h>
+
+#include "convert.h"
+
+#define N_SAMPLES	1031
+
+/* the scalar conversions that were used before */
+static void ref_volume(float *dst, const float *src, float v, uint32_t n_samples)
+{
+	uint32_t i;
+	for (i = 0; i < n_samples; i++)
+		dst[i] = src[i] * v;
+}
+
+static void ref_to_s16(int16_t *dst, const float *src, float v, uint32_t n_samples)
+{
+	uint32_t i;
+	for (i = 0; i < n_samples; i++)
+		dst[i] = (int16_t)SPA_CLAMPF(src[i] * v * S16_SCALE, S16_MIN, S16_MAX);
+}
+
+static void ref_from_s16(float *dst, const int16_t *src, float v, uint32_t n_samples)
+{
+	uint32_t i;
+	for (i = 0; i < n_samples; i++)
+		dst[i] = S16_TO_F32(src[i]) * v;
+}
+
+static float src_f32[N_SAMPLES + 8] SPA_ALIGNED(32);
+static int16_t src_s16[N_SAMPLES + 8] SPA_ALIGNED(32);
+static float out_f32[N_SAMPLES + 8] SPA_ALIGNED(32);
+static float ref_f32[N_SAMPLES] SPA_ALIGNED(32);
+static int16_t out_s16[N_SAMPLES + 8] SPA_ALIGNED(32);
+static int16_t ref_s16[N_SAMPLES] SPA_ALIGNED(32);
+
+static void test_volume(struct netjack2_convert *c, struct netjack2_volume *vol,
+		uint32_t offs)
+{
+	float v = vol->mute ? 0.0f : vol->volumes[0];
+	uint32_t i;
+
+	/* network packets are only 4 byte aligned, test with an offset */
+	do_volume(c, &out_f32[offs], src_f32, vol, 0, N_SAMPLES, false);
+	ref_volume(ref_f32, src_f32, v, N_SAMPLES);
+	for (i = 0; i < N_SAMPLES; i++)
+		spa_assert_se(fabsf(out_f32[offs + i] - ref_f32[i]) < 1e-6f);
+
+	do_volume(c, out_f32, &src_f32[offs], vol, 0, N_SAMPLES, true);
+	ref_volume(ref_f32, &src_f32[offs], v, N_SAMPLES);
+	for (i = 0; i < N_SAMPLES; i++)
+		spa_assert_se(fabsf(out_f32[i] - ref_f32[i]) < 1e-6f);
+}
+
+static void test_s16(struct netjack2_convert *c, struct netjack2_volume *vol)
+{
+	float v = vol->mute ? 0.0f : vol->volumes[0];
+	uint32_t i;
+
+	do_volume_to_s16(c, out_s16, src_f32, vol, 0, N_SAMPLES);
+	ref_to_s16(ref_s16, src_f32, v, N_SAMPLES);
+	/* the kernels round, the old code truncated */
+	for (i = 0; i < N_SAMPLES; i++)
+		spa_assert_se(abs(out_s16[i] - ref_s16[i]) <= 1);
+
+	do_volume_from_s16(c, out_f32, src_s16, vol, 0, N_SAMPLES);
+	ref_from_s16(ref_f32, src_s16, v, N_SAMPLES);
+	for (i = 0; i < N_SAMPLES; i++)
+		spa_assert_se(fabsf(out_f32[i] - ref_f32[i]) < 1e-6f);
+}
+
+static void test_all(const char *impl, uint32_t cpu_flags)
+{
+	struct netjack2_convert c;
+	struct netjack2_volume vol = { .n_volumes = 1, };
+	static const float volumes[] = { 1.0f, 0.5f, 1.7f, 0.0f };
+	uint32_t i;
+
+	spa_assert_se(netjack2_convert_init(&c, cpu_flags) == 0);
+	fprintf(stderr, "test %s: volume:%s to-s16:%s from-s16:%s\n", impl,
+			c.volume.func_name, c.to_s16.func_name, c.from_s16.func_name);
+
+	for (i = 0; i < SPA_N_ELEMENTS(volumes); i++) {
+		vol.volumes[0] = volumes[i];
+		test_volume(&c, &vol, 0);
+		test_volume(&c, &vol, 1);
+		test_s16(&c, &vol);
+	}
+	vol.mute = true;
+	test_volume(&c, &vol, 1);
+	test_s16(&c, &vol);
+
+	netjack2_convert_free(&c);
+}
+
+int main(int argc, char *argv[])
+{
+	struct spa_support support[16];
+	uint32_t i, n_support, cpu_flags = 0;
+	struct spa_cpu *cpu;
+
+	pw_init(&argc, &argv);
+
+	n_support = pw_get_support(support, SPA_N_ELEMENTS(support));
+	cpu = spa_support_find(support, n_support, SPA_TYPE_INTERFACE_CPU);
+	if (cpu != NULL)
+		cpu_flags = spa_cpu_get_flags(cpu);
+
+	for (i = 0; i < SPA_N_ELEMENTS(src_f32); i++) {
+		/* include some values that clip */
+		src_f32[i] = (drand48() - 0.5) * 2.4;
+		src_s16[i] = (int16_t)(drand48() * 65535 - 32768);
+	}
+
+	test_all("c", 0);
+	if (cpu_flags != 0)
+		test_all("simd", cpu_flags);
+
+	pw_deinit();
+	return 0;
+}
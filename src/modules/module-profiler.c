@@ -13,6 +13,16 @@
 
 #include "config.h"
 
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (F_LINUX_SPECIFIC_BASE + 9)
+#define F_SEAL_SEAL	0x0001
+#define F_SEAL_SHRINK	0x0002
+#define F_SEAL_GROW	0x0004
+#endif
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE	0x0010
+#endif
+
 #include <spa/pod/builder.h>
 #include <spa/utils/result.h>
 #include <spa/utils/ringbuffer.h>
@@ -30,14 +40,36 @@
  * Use tools like pw-top and pw-profiler to collect profiling information
  * about the pipewire graph.
  *
+ * Clients that bind version 4 or later of the profiler receive a shared
+ * memory region instead of profile events. The memory contains a ring with
+ * a fixed size record for each driver cycle and, for each node, histograms
+ * of the wakeup latency and the processing time. This is cheap enough to
+ * keep profiling enabled all the time.
+ *
+ * The node statistics also contain the median, 99th percentile and maximum
+ * of the wakeup and processing time over the last complete window. For the
+ * last cycles with an xrun, the critical path of nodes that finished last
+ * is kept so that the node that caused the xrun can be found.
+ *
+ * ## Module Options
+ *
+ * - `profiler.always-on`: collect profiler data also when no clients are
+ *   connected, default false
+ * - `profiler.window`: the length of the statistics window in milliseconds,
+ *   default 1000
+ *
  * ## Example configuration
  *
- * The module has no arguments and is usually added to the config file of
- * the main pipewire daemon.
+ * The module is usually added to the config file of the main pipewire daemon.
  *
  *\code{.unparsed}
  * context.modules = [
- * { name = libpipewire-module-profiler }
+ * { name = libpipewire-module-profiler
+ *   args = {
+ *       #profiler.always-on = false
+ *       #profiler.window = 1000
+ *   }
+ * }
  * ]
  *\endcode
  *
@@ -56,6 +88,12 @@ PW_LOG_TOPIC(mod_topic, "mod." NAME);
 #define DATA_BUFFER		(32 * 1024)
 #define FLUSH_BUFFER		(8 * 1024 * 1024)
 
+#define SHM_NODES		1024
+#define SHM_RING_SIZE		(1024 * 1024)
+#define SHM_XRUNS		64
+
+#define DEFAULT_WINDOW		1000
+
 int pw_protocol_native_ext_profiler_init(struct pw_context *context);
 
 #define pw_profiler_resource(r,m,v,...)      \
@@ -63,6 +101,8 @@ int pw_protocol_native_ext_profiler_init(struct pw_context *context);
 
 #define pw_profiler_resource_profile(r,...)        \
         pw_profiler_resource(r,profile,0,__VA_ARGS__)
+#define pw_profiler_resource_shm(r,...)        \
+        pw_profiler_resource(r,shm,1,__VA_ARGS__)
 
 static const struct spa_dict_item module_props[] = {
 	{ PW_KEY_MODULE_AUTHOR, "Wim Taymans <wim.taymans@gmail.com>" },
@@ -81,6 +121,7 @@ struct node {
 	struct spa_ringbuffer buffer;
 	uint8_t tmp[TMP_BUFFER];
 	uint8_t data[DATA_BUFFER];
+	uint8_t record[PW_PROFILER_MAX_RECORD];
 
 	unsigned enabled:1;
 };
@@ -100,9 +141,23 @@ struct impl {
 
 	struct spa_list node_list;
 
+	struct pw_memblock *shm_block;
+	struct pw_profiler_shm *shm;
+	/* clients can write to the shared memory, the layout and the
+	 * indexes are never read back from it */
+	struct pw_profiler_node *shm_nodes;
+	struct pw_profiler_xrun *shm_xruns;
+	void *shm_ring;
+	uint32_t shm_ring_index;
+	uint32_t shm_xrun_index;
+
+	uint64_t window;
+
 	uint32_t busy;
+	uint32_t pod_busy;
 	struct spa_source *flush_event;
 	unsigned int listening:1;
+	unsigned int always_on:1;
 
 #ifdef max_align_t
 	alignas(max_align_t)
@@ -117,6 +172,8 @@ struct resource_data {
 
 	struct pw_resource *resource;
 	struct spa_hook resource_listener;
+
+	unsigned int pod:1;
 };
 
 static void do_flush_event(void *data, uint64_t count)
@@ -155,11 +212,189 @@ static void do_flush_event(void *data, uint64_t count)
 		pw_profiler_resource_profile(resource, &p->pod);
 }
 
-static void context_do_profile(void *data)
+static void get_target_latency(struct pw_node_target *t, struct spa_fraction *latency)
+{
+	struct pw_impl_node *n = t->node;
+
+	if (n != NULL) {
+		*latency = n->latency;
+		if (n->force_quantum != 0)
+			latency->num = n->force_quantum;
+		if (n->force_rate != 0)
+			latency->denom = n->force_rate;
+		else if (n->rate.denom != 0)
+			latency->denom = n->rate.denom;
+	} else {
+		spa_zero(*latency);
+	}
+}
+
+static struct pw_profiler_node *find_shm_node(struct impl *impl, uint32_t id, const char *name)
+{
+	struct pw_profiler_node *nodes = impl->shm_nodes, *s = NULL;
+	uint32_t i, n_nodes = SHM_NODES;
+
+	for (i = 0; i < n_nodes; i++) {
+		s = &nodes[(id + i) % n_nodes];
+		if (s->id == id) {
+			if (strncmp(s->name, name, sizeof(s->name)) == 0)
+				return s;
+			/* id was reused by another node, start again */
+			break;
+		}
+		if (s->id == SPA_ID_INVALID)
+			break;
+	}
+	if (i == n_nodes)
+		return NULL;
+
+	SPA_SEQ_WRITE(s->seq);
+	memset(SPA_PTROFF(s, sizeof(s->seq), void), 0, sizeof(*s) - sizeof(s->seq));
+	s->id = id;
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	SPA_SEQ_WRITE(s->seq);
+	return s;
+}
+
+/* returns true when the node had a new xrun */
+static bool update_shm_node(struct impl *impl, const struct pw_profiler_block *b,
+		const char *name, uint32_t driver_id, const struct pw_profiler_info *info)
+{
+	struct pw_profiler_node *s;
+	bool xrun;
+
+	if ((s = find_shm_node(impl, b->id, name)) == NULL)
+		return false;
+
+	xrun = s->last.signal_time != 0 && b->xrun_count != s->last.xrun_count;
+
+	SPA_SEQ_WRITE(s->seq);
+	s->driver_id = driver_id;
+	if (info != NULL)
+		s->info = *info;
+	s->last = *b;
+	/* only when the node woke up and completed in this cycle */
+	if (b->signal_time >= b->prev_signal_time &&
+	    b->awake_time >= b->signal_time &&
+	    b->finish_time >= b->awake_time) {
+		uint64_t wakeup = b->awake_time - b->signal_time;
+		uint64_t process = b->finish_time - b->awake_time;
+
+		pw_profiler_hist_add(&s->wakeup, wakeup);
+		pw_profiler_hist_add(&s->process, process);
+
+		if (s->window_start == 0)
+			s->window_start = b->signal_time;
+		else if (b->signal_time - s->window_start >= impl->window) {
+			pw_profiler_hist_stats(&s->window_wakeup, &s->wakeup_stats);
+			pw_profiler_hist_stats(&s->window_process, &s->process_stats);
+			spa_zero(s->window_wakeup);
+			spa_zero(s->window_process);
+			s->window_start = b->signal_time;
+		}
+		pw_profiler_hist_add(&s->window_wakeup, wakeup);
+		pw_profiler_hist_add(&s->window_process, process);
+	}
+	SPA_SEQ_WRITE(s->seq);
+
+	return xrun;
+}
+
+static void add_shm_xrun(struct impl *impl, const struct pw_profiler_record *r)
+{
+	struct pw_profiler_shm *shm = impl->shm;
+	struct pw_profiler_xrun *x;
+	uint32_t index = impl->shm_xrun_index++;
+	uint64_t start = r->driver.signal_time;
+
+	x = &impl->shm_xruns[index % SHM_XRUNS];
+
+	SPA_SEQ_WRITE(x->seq);
+	x->index = index;
+	x->driver_id = r->driver.id;
+	x->time = start;
+	x->duration = r->driver.finish_time > start ? r->driver.finish_time - start : 0;
+	x->period = pw_profiler_record_period(r);
+	x->n_path = pw_profiler_record_path(r, x->path, PW_PROFILER_XRUN_PATH);
+	SPA_SEQ_WRITE(x->seq);
+
+	SPA_ATOMIC_STORE(shm->xrun_index, index + 1);
+}
+
+static void do_profile_shm(struct impl *impl, struct node *n)
+{
+	struct pw_impl_node *node = n->node;
+	uint32_t id = node->info.id;
+	struct pw_node_activation *a = node->rt.target.activation;
+	struct pw_profiler_shm *shm = impl->shm;
+	struct pw_profiler_record *r = (struct pw_profiler_record *)n->record;
+	uint32_t max_followers, idx = impl->shm_ring_index;
+	struct pw_node_target *t;
+	bool xrun;
+
+	max_followers = (sizeof(n->record) - sizeof(*r)) / sizeof(struct pw_profiler_block);
+
+	r->n_followers = 0;
+	r->info.count = n->count;
+	r->info.cpu_load[0] = a->cpu_load[0];
+	r->info.cpu_load[1] = a->cpu_load[1];
+	r->info.cpu_load[2] = a->cpu_load[2];
+	r->info.xrun_count = a->xrun_count;
+	r->info.clock = a->position.clock;
+
+	r->driver = (struct pw_profiler_block) {
+		.id = id,
+		.status = a->status,
+		.prev_signal_time = a->prev_signal_time,
+		.signal_time = a->signal_time,
+		.awake_time = a->awake_time,
+		.finish_time = a->finish_time,
+		.latency = node->latency,
+		.xrun_count = a->xrun_count,
+	};
+	xrun = update_shm_node(impl, &r->driver, node->name, id, &r->info);
+
+	spa_list_for_each(t, &node->rt.target_list, link) {
+		struct pw_node_activation *na = t->activation;
+		struct pw_profiler_block *b;
+
+		if (t->id == id || t->flags & PW_NODE_TARGET_PEER)
+			continue;
+		if (r->n_followers >= max_followers)
+			break;
+
+		b = &r->followers[r->n_followers++];
+		*b = (struct pw_profiler_block) {
+			.id = t->id,
+			.status = na->status,
+			.prev_signal_time = a->signal_time,
+			.signal_time = na->signal_time,
+			.awake_time = na->awake_time,
+			.finish_time = na->finish_time,
+			.xrun_count = na->xrun_count,
+		};
+		get_target_latency(t, &b->latency);
+		xrun |= update_shm_node(impl, b, t->name, id, NULL);
+	}
+	r->size = sizeof(*r) + r->n_followers * sizeof(struct pw_profiler_block);
+
+	/* the graph did not complete within the cycle */
+	if (!xrun && pw_profiler_record_period(r) != 0 &&
+	    a->finish_time > a->signal_time)
+		xrun = a->finish_time - a->signal_time > pw_profiler_record_period(r);
+	if (xrun)
+		add_shm_xrun(impl, r);
+
+	/* we never wait for the readers, they detect when they are overtaken */
+	spa_ringbuffer_write_data(&shm->ring, impl->shm_ring, SHM_RING_SIZE,
+			idx & (SHM_RING_SIZE - 1), r, r->size);
+	impl->shm_ring_index = idx + r->size;
+	spa_ringbuffer_write_update(&shm->ring, impl->shm_ring_index);
+}
+
+static void do_profile_pod(struct impl *impl, struct node *n)
 {
-	struct node *n = data;
 	struct pw_impl_node *node = n->node;
-	struct impl *impl = n->impl;
 	struct spa_pod_builder b;
 	struct spa_pod_frame f[2];
 	uint32_t id = node->info.id;
@@ -169,9 +404,6 @@ static void context_do_profile(void *data)
 	int32_t filled;
 	uint32_t idx, avail;
 
-	if (SPA_FLAG_IS_SET(pos->clock.flags, SPA_IO_CLOCK_FLAG_FREEWHEEL))
-		return;
-
 	spa_pod_builder_init(&b, n->tmp, sizeof(n->tmp));
 	spa_pod_builder_push_object(&b, &f[0],
 			SPA_TYPE_OBJECT_Profiler, 0);
@@ -211,24 +443,13 @@ static void context_do_profile(void *data)
 			SPA_POD_Int(a->xrun_count));
 
 	spa_list_for_each(t, &node->rt.target_list, link) {
-		struct pw_impl_node *n = t->node;
 		struct pw_node_activation *na;
 		struct spa_fraction latency;
 
 		if (t->id == id || t->flags & PW_NODE_TARGET_PEER)
 			continue;
 
-		if (n != NULL) {
-			latency = n->latency;
-			if (n->force_quantum != 0)
-				latency.num = n->force_quantum;
-			if (n->force_rate != 0)
-				latency.denom = n->force_rate;
-			else if (n->rate.denom != 0)
-				latency.denom = n->rate.denom;
-		} else {
-			spa_zero(latency);
-		}
+		get_target_latency(t, &latency);
 
 		na = t->activation;
 		spa_pod_builder_prop(&b, SPA_PROFILER_followerBlock, 0);
@@ -246,17 +467,17 @@ static void context_do_profile(void *data)
 	spa_pod_builder_pop(&b, &f[0]);
 
 	if (b.state.offset > sizeof(n->tmp))
-		goto done;
+		return;
 
 	filled = spa_ringbuffer_get_write_index(&n->buffer, &idx);
 	if (filled < 0 || filled > DATA_BUFFER) {
 		pw_log_warn("%p: queue xrun %d", impl, filled);
-		goto done;
+		return;
 	}
 	avail = DATA_BUFFER - filled;
 	if (avail < b.state.offset) {
 		pw_log_warn("%p: queue full %d < %d", impl, avail, b.state.offset);
-		goto done;
+		return;
 	}
 	spa_ringbuffer_write_data(&n->buffer,
 			n->data, DATA_BUFFER,
@@ -265,7 +486,22 @@ static void context_do_profile(void *data)
 	spa_ringbuffer_write_update(&n->buffer, idx + b.state.offset);
 
 	pw_loop_signal_event(impl->main_loop, impl->flush_event);
-done:
+}
+
+static void context_do_profile(void *data)
+{
+	struct node *n = data;
+	struct impl *impl = n->impl;
+	struct spa_io_position *pos = &n->node->rt.target.activation->position;
+
+	if (SPA_FLAG_IS_SET(pos->clock.flags, SPA_IO_CLOCK_FLAG_FREEWHEEL))
+		return;
+
+	if (impl->shm != NULL)
+		do_profile_shm(impl, n);
+	if (impl->pod_busy > 0)
+		do_profile_pod(impl, n);
+
 	n->count++;
 }
 
@@ -308,7 +544,7 @@ static void context_driver_added(void *data, struct pw_impl_node *node)
 	spa_list_append(&impl->node_list, &n->link);
 	spa_ringbuffer_init(&n->buffer);
 
-	if (impl->busy > 0)
+	if (impl->listening)
 		enable_node_profiling(n, true);
 }
 
@@ -350,15 +586,97 @@ static void stop_listener(struct impl *impl)
 	}
 }
 
-static void resource_destroy(void *data)
+static void update_listener(struct impl *impl)
 {
-	struct impl *impl = data;
-	if (--impl->busy == 0) {
+	bool listen = impl->busy > 0 || impl->always_on;
+
+	if (listen == impl->listening)
+		return;
+
+	if (listen) {
+		pw_log_info("%p: starting profiler", impl);
+		enable_profiling(impl, true);
+		impl->listening = true;
+	} else {
 		pw_log_info("%p: stopping profiler", impl);
 		stop_listener(impl);
 	}
 }
 
+static int init_shm(struct impl *impl)
+{
+	struct pw_profiler_shm *shm;
+	struct pw_profiler_node *nodes;
+	uint32_t i, nodes_offset, xruns_offset, ring_offset, size;
+
+	nodes_offset = SPA_ROUND_UP_N(sizeof(struct pw_profiler_shm), 64);
+	xruns_offset = SPA_ROUND_UP_N(nodes_offset + SHM_NODES * sizeof(struct pw_profiler_node), 64);
+	ring_offset = SPA_ROUND_UP_N(xruns_offset + SHM_XRUNS * sizeof(struct pw_profiler_xrun), 64);
+	size = ring_offset + SHM_RING_SIZE;
+
+	impl->shm_block = pw_mempool_alloc(impl->context->pool,
+			PW_MEMBLOCK_FLAG_READWRITE |
+			PW_MEMBLOCK_FLAG_MAP,
+			SPA_DATA_MemFd, size);
+	if (impl->shm_block == NULL) {
+		int res = -errno;
+		pw_log_warn("%p: can't create shared memory, using events only: %s",
+				impl, spa_strerror(res));
+		return res;
+	}
+	/* we keep our writable mapping, clients can only map the memory
+	 * read-only and can't corrupt it for the other clients */
+	if (fcntl(impl->shm_block->fd, F_ADD_SEALS, F_SEAL_GROW | F_SEAL_SHRINK |
+				F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+		int res = -errno;
+		pw_log_warn("%p: can't seal shared memory, using events only: %s",
+				impl, spa_strerror(res));
+		pw_memblock_unref(impl->shm_block);
+		impl->shm_block = NULL;
+		return res;
+	}
+
+	shm = impl->shm_block->map->ptr;
+	spa_zero(*shm);
+	shm->magic = PW_PROFILER_SHM_MAGIC;
+	shm->version = PW_PROFILER_SHM_VERSION;
+	shm->n_nodes = SHM_NODES;
+	shm->nodes_offset = nodes_offset;
+	shm->ring_size = SHM_RING_SIZE;
+	shm->ring_offset = ring_offset;
+	shm->n_xruns = SHM_XRUNS;
+	shm->xruns_offset = xruns_offset;
+	shm->window = impl->window / SPA_NSEC_PER_MSEC;
+	spa_ringbuffer_init(&shm->ring);
+
+	impl->shm_nodes = nodes = SPA_PTROFF(shm, nodes_offset, struct pw_profiler_node);
+	impl->shm_xruns = SPA_PTROFF(shm, xruns_offset, struct pw_profiler_xrun);
+	impl->shm_ring = SPA_PTROFF(shm, ring_offset, void);
+	impl->shm_ring_index = 0;
+	impl->shm_xrun_index = 0;
+
+	for (i = 0; i < SHM_NODES; i++) {
+		spa_zero(nodes[i]);
+		nodes[i].id = SPA_ID_INVALID;
+	}
+	memset(impl->shm_xruns, 0, SHM_XRUNS * sizeof(struct pw_profiler_xrun));
+
+	/* the data thread can already be profiling for older clients */
+	SPA_ATOMIC_STORE(impl->shm, shm);
+	return 0;
+}
+
+static void resource_destroy(void *data)
+{
+	struct resource_data *d = data;
+	struct impl *impl = d->impl;
+
+	if (d->pod)
+		impl->pod_busy--;
+	impl->busy--;
+	update_listener(impl);
+}
+
 static const struct pw_resource_events resource_events = {
 	PW_VERSION_RESOURCE_EVENTS,
 	.destroy = resource_destroy,
@@ -384,13 +702,21 @@ global_bind(void *object, struct pw_impl_client *client, uint32_t permissions,
 	pw_global_add_resource(global, resource);
 
 	pw_resource_add_listener(resource, &data->resource_listener,
-			&resource_events, impl);
+			&resource_events, data);
 
-	if (++impl->busy == 1) {
-		pw_log_info("%p: starting profiler", impl);
-		enable_profiling(impl, true);
-		impl->listening = true;
-	}
+	if (version >= 4 && impl->shm_block == NULL)
+		init_shm(impl);
+
+	/* older clients only understand the profile event */
+	data->pod = version < 4 || impl->shm == NULL;
+	if (data->pod)
+		impl->pod_busy++;
+	else
+		pw_profiler_resource_shm(resource, impl->shm_block->fd,
+				impl->shm_block->size);
+
+	impl->busy++;
+	update_listener(impl);
 	return 0;
 }
 
@@ -408,6 +734,9 @@ static void module_destroy(void *data)
 
 	pw_loop_destroy_source(impl->main_loop, impl->flush_event);
 
+	if (impl->shm_block)
+		pw_memblock_unref(impl->shm_block);
+
 	free(impl);
 }
 
@@ -477,6 +806,15 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	pw_properties_setf(impl->properties, PW_KEY_OBJECT_SERIAL, "%"PRIu64,
 			pw_global_get_serial(impl->global));
 
+	impl->always_on = pw_properties_get_bool(props, PW_KEY_PROFILER_ALWAYS_ON, false);
+	impl->window = pw_properties_get_uint32(props, PW_KEY_PROFILER_WINDOW, DEFAULT_WINDOW);
+	impl->window = SPA_MAX(impl->window, 1u) * SPA_NSEC_PER_MSEC;
+
+	/* the shared memory is otherwise created when the first client binds,
+	 * clients also load this module for the protocol extension */
+	if (impl->always_on)
+		init_shm(impl);
+
 	impl->flush_event = pw_loop_add_event(impl->main_loop, do_flush_event, impl);
 
 	pw_global_update_keys(impl->global, &impl->properties->dict, keys);
@@ -493,5 +831,7 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 
 	pw_global_add_listener(impl->global, &impl->global_listener, &global_events, impl);
 
+	update_listener(impl);
+
 	return 0;
 }
@@ -165,6 +165,18 @@ static void client_unref(struct client *impl)
 		free(impl);
 }
 
+#define MAX_SHARED	8
+
+/* a message body that was marshalled once for a broadcast and can be
+ * queued on the other client connections of the same broadcast */
+struct shared_body {
+	uint32_t serial;
+	uint32_t version;
+	const void *marshal;
+	uint8_t opcode;
+	struct pw_protocol_native_shared *shared;
+};
+
 struct server {
 	struct pw_protocol_server this;
 
@@ -176,6 +188,9 @@ struct server {
 	struct spa_source *source;
 	struct spa_source *resume;
 	unsigned int activated:1;
+
+	uint32_t n_shared;
+	struct shared_body shared[MAX_SHARED];
 };
 
 struct client_data {
@@ -191,6 +206,11 @@ struct client_data {
 
 	struct footer_client_global_state footer_state;
 
+	struct pw_protocol_native_message *msg;
+	struct spa_pod_builder *builder;
+	struct spa_pod_builder null_builder;
+	struct shared_body *pending;
+
 	unsigned int busy:1;
 	unsigned int need_flush:1;
 
@@ -448,8 +468,17 @@ static void client_free(void *data)
 
 	if (this->source)
 		pw_loop_destroy_source(client->context->main_loop, this->source);
-	if (this->connection)
+	if (this->connection) {
+		struct pw_protocol_native_connection_stats stats;
+
+		pw_protocol_native_connection_get_stats(this->connection, &stats);
+		pw_log_debug("%p: sent %"PRIu64" messages (%"PRIu64" shared) %"PRIu64
+				" bytes in %"PRIu64" flushes %"PRIu64" syscalls, max %u/%u",
+				this, stats.n_messages, stats.n_shared, stats.n_bytes,
+				stats.n_flushes, stats.n_syscalls,
+				stats.max_messages, stats.max_bytes);
 		pw_protocol_native_connection_destroy(this->connection);
+	}
 
 	pw_map_clear(&this->compat_v2.types);
 }
@@ -1228,6 +1257,20 @@ error_free:
 	return NULL;
 }
 
+static void clear_shared(struct server *s, uint32_t serial, bool all)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->n_shared; i++) {
+		struct shared_body *b = &s->shared[i];
+		if (!all && b->serial == serial)
+			continue;
+		pw_protocol_native_shared_unref(b->shared);
+		*b = s->shared[--s->n_shared];
+		i--;
+	}
+}
+
 static void destroy_server(struct pw_protocol_server *server)
 {
 	struct server *s = SPA_CONTAINER_OF(server, struct server, this);
@@ -1250,6 +1293,7 @@ static void destroy_server(struct pw_protocol_server *server)
 		unlink(s->lock_addr);
 	if (s->fd_lock != -1)
 		close(s->fd_lock);
+	clear_shared(s, 0, true);
 	free(s);
 }
 
@@ -1396,12 +1440,57 @@ static int impl_ext_end_proxy(struct pw_proxy *proxy,
 	return core->send_seq = pw_protocol_native_connection_end(impl->connection, builder);
 }
 
+/* While the context broadcasts the same event to all resources of a global,
+ * the message body is marshalled only once. The other clients get a builder
+ * without memory to absorb the marshalling and queue a reference to the
+ * shared body followed by their own footers. */
 static struct spa_pod_builder *
 impl_ext_begin_resource(struct pw_resource *resource,
 		uint8_t opcode, struct pw_protocol_native_message **msg)
 {
-	struct client_data *data = resource->client->user_data;
-	return pw_protocol_native_connection_begin(data->connection, resource->id, opcode, msg);
+	struct pw_impl_client *client = resource->client;
+	struct client_data *data = client->user_data;
+	struct pw_context *context = client->context;
+	struct server *s = data->server;
+	struct shared_body *b;
+	uint32_t i;
+
+	data->builder = pw_protocol_native_connection_begin(data->connection,
+			resource->id, opcode, &data->msg);
+	data->pending = NULL;
+	if (msg)
+		*msg = data->msg;
+
+	if (s == NULL || client->compat_v2 != NULL)
+		return data->builder;
+
+	if (context->broadcast_depth == 0) {
+		if (s->n_shared > 0)
+			clear_shared(s, 0, true);
+		return data->builder;
+	}
+	clear_shared(s, context->broadcast_serial, false);
+
+	for (i = 0; i < s->n_shared; i++) {
+		b = &s->shared[i];
+		if (b->marshal == resource->marshal &&
+		    b->version == resource->version &&
+		    b->opcode == opcode) {
+			data->pending = b;
+			data->null_builder = SPA_POD_BUILDER_INIT(NULL, 0);
+			return &data->null_builder;
+		}
+	}
+	if (s->n_shared < MAX_SHARED) {
+		b = &s->shared[s->n_shared];
+		b->serial = context->broadcast_serial;
+		b->version = resource->version;
+		b->marshal = resource->marshal;
+		b->opcode = opcode;
+		b->shared = NULL;
+		data->pending = b;
+	}
+	return data->builder;
 }
 
 static uint32_t impl_ext_add_resource_fd(struct pw_resource *resource, int fd)
@@ -1420,7 +1509,25 @@ static int impl_ext_end_resource(struct pw_resource *resource,
 {
 	struct client_data *data = resource->client->user_data;
 	struct pw_impl_client *client = resource->client;
+	struct shared_body *b = data->pending;
+
+	data->pending = NULL;
+
+	if (builder == &data->null_builder) {
+		builder = data->builder;
+		marshal_client_footers(&data->footer_state, client, builder);
+		return client->send_seq = pw_protocol_native_connection_end_shared(
+				data->connection, builder, b->shared);
+	}
 	assert_single_pod(builder);
+
+	if (b != NULL && data->msg->n_fds == 0 && builder->data != NULL &&
+	    builder->state.offset > 0) {
+		b->shared = pw_protocol_native_shared_new(builder->data,
+				builder->state.offset);
+		if (b->shared != NULL)
+			data->server->n_shared++;
+	}
 	marshal_client_footers(&data->footer_state, client, builder);
 	return client->send_seq = pw_protocol_native_connection_end(data->connection, builder);
 }
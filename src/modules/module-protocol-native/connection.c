@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <spa/utils/result.h>
 #include <spa/pod/builder.h>
@@ -30,10 +31,17 @@ PW_LOG_TOPIC_EXTERN(mod_topic_connection);
 #define MAX_BUFFER_SIZE (1024 * 32)
 #define MAX_FDS 1024u
 #define MAX_FDS_MSG 28
+#define MAX_IOV 64
 
 #define HDR_SIZE_V0	8
 #define HDR_SIZE	16
 
+/* a shared body that is sent before the data at offset */
+struct buffer_ref {
+	size_t offset;
+	struct pw_protocol_native_shared *shared;
+};
+
 struct buffer {
 	uint8_t *buffer_data;
 	size_t buffer_size;
@@ -41,6 +49,12 @@ struct buffer {
 	int fds[MAX_FDS];
 	uint32_t n_fds;
 
+	struct buffer_ref *refs;
+	uint32_t n_refs;
+	uint32_t max_refs;
+	size_t ref_sent;	/**< bytes sent of the first ref */
+	uint32_t n_msgs;	/**< messages queued since the last flush */
+
 	uint32_t seq;
 	size_t offset;
 	size_t fds_offset;
@@ -65,10 +79,32 @@ struct impl {
 
 	uint32_t version;
 	size_t hdr_size;
+
+	struct pw_protocol_native_connection_stats stats;
 };
 
 /** \endcond */
 
+struct pw_protocol_native_shared *pw_protocol_native_shared_new(const void *data, uint32_t size)
+{
+	struct pw_protocol_native_shared *shared;
+
+	shared = malloc(sizeof(*shared) + size);
+	if (shared == NULL)
+		return NULL;
+
+	shared->ref = 1;
+	shared->size = size;
+	memcpy(shared->data, data, size);
+	return shared;
+}
+
+void pw_protocol_native_shared_unref(struct pw_protocol_native_shared *shared)
+{
+	if (--shared->ref == 0)
+		free(shared);
+}
+
 /** Get an fd from a connection
  *
  * \param conn the connection
@@ -271,6 +307,16 @@ too_many_fds:
 	return -EPROTO;
 }
 
+static void clear_refs(struct buffer *buf)
+{
+	uint32_t i;
+
+	for (i = 0; i < buf->n_refs; i++)
+		pw_protocol_native_shared_unref(buf->refs[i].shared);
+	buf->n_refs = 0;
+	buf->ref_sent = 0;
+}
+
 static void clear_buffer(struct buffer *buf, bool fds)
 {
 	uint32_t i;
@@ -290,6 +336,8 @@ static void clear_buffer(struct buffer *buf, bool fds)
 	}
 	buf->buffer_size = 0;
 	buf->offset = 0;
+	buf->n_msgs = 0;
+	clear_refs(buf);
 }
 
 /** Prepare connection for calling from reentered context.
@@ -483,6 +531,7 @@ void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection
 	clear_buffer(&impl->in, true);
 	free(impl->out.buffer_data);
 	free(impl->in.buffer_data);
+	free(impl->out.refs);
 
 	while (!spa_list_is_empty(&impl->reenter_stack))
 		pop_reenter_stack(impl, 1);
@@ -713,6 +762,7 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 	}
 
 	buf->buffer_size += impl->hdr_size + size;
+	buf->n_msgs++;
 	if (impl->version >= 3)
 		buf->n_fds += buf->msg.n_fds;
 	else
@@ -737,6 +787,159 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 	return res;
 }
 
+static int add_ref(struct pw_protocol_native_connection *conn, struct buffer *buf,
+		size_t offset, struct pw_protocol_native_shared *shared)
+{
+	if (buf->n_refs == buf->max_refs) {
+		uint32_t max = SPA_MAX(buf->max_refs * 2, 16u);
+		struct buffer_ref *refs;
+
+		refs = reallocarray(buf->refs, max, sizeof(struct buffer_ref));
+		if (refs == NULL)
+			return -errno;
+		buf->refs = refs;
+		buf->max_refs = max;
+	}
+	buf->refs[buf->n_refs++] = (struct buffer_ref) {
+		.offset = offset,
+		.shared = pw_protocol_native_shared_ref(shared),
+	};
+	return 0;
+}
+
+/** End a message with a shared body
+ *
+ * \param conn the connection
+ * \param builder the builder from pw_protocol_native_connection_begin(), with
+ *    the data that is sent after \a body, like the footer
+ * \param body the body of the message
+ * \return the sequence number of the message or a negative error code
+ *
+ * The body is not copied but a reference to it is kept until the message is
+ * sent. When the connection can't send shared data, because of an old
+ * protocol version or fds in the message, the body is copied.
+ *
+ * \memberof pw_protocol_native_connection
+ */
+int
+pw_protocol_native_connection_end_shared(struct pw_protocol_native_connection *conn,
+				  struct spa_pod_builder *builder,
+				  struct pw_protocol_native_shared *body)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	uint32_t *p, size = builder->state.offset;
+	struct buffer *buf = &impl->out;
+	int res;
+
+	if (impl->version < 3 || buf->msg.n_fds > 0) {
+		void *tail = NULL;
+
+		if (size > 0 && (tail = malloc(size)) == NULL)
+			return -errno;
+		if (tail)
+			memcpy(tail, builder->data, size);
+		builder->state.offset = 0;
+		spa_pod_builder_raw(builder, body->data, body->size);
+		if (tail)
+			spa_pod_builder_raw(builder, tail, size);
+		free(tail);
+		if (builder->state.offset > builder->size)
+			return -ENOMEM;
+		return pw_protocol_native_connection_end(conn, builder);
+	}
+
+	if ((p = connection_ensure_size(conn, buf, impl->hdr_size + size)) == NULL)
+		return -errno;
+
+	if ((res = add_ref(conn, buf, buf->buffer_size + impl->hdr_size, body)) < 0)
+		return res;
+
+	p[0] = buf->msg.id;
+	p[1] = (buf->msg.opcode << 24) | ((body->size + size) & 0xffffff);
+	p[2] = buf->msg.seq;
+	p[3] = 0;
+
+	buf->buffer_size += impl->hdr_size + size;
+	buf->n_msgs++;
+	impl->stats.n_shared++;
+
+	if (mod_topic_connection->level >= SPA_LOG_LEVEL_DEBUG) {
+		pw_logt_debug(mod_topic_connection,
+			">>>>>>>>> out: id:%d op:%d size:%d seq:%d shared:%d",
+				buf->msg.id, buf->msg.opcode, body->size + size,
+				buf->msg.seq, body->size);
+	        spa_debug_pod(0, NULL, (struct spa_pod *)body->data);
+		pw_logt_debug(mod_topic_connection,
+			">>>>>>>>> out: done");
+	}
+
+	buf->seq = (buf->seq + 1) & SPA_ASYNC_SEQ_MASK;
+	res = SPA_RESULT_RETURN_ASYNC(buf->msg.seq);
+
+	spa_hook_list_call(&conn->listener_list,
+			struct pw_protocol_native_connection_events, need_flush, 0);
+
+	return res;
+}
+
+/* fill iov with at most max bytes of the queued data, starting from the
+ * inline data at pos and ref with ref_sent bytes already sent */
+static uint32_t fill_iov(struct buffer *buf, struct iovec *iov, size_t pos,
+		uint32_t ref, size_t ref_sent, size_t max, size_t *size)
+{
+	uint32_t n_iov = 0;
+	size_t len, total = 0;
+
+	while (n_iov < MAX_IOV && total < max) {
+		size_t end = ref < buf->n_refs ? buf->refs[ref].offset : buf->buffer_size;
+
+		if (pos < end) {
+			len = SPA_MIN(end - pos, max - total);
+			iov[n_iov].iov_base = buf->buffer_data + pos;
+			iov[n_iov++].iov_len = len;
+			pos += len;
+		} else if (ref < buf->n_refs) {
+			struct pw_protocol_native_shared *shared = buf->refs[ref].shared;
+			len = SPA_MIN(shared->size - ref_sent, max - total);
+			iov[n_iov].iov_base = SPA_PTROFF(shared->data, ref_sent, void);
+			iov[n_iov++].iov_len = len;
+			ref_sent += len;
+			if (ref_sent == shared->size) {
+				ref++;
+				ref_sent = 0;
+			}
+		} else
+			break;
+		total += len;
+	}
+	*size = total;
+	return n_iov;
+}
+
+/* skip size bytes of sent data */
+static void consume_data(struct buffer *buf, size_t *pos, uint32_t *ref,
+		size_t *ref_sent, size_t size)
+{
+	while (size > 0) {
+		size_t len, end = *ref < buf->n_refs ? buf->refs[*ref].offset : buf->buffer_size;
+
+		if (*pos < end) {
+			len = SPA_MIN(end - *pos, size);
+			*pos += len;
+		} else {
+			struct pw_protocol_native_shared *shared = buf->refs[*ref].shared;
+			len = SPA_MIN(shared->size - *ref_sent, size);
+			*ref_sent += len;
+			if (*ref_sent == shared->size) {
+				pw_protocol_native_shared_unref(shared);
+				(*ref)++;
+				*ref_sent = 0;
+			}
+		}
+		size -= len;
+	}
+}
+
 /** Flush the connection object
  *
  * \param conn the connection object
@@ -749,42 +952,42 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 int pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	ssize_t sent, outsize;
+	ssize_t sent;
+	size_t outsize, pos, ref_sent, total = 0;
 	struct msghdr msg = { 0 };
-	struct iovec iov[1];
+	struct iovec iov[MAX_IOV];
 	struct cmsghdr *cmsg;
 	union {
 		char cmsgbuf[CMSG_SPACE(MAX_FDS_MSG * sizeof(int))];
 		struct cmsghdr align;
 	} cmsgbuf;
 	int res = 0, *fds;
-	uint32_t fds_len, to_close, n_fds, outfds, i;
+	uint32_t fds_len, to_close, n_fds, outfds, i, ref;
 	struct buffer *buf;
-	void *data;
-	size_t size;
 
 	buf = &impl->out;
-	data = buf->buffer_data;
-	size = buf->buffer_size;
+	pos = 0;
+	ref = 0;
+	ref_sent = buf->ref_sent;
 	fds = buf->fds;
 	n_fds = buf->n_fds;
 	to_close = 0;
 
-	while (size > 0) {
+	while (pos < buf->buffer_size || ref < buf->n_refs) {
 		if (n_fds > MAX_FDS_MSG) {
+			/* send the fds with a small part of the data */
 			outfds = MAX_FDS_MSG;
-			outsize = SPA_MIN(sizeof(uint32_t), size);
+			msg.msg_iovlen = fill_iov(buf, iov, pos, ref, ref_sent,
+					sizeof(uint32_t), &outsize);
 		} else {
 			outfds = n_fds;
-			outsize = size;
+			msg.msg_iovlen = fill_iov(buf, iov, pos, ref, ref_sent,
+					SIZE_MAX, &outsize);
 		}
 
 		fds_len = outfds * sizeof(int);
 
-		iov[0].iov_base = data;
-		iov[0].iov_len = outsize;
 		msg.msg_iov = iov;
-		msg.msg_iovlen = 1;
 
 		if (outfds > 0) {
 			msg.msg_control = &cmsgbuf;
@@ -812,11 +1015,12 @@ int pw_protocol_native_connection_flush(struct pw_protocol_native_connection *co
 			}
 			break;
 		}
-		pw_log_trace("connection %p: %d written %zd bytes and %u fds", conn, conn->fd, sent,
-			     outfds);
+		pw_log_trace("connection %p: %d written %zd of %zu bytes in %zu iov and %u fds",
+				conn, conn->fd, sent, outsize, (size_t)msg.msg_iovlen, outfds);
 
-		size -= sent;
-		data = SPA_PTROFF(data, sent, void);
+		impl->stats.n_syscalls++;
+		total += sent;
+		consume_data(buf, &pos, &ref, &ref_sent, sent);
 		n_fds -= outfds;
 		fds += outfds;
 		to_close += outfds;
@@ -824,10 +1028,32 @@ int pw_protocol_native_connection_flush(struct pw_protocol_native_connection *co
 
 	res = 0;
 
+	if (buf->n_msgs > 0) {
+		impl->stats.n_flushes++;
+		impl->stats.n_messages += buf->n_msgs;
+		impl->stats.last_messages = buf->n_msgs;
+		impl->stats.max_messages = SPA_MAX(impl->stats.max_messages, buf->n_msgs);
+		pw_log_trace("connection %p: flushed %u messages", conn, buf->n_msgs);
+		buf->n_msgs = 0;
+	}
+
 exit:
-	if (size > 0)
-		memmove(buf->buffer_data, data, size);
-	buf->buffer_size = size;
+	if (total > 0) {
+		impl->stats.n_bytes += total;
+		impl->stats.last_bytes = total;
+		impl->stats.max_bytes = SPA_MAX(impl->stats.max_bytes, (uint32_t)total);
+	}
+	if (pos < buf->buffer_size)
+		memmove(buf->buffer_data, buf->buffer_data + pos, buf->buffer_size - pos);
+	buf->buffer_size -= pos;
+	if (ref > 0) {
+		buf->n_refs -= ref;
+		memmove(buf->refs, &buf->refs[ref], buf->n_refs * sizeof(struct buffer_ref));
+	}
+	for (i = 0; i < buf->n_refs; i++)
+		buf->refs[i].offset -= pos;
+	buf->ref_sent = ref_sent;
+
 	for (i = 0; i < to_close; i++) {
 		pw_log_debug("%p: close fd:%d", conn, buf->fds[i]);
 		close(buf->fds[i]);
@@ -838,6 +1064,20 @@ exit:
 	return res;
 }
 
+/** Get the statistics of a connection
+ *
+ * \param conn the connection object
+ * \param stats the statistics
+ *
+ * \memberof pw_protocol_native_connection
+ */
+void pw_protocol_native_connection_get_stats(struct pw_protocol_native_connection *conn,
+		struct pw_protocol_native_connection_stats *stats)
+{
+	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	*stats = impl->stats;
+}
+
 /** Clear the connection object
  *
  * \param conn the connection object
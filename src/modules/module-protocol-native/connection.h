@@ -27,6 +27,37 @@ struct pw_protocol_native_connection_events {
 	void (*start) (void *data, uint32_t version);
 };
 
+/** A refcounted message body that can be queued on many connections */
+struct pw_protocol_native_shared {
+	int ref;
+	uint32_t size;			/**< size of data */
+	uint64_t data[];		/**< the message body */
+};
+
+struct pw_protocol_native_shared *pw_protocol_native_shared_new(const void *data, uint32_t size);
+
+static inline struct pw_protocol_native_shared *
+pw_protocol_native_shared_ref(struct pw_protocol_native_shared *shared)
+{
+	shared->ref++;
+	return shared;
+}
+
+void pw_protocol_native_shared_unref(struct pw_protocol_native_shared *shared);
+
+/** Statistics of the data sent on a connection */
+struct pw_protocol_native_connection_stats {
+	uint64_t n_flushes;		/**< number of flushes that sent data */
+	uint64_t n_messages;		/**< total number of messages sent */
+	uint64_t n_bytes;		/**< total number of bytes sent */
+	uint64_t n_shared;		/**< number of messages with a shared body */
+	uint64_t n_syscalls;		/**< number of sendmsg calls */
+	uint32_t last_messages;		/**< messages sent in the last flush */
+	uint32_t last_bytes;		/**< bytes sent in the last flush */
+	uint32_t max_messages;		/**< max messages sent in one flush */
+	uint32_t max_bytes;		/**< max bytes sent in one flush */
+};
+
 /** \class pw_protocol_native_connection
  *
  * \brief Manages the connection between client and server
@@ -73,9 +104,17 @@ int
 pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
                                   struct spa_pod_builder *builder);
 
+int
+pw_protocol_native_connection_end_shared(struct pw_protocol_native_connection *conn,
+                                  struct spa_pod_builder *builder,
+				  struct pw_protocol_native_shared *body);
+
 int
 pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn);
 
+void pw_protocol_native_connection_get_stats(struct pw_protocol_native_connection *conn,
+		struct pw_protocol_native_connection_stats *stats);
+
 int
 pw_protocol_native_connection_clear(struct pw_protocol_native_connection *conn);
 
@@ -109,6 +109,145 @@ static void test_read_write(struct pw_protocol_native_connection *in,
 	spa_assert_se(read_message(in, NULL) == -1);
 }
 
+static void write_shared(struct pw_protocol_native_connection *conn,
+		struct pw_protocol_native_shared *body)
+{
+	struct pw_protocol_native_message *msg;
+	struct spa_pod_builder *b;
+	int seq, res;
+
+	b = pw_protocol_native_connection_begin(conn, 2, 7, &msg);
+	spa_assert_se(b != NULL);
+	seq = SPA_RESULT_RETURN_ASYNC(msg->seq);
+
+	res = pw_protocol_native_connection_end_shared(conn, b, body);
+	spa_assert_se(seq == res);
+}
+
+static void check_shared(const struct pw_protocol_native_message *msg, uint32_t n_values)
+{
+	struct spa_pod_parser prs;
+	struct spa_pod *pod;
+	const int32_t *values;
+	uint32_t i, n;
+
+	spa_assert_se(msg->opcode == 7);
+	spa_assert_se(msg->id == 2);
+	spa_assert_se(msg->n_fds == 0);
+
+	spa_pod_parser_init(&prs, msg->data, msg->size);
+	spa_assert_se(spa_pod_parser_get_struct(&prs, SPA_POD_Pod(&pod)) >= 0);
+	values = spa_pod_get_array(pod, &n);
+	spa_assert_se(values != NULL);
+	spa_assert_se(n == n_values);
+	for (i = 0; i < n; i++)
+		spa_assert_se(values[i] == (int32_t)i);
+}
+
+static void read_shared(struct pw_protocol_native_connection *conn, uint32_t n_values)
+{
+	const struct pw_protocol_native_message *msg;
+
+	spa_assert_se(pw_protocol_native_connection_get_next(conn, &msg) == 1);
+	check_shared(msg, n_values);
+}
+
+static struct pw_protocol_native_shared *make_shared(uint32_t n_values)
+{
+	struct pw_protocol_native_shared *shared;
+	struct spa_pod_builder b = { 0 };
+	struct spa_pod_frame f[2];
+	uint8_t *buffer;
+	uint32_t i, size = 1024 + n_values * sizeof(int32_t);
+
+	buffer = malloc(size);
+	spa_assert_se(buffer != NULL);
+	spa_pod_builder_init(&b, buffer, size);
+	spa_pod_builder_push_struct(&b, &f[0]);
+	spa_pod_builder_push_array(&b, &f[1]);
+	for (i = 0; i < n_values; i++)
+		spa_pod_builder_int(&b, i);
+	spa_pod_builder_pop(&b, &f[1]);
+	spa_pod_builder_pop(&b, &f[0]);
+	spa_assert_se(b.state.offset <= size);
+
+	shared = pw_protocol_native_shared_new(buffer, b.state.offset);
+	spa_assert_se(shared != NULL);
+	free(buffer);
+	return shared;
+}
+
+static void test_shared(struct pw_protocol_native_connection *in,
+		struct pw_protocol_native_connection *out)
+{
+	struct pw_protocol_native_connection_stats stats;
+	struct pw_protocol_native_shared *small, *large;
+	const struct pw_protocol_native_message *msg;
+	const uint32_t n_large = 256 * 1024;
+	int res, i, n_read = 0;
+
+	small = make_shared(16);
+	large = make_shared(n_large);
+
+	/* shared bodies between normal messages */
+	write_message(out, 1);
+	write_shared(out, small);
+	write_message(out, 2);
+	write_shared(out, small);
+	spa_assert_se(pw_protocol_native_connection_flush(out) == 0);
+	spa_assert_se(read_message(in, NULL) == 0);
+	read_shared(in, 16);
+	spa_assert_se(read_message(in, NULL) == 0);
+	read_shared(in, 16);
+
+	pw_protocol_native_connection_get_stats(out, &stats);
+	spa_assert_se(stats.last_messages == 4);
+	spa_assert_se(stats.n_shared == 2);
+
+	/* a message with fds gets a copy of the body */
+	{
+		struct pw_protocol_native_message *m;
+		struct spa_pod_builder *b;
+
+		b = pw_protocol_native_connection_begin(out, 2, 7, &m);
+		spa_assert_se(b != NULL);
+		pw_protocol_native_connection_add_fd(out, 0);
+		spa_assert_se(pw_protocol_native_connection_end_shared(out, b, small) >= 0);
+		spa_assert_se(small->ref == 1);
+		spa_assert_se(pw_protocol_native_connection_flush(out) == 0);
+		spa_assert_se(pw_protocol_native_connection_get_next(in, &msg) == 1);
+		spa_assert_se(msg->n_fds == 1);
+		spa_assert_se(msg->size == small->size);
+		spa_assert_se(memcmp(msg->data, small->data, small->size) == 0);
+	}
+
+	/* a body larger than the socket buffer is sent in parts */
+	for (i = 0; i < 2; i++)
+		write_shared(out, large);
+	write_message(out, 1);
+	while (true) {
+		res = pw_protocol_native_connection_flush(out);
+		spa_assert_se(res == 0 || res == -EAGAIN);
+
+		while (pw_protocol_native_connection_get_next(in, &msg) == 1) {
+			if (n_read < 2) {
+				check_shared(msg, n_large);
+			} else {
+				spa_assert_se(msg->opcode == 5);
+				spa_assert_se(msg->n_fds == 1);
+			}
+			n_read++;
+		}
+		if (res == 0 && n_read == 3)
+			break;
+	}
+	spa_assert_se(small->ref == 1);
+	spa_assert_se(large->ref == 1);
+
+	pw_protocol_native_shared_unref(small);
+	pw_protocol_native_shared_unref(large);
+}
+
 static void test_reentering(struct pw_protocol_native_connection *in,
 		struct pw_protocol_native_connection *out)
 {
@@ -195,6 +334,7 @@ int main(int argc, char *argv[])
 	test_create(out);
 	test_read_write(in, out);
 	test_reentering(in, out);
+	test_shared(in, out);
 
 	pw_protocol_native_connection_destroy(in);
 	pw_protocol_native_connection_destroy(out);
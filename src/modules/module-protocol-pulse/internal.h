@@ -63,6 +63,7 @@ struct impl {
 
 	struct pw_map samples;
 	struct pw_map modules;
+	struct spa_list sample_players;
 
 	struct spa_list free_messages;
 	struct defs defs;
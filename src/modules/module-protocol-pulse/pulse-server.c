@@ -51,6 +51,7 @@
 #include "quirks.h"
 #include "reply.h"
 #include "sample.h"
+#include "sample-play.h"
 #include "server.h"
 #include "stream.h"
 #include "utils.h"
@@ -5358,6 +5359,8 @@ static void impl_clear(struct impl *impl)
 	spa_list_consume(msg, &impl->free_messages, link)
 		message_free(msg, true, true);
 
+	sample_player_destroy_all(impl);
+
 	pw_map_for_each(&impl->samples, impl_free_sample, impl);
 	pw_map_clear(&impl->samples);
 
@@ -5517,6 +5520,7 @@ struct pw_protocol_pulse *pw_protocol_pulse_new(struct pw_context *context,
 	pw_map_init(&impl->modules, 16, 16);
 	spa_list_init(&impl->cleanup_clients);
 	spa_list_init(&impl->free_messages);
+	spa_list_init(&impl->sample_players);
 
 	str = pw_properties_get(props, "server.address");
 	if (str == NULL) {
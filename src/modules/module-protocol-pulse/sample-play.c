@@ -11,17 +11,78 @@
 #include <spa/param/audio/raw.h>
 #include <spa/pod/builder.h>
 #include <spa/utils/hook.h>
+#include <spa/utils/string.h>
 #include <pipewire/context.h>
 #include <pipewire/core.h>
+#include <pipewire/data-loop.h>
+#include <pipewire/keys.h>
 #include <pipewire/log.h>
+#include <pipewire/loop.h>
 #include <pipewire/properties.h>
 #include <pipewire/stream.h>
+#include <pipewire/work-queue.h>
 
 #include "format.h"
+#include "internal.h"
 #include "log.h"
 #include "sample.h"
 #include "sample-play.h"
 
+/* how long an unused player stays around */
+#define PLAYER_IDLE_TIMEOUT	10
+
+#define VOICE_STARTED	0
+#define VOICE_DONE	1
+
+/* A player is a stream to one sink that mixes all the samples with the same
+ * rate, channels and routing properties that play on that sink. The stream
+ * stays connected between sounds so that a new sound starts in the next
+ * cycle. Samples with another role or from another application get their
+ * own player so that routing and volume restore still apply. */
+struct sample_player {
+	struct spa_list link;
+	struct impl *impl;
+	struct pw_loop *main_loop;
+	struct pw_data_loop *data_loop;
+
+	struct pw_core *core;
+	struct pw_stream *stream;
+	struct spa_hook listener;
+	struct spa_source *idle_timer;
+
+	struct pw_properties *props;
+	struct sample_spec ss;
+	struct channel_map map;
+	uint32_t stride;
+	uint32_t id;
+	uint32_t serial;
+
+	/* voices of the main thread and of the data thread */
+	struct spa_list voices;
+	struct spa_list rt_voices;
+
+	unsigned int active:1;
+	unsigned int destroying:1;
+};
+
+static void player_destroy(struct sample_player *player);
+
+/* the properties that select a player, the other properties, such as the
+ * name of the sample, are different for every sound */
+static const char * const player_keys[] = {
+	PW_KEY_TARGET_OBJECT,
+	PW_KEY_MEDIA_TYPE,
+	PW_KEY_MEDIA_CATEGORY,
+	PW_KEY_MEDIA_ROLE,
+	PW_KEY_APP_NAME,
+	PW_KEY_APP_ID,
+	PW_KEY_APP_ICON_NAME,
+	PW_KEY_APP_PROCESS_ID,
+	PW_KEY_APP_PROCESS_BINARY,
+	PW_KEY_CLIENT_ID,
+	NULL
+};
+
 static void sample_play_stream_state_changed(void *data, enum pw_stream_state old,
 					     enum pw_stream_state state, const char *error)
 {
@@ -109,6 +170,416 @@ static const struct pw_stream_events sample_play_stream_events = {
 	.drained = sample_play_stream_drained,
 };
 
+/* convert the sample to F32 once, all players mix in F32 */
+static int sample_prepare_mix(struct sample *s)
+{
+	uint32_t i, n_samples, frame_size;
+	float *d;
+
+	if (s->mix_buffer != NULL)
+		return 0;
+
+	if ((frame_size = sample_spec_frame_size(&s->ss)) == 0)
+		return -EINVAL;
+	n_samples = (s->length / frame_size) * s->ss.channels;
+
+	switch (s->ss.format) {
+	case SPA_AUDIO_FORMAT_U8:
+	case SPA_AUDIO_FORMAT_S16:
+	case SPA_AUDIO_FORMAT_S32:
+	case SPA_AUDIO_FORMAT_F32:
+		break;
+	default:
+		return -ENOTSUP;
+	}
+	if ((d = malloc(SPA_MAX(n_samples, 1u) * sizeof(float))) == NULL)
+		return -errno;
+
+	switch (s->ss.format) {
+	case SPA_AUDIO_FORMAT_U8:
+		for (i = 0; i < n_samples; i++)
+			d[i] = (s->buffer[i] - 128) / 128.0f;
+		break;
+	case SPA_AUDIO_FORMAT_S16:
+		for (i = 0; i < n_samples; i++)
+			d[i] = ((int16_t*)s->buffer)[i] / 32768.0f;
+		break;
+	case SPA_AUDIO_FORMAT_S32:
+		for (i = 0; i < n_samples; i++)
+			d[i] = ((int32_t*)s->buffer)[i] / 2147483648.0f;
+		break;
+	case SPA_AUDIO_FORMAT_F32:
+		memcpy(d, s->buffer, n_samples * sizeof(float));
+		break;
+	}
+	s->mix_buffer = d;
+	s->mix_frames = n_samples / s->ss.channels;
+	return 0;
+}
+
+static int do_voice_event(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct sample_player *player = user_data;
+	const uint32_t *serial = data;
+	struct sample_play *p;
+
+	spa_list_for_each(p, &player->voices, link) {
+		if (p->serial != *serial)
+			continue;
+		if (seq == VOICE_STARTED) {
+			sample_play_emit_ready(p, player->id);
+		} else if (!p->done) {
+			p->done = true;
+			sample_play_emit_done(p, 0);
+		}
+		break;
+	}
+	return 0;
+}
+
+static void player_stream_process(void *data)
+{
+	struct sample_player *player = data;
+	struct sample_play *p, *t;
+	struct pw_buffer *b;
+	struct spa_buffer *buf;
+	uint32_t i, n_frames, n, channels = player->ss.channels;
+	float *d;
+
+	if ((b = pw_stream_dequeue_buffer(player->stream)) == NULL) {
+		pw_log_warn("out of buffers: %m");
+		return;
+	}
+
+	buf = b->buffer;
+	if ((d = buf->datas[0].data) == NULL)
+		return;
+
+	n_frames = buf->datas[0].maxsize / player->stride;
+	if (b->requested)
+		n_frames = SPA_MIN(n_frames, b->requested);
+
+	memset(d, 0, n_frames * player->stride);
+
+	spa_list_for_each_safe(p, t, &player->rt_voices, rt_link) {
+		struct sample *s = p->sample;
+		const float *src = &s->mix_buffer[p->offset * channels];
+
+		n = SPA_MIN(n_frames, s->mix_frames - p->offset);
+		for (i = 0; i < n * channels; i++)
+			d[i] += src[i];
+		p->offset += n;
+
+		if (!p->started) {
+			p->started = true;
+			pw_loop_invoke(player->main_loop, do_voice_event, VOICE_STARTED,
+					&p->serial, sizeof(p->serial), false, player);
+		}
+		if (p->offset >= s->mix_frames) {
+			spa_list_remove(&p->rt_link);
+			p->rt_active = false;
+			pw_loop_invoke(player->main_loop, do_voice_event, VOICE_DONE,
+					&p->serial, sizeof(p->serial), false, player);
+		}
+	}
+
+	buf->datas[0].chunk->offset = 0;
+	buf->datas[0].chunk->stride = player->stride;
+	buf->datas[0].chunk->size = n_frames * player->stride;
+
+	pw_stream_queue_buffer(player->stream, b);
+}
+
+static void do_player_destroy(void *obj, void *data, int res, uint32_t id)
+{
+	player_destroy(obj);
+}
+
+static void player_stream_state_changed(void *data, enum pw_stream_state old,
+					enum pw_stream_state state, const char *error)
+{
+	struct sample_player *player = data;
+
+	switch (state) {
+	case PW_STREAM_STATE_UNCONNECTED:
+	case PW_STREAM_STATE_ERROR:
+		pw_log_info("player %p: stream %s: %s", player,
+				pw_stream_state_as_string(state), error);
+		if (!player->destroying) {
+			player->destroying = true;
+			pw_work_queue_add(player->impl->work_queue, player, 0,
+					do_player_destroy, NULL);
+		}
+		break;
+	case PW_STREAM_STATE_PAUSED:
+	case PW_STREAM_STATE_STREAMING:
+		player->id = pw_stream_get_node_id(player->stream);
+		break;
+	default:
+		break;
+	}
+}
+
+static const struct pw_stream_events player_stream_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = player_stream_state_changed,
+	.process = player_stream_process,
+};
+
+static void player_idle_timeout(void *data, uint64_t expirations)
+{
+	struct sample_player *player = data;
+
+	pw_log_info("player %p: idle, destroy", player);
+	player_destroy(player);
+}
+
+static void player_set_active(struct sample_player *player, bool active)
+{
+	struct timespec value = { 0, 0 };
+
+	if (player->active == active)
+		return;
+
+	player->active = active;
+	pw_stream_set_active(player->stream, active);
+
+	/* when inactive, the player is destroyed after a while */
+	if (!active)
+		value.tv_sec = PLAYER_IDLE_TIMEOUT;
+	pw_loop_update_timer(player->main_loop, player->idle_timer, &value, NULL, false);
+}
+
+static struct sample_player *player_new(struct impl *impl, const char *name,
+		const struct pw_properties *stream_props,
+		const struct sample_spec *ss, const struct channel_map *map)
+{
+	struct sample_player *player;
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const struct spa_pod *params[1];
+	struct pw_properties *props;
+	int res;
+
+	player = calloc(1, sizeof(*player));
+	if (player == NULL)
+		return NULL;
+
+	player->impl = impl;
+	player->main_loop = impl->loop;
+	player->data_loop = pw_context_get_data_loop(impl->context);
+	player->ss = *ss;
+	player->map = *map;
+	player->stride = sample_spec_frame_size(ss);
+	player->id = SPA_ID_INVALID;
+	spa_list_init(&player->voices);
+	spa_list_init(&player->rt_voices);
+
+	if ((player->props = pw_properties_copy(stream_props)) == NULL)
+		goto error_free;
+
+	player->idle_timer = pw_loop_add_timer(player->main_loop, player_idle_timeout, player);
+	if (player->idle_timer == NULL)
+		goto error_free;
+
+	/* the clients come and go, the player has its own connection */
+	player->core = pw_context_connect_self(impl->context, NULL, 0);
+	if (player->core == NULL)
+		goto error_free;
+
+	if ((props = pw_properties_copy(stream_props)) == NULL)
+		goto error_free;
+	pw_properties_set(props, PW_KEY_MEDIA_NAME, name);
+	pw_properties_set(props, PW_KEY_NODE_DONT_RECONNECT, "true");
+
+	player->stream = pw_stream_new(player->core, name, props);
+	if (player->stream == NULL)
+		goto error_free;
+
+	pw_stream_add_listener(player->stream,
+			&player->listener,
+			&player_stream_events, player);
+
+	params[0] = format_build_param(&b, SPA_PARAM_EnumFormat, ss, map);
+
+	res = pw_stream_connect(player->stream,
+			PW_DIRECTION_OUTPUT,
+			PW_ID_ANY,
+			PW_STREAM_FLAG_AUTOCONNECT |
+			PW_STREAM_FLAG_MAP_BUFFERS |
+			PW_STREAM_FLAG_RT_PROCESS,
+			params, 1);
+	if (res < 0) {
+		errno = -res;
+		goto error_free;
+	}
+	player->active = true;
+	spa_list_append(&impl->sample_players, &player->link);
+
+	pw_log_info("player %p: new target:%s rate:%u channels:%u", player,
+			pw_properties_get(stream_props, PW_KEY_TARGET_OBJECT),
+			ss->rate, ss->channels);
+
+	return player;
+
+error_free:
+	res = -errno;
+	if (player->stream)
+		pw_stream_destroy(player->stream);
+	if (player->core)
+		pw_core_disconnect(player->core);
+	if (player->idle_timer)
+		pw_loop_destroy_source(player->main_loop, player->idle_timer);
+	pw_properties_free(player->props);
+	free(player);
+	errno = -res;
+	return NULL;
+}
+
+static bool props_equal(const struct spa_dict *a, const struct spa_dict *b)
+{
+	const struct spa_dict_item *it;
+
+	if (a->n_items != b->n_items)
+		return false;
+	spa_dict_for_each(it, a) {
+		if (!spa_streq(it->value, spa_dict_lookup(b, it->key)))
+			return false;
+	}
+	return true;
+}
+
+static struct sample_player *player_find(struct impl *impl, const char *name,
+		const struct pw_properties *props,
+		const struct sample_spec *ss, const struct channel_map *map)
+{
+	struct sample_player *player;
+
+	spa_list_for_each(player, &impl->sample_players, link) {
+		if (player->destroying ||
+		    !props_equal(&player->props->dict, &props->dict) ||
+		    player->ss.rate != ss->rate ||
+		    player->ss.channels != ss->channels ||
+		    memcmp(player->map.map, map->map, map->channels * sizeof(map->map[0])) != 0)
+			continue;
+		return player;
+	}
+	return player_new(impl, name, props, ss, map);
+}
+
+static void player_destroy(struct sample_player *player)
+{
+	struct sample_play *p;
+
+	pw_log_info("player %p: destroy", player);
+
+	spa_list_remove(&player->link);
+	pw_work_queue_cancel(player->impl->work_queue, player, SPA_ID_INVALID);
+
+	spa_hook_remove(&player->listener);
+	pw_stream_destroy(player->stream);
+	/* run the pending voice events of the data thread */
+	pw_loop_invoke(player->main_loop, NULL, 0, NULL, 0, true, NULL);
+
+	spa_list_consume(p, &player->voices, link) {
+		spa_list_remove(&p->link);
+		spa_list_init(&p->link);
+		p->player = NULL;
+		sample_unref(p->sample);
+		p->sample = NULL;
+		/* the voices that finished already emitted done */
+		if (!p->done) {
+			p->done = true;
+			sample_play_emit_done(p, -EIO);
+		}
+	}
+
+	pw_core_disconnect(player->core);
+	pw_loop_destroy_source(player->main_loop, player->idle_timer);
+	pw_properties_free(player->props);
+	free(player);
+}
+
+void sample_player_destroy_all(struct impl *impl)
+{
+	struct sample_player *player;
+
+	spa_list_consume(player, &impl->sample_players, link)
+		player_destroy(player);
+}
+
+static int do_add_voice(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct sample_play *p = user_data;
+
+	spa_list_append(&p->player->rt_voices, &p->rt_link);
+	p->rt_active = true;
+	return 0;
+}
+
+static int do_remove_voice(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct sample_play *p = user_data;
+
+	if (p->rt_active) {
+		spa_list_remove(&p->rt_link);
+		p->rt_active = false;
+	}
+	return 0;
+}
+
+static struct sample_play *sample_play_new_voice(struct sample *sample,
+		struct pw_properties *props, size_t user_data_size)
+{
+	struct impl *impl = sample->impl;
+	struct sample_player *player;
+	struct sample_play *p;
+	struct sample_spec ss;
+	struct pw_properties *player_props;
+
+	if (pw_properties_get(props, PW_KEY_TARGET_OBJECT) == NULL ||
+	    sample_prepare_mix(sample) < 0)
+		return NULL;
+
+	/* the player stream gets the routing properties that a stream of
+	 * its own would get */
+	if ((player_props = pw_properties_new(NULL, NULL)) == NULL)
+		return NULL;
+	pw_properties_update_keys(player_props, &props->dict, player_keys);
+	pw_properties_update_keys(player_props, &sample->props->dict, player_keys);
+
+	ss = sample->ss;
+	ss.format = SPA_AUDIO_FORMAT_F32;
+	player = player_find(impl, "sample player", player_props, &ss, &sample->map);
+	pw_properties_free(player_props);
+	if (player == NULL)
+		return NULL;
+
+	if ((p = calloc(1, sizeof(*p) + user_data_size)) == NULL)
+		return NULL;
+
+	p->context = impl->context;
+	p->main_loop = player->main_loop;
+	spa_hook_list_init(&p->hooks);
+	p->user_data = SPA_PTROFF(p, sizeof(struct sample_play), void);
+	p->sample = sample_ref(sample);
+	p->stride = player->stride;
+	p->player = player;
+	p->serial = player->serial++;
+
+	spa_list_append(&player->voices, &p->link);
+	pw_data_loop_invoke(player->data_loop, do_add_voice, 0, NULL, 0, true, p);
+	player_set_active(player, true);
+
+	pw_log_info("player %p: play %s", player, sample->name);
+
+	pw_properties_free(props);
+	return p;
+}
+
 struct sample_play *sample_play_new(struct pw_core *core,
 				    struct sample *sample, struct pw_properties *props,
 				    size_t user_data_size)
@@ -120,6 +591,11 @@ struct sample_play *sample_play_new(struct pw_core *core,
 	uint32_t n_params = 0;
 	int res;
 
+	/* samples that can be mixed play on a shared player, the others
+	 * get their own stream */
+	if ((p = sample_play_new_voice(sample, props, user_data_size)) != NULL)
+		return p;
+
 	p = calloc(1, sizeof(*p) + user_data_size);
 	if (p == NULL) {
 		res = -errno;
@@ -176,6 +652,15 @@ error_free:
 
 void sample_play_destroy(struct sample_play *p)
 {
+	struct sample_player *player = p->player;
+
+	if (player) {
+		pw_data_loop_invoke(player->data_loop, do_remove_voice, 0, NULL, 0, true, p);
+		spa_list_remove(&p->link);
+		if (spa_list_is_empty(&player->voices))
+			player_set_active(player, false);
+		sample_unref(p->sample);
+	}
 	if (p->stream)
 		pw_stream_destroy(p->stream);
 
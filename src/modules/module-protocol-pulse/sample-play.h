@@ -5,13 +5,16 @@
 #ifndef PULSER_SERVER_SAMPLE_PLAY_H
 #define PULSER_SERVER_SAMPLE_PLAY_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <spa/utils/list.h>
 #include <spa/utils/hook.h>
 
+struct impl;
 struct sample;
+struct sample_player;
 struct pw_core;
 struct pw_loop;
 struct pw_stream;
@@ -34,6 +37,14 @@ struct sample_play {
 	struct spa_list link;
 	struct sample *sample;
 	struct pw_stream *stream;
+	/* when not NULL, the sample is mixed by a shared player instead of
+	 * playing on its own stream */
+	struct sample_player *player;
+	struct spa_list rt_link;
+	uint32_t serial;
+	bool rt_active;
+	bool started;
+	bool done;
 	uint32_t id;
 	struct spa_hook listener;
 	struct pw_context *context;
@@ -53,4 +64,6 @@ void sample_play_destroy(struct sample_play *p);
 void sample_play_add_listener(struct sample_play *p, struct spa_hook *listener,
 			      const struct sample_play_events *events, void *data);
 
+void sample_player_destroy_all(struct impl *impl);
+
 #endif /* PULSER_SERVER_SAMPLE_PLAY_H */
@@ -26,5 +26,6 @@ void sample_free(struct sample *sample)
 	pw_properties_free(sample->props);
 
 	free(sample->buffer);
+	free(sample->mix_buffer);
 	free(sample);
 }
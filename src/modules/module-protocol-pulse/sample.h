@@ -22,6 +22,11 @@ struct sample {
 	struct pw_properties *props;
 	uint32_t length;
 	uint8_t *buffer;
+
+	/* the samples converted to F32 for the sample players, made when the
+	 * sample is first played */
+	float *mix_buffer;
+	uint32_t mix_frames;
 };
 
 void sample_free(struct sample *sample);
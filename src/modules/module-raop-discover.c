@@ -43,6 +43,8 @@
  *
  * - `raop.latency.ms` = latency for all streams in microseconds. This
  *    can be overwritten in the stream rules.
+ * - `raop.prefer-alac` = use ALAC instead of PCM when a device supports both.
+ *    ALAC uses less bandwidth but needs more CPU. Default false.
  * - `stream.rules` = <rules>: match rules, use create-stream actions. See
  *   \ref page_module_raop_sink for module properties.
  *
@@ -53,6 +55,7 @@
  * {   name = libpipewire-raop-discover
  *     args = {
  *         #raop.latency.ms = 1000
+ *         #raop.prefer-alac = false
  *         stream.rules = [
  *             {   matches = [
  *                     {    raop.ip = "~.*"
@@ -98,7 +101,8 @@
 PW_LOG_TOPIC_STATIC(mod_topic, "mod." NAME);
 #define PW_LOG_TOPIC_DEFAULT mod_topic
 
-#define MODULE_USAGE "( stream.rules=<rules>, use create-stream actions )"
+#define MODULE_USAGE "( raop.prefer-alac=<bool, default false> ) "	\
+			"( stream.rules=<rules>, use create-stream actions )"
 
 #define DEFAULT_CREATE_RULES	\
         "[ { matches = [ { raop.ip = \"~.*\" } ] actions = { create-stream = { } } } ] "
@@ -125,6 +129,8 @@ struct impl {
 	AvahiServiceBrowser *sink_browser;
 
 	struct spa_list tunnel_list;
+
+	unsigned int prefer_alac:1;
 };
 
 struct tunnel_info {
@@ -215,8 +221,8 @@ static bool str_in_list(const char *haystack, const char *delimiters, const char
 	return false;
 }
 
-static void pw_properties_from_avahi_string(const char *key, const char *value,
-		struct pw_properties *props)
+static void pw_properties_from_avahi_string(struct impl *impl, const char *key,
+		const char *value, struct pw_properties *props)
 {
 	if (spa_streq(key, "device")) {
 		pw_properties_set(props, "raop.device", value);
@@ -248,7 +254,9 @@ static void pw_properties_from_avahi_string(const char *key, const char *value,
 		 *  1 = ALAC,
 		 *  2 = AAC,
 		 *  3 = AAC ELD. */
-		if (str_in_list(value, ",", "0"))
+		if (impl->prefer_alac && str_in_list(value, ",", "1"))
+			value = "ALAC";
+		else if (str_in_list(value, ",", "0"))
 			value = "PCM";
 		else if (str_in_list(value, ",", "1"))
 			value = "ALAC";
@@ -408,7 +416,7 @@ static void resolver_cb(AvahiServiceResolver *r, AvahiIfIndex interface, AvahiPr
 		if (avahi_string_list_get_pair(l, &key, &value, NULL) != 0)
 			break;
 
-		pw_properties_from_avahi_string(key, value, props);
+		pw_properties_from_avahi_string(impl, key, value, props);
 		avahi_free(key);
 		avahi_free(value);
 	}
@@ -578,6 +586,7 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 	impl->module = module;
 	impl->context = context;
 	impl->properties = props;
+	impl->prefer_alac = pw_properties_get_bool(props, "raop.prefer-alac", false);
 
 	pw_impl_module_add_listener(module, &impl->module_listener, &module_events, impl);
 
@@ -44,6 +44,8 @@
 #include <pipewire/i18n.h>
 
 #include "module-raop/rtsp-client.h"
+#include "module-raop/alac.h"
+#include "module-raop/packet.h"
 
 /** \page page_module_raop_sink PipeWire Module: AirPlay Sink
  *
@@ -65,7 +67,8 @@
  *                    to "udp".
  * - `raop.encryption.type`: The encryption type to use. One of "none", "RSA" or
  *                    "auth_setup". Default is "none".
- * - `raop.audio.codec`: The audio codec to use. Needs to be "PCM". Defaults to "PCM".
+ * - `raop.audio.codec`: The audio codec to use. One of "PCM" or "ALAC". Defaults
+ *                    to "PCM".
  * - `raop.password`: The password to use.
  * - `stream.props = {}`: properties to be passed to the sink stream
  *
@@ -96,7 +99,7 @@
  *         raop.hostname = "My Service"
  *         #raop.transport = "udp"
  *         raop.encryption.type = "RSA"
- *         #raop.audio.codec = "PCM"
+ *         #raop.audio.codec = "ALAC"
  *         #raop.password = "****"
  *         #audio.format = "S16"
  *         #audio.rate = 44100
@@ -123,6 +126,11 @@ PW_LOG_TOPIC_STATIC(mod_topic, "mod." NAME);
 #define FRAMES_PER_TCP_PACKET 4096
 #define FRAMES_PER_UDP_PACKET 352
 
+#define RINGBUFFER_SIZE		(1u << 18)
+#define RINGBUFFER_MASK		(RINGBUFFER_SIZE-1)
+
+#define SEND_BUFFER_SIZE	(64 * 1024)
+
 #define RAOP_LATENCY_MIN	11025u
 #define DEFAULT_LATENCY_MS	"1500"
 
@@ -157,7 +165,7 @@ PW_LOG_TOPIC_STATIC(mod_topic, "mod." NAME);
 			"( raop.hostname=<hostname of host> ) "					\
 			"( raop.transport=<transport, default:udp> ) "				\
 			"( raop.encryption.type=<encryption, default:none> ) "			\
-			"( raop.audio.codec=PCM ) "						\
+			"( raop.audio.codec=<codec, default:PCM> ) "				\
 			"( raop.password=<password for auth> ) "				\
 			"( node.latency=<latency as fraction> ) "				\
 			"( node.name=<name of the nodes> ) "					\
@@ -260,8 +268,19 @@ struct impl {
 	bool mute;
 	float volume;
 
-	uint8_t buffer[FRAMES_PER_TCP_PACKET * 4];
-	uint32_t filled;
+	/* the graph thread writes the samples in the ringbuffer, the sender
+	 * thread encodes, encrypts and sends them in batches */
+	struct pw_thread_loop *thread_loop;
+	struct pw_loop *thread_loop_loop;
+	struct spa_source *send_event;
+
+	struct spa_ringbuffer ring;
+	uint8_t ring_buffer[RINGBUFFER_SIZE];
+
+	struct alac_encoder alac;
+	int16_t buffer[FRAMES_PER_TCP_PACKET * 2];
+	uint32_t packet_size;
+	uint8_t send_buffer[SEND_BUFFER_SIZE];
 };
 
 static void stream_destroy(void *d)
@@ -271,27 +290,6 @@ static void stream_destroy(void *d)
 	impl->stream = NULL;
 }
 
-static inline void bit_writer(uint8_t **p, int *pos, uint8_t data, int len)
-{
-	int rb = 8 - *pos - len;
-	if (rb >= 0) {
-		**p = (*pos ? **p : 0) | (data << rb);
-                *pos += len;
-	} else {
-		*(*p)++ |= (data >> -rb);
-		**p = data << (8+rb);
-		*pos = -rb;
-	}
-}
-
-static int aes_encrypt(struct impl *impl, uint8_t *data, int len)
-{
-	int i = len & ~0xf, clen = i;
-	EVP_EncryptInit(impl->ctx, EVP_aes_128_cbc(), impl->key, impl->iv);
-	EVP_EncryptUpdate(impl->ctx, data, &clen, data, i);
-	return i;
-}
-
 static inline uint64_t timespec_to_ntp(struct timespec *ts)
 {
     uint64_t ntp = (uint64_t) ts->tv_nsec * UINT32_MAX / SPA_NSEC_PER_SEC;
@@ -350,46 +348,23 @@ static int send_udp_timing_packet(struct impl *impl, uint64_t remote, uint64_t r
 	return sendto(impl->timing_fd, pkt, sizeof(pkt), 0, dest_addr, addrlen);
 }
 
-static int write_codec_pcm(void *dst, void *frames, uint32_t n_frames)
+static int write_codec_data(struct impl *impl, uint8_t *dst, size_t size, uint32_t n_frames)
 {
-	uint8_t *bp, *b, *d = frames;
-	int bpos = 0;
-	uint32_t i;
-
-	b = bp = dst;
-
-	bit_writer(&bp, &bpos, 1, 3); /* channel=1, stereo */
-	bit_writer(&bp, &bpos, 0, 4); /* Unknown */
-	bit_writer(&bp, &bpos, 0, 8); /* Unknown */
-	bit_writer(&bp, &bpos, 0, 4); /* Unknown */
-	bit_writer(&bp, &bpos, 1, 1); /* Hassize */
-	bit_writer(&bp, &bpos, 0, 2); /* Unused */
-	bit_writer(&bp, &bpos, 1, 1); /* Is-not-compressed */
-	bit_writer(&bp, &bpos, (n_frames >> 24) & 0xff, 8);
-	bit_writer(&bp, &bpos, (n_frames >> 16) & 0xff, 8);
-	bit_writer(&bp, &bpos, (n_frames >> 8)  & 0xff, 8);
-	bit_writer(&bp, &bpos, (n_frames)       & 0xff, 8);
-
-	for (i = 0; i < n_frames; i++) {
-		bit_writer(&bp, &bpos, *(d + 1), 8);
-		bit_writer(&bp, &bpos, *(d + 0), 8);
-		bit_writer(&bp, &bpos, *(d + 3), 8);
-		bit_writer(&bp, &bpos, *(d + 2), 8);
-		d += 4;
-	}
-	return bp - b + 1;
+	switch (impl->codec) {
+	case CODEC_PCM:
+		return alac_encode_verbatim(dst, size, impl->buffer, n_frames);
+	case CODEC_ALAC:
+		return alac_encode(&impl->alac, dst, size, impl->buffer, n_frames);
+	default:
+		if (size < 8 + impl->block_size)
+			return -ENOSPC;
+		memset(dst, 0, 8 + impl->block_size);
+		return 8 + impl->block_size;
+	}
 }
 
-static int flush_to_udp_packet(struct impl *impl)
+static void write_udp_header(struct impl *impl, uint32_t *pkt)
 {
-	const size_t max = 12 + 8 + impl->block_size;
-	uint32_t pkt[max], len, n_frames;
-	uint8_t *dst;
-	int res;
-
-	if (!impl->recording)
-		return 0;
-
 	if (impl->first || ++impl->sync == impl->sync_period) {
 		impl->sync = 0;
 		send_udp_sync_packet(impl, NULL, 0);
@@ -400,77 +375,108 @@ static int flush_to_udp_packet(struct impl *impl)
 	pkt[0] |= htonl((uint32_t)impl->seq);
 	pkt[1] = htonl(impl->rtptime);
 	pkt[2] = htonl(impl->ssrc);
+}
 
-	n_frames = impl->filled / impl->frame_size;
-	dst = (uint8_t*)&pkt[3];
+static void write_tcp_header(struct impl *impl, uint32_t *pkt, uint32_t len)
+{
+	pkt[0] = htonl(0x24000000);
+	pkt[0] |= htonl((uint32_t) len + 12);
+	pkt[1] = htonl(0x80e00000);
+	pkt[1] |= htonl((uint32_t)impl->seq);
+	pkt[2] = htonl(impl->rtptime);
+	pkt[3] = htonl(impl->ssrc);
+}
 
-	switch (impl->codec) {
-	case CODEC_PCM:
-	case CODEC_ALAC:
-		len = write_codec_pcm(dst, impl->buffer, n_frames);
-		break;
-	default:
-		len = 8 + impl->block_size;
-		memset(dst, 0, len);
-		break;
-	}
-	if (impl->encryption == CRYPTO_RSA)
-		aes_encrypt(impl, dst, len);
+/* encode the block in buffer into a packet, the payload is returned so
+ * that it can be encrypted later with the rest of the batch */
+static int make_packet(struct impl *impl, uint8_t *pkt, size_t size, struct iovec *payload)
+{
+	uint32_t hdr, n_frames;
+	int len;
 
-	impl->rtptime += n_frames;
-	impl->seq = (impl->seq + 1) & 0xffff;
+	hdr = impl->protocol == PROTO_TCP ? 16 : 12;
+	n_frames = impl->block_size / impl->frame_size;
+
+	if ((len = write_codec_data(impl, pkt + hdr, size - hdr, n_frames)) < 0)
+		return len;
 
-	pw_log_debug("send %u", len + 12);
-	res = send(impl->server_fd, pkt, len + 12, 0);
+	if (impl->protocol == PROTO_TCP)
+		write_tcp_header(impl, (uint32_t*)pkt, len);
+	else
+		write_udp_header(impl, (uint32_t*)pkt);
 
+	impl->rtptime += n_frames;
+	impl->seq = (impl->seq + 1) & 0xffff;
 	impl->first = false;
 
-	return res;
+	payload->iov_base = pkt + hdr;
+	payload->iov_len = len;
+
+	return hdr + len;
 }
 
-static int flush_to_tcp_packet(struct impl *impl)
+static void send_packets(struct impl *impl, struct iovec *packets,
+		struct iovec *payloads, uint32_t n_packets)
 {
-	const size_t max = 16 + 8 + impl->block_size;
-	uint32_t pkt[max], len, n_frames;
-	uint8_t *dst;
 	int res;
 
-	if (!impl->recording)
-		return 0;
+	if (impl->encryption == CRYPTO_RSA &&
+	    (res = raop_aes_encrypt(impl->ctx, impl->iv, payloads, n_packets)) < 0) {
+		pw_log_warn("can't encrypt packets: %s", spa_strerror(res));
+		return;
+	}
 
-	pkt[0] = htonl(0x24000000);
-	pkt[1] = htonl(0x80e00000);
-	pkt[1] |= htonl((uint32_t)impl->seq);
-	pkt[2] = htonl(impl->rtptime);
-	pkt[3] = htonl(impl->ssrc);
+	pw_log_debug("send %u packets", n_packets);
+	res = raop_send_packets(impl->server_fd, packets, n_packets,
+			impl->protocol == PROTO_TCP);
+	if (res < 0)
+		pw_log_debug("send failed: %s", spa_strerror(res));
+	else if ((uint32_t)res < n_packets)
+		pw_log_debug("sent %d of %u packets", res, n_packets);
+}
 
-	n_frames = impl->filled / impl->frame_size;
-	dst = (uint8_t*)&pkt[4];
+/* runs in the sender thread with the thread loop lock held */
+static void on_send_event(void *data, uint64_t count)
+{
+	struct impl *impl = data;
+	struct iovec packets[RAOP_MAX_BATCH], payloads[RAOP_MAX_BATCH];
+	uint32_t index, n_packets = 0, max_packets;
+	int32_t avail;
 
-	switch (impl->codec) {
-	case CODEC_PCM:
-	case CODEC_ALAC:
-		len = write_codec_pcm(dst, impl->buffer, n_frames);
-		break;
-	default:
-		len = 8 + impl->block_size;
-		memset(dst, 0, len);
-		break;
+	avail = spa_ringbuffer_get_read_index(&impl->ring, &index);
+
+	if (!impl->recording || impl->server_fd < 0 || impl->block_size == 0) {
+		spa_ringbuffer_read_update(&impl->ring, index + avail);
+		return;
 	}
-	if (impl->encryption == CRYPTO_RSA)
-		aes_encrypt(impl, dst, len);
+	max_packets = SPA_MIN(SEND_BUFFER_SIZE / impl->packet_size,
+			(uint32_t)RAOP_MAX_BATCH);
 
-	pkt[0] |= htonl((uint32_t) len + 12);
+	while (avail >= (int32_t)impl->block_size) {
+		uint8_t *pkt = &impl->send_buffer[n_packets * impl->packet_size];
+		int res;
 
-	impl->rtptime += n_frames;
-	impl->seq = (impl->seq + 1) & 0xffff;
+		spa_ringbuffer_read_data(&impl->ring, impl->ring_buffer, RINGBUFFER_SIZE,
+				index & RINGBUFFER_MASK, impl->buffer, impl->block_size);
+		index += impl->block_size;
+		avail -= impl->block_size;
 
-	pw_log_debug("send %u", len + 16);
-	res = send(impl->server_fd, pkt, len + 16, 0);
+		if ((res = make_packet(impl, pkt, impl->packet_size, &payloads[n_packets])) < 0) {
+			pw_log_warn("can't encode packet: %s", spa_strerror(res));
+			continue;
+		}
+		packets[n_packets].iov_base = pkt;
+		packets[n_packets].iov_len = res;
 
-	impl->first = false;
+		if (++n_packets == max_packets) {
+			send_packets(impl, packets, payloads, n_packets);
+			n_packets = 0;
+		}
+	}
+	spa_ringbuffer_read_update(&impl->ring, index);
 
-	return res;
+	if (n_packets > 0)
+		send_packets(impl, packets, payloads, n_packets);
 }
 
 static void playback_stream_process(void *d)
@@ -479,7 +485,8 @@ static void playback_stream_process(void *d)
 	struct pw_buffer *buf;
 	struct spa_data *bd;
 	uint8_t *data;
-	uint32_t offs, size;
+	uint32_t offs, size, index;
+	int32_t filled;
 
 	if ((buf = pw_stream_dequeue_buffer(impl->stream)) == NULL) {
 		pw_log_debug("out of buffers: %m");
@@ -492,33 +499,19 @@ static void playback_stream_process(void *d)
 	size = SPA_MIN(bd->chunk->size, bd->maxsize - offs);
 	data = SPA_PTROFF(bd->data, offs, uint8_t);
 
-	while (size > 0 && impl->block_size > 0) {
-		uint32_t avail, to_fill;
-
-		avail = impl->block_size - impl->filled;
-		to_fill = SPA_MIN(avail, size);
-
-		memcpy(&impl->buffer[impl->filled], data, to_fill);
-
-		impl->filled += to_fill;
-		avail -= to_fill;
-		size -= to_fill;
-		data += to_fill;
-
-		if (avail == 0) {
-			switch (impl->protocol) {
-			case PROTO_UDP:
-				flush_to_udp_packet(impl);
-				break;
-			case PROTO_TCP:
-				flush_to_tcp_packet(impl);
-				break;
-			}
-			impl->filled = 0;
-		}
+	filled = spa_ringbuffer_get_write_index(&impl->ring, &index);
+	if (filled < 0 || filled + size > RINGBUFFER_SIZE) {
+		pw_log_debug("overrun filled:%d size:%u", filled, size);
+		size = filled < 0 ? 0 : (RINGBUFFER_SIZE - filled) /
+			impl->frame_size * impl->frame_size;
 	}
+	spa_ringbuffer_write_data(&impl->ring, impl->ring_buffer, RINGBUFFER_SIZE,
+			index & RINGBUFFER_MASK, data, size);
+	spa_ringbuffer_write_update(&impl->ring, index + size);
 
 	pw_stream_queue_buffer(impl->stream, buf);
+
+	pw_loop_signal_event(impl->thread_loop_loop, impl->send_event);
 }
 
 static int create_udp_socket(struct impl *impl, uint16_t *port)
@@ -851,11 +844,13 @@ static int rtsp_do_flush(struct impl *impl)
 	if (!impl->recording)
 		return 0;
 
+	pw_thread_loop_lock(impl->thread_loop);
 	pw_properties_set(impl->headers, "Range", "npt=0-");
 	pw_properties_setf(impl->headers, "RTP-Info",
 			"seq=%u;rtptime=%u", impl->seq, impl->rtptime);
 
 	impl->recording = false;
+	pw_thread_loop_unlock(impl->thread_loop);
 
 	res = rtsp_send(impl, "FLUSH", NULL, NULL, rtsp_log_reply_status);
 
@@ -886,6 +881,7 @@ static int rtsp_record_reply(void *data, int status, const struct spa_dict *head
 	struct spa_pod_builder b;
 	struct spa_latency_info latency;
 	char progress[128];
+	uint32_t index;
 
 	pw_log_info("record status: %d", status);
 
@@ -905,10 +901,17 @@ static int rtsp_record_reply(void *data, int status, const struct spa_dict *head
 
 	pw_stream_update_params(impl->stream, params, n_params);
 
+	pw_thread_loop_lock(impl->thread_loop);
+	/* drop what was queued before the receiver was ready */
+	spa_ringbuffer_get_write_index(&impl->ring, &index);
+	spa_ringbuffer_read_update(&impl->ring, index);
+	alac_encoder_init(&impl->alac);
+
 	impl->first = true;
 	impl->sync = 0;
 	impl->sync_period = impl->info.rate / (impl->block_size / impl->frame_size);
 	impl->recording = true;
+	pw_thread_loop_unlock(impl->thread_loop);
 
 	rtsp_send_volume(impl);
 
@@ -923,9 +926,11 @@ static int rtsp_do_record(struct impl *impl)
 	if (!impl->ready || impl->recording)
 		return 0;
 
+	pw_thread_loop_lock(impl->thread_loop);
 	pw_properties_set(impl->headers, "Range", "npt=0-");
 	pw_properties_setf(impl->headers, "RTP-Info",
 			"seq=%u;rtptime=%u", impl->seq, impl->rtptime);
+	pw_thread_loop_unlock(impl->thread_loop);
 
 	res = rtsp_send(impl, "RECORD", NULL, NULL, rtsp_record_reply);
 
@@ -1005,11 +1010,14 @@ static int rtsp_setup_reply(void *data, int status, const struct spa_dict *heade
 		return 0;
 	}
 
+	pw_thread_loop_lock(impl->thread_loop);
 	if ((res = pw_getrandom(&impl->seq, sizeof(impl->seq), 0)) < 0 ||
 	    (res = pw_getrandom(&impl->rtptime, sizeof(impl->rtptime), 0)) <  0) {
+		pw_thread_loop_unlock(impl->thread_loop);
 		pw_log_error("error generating random seq and rtptime: %s", spa_strerror(res));
 		return 0;
 	}
+	pw_thread_loop_unlock(impl->thread_loop);
 
 	pw_log_info("server port:%u", impl->server_port);
 
@@ -1221,7 +1229,11 @@ static int rtsp_do_announce(struct impl *impl)
 	else
 		frames = FRAMES_PER_UDP_PACKET;
 
+	pw_thread_loop_lock(impl->thread_loop);
 	impl->block_size = frames * impl->frame_size;
+	impl->packet_size = SPA_ROUND_UP_N(16 + SPA_MAX(alac_max_packet_size(frames),
+				8 + impl->block_size), 16);
+	pw_thread_loop_unlock(impl->thread_loop);
 
 	pw_rtsp_client_get_local_ip(impl->rtsp, &ip_version,
 			local_ip, sizeof(local_ip));
@@ -1268,6 +1280,12 @@ static int rtsp_do_announce(struct impl *impl)
 		if (rsa_len < 0)
 			return -rsa_len;
 
+		pw_thread_loop_lock(impl->thread_loop);
+		res = raop_aes_init(impl->ctx, impl->key);
+		pw_thread_loop_unlock(impl->thread_loop);
+		if (res < 0)
+			return res;
+
 	        base64_encode(rsakey, rsa_len, key, '=');
 	        base64_encode(impl->iv, 16, iv, '=');
 
@@ -1439,6 +1457,10 @@ static void rtsp_connected(void *data)
 static void connection_cleanup(struct impl *impl)
 {
 	impl->ready = false;
+
+	/* the sender thread uses the sockets */
+	pw_thread_loop_lock(impl->thread_loop);
+	impl->recording = false;
 	if (impl->server_source != NULL) {
 		pw_loop_destroy_source(impl->loop, impl->server_source);
 		impl->server_source = NULL;
@@ -1455,6 +1477,7 @@ static void connection_cleanup(struct impl *impl)
 		close(impl->control_fd);
 		impl->control_fd = -1;
 	}
+	pw_thread_loop_unlock(impl->thread_loop);
 	if (impl->timing_source != NULL) {
 		pw_loop_destroy_source(impl->loop, impl->timing_source);
 		impl->timing_source = NULL;
@@ -1742,6 +1765,13 @@ static void impl_destroy(struct impl *impl)
 	if (impl->rtsp)
 		pw_rtsp_client_destroy(impl->rtsp);
 
+	if (impl->thread_loop) {
+		pw_thread_loop_stop(impl->thread_loop);
+		if (impl->send_event)
+			pw_loop_destroy_source(impl->thread_loop_loop, impl->send_event);
+		pw_thread_loop_destroy(impl->thread_loop);
+	}
+
 	if (impl->ctx)
 		EVP_CIPHER_CTX_free(impl->ctx);
 
@@ -1889,6 +1919,27 @@ int pipewire__module_init(struct pw_impl_module *module, const char *args)
 		pw_log_error( "can't create cipher context: %m");
 		goto error;
 	}
+	spa_ringbuffer_init(&impl->ring);
+	alac_encoder_init(&impl->alac);
+
+	impl->thread_loop = pw_thread_loop_new("raop-sender", NULL);
+	if (impl->thread_loop == NULL) {
+		res = -errno;
+		pw_log_error("can't create thread loop: %m");
+		goto error;
+	}
+	impl->thread_loop_loop = pw_thread_loop_get_loop(impl->thread_loop);
+	impl->send_event = pw_loop_add_event(impl->thread_loop_loop, on_send_event, impl);
+	if (impl->send_event == NULL) {
+		res = -errno;
+		pw_log_error("can't create send event: %m");
+		goto error;
+	}
+	if ((res = pw_thread_loop_start(impl->thread_loop)) < 0) {
+		pw_log_error("can't start thread loop: %s", spa_strerror(res));
+		goto error;
+	}
+
 	if (args == NULL)
 		args = "";
 
@@ -0,0 +1,308 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <spa/utils/defs.h>
+
+#include "alac.h"
+
+/* element tags */
+#define ID_CPE			1
+#define ID_END			7
+
+#define BIT_DEPTH		16
+/* the side channel needs an extra bit */
+#define CHAN_BITS		(BIT_DEPTH + 1)
+
+#define MIX_BITS		2
+#define MIX_RES			2
+
+#define DENSHIFT		9
+#define PB_FACTOR		4
+
+/* adaptive Golomb coder, see the ALAC reference implementation */
+#define QBSHIFT			9
+#define QB			(1u << QBSHIFT)
+#define MMULSHIFT		2
+#define MDENSHIFT		(QBSHIFT - MMULSHIFT - 1)
+#define MOFF			(1u << (MDENSHIFT - 2))
+#define BITOFF			24
+#define MAX_PREFIX_16		9
+#define MAX_PREFIX_32		9
+#define MAX_DATATYPE_BITS_16	16
+#define MAX_MEAN_CLAMP		0xffffu
+#define MAX_RUN			65535u
+
+/* with fewer frames there is not enough history for the predictor */
+#define MIN_FRAMES		(2 * ALAC_NUM_COEFS)
+
+struct bits {
+	uint8_t *data;
+	uint8_t *end;
+	uint64_t acc;
+	uint32_t n_acc;
+	bool overflow;
+};
+
+static inline void bits_init(struct bits *b, uint8_t *data, size_t size)
+{
+	b->data = data;
+	b->end = data + size;
+	b->acc = 0;
+	b->n_acc = 0;
+	b->overflow = false;
+}
+
+/* write the lower n bits of value, n <= 32 */
+static inline void bits_put(struct bits *b, uint32_t value, uint32_t n)
+{
+	b->acc = (b->acc << n) | (value & (uint32_t)((1ull << n) - 1));
+	b->n_acc += n;
+	while (b->n_acc >= 8) {
+		b->n_acc -= 8;
+		if (b->data < b->end)
+			*b->data++ = (uint8_t)(b->acc >> b->n_acc);
+		else
+			b->overflow = true;
+	}
+}
+
+static inline int bits_flush(struct bits *b, uint8_t *start)
+{
+	if (b->n_acc > 0)
+		bits_put(b, 0, 8 - b->n_acc);
+	return b->overflow ? -ENOSPC : (int)(b->data - start);
+}
+
+static inline void put_header(struct bits *b, uint32_t n_frames, bool escape)
+{
+	bits_put(b, ID_CPE, 3);
+	bits_put(b, 0, 4);		/* element instance tag */
+	bits_put(b, 0, 12);		/* unused */
+	bits_put(b, 1, 1);		/* has size */
+	bits_put(b, 0, 2);		/* bytes shifted */
+	bits_put(b, escape, 1);		/* is not compressed */
+	bits_put(b, n_frames, 32);
+}
+
+static inline uint32_t lead(uint32_t x)
+{
+	return x == 0 ? 32 : (uint32_t)__builtin_clz(x);
+}
+
+static inline int32_t sign_of(int32_t x)
+{
+	return (x > 0) - (x < 0);
+}
+
+static inline int32_t sign_extend(int32_t x, uint32_t shift)
+{
+	return (int32_t)((uint32_t)x << shift) >> shift;
+}
+
+void alac_encoder_init(struct alac_encoder *enc)
+{
+	uint32_t i;
+	for (i = 0; i < ALAC_CHANNELS; i++) {
+		memset(enc->coefs[i], 0, sizeof(enc->coefs[i]));
+		enc->coefs[i][0] = (38 << DENSHIFT) >> 4;
+		enc->coefs[i][1] = (-29 * (1 << DENSHIFT)) >> 4;
+		enc->coefs[i][2] = (-2 * (1 << DENSHIFT)) >> 4;
+	}
+}
+
+size_t alac_max_packet_size(uint32_t n_frames)
+{
+	/* header, samples and end tag */
+	return (58 + n_frames * ALAC_CHANNELS * BIT_DEPTH + 7) / 8;
+}
+
+int alac_encode_verbatim(uint8_t *dst, size_t size, const int16_t *src, uint32_t n_frames)
+{
+	struct bits b;
+	uint32_t i;
+
+	bits_init(&b, dst, size);
+	put_header(&b, n_frames, true);
+	for (i = 0; i < n_frames * ALAC_CHANNELS; i++)
+		bits_put(&b, (uint16_t)src[i], BIT_DEPTH);
+	bits_put(&b, ID_END, 3);
+	return bits_flush(&b, dst);
+}
+
+/* adaptive FIR predictor, the decoder runs the same adaptation on the
+ * reconstructed samples */
+static void predict(const int32_t *in, int32_t *pc, uint32_t n_frames, int16_t *coefs)
+{
+	const uint32_t chanshift = 32 - CHAN_BITS;
+	const int32_t denhalf = 1 << (DENSHIFT - 1);
+	const int32_t n_coefs = ALAC_NUM_COEFS;
+	uint32_t j;
+	int32_t k;
+
+	pc[0] = in[0];
+	for (j = 1; j <= ALAC_NUM_COEFS; j++)
+		pc[j] = sign_extend(in[j] - in[j-1], chanshift);
+
+	for (j = ALAC_NUM_COEFS + 1; j < n_frames; j++) {
+		const int32_t *p = &in[j - 1];
+		int32_t top = in[j - ALAC_NUM_COEFS - 1];
+		int32_t sum = 0, del, del0, dd, sgn;
+
+		for (k = 0; k < n_coefs; k++)
+			sum -= coefs[k] * (top - p[-k]);
+
+		del = in[j] - top - ((sum + denhalf) >> DENSHIFT);
+		del = sign_extend(del, chanshift);
+		pc[j] = del0 = del;
+
+		if (del > 0) {
+			for (k = n_coefs - 1; k >= 0; k--) {
+				dd = top - p[-k];
+				sgn = sign_of(dd);
+				coefs[k] -= sgn;
+				del0 -= (n_coefs - k) * ((sgn * dd) >> DENSHIFT);
+				if (del0 <= 0)
+					break;
+			}
+		} else if (del < 0) {
+			for (k = n_coefs - 1; k >= 0; k--) {
+				dd = top - p[-k];
+				sgn = sign_of(dd);
+				coefs[k] += sgn;
+				del0 -= (n_coefs - k) * ((-sgn * dd) >> DENSHIFT);
+				if (del0 >= 0)
+					break;
+			}
+		}
+	}
+}
+
+static inline void put_code_16(struct bits *b, uint32_t m, uint32_t k, uint32_t n)
+{
+	uint32_t div = n / m, mod, de, n_bits;
+
+	if (div < MAX_PREFIX_16) {
+		mod = n % m;
+		de = mod == 0;
+		n_bits = div + k + 1 - de;
+		if (n_bits <= MAX_PREFIX_16 + MAX_DATATYPE_BITS_16) {
+			bits_put(b, (((1u << div) - 1) << (n_bits - div)) + mod + 1 - de, n_bits);
+			return;
+		}
+	}
+	bits_put(b, ((1u << MAX_PREFIX_16) - 1), MAX_PREFIX_16);
+	bits_put(b, n, MAX_DATATYPE_BITS_16);
+}
+
+static inline void put_code_32(struct bits *b, uint32_t m, uint32_t k, uint32_t n)
+{
+	uint32_t div = n / m, mod, de, n_bits;
+
+	if (div < MAX_PREFIX_32) {
+		mod = n - m * div;
+		de = mod == 0;
+		n_bits = div + k + 1 - de;
+		if (n_bits <= 25) {
+			bits_put(b, (((1u << div) - 1) << (n_bits - div)) + mod + 1 - de, n_bits);
+			return;
+		}
+	}
+	bits_put(b, ((1u << MAX_PREFIX_32) - 1), MAX_PREFIX_32);
+	bits_put(b, n, CHAN_BITS);
+}
+
+/* adaptive Golomb coding of the residuals with run length coding of
+ * silence */
+static void entropy_encode(struct bits *b, const int32_t *pc, uint32_t n_frames)
+{
+	const uint32_t pb = (ALAC_PB * PB_FACTOR) / 4;
+	const uint32_t wb = (1u << ALAC_KB) - 1;
+	uint32_t c = 0, mb = ALAC_MB, zmode = 0;
+
+	while (c < n_frames) {
+		uint32_t m, k, n;
+		int32_t del;
+
+		k = SPA_MIN(31 - lead((mb >> QBSHIFT) + 3), (uint32_t)ALAC_KB);
+		m = (1u << k) - 1;
+
+		del = pc[c++];
+		n = ((uint32_t)abs(del) << 1) - (del < 0) - zmode;
+
+		put_code_32(b, m, k, n);
+
+		mb = pb * (n + zmode) + mb - ((pb * mb) >> QBSHIFT);
+		if (n > MAX_MEAN_CLAMP)
+			mb = MAX_MEAN_CLAMP;
+
+		zmode = 0;
+
+		if ((mb << MMULSHIFT) < QB && c < n_frames) {
+			uint32_t nz = 0;
+
+			zmode = 1;
+			while (c < n_frames && pc[c] == 0) {
+				c++;
+				if (++nz >= MAX_RUN) {
+					zmode = 0;
+					break;
+				}
+			}
+			k = lead(mb) - BITOFF + ((mb + MOFF) >> MDENSHIFT);
+			m = ((1u << k) - 1) & wb;
+
+			put_code_16(b, m, k, nz);
+			mb = 0;
+		}
+	}
+}
+
+int alac_encode(struct alac_encoder *enc, uint8_t *dst, size_t size,
+		const int16_t *src, uint32_t n_frames)
+{
+	struct bits b;
+	uint32_t i, j;
+	int res;
+
+	if (n_frames > ALAC_MAX_FRAMES)
+		return -EINVAL;
+	if (n_frames < MIN_FRAMES)
+		return alac_encode_verbatim(dst, size, src, n_frames);
+
+	for (i = 0; i < n_frames; i++) {
+		int32_t l = src[2*i], r = src[2*i+1];
+		enc->mix[0][i] = (MIX_RES * l + ((1 << MIX_BITS) - MIX_RES) * r) >> MIX_BITS;
+		enc->mix[1][i] = l - r;
+	}
+
+	/* anything that does not fit in the size of an uncompressed packet
+	 * is sent uncompressed */
+	bits_init(&b, dst, SPA_MIN(size, alac_max_packet_size(n_frames)));
+	put_header(&b, n_frames, false);
+	bits_put(&b, MIX_BITS, 8);
+	bits_put(&b, MIX_RES, 8);
+
+	for (i = 0; i < ALAC_CHANNELS; i++) {
+		bits_put(&b, (0 << 4) | DENSHIFT, 8);	/* mode, denshift */
+		bits_put(&b, (PB_FACTOR << 5) | ALAC_NUM_COEFS, 8);
+		for (j = 0; j < ALAC_NUM_COEFS; j++)
+			bits_put(&b, (uint16_t)enc->coefs[i][j], 16);
+	}
+	for (i = 0; i < ALAC_CHANNELS; i++) {
+		predict(enc->mix[i], enc->residual[i], n_frames, enc->coefs[i]);
+		entropy_encode(&b, enc->residual[i], n_frames);
+		if (b.overflow)
+			break;
+	}
+	bits_put(&b, ID_END, 3);
+
+	if ((res = bits_flush(&b, dst)) == -ENOSPC)
+		res = alac_encode_verbatim(dst, size, src, n_frames);
+	return res;
+}
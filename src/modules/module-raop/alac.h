@@ -0,0 +1,55 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PIPEWIRE_RAOP_ALAC_H
+#define PIPEWIRE_RAOP_ALAC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** The largest packet we encode, the TCP transport uses 4096 frames */
+#define ALAC_MAX_FRAMES		4096
+#define ALAC_CHANNELS		2
+#define ALAC_NUM_COEFS		8
+
+/* The rice parameters, these need to match the fmtp line of the SDP */
+#define ALAC_PB			40
+#define ALAC_MB			10
+#define ALAC_KB			14
+
+/** Encoder state for 16 bits stereo packets.
+ *
+ * The predictor coefficients adapt while encoding and are carried over to
+ * the next packet, every packet contains the coefficients it starts with so
+ * that packets can be decoded independently. */
+struct alac_encoder {
+	int16_t coefs[ALAC_CHANNELS][ALAC_NUM_COEFS];
+	int32_t mix[ALAC_CHANNELS][ALAC_MAX_FRAMES];
+	int32_t residual[ALAC_CHANNELS][ALAC_MAX_FRAMES];
+};
+
+void alac_encoder_init(struct alac_encoder *enc);
+
+/** The size of an uncompressed packet, the compressed packets are never larger */
+size_t alac_max_packet_size(uint32_t n_frames);
+
+/** Write interleaved S16 stereo frames as an uncompressed packet.
+ * Returns the number of bytes written or a negative errno. */
+int alac_encode_verbatim(uint8_t *dst, size_t size, const int16_t *src, uint32_t n_frames);
+
+/** Compress interleaved S16 stereo frames. Falls back to an uncompressed
+ * packet when the data does not compress. Returns the number of bytes
+ * written or a negative errno. */
+int alac_encode(struct alac_encoder *enc, uint8_t *dst, size_t size,
+		const int16_t *src, uint32_t n_frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PIPEWIRE_RAOP_ALAC_H */
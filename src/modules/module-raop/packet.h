@@ -0,0 +1,121 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#ifndef PIPEWIRE_RAOP_PACKET_H
+#define PIPEWIRE_RAOP_PACKET_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <openssl/evp.h>
+
+#include <spa/utils/defs.h>
+
+#define RAOP_MAX_BATCH		16
+#define RAOP_SEND_TIMEOUT	100	/* msec to wait for the rest of a packet */
+
+/** Set up the key schedule once, the packets only restart the CBC chain */
+static inline int raop_aes_init(EVP_CIPHER_CTX *ctx, const uint8_t *key)
+{
+	if (EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, NULL) != 1)
+		return -EIO;
+	EVP_CIPHER_CTX_set_padding(ctx, 0);
+	return 0;
+}
+
+/** Encrypt a batch of payloads in place.
+ *
+ * Every payload is encrypted with the same IV and a trailing partial block
+ * is sent in the clear. */
+static inline int raop_aes_encrypt(EVP_CIPHER_CTX *ctx, const uint8_t *iv,
+		struct iovec *payloads, uint32_t n_payloads)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_payloads; i++) {
+		uint8_t *data = payloads[i].iov_base;
+		int len = payloads[i].iov_len & ~0xf, clen;
+
+		if (len == 0)
+			continue;
+		if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) != 1 ||
+		    EVP_EncryptUpdate(ctx, data, &clen, data, len) != 1)
+			return -EIO;
+	}
+	return 0;
+}
+
+/** Send all packets on a non-blocking stream socket.
+ *
+ * When nothing could be sent, -EAGAIN is returned and the packets can be
+ * dropped. After a short write the rest is always sent, because the
+ * receiver would lose the framing otherwise. The iovecs are updated. */
+static inline int raop_send_stream(int fd, struct iovec *packets, uint32_t n_packets)
+{
+	struct msghdr msg;
+	struct pollfd pfd;
+	uint32_t i = 0;
+	bool started = false;
+	ssize_t res;
+
+	while (i < n_packets) {
+		spa_zero(msg);
+		msg.msg_iov = &packets[i];
+		msg.msg_iovlen = n_packets - i;
+		if ((res = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN || !started)
+				return -errno;
+
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			if ((res = poll(&pfd, 1, RAOP_SEND_TIMEOUT)) < 0 && errno != EINTR)
+				return -errno;
+			if (res == 0)
+				return -ETIMEDOUT;
+			continue;
+		}
+		started = true;
+		while (i < n_packets && (size_t)res >= packets[i].iov_len) {
+			res -= packets[i].iov_len;
+			i++;
+		}
+		if (i < n_packets) {
+			packets[i].iov_base = SPA_PTROFF(packets[i].iov_base, res, void);
+			packets[i].iov_len -= res;
+		}
+	}
+	return n_packets;
+}
+
+/** Send a batch of packets, one datagram per packet or all of them in one
+ * go on a stream socket. Returns the number of packets sent. */
+static inline int raop_send_packets(int fd, struct iovec *packets, uint32_t n_packets,
+		bool stream)
+{
+	struct mmsghdr msgs[RAOP_MAX_BATCH];
+	uint32_t i;
+	int res;
+
+	if (stream)
+		return raop_send_stream(fd, packets, n_packets);
+
+	n_packets = SPA_MIN(n_packets, (uint32_t)RAOP_MAX_BATCH);
+	for (i = 0; i < n_packets; i++) {
+		spa_zero(msgs[i]);
+		msgs[i].msg_hdr.msg_iov = &packets[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	if ((res = sendmmsg(fd, msgs, n_packets, MSG_NOSIGNAL)) < 0)
+		return -errno;
+	return res;
+}
+
+#endif /* PIPEWIRE_RAOP_PACKET_H */
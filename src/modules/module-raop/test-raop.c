@@ -0,0 +1,462 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <openssl/evp.h>
+
+#include <spa/utils/defs.h>
+
+#include "alac.h"
+#include "packet.h"
+
+/* A fake RAOP receiver: it receives the packets over a loopback socket,
+ * decrypts them and decodes the ALAC frames like the receivers do. */
+
+#define N_FRAMES	352
+#define N_PACKETS	64
+#define HEADER_SIZE	12
+#define PACKET_SIZE	(HEADER_SIZE + 8 + N_FRAMES * 4 + 16)
+
+static int16_t samples[N_PACKETS * N_FRAMES * 2];
+static int16_t decoded[N_PACKETS * N_FRAMES * 2];
+
+static const uint8_t key[16] = {
+	0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+	0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10 };
+static const uint8_t iv[16] = {
+	0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a, 0x69, 0x78,
+	0x87, 0x96, 0xa5, 0xb4, 0xc3, 0xd2, 0xe1, 0xf0 };
+
+struct reader {
+	const uint8_t *data;
+	uint32_t size;
+	uint32_t pos;
+};
+
+static uint32_t read_bits(struct reader *r, uint32_t n)
+{
+	uint32_t v = 0;
+	while (n--) {
+		spa_assert_se(r->pos < r->size * 8);
+		v = (v << 1) | ((r->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+		r->pos++;
+	}
+	return v;
+}
+
+static inline uint32_t lead(uint32_t x)
+{
+	return x == 0 ? 32 : (uint32_t)__builtin_clz(x);
+}
+
+/* the prefix code of the entropy coder, values with a long prefix are
+ * escaped and sent raw */
+static uint32_t read_code(struct reader *r, uint32_t m, uint32_t k, uint32_t max_bits)
+{
+	uint32_t prefix = 0, v;
+
+	while (prefix < 9 && read_bits(r, 1))
+		prefix++;
+	if (prefix == 9)
+		return read_bits(r, max_bits);
+
+	v = read_bits(r, k);
+	if (v < 2) {
+		r->pos--;
+		return prefix * m;
+	}
+	return prefix * m + v - 1;
+}
+
+static void read_residuals(struct reader *r, int32_t *pc, uint32_t n_frames, uint32_t pb,
+		uint32_t chan_bits)
+{
+	uint32_t c = 0, mb = ALAC_MB, zmode = 0, wb = (1u << ALAC_KB) - 1;
+
+	while (c < n_frames) {
+		uint32_t k, m, n, nd;
+
+		k = SPA_MIN(31 - lead((mb >> 9) + 3), (uint32_t)ALAC_KB);
+		m = (1u << k) - 1;
+		n = read_code(r, m, k, chan_bits);
+
+		nd = n + zmode;
+		pc[c++] = (nd & 1) ? -(int32_t)((nd + 1) >> 1) : (int32_t)(nd >> 1);
+
+		mb = pb * (n + zmode) + mb - ((pb * mb) >> 9);
+		if (n > 0xffff)
+			mb = 0xffff;
+		zmode = 0;
+
+		if ((mb << 2) < 512 && c < n_frames) {
+			zmode = 1;
+			k = lead(mb) - 24 + ((mb + 16) >> 6);
+			m = ((1u << k) - 1) & wb;
+			n = read_code(r, m, k, 16);
+			spa_assert_se(c + n <= n_frames);
+			while (n-- > 0)
+				pc[c++] = 0;
+			mb = 0;
+		}
+	}
+}
+
+static inline int32_t extend(int32_t x, uint32_t shift)
+{
+	return (int32_t)((uint32_t)x << shift) >> shift;
+}
+
+static void unpredict(const int32_t *pc, int32_t *out, uint32_t n_frames, int16_t *coefs,
+		int32_t n_coefs, uint32_t chan_bits, uint32_t denshift)
+{
+	uint32_t shift = 32 - chan_bits, j;
+	int32_t k;
+
+	out[0] = pc[0];
+	for (j = 1; j <= (uint32_t)n_coefs; j++)
+		out[j] = extend(pc[j] + out[j-1], shift);
+
+	for (j = n_coefs + 1; j < n_frames; j++) {
+		const int32_t *p = &out[j - 1];
+		int32_t top = out[j - n_coefs - 1], sum = 0, del, del0, dd, sgn;
+
+		for (k = 0; k < n_coefs; k++)
+			sum += coefs[k] * (p[-k] - top);
+
+		del = del0 = pc[j];
+		out[j] = extend(del + top + ((sum + (1 << (denshift - 1))) >> denshift), shift);
+
+		if (del > 0) {
+			for (k = n_coefs - 1; k >= 0; k--) {
+				dd = top - p[-k];
+				sgn = (dd > 0) - (dd < 0);
+				coefs[k] -= sgn;
+				del0 -= (n_coefs - k) * ((sgn * dd) >> denshift);
+				if (del0 <= 0)
+					break;
+			}
+		} else if (del < 0) {
+			for (k = n_coefs - 1; k >= 0; k--) {
+				dd = top - p[-k];
+				sgn = (dd > 0) - (dd < 0);
+				coefs[k] += sgn;
+				del0 -= (n_coefs - k) * ((-sgn * dd) >> denshift);
+				if (del0 >= 0)
+					break;
+			}
+		}
+	}
+}
+
+static uint32_t decode_packet(const uint8_t *data, uint32_t size, int16_t *out)
+{
+	static int32_t pc[ALAC_MAX_FRAMES], mix[2][ALAC_MAX_FRAMES];
+	struct reader r = { data, size, 0 };
+	uint32_t hdr, n_frames, i, ch, mix_bits, chan_bits = 17;
+	int32_t mix_res;
+	bool escape;
+
+	spa_assert_se(read_bits(&r, 3) == 1);	/* stereo */
+	read_bits(&r, 4);
+	spa_assert_se(read_bits(&r, 12) == 0);
+	hdr = read_bits(&r, 4);
+	spa_assert_se(hdr & 0x8);		/* has size */
+	spa_assert_se((hdr & 0x6) == 0);	/* no shift */
+	escape = hdr & 1;
+	n_frames = read_bits(&r, 32);
+	spa_assert_se(n_frames <= ALAC_MAX_FRAMES);
+
+	if (escape) {
+		for (i = 0; i < n_frames * 2; i++)
+			out[i] = (int16_t)read_bits(&r, 16);
+	} else {
+		int16_t coefs[2][32];
+		uint32_t n_coefs[2], denshift[2], pb_factor[2];
+
+		mix_bits = read_bits(&r, 8);
+		mix_res = (int8_t)read_bits(&r, 8);
+		for (ch = 0; ch < 2; ch++) {
+			hdr = read_bits(&r, 8);
+			spa_assert_se((hdr >> 4) == 0);	/* mode */
+			denshift[ch] = hdr & 0xf;
+			hdr = read_bits(&r, 8);
+			pb_factor[ch] = hdr >> 5;
+			n_coefs[ch] = hdr & 0x1f;
+			for (i = 0; i < n_coefs[ch]; i++)
+				coefs[ch][i] = (int16_t)read_bits(&r, 16);
+		}
+		for (ch = 0; ch < 2; ch++) {
+			read_residuals(&r, pc, n_frames, (ALAC_PB * pb_factor[ch]) / 4, chan_bits);
+			unpredict(pc, mix[ch], n_frames, coefs[ch], n_coefs[ch],
+					chan_bits, denshift[ch]);
+		}
+		for (i = 0; i < n_frames; i++) {
+			int32_t u = mix[0][i], v = mix[1][i], l, r;
+			if (mix_res != 0) {
+				l = u + v - ((mix_res * v) >> mix_bits);
+				r = l - v;
+			} else {
+				l = u;
+				r = v;
+			}
+			out[2*i] = (int16_t)l;
+			out[2*i+1] = (int16_t)r;
+		}
+	}
+	spa_assert_se(read_bits(&r, 3) == 7);	/* end */
+	spa_assert_se((r.pos + 7) / 8 == size);
+
+	return n_frames;
+}
+
+static void decrypt(uint8_t *data, uint32_t size)
+{
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int len = size & ~0xf, clen;
+
+	spa_assert_se(ctx != NULL);
+	spa_assert_se(EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv) == 1);
+	EVP_CIPHER_CTX_set_padding(ctx, 0);
+	if (len > 0)
+		spa_assert_se(EVP_DecryptUpdate(ctx, data, &clen, data, len) == 1);
+	EVP_CIPHER_CTX_free(ctx);
+}
+
+static void make_sockets(int *send_fd, int *recv_fd)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+
+	spa_zero(sa);
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	spa_assert_se((*recv_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0);
+	spa_assert_se(bind(*recv_fd, (struct sockaddr*)&sa, sizeof(sa)) == 0);
+	spa_assert_se(getsockname(*recv_fd, (struct sockaddr*)&sa, &len) == 0);
+
+	spa_assert_se((*send_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) >= 0);
+	spa_assert_se(connect(*send_fd, (struct sockaddr*)&sa, sizeof(sa)) == 0);
+}
+
+static void run_stream(const char *name, bool compress, bool encrypt, uint32_t batch)
+{
+	static uint8_t packets[RAOP_MAX_BATCH][PACKET_SIZE];
+	static struct alac_encoder enc;
+	struct iovec iov[RAOP_MAX_BATCH], payload[RAOP_MAX_BATCH];
+	EVP_CIPHER_CTX *ctx;
+	int send_fd, recv_fd;
+	uint32_t i, j, n, received = 0, n_bytes = 0, seq = 1000, rtptime = 5000;
+
+	make_sockets(&send_fd, &recv_fd);
+	alac_encoder_init(&enc);
+	spa_assert_se((ctx = EVP_CIPHER_CTX_new()) != NULL);
+	spa_assert_se(raop_aes_init(ctx, key) == 0);
+
+	for (i = 0; i < N_PACKETS; i += batch) {
+		n = SPA_MIN(batch, N_PACKETS - i);
+
+		for (j = 0; j < n; j++) {
+			uint32_t *hdr = (uint32_t*)packets[j];
+			const int16_t *src = &samples[(i + j) * N_FRAMES * 2];
+			uint8_t *dst = &packets[j][HEADER_SIZE];
+			int len;
+
+			if (compress)
+				len = alac_encode(&enc, dst, PACKET_SIZE - HEADER_SIZE, src, N_FRAMES);
+			else
+				len = alac_encode_verbatim(dst, PACKET_SIZE - HEADER_SIZE, src, N_FRAMES);
+			spa_assert_se(len > 0);
+
+			hdr[0] = htonl(0x80600000 | ((seq + i + j) & 0xffff));
+			hdr[1] = htonl(rtptime + (i + j) * N_FRAMES);
+			hdr[2] = htonl(0x12345678);
+
+			payload[j].iov_base = dst;
+			payload[j].iov_len = len;
+			iov[j].iov_base = packets[j];
+			iov[j].iov_len = HEADER_SIZE + len;
+			n_bytes += len;
+		}
+		if (encrypt)
+			spa_assert_se(raop_aes_encrypt(ctx, iv, payload, n) == 0);
+		spa_assert_se(raop_send_packets(send_fd, iov, n, false) == (int)n);
+
+		/* the receiver side */
+		for (j = 0; j < n; j++) {
+			uint8_t buf[PACKET_SIZE];
+			uint32_t *hdr = (uint32_t*)buf;
+			ssize_t size;
+
+			size = recv(recv_fd, buf, sizeof(buf), 0);
+			spa_assert_se(size > HEADER_SIZE);
+			spa_assert_se((ntohl(hdr[0]) & 0xffff) == ((seq + received) & 0xffff));
+			spa_assert_se(ntohl(hdr[1]) == rtptime + received * N_FRAMES);
+
+			if (encrypt)
+				decrypt(&buf[HEADER_SIZE], size - HEADER_SIZE);
+
+			spa_assert_se(decode_packet(&buf[HEADER_SIZE], size - HEADER_SIZE,
+					&decoded[received * N_FRAMES * 2]) == N_FRAMES);
+			received++;
+		}
+	}
+	spa_assert_se(received == N_PACKETS);
+	spa_assert_se(memcmp(samples, decoded, sizeof(samples)) == 0);
+
+	fprintf(stderr, "%-8s compress:%d encrypt:%d batch:%-2u %5.1f%% of PCM\n",
+			name, compress, encrypt, batch,
+			n_bytes * 100.0 / (N_PACKETS * alac_max_packet_size(N_FRAMES)));
+
+	EVP_CIPHER_CTX_free(ctx);
+	close(send_fd);
+	close(recv_fd);
+}
+
+static void run_all(const char *name)
+{
+	run_stream(name, false, false, 1);
+	run_stream(name, true, false, 1);
+	run_stream(name, true, true, 1);
+	run_stream(name, true, true, RAOP_MAX_BATCH);
+	run_stream(name, false, true, 5);
+}
+
+static void test_short(void)
+{
+	uint8_t buf[256];
+	int16_t out[32];
+	struct alac_encoder enc;
+	int len;
+
+	/* too short for the predictor, sent uncompressed */
+	alac_encoder_init(&enc);
+	len = alac_encode(&enc, buf, sizeof(buf), samples, 7);
+	spa_assert_se(len == (int)alac_max_packet_size(7));
+	spa_assert_se(decode_packet(buf, len, out) == 7);
+	spa_assert_se(memcmp(out, samples, 7 * 4) == 0);
+
+	/* not enough space */
+	spa_assert_se(alac_encode(&enc, buf, 16, samples, 64) == -ENOSPC);
+}
+
+#define STREAM_PACKET_SIZE	(16 * 1024)
+#define STREAM_BATCHES		32
+
+struct stream_reader {
+	int fd;
+	uint8_t *data;
+	size_t size;
+	size_t received;
+};
+
+static void *stream_reader_thread(void *data)
+{
+	struct stream_reader *r = data;
+	ssize_t len;
+
+	while (r->received < r->size) {
+		/* read slowly in small pieces so that the sender sees short writes */
+		len = read(r->fd, &r->data[r->received], SPA_MIN(r->size - r->received, 4096u));
+		if (len <= 0)
+			break;
+		r->received += len;
+		usleep(100);
+	}
+	return NULL;
+}
+
+static void test_stream(void)
+{
+	static uint8_t packets[STREAM_BATCHES][3][STREAM_PACKET_SIZE];
+	struct stream_reader r;
+	struct iovec iov[3];
+	pthread_t thread;
+	int fds[2], sndbuf = 4096;
+	uint32_t i, j;
+
+	/* the TCP framing is lost when part of a batch is not sent */
+	spa_assert_se(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == 0);
+	spa_assert_se(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+	spa_assert_se(fcntl(fds[1], F_SETFL, 0) == 0);
+
+	for (i = 0; i < sizeof(packets); i++)
+		((uint8_t*)packets)[i] = (uint8_t)(drand48() * 255);
+
+	spa_zero(r);
+	r.fd = fds[1];
+	r.size = sizeof(packets);
+	spa_assert_se((r.data = calloc(1, r.size)) != NULL);
+	spa_assert_se(pthread_create(&thread, NULL, stream_reader_thread, &r) == 0);
+
+	for (i = 0; i < STREAM_BATCHES; i++) {
+		int res;
+
+		for (j = 0; j < 3; j++) {
+			iov[j].iov_base = packets[i][j];
+			iov[j].iov_len = STREAM_PACKET_SIZE;
+		}
+		/* nothing was sent, wait and send the whole batch again */
+		while ((res = raop_send_packets(fds[0], iov, 3, true)) == -EAGAIN) {
+			struct pollfd pfd = { .fd = fds[0], .events = POLLOUT };
+			spa_assert_se(poll(&pfd, 1, -1) == 1);
+		}
+		spa_assert_se(res == 3);
+	}
+	pthread_join(thread, NULL);
+
+	spa_assert_se(r.received == sizeof(packets));
+	spa_assert_se(memcmp(r.data, packets, sizeof(packets)) == 0);
+
+	free(r.data);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t i;
+
+	test_short();
+	test_stream();
+
+	for (i = 0; i < SPA_N_ELEMENTS(samples) / 2; i++) {
+		samples[2*i] = (int16_t)(sin(i * 0.031) * 20000.0);
+		samples[2*i+1] = (int16_t)(sin(i * 0.047 + 1.0) * 12000.0);
+	}
+	run_all("sine");
+
+	memset(samples, 0, sizeof(samples));
+	run_all("silence");
+
+	/* silence with a few clicks to exercise the run length coding */
+	for (i = 0; i < SPA_N_ELEMENTS(samples); i += 997)
+		samples[i] = (int16_t)(drand48() * 65535 - 32768);
+	run_all("clicks");
+
+	for (i = 0; i < SPA_N_ELEMENTS(samples); i++)
+		samples[i] = (int16_t)(drand48() * 65535 - 32768);
+	run_all("noise");
+
+	/* full scale square wave, large residuals that need escapes */
+	for (i = 0; i < SPA_N_ELEMENTS(samples) / 2; i++) {
+		samples[2*i] = (i / 3) & 1 ? INT16_MAX : INT16_MIN;
+		samples[2*i+1] = (i / 5) & 1 ? INT16_MIN : INT16_MAX;
+	}
+	run_all("square");
+
+	return 0;
+}
@@ -132,6 +132,7 @@ PW_LOG_TOPIC_STATIC(mod_topic, "mod." NAME);
 
 #define DEFAULT_CLEANUP_SEC	90
 #define SAP_INTERVAL_SEC	5
+#define SAP_TIMER_SLACK		(500 * SPA_NSEC_PER_MSEC)
 #define SAP_MIME_TYPE		"application/sdp"
 
 #define DEFAULT_SAP_IP		"224.0.0.56"
@@ -1233,7 +1234,12 @@ static int start_sap(struct impl *impl)
 	impl->sap_fd = fd;
 
 	pw_log_info("starting SAP timer");
-	impl->timer = pw_loop_add_timer(impl->loop, on_timer_event, impl);
+	/* the announcements don't need to be exact, let them share a
+	 * wakeup with other timers */
+	impl->timer = pw_loop_add_shared_timer(impl->loop, SAP_TIMER_SLACK,
+			on_timer_event, impl);
+	if (impl->timer == NULL)
+		impl->timer = pw_loop_add_timer(impl->loop, on_timer_event, impl);
 	if (impl->timer == NULL) {
 		res = -errno;
 		pw_log_error("can't create timer source: %m");
@@ -17,6 +17,7 @@
 #include <spa/support/plugin.h>
 #include <spa/support/plugin-loader.h>
 #include <spa/node/utils.h>
+#include <spa/pod/filter.h>
 #include <spa/utils/atomic.h>
 #include <spa/utils/names.h>
 #include <spa/utils/string.h>
@@ -33,14 +34,36 @@ PW_LOG_TOPIC_EXTERN(log_context);
 #define PW_LOG_TOPIC_DEFAULT log_context
 
 /** \cond */
+#define FORMAT_CACHE_SIZE	64
+
+struct format_cache_entry {
+	uint64_t hash;
+	struct spa_pod *param;
+	struct spa_pod *filter;
+	struct spa_pod *result;		/**< NULL when param and filter don't intersect */
+};
+
 struct impl {
 	struct pw_context this;
 	struct spa_handle *dbus_handle;
 	struct spa_plugin_loader plugin_loader;
+	struct spa_thread_utils thread_utils;
 	unsigned int recalc:1;
 	unsigned int recalc_pending:1;
 
 	struct pw_data_loop *data_loop_impl;
+
+	struct spa_list recalc_list;		/**< nodes that need a graph recalculation */
+	struct pw_array recalc_nodes;		/**< nodes in the current recalculation */
+	struct pw_impl_node *recalc_target;	/**< driver for unassigned nodes */
+	unsigned int recalc_full:1;
+	unsigned int recalc_stats_pending:1;
+	struct spa_source *recalc_stats_timer;	/**< publishes the recalc stats on the core */
+
+	struct format_cache_entry *format_cache[FORMAT_CACHE_SIZE];
+	uint32_t format_cache_next;
+	uint64_t format_cache_hits;
+	uint64_t format_cache_misses;
 };
 
 
@@ -144,6 +167,58 @@ static void init_plugin_loader(struct impl *impl)
 		impl);
 }
 
+/* the thread utils of the context can change when the realtime module
+ * is loaded, the plugins get these that forward to the current ones */
+static inline struct spa_thread_utils *get_thread_utils(struct impl *impl)
+{
+	return impl->this.thread_utils ? impl->this.thread_utils : pw_thread_utils_get();
+}
+
+static struct spa_thread *impl_thread_utils_create(void *object,
+		const struct spa_dict *props, void *(*start)(void*), void *arg)
+{
+	return spa_thread_utils_create(get_thread_utils(object), props, start, arg);
+}
+
+static int impl_thread_utils_join(void *object, struct spa_thread *thread, void **retval)
+{
+	return spa_thread_utils_join(get_thread_utils(object), thread, retval);
+}
+
+static int impl_thread_utils_get_rt_range(void *object, const struct spa_dict *props,
+		int *min, int *max)
+{
+	return spa_thread_utils_get_rt_range(get_thread_utils(object), props, min, max);
+}
+
+static int impl_thread_utils_acquire_rt(void *object, struct spa_thread *thread, int priority)
+{
+	return spa_thread_utils_acquire_rt(get_thread_utils(object), thread, priority);
+}
+
+static int impl_thread_utils_drop_rt(void *object, struct spa_thread *thread)
+{
+	return spa_thread_utils_drop_rt(get_thread_utils(object), thread);
+}
+
+static const struct spa_thread_utils_methods impl_thread_utils = {
+	SPA_VERSION_THREAD_UTILS_METHODS,
+	.create = impl_thread_utils_create,
+	.join = impl_thread_utils_join,
+	.get_rt_range = impl_thread_utils_get_rt_range,
+	.acquire_rt = impl_thread_utils_acquire_rt,
+	.drop_rt = impl_thread_utils_drop_rt,
+};
+
+static void init_thread_utils(struct impl *impl)
+{
+	impl->thread_utils.iface = SPA_INTERFACE_INIT(
+		SPA_TYPE_INTERFACE_ThreadUtils,
+		SPA_VERSION_THREAD_UTILS,
+		&impl_thread_utils,
+		impl);
+}
+
 static int do_data_loop_setup(struct spa_loop *loop, bool async, uint32_t seq,
 		const void *data, size_t size, void *user_data)
 {
@@ -200,6 +275,10 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 	pw_array_init(&this->objects, 32);
 	pw_map_init(&this->globals, 128, 32);
 
+	spa_list_init(&impl->recalc_list);
+	pw_array_init(&impl->recalc_nodes, 64);
+	impl->recalc_full = true;
+
 	spa_list_init(&this->core_impl_list);
 	spa_list_init(&this->protocol_list);
 	spa_list_init(&this->core_list);
@@ -277,6 +356,10 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 	pr = pw_properties_copy(properties);
 	if ((str = pw_properties_get(pr, "context.data-loop." PW_KEY_LIBRARY_NAME_SYSTEM)))
 		pw_properties_set(pr, PW_KEY_LIBRARY_NAME_SYSTEM, str);
+	if ((str = pw_properties_get(pr, "context.data-loop.poll-time")))
+		pw_properties_set(pr, "loop.poll-time", str);
+	if ((str = pw_properties_get(pr, "context.data-loop.poll-budget")))
+		pw_properties_set(pr, "loop.poll-budget", str);
 
 	impl->data_loop_impl = pw_data_loop_new(&pr->dict);
 	pw_properties_free(pr);
@@ -302,6 +385,7 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 	}
 
 	init_plugin_loader(impl);
+	init_thread_utils(impl);
 
 	this->support[n_support++] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_System, this->main_loop->system);
 	this->support[n_support++] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_Loop, this->main_loop->loop);
@@ -309,6 +393,7 @@ struct pw_context *pw_context_new(struct pw_loop *main_loop,
 	this->support[n_support++] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_DataSystem, this->data_system);
 	this->support[n_support++] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_DataLoop, this->data_loop->loop);
 	this->support[n_support++] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_PluginLoader, &impl->plugin_loader);
+	this->support[n_support++] = SPA_SUPPORT_INIT(SPA_TYPE_INTERFACE_ThreadUtils, &impl->thread_utils);
 
 	if ((str = pw_properties_get(properties, "support.dbus")) == NULL ||
 	    pw_properties_parse_bool(str)) {
@@ -394,6 +479,7 @@ void pw_context_destroy(struct pw_context *context)
 	struct factory_entry *entry;
 	struct pw_impl_metadata *metadata;
 	struct pw_impl_core *core_impl;
+	uint32_t i;
 
 	pw_log_debug("%p: destroy", context);
 	pw_context_emit_destroy(context);
@@ -425,6 +511,9 @@ void pw_context_destroy(struct pw_context *context)
 	spa_list_consume(metadata, &context->metadata_list, link)
 		pw_impl_metadata_destroy(metadata);
 
+	if (impl->recalc_stats_timer)
+		pw_loop_destroy_source(context->main_loop, impl->recalc_stats_timer);
+
 	spa_list_consume(core_impl, &context->core_impl_list, link)
 		pw_impl_core_destroy(core_impl);
 
@@ -456,6 +545,11 @@ void pw_context_destroy(struct pw_context *context)
 
 	pw_array_clear(&context->objects);
 
+	pw_array_clear(&impl->recalc_nodes);
+
+	for (i = 0; i < FORMAT_CACHE_SIZE; i++)
+		free(impl->format_cache[i]);
+
 	pw_map_clear(&context->globals);
 
 	spa_hook_list_clean(&context->listener_list);
@@ -623,6 +717,131 @@ SPA_PRINTF_FUNC(7, 8) int pw_context_debug_port_params(struct pw_context *this,
         return 0;
 }
 
+static uint64_t pod_hash(const struct spa_pod *pod)
+{
+	const uint8_t *p = (const uint8_t *)pod;
+	uint32_t i, size = SPA_POD_SIZE(pod);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static inline bool pod_equal(const struct spa_pod *a, const struct spa_pod *b)
+{
+	return SPA_POD_SIZE(a) == SPA_POD_SIZE(b) &&
+		memcmp(a, b, SPA_POD_SIZE(a)) == 0;
+}
+
+/* Filter param with filter and write the result in builder. The outcome is
+ * remembered, keyed on the hashes of param and filter, so that renegotiating
+ * the same pair of formats does not need to filter again.
+ * Returns 1 when there is a result, 0 when param and filter don't intersect
+ * and < 0 on error. */
+static int filter_format_cached(struct impl *impl, const struct spa_pod *param,
+		const struct spa_pod *filter, struct spa_pod **result,
+		struct spa_pod_builder *builder)
+{
+	struct format_cache_entry *e;
+	struct spa_pod_builder_state state;
+	struct spa_pod *res_pod = NULL;
+	uint64_t hp, hf, hash;
+	uint32_t i, psize, fsize, rsize;
+	int res;
+
+	hp = pod_hash(param);
+	hf = pod_hash(filter);
+	hash = hp ^ (hf + 0x9e3779b97f4a7c15ULL + (hp << 6) + (hp >> 2));
+
+	for (i = 0; i < FORMAT_CACHE_SIZE; i++) {
+		e = impl->format_cache[i];
+		if (e == NULL || e->hash != hash ||
+		    !pod_equal(e->param, param) || !pod_equal(e->filter, filter))
+			continue;
+
+		impl->format_cache_hits++;
+		if (e->result == NULL)
+			return 0;
+
+		spa_pod_builder_get_state(builder, &state);
+		spa_pod_builder_raw_padded(builder, e->result, SPA_POD_SIZE(e->result));
+		if ((*result = spa_pod_builder_deref(builder, state.offset)) == NULL)
+			return -ENOSPC;
+		return 1;
+	}
+	impl->format_cache_misses++;
+
+	res = spa_pod_filter(builder, &res_pod, param, filter);
+	if (res == -ENOSPC)
+		return res;
+
+	psize = SPA_POD_SIZE(param);
+	fsize = SPA_POD_SIZE(filter);
+	rsize = res >= 0 ? SPA_POD_SIZE(res_pod) : 0;
+
+	e = malloc(sizeof(*e) + psize + fsize + rsize);
+	if (e != NULL) {
+		e->hash = hash;
+		e->param = SPA_PTROFF(e, sizeof(*e), struct spa_pod);
+		memcpy(e->param, param, psize);
+		e->filter = SPA_PTROFF(e->param, psize, struct spa_pod);
+		memcpy(e->filter, filter, fsize);
+		if (res >= 0) {
+			e->result = SPA_PTROFF(e->filter, fsize, struct spa_pod);
+			memcpy(e->result, res_pod, rsize);
+		} else {
+			e->result = NULL;
+		}
+		i = impl->format_cache_next++ % FORMAT_CACHE_SIZE;
+		free(impl->format_cache[i]);
+		impl->format_cache[i] = e;
+	}
+	pw_log_trace("%p: format cache hits:%"PRIu64" misses:%"PRIu64, impl,
+			impl->format_cache_hits, impl->format_cache_misses);
+
+	if (res < 0)
+		return 0;
+
+	*result = res_pod;
+	return 1;
+}
+
+/* Enumerate the formats of port and return the next one that matches filter.
+ * This does the same as passing the filter to the node but uses the format
+ * cache of the context. */
+static int enum_format_filtered(struct pw_context *context, struct pw_impl_port *port,
+		uint32_t *index, const struct spa_pod *filter,
+		struct spa_pod **format, struct spa_pod_builder *builder)
+{
+	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
+	uint8_t buffer[4096];
+	struct spa_pod_builder b;
+	struct spa_pod *param;
+	int res;
+
+	if (filter == NULL)
+		return spa_node_port_enum_params_sync(port->node->node,
+				port->direction, port->port_id,
+				SPA_PARAM_EnumFormat, index,
+				NULL, format, builder);
+
+	while (true) {
+		spa_pod_builder_init(&b, buffer, sizeof(buffer));
+		if ((res = spa_node_port_enum_params_sync(port->node->node,
+						port->direction, port->port_id,
+						SPA_PARAM_EnumFormat, index,
+						NULL, &param, &b)) != 1)
+			return res;
+
+		if ((res = filter_format_cached(impl, param, filter, format, builder)) != 0)
+			return res;
+	}
+}
+
 /** Find a common format between two ports
  *
  * \param context a context object
@@ -750,10 +969,8 @@ int pw_context_find_format(struct pw_context *context,
 		pw_log_debug("%p: enum output %d with filter: %p", context, oidx, filter);
 		pw_log_format(SPA_LOG_LEVEL_DEBUG, filter);
 
-		if ((res = spa_node_port_enum_params_sync(output->node->node,
-						     output->direction, output->port_id,
-						     SPA_PARAM_EnumFormat, &oidx,
-						     filter, format, builder)) != 1) {
+		if ((res = enum_format_filtered(context, output, &oidx,
+						filter, format, builder)) != 1) {
 			if (res == 0 && filter != NULL) {
 				oidx = 0;
 				goto again;
@@ -864,6 +1081,7 @@ static inline int run_nodes(struct pw_context *context, struct pw_impl_node *nod
  */
 static int collect_nodes(struct pw_context *context, struct pw_impl_node *node, struct spa_list *collect)
 {
+	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
 	struct spa_list queue;
 	struct pw_impl_node *n, *t;
 	struct pw_impl_port *p;
@@ -902,6 +1120,11 @@ static int collect_nodes(struct pw_context *context, struct pw_impl_node *node,
 				if (!l->passive)
 					t->runnable = true;
 
+				/* the peer is scheduled by a driver that is not
+				 * evaluated, its state can't be trusted */
+				if (!t->recalc_affected)
+					impl->recalc_full = true;
+
 				if (!t->visited) {
 					t->visited = true;
 					spa_list_append(&queue, &t->sort_link);
@@ -923,6 +1146,11 @@ static int collect_nodes(struct pw_context *context, struct pw_impl_node *node,
 				if (!l->passive)
 					t->runnable = true;
 
+				/* the peer is scheduled by a driver that is not
+				 * evaluated, its state can't be trusted */
+				if (!t->recalc_affected)
+					impl->recalc_full = true;
+
 				if (!t->visited) {
 					t->visited = true;
 					spa_list_append(&queue, &t->sort_link);
@@ -1162,6 +1390,224 @@ static uint32_t find_best_rate(const uint32_t *rates, uint32_t n_rates, uint32_t
 	return def;
 }
 
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+/* Publish the recalc stats as properties of the core object, where tools
+ * like pw-dump can read them. This is done at most once per second so that
+ * clients don't get an update of the core for every recalculation. */
+static void publish_recalc_stats(void *data, uint64_t expirations)
+{
+	struct impl *impl = data;
+	struct pw_context *context = &impl->this;
+	struct pw_context_recalc_stats *st = &context->recalc_stats;
+	char count[32], full_count[32], last_nodes[32], last_usec[32];
+	char max_usec[32], total_usec[32], hist[PW_CONTEXT_RECALC_HIST_SIZE * 12 + 8];
+	struct spa_dict_item items[7];
+	struct spa_strbuf buf;
+	uint32_t i;
+
+	impl->recalc_stats_pending = false;
+	if (context->core == NULL)
+		return;
+
+	spa_strbuf_init(&buf, hist, sizeof(hist));
+	spa_strbuf_append(&buf, "[");
+	for (i = 0; i < PW_CONTEXT_RECALC_HIST_SIZE; i++)
+		spa_strbuf_append(&buf, " %u", st->hist[i]);
+	spa_strbuf_append(&buf, " ]");
+
+	snprintf(count, sizeof(count), "%"PRIu64, st->count);
+	snprintf(full_count, sizeof(full_count), "%"PRIu64, st->full_count);
+	snprintf(last_nodes, sizeof(last_nodes), "%"PRIu64, st->last_nodes);
+	snprintf(last_usec, sizeof(last_usec), "%"PRIu64, (uint64_t)(st->last_time / SPA_NSEC_PER_USEC));
+	snprintf(max_usec, sizeof(max_usec), "%"PRIu64, (uint64_t)(st->max_time / SPA_NSEC_PER_USEC));
+	snprintf(total_usec, sizeof(total_usec), "%"PRIu64, (uint64_t)(st->total_time / SPA_NSEC_PER_USEC));
+
+	items[0] = SPA_DICT_ITEM_INIT("graph.recalc.count", count);
+	items[1] = SPA_DICT_ITEM_INIT("graph.recalc.full-count", full_count);
+	items[2] = SPA_DICT_ITEM_INIT("graph.recalc.last-nodes", last_nodes);
+	items[3] = SPA_DICT_ITEM_INIT("graph.recalc.last-usec", last_usec);
+	items[4] = SPA_DICT_ITEM_INIT("graph.recalc.max-usec", max_usec);
+	items[5] = SPA_DICT_ITEM_INIT("graph.recalc.total-usec", total_usec);
+	items[6] = SPA_DICT_ITEM_INIT("graph.recalc.histogram", hist);
+
+	pw_impl_core_update_properties(context->core, &SPA_DICT_INIT_ARRAY(items));
+}
+
+static void schedule_recalc_stats(struct impl *impl)
+{
+	struct pw_context *context = &impl->this;
+	struct timespec value = { 1, 0 };
+
+	if (impl->recalc_stats_pending)
+		return;
+	if (impl->recalc_stats_timer == NULL &&
+	    (impl->recalc_stats_timer = pw_loop_add_timer(context->main_loop,
+				publish_recalc_stats, impl)) == NULL)
+		return;
+
+	pw_loop_update_timer(context->main_loop, impl->recalc_stats_timer,
+			&value, NULL, false);
+	impl->recalc_stats_pending = true;
+}
+
+static void update_recalc_stats(struct pw_context *context, bool full,
+		uint32_t n_nodes, uint64_t elapsed)
+{
+	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
+	struct pw_context_recalc_stats *st = &context->recalc_stats;
+	uint64_t usec = elapsed / SPA_NSEC_PER_USEC;
+	uint32_t bucket = 0;
+
+	while (bucket < PW_CONTEXT_RECALC_HIST_SIZE - 1 && usec >= (1ULL << bucket))
+		bucket++;
+
+	st->count++;
+	if (full)
+		st->full_count++;
+	st->last_nodes = n_nodes;
+	st->last_time = elapsed;
+	st->max_time = SPA_MAX(st->max_time, elapsed);
+	st->total_time += elapsed;
+	st->hist[bucket]++;
+
+	pw_log_debug("%p: recalc full:%d nodes:%u time:%"PRIu64" count:%"PRIu64
+			" full:%"PRIu64" max:%"PRIu64, context, full, n_nodes,
+			elapsed, st->count, st->full_count, st->max_time);
+
+	schedule_recalc_stats(impl);
+}
+
+/** Mark a node as changed
+ *
+ * The next call to pw_context_recalc_graph_changed() will evaluate the node,
+ * the nodes it is linked to and all the nodes that are, or were, scheduled
+ * with the same drivers. When linked nodes of other drivers are found, the
+ * complete graph is evaluated.
+ */
+void pw_context_recalc_graph_mark(struct pw_context *context, struct pw_impl_node *node)
+{
+	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
+
+	/* a node that is destroyed is forgotten when its links are gone */
+	if (node->destroying)
+		return;
+
+	/* groups can join nodes from anywhere in the graph */
+	if (node->group != NULL || node->link_group != NULL)
+		impl->recalc_full = true;
+
+	if (node->recalc_dirty)
+		return;
+
+	spa_list_append(&impl->recalc_list, &node->recalc_link);
+	node->recalc_dirty = true;
+}
+
+/** Remove all references to a node that is destroyed */
+void pw_context_recalc_graph_forget(struct pw_context *context, struct pw_impl_node *node)
+{
+	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
+	struct pw_impl_node **n;
+
+	if (node->recalc_dirty) {
+		spa_list_remove(&node->recalc_link);
+		node->recalc_dirty = false;
+	}
+	if (node->recalc_affected) {
+		pw_array_for_each(n, &impl->recalc_nodes) {
+			if (*n == node)
+				*n = NULL;
+		}
+		node->recalc_affected = false;
+	}
+	/* the next recalculation finds a new target */
+	if (impl->recalc_target == node)
+		impl->recalc_target = NULL;
+}
+
+static void add_affected(struct impl *impl, struct pw_impl_node *node)
+{
+	struct pw_impl_node **n;
+
+	if (node->recalc_affected)
+		return;
+
+	if ((n = pw_array_add(&impl->recalc_nodes, sizeof(node))) == NULL) {
+		pw_log_warn("%p: can't add node %p: %m", impl, node);
+		return;
+	}
+	*n = node;
+	node->recalc_affected = true;
+}
+
+/* a changed node can move to the driver of one of its peers or take its
+ * peers along, add the peers so that their drivers are evaluated too */
+static void add_affected_peers(struct impl *impl, struct pw_impl_node *node)
+{
+	struct pw_impl_port *p;
+	struct pw_impl_link *l;
+
+	spa_list_for_each(p, &node->input_ports, link) {
+		spa_list_for_each(l, &p->links, input_link)
+			add_affected(impl, l->output->node);
+	}
+	spa_list_for_each(p, &node->output_ports, link) {
+		spa_list_for_each(l, &p->links, output_link)
+			add_affected(impl, l->input->node);
+	}
+}
+
+/* Collect the nodes that take part in the recalculation. This is all the
+ * nodes for a complete recalculation or else the changed nodes together with
+ * all the nodes of the drivers they were assigned to. Nodes in other
+ * drivers keep their state from the previous recalculation. */
+static uint32_t collect_affected(struct impl *impl, bool full)
+{
+	struct pw_context *context = &impl->this;
+	struct pw_impl_node *n, *s;
+	uint32_t i;
+
+	if (full) {
+		spa_list_for_each(n, &context->node_list, link)
+			add_affected(impl, n);
+	}
+
+	spa_list_consume(n, &impl->recalc_list, recalc_link) {
+		spa_list_remove(&n->recalc_link);
+		n->recalc_dirty = false;
+		add_affected(impl, n);
+		add_affected_peers(impl, n);
+	}
+
+	/* the array grows while we add the drivers and followers */
+	for (i = 0; i < pw_array_get_len(&impl->recalc_nodes, struct pw_impl_node*); i++) {
+		n = *pw_array_get_unchecked_s(&impl->recalc_nodes, i,
+				sizeof(struct pw_impl_node*), struct pw_impl_node*);
+		n = n->driver_node;
+		add_affected(impl, n);
+		spa_list_for_each(s, &n->follower_list, follower_link)
+			add_affected(impl, s);
+	}
+	return i;
+}
+
+static void release_affected(struct impl *impl)
+{
+	struct pw_impl_node **n;
+
+	pw_array_for_each(n, &impl->recalc_nodes) {
+		if (*n != NULL)
+			(*n)->recalc_affected = false;
+	}
+	pw_array_reset(&impl->recalc_nodes);
+}
+
 /* here we evaluate the complete state of the graph.
  *
  * It roughly operates in 3 stages:
@@ -1176,20 +1622,23 @@ static uint32_t find_best_rate(const uint32_t *rates, uint32_t n_rates, uint32_t
  * 3. go over all drivers again, collect the quantum/rate of all followers, select
  *    the desired final value and activate the followers and then the driver.
  *
- * A complete graph evaluation is performed for each change that is made to the
- * graph, such as making/destroying links, adding/removing nodes, property changes such
- * as quantum/rate changes or metadata changes.
+ * Changes that are local to some nodes, such as making/destroying links,
+ * activating nodes or property changes, mark the nodes with
+ * pw_context_recalc_graph_mark() and only the drivers of those nodes, and
+ * their followers, are evaluated again. Other changes, such as settings or
+ * metadata changes, perform a complete graph evaluation.
  */
-int pw_context_recalc_graph(struct pw_context *context, const char *reason)
+static int recalc_graph(struct pw_context *context, const char *reason)
 {
 	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
 	struct settings *settings = &context->settings;
-	struct pw_impl_node *n, *s, *target, *fallback;
+	struct pw_impl_node *n, *s, *target, *fallback, **np;
 	const uint32_t *rates;
 	uint32_t max_quantum, min_quantum, def_quantum, lim_quantum, rate_quantum;
-	uint32_t n_rates, def_rate;
-	bool freewheel = false, global_force_rate, global_force_quantum;
+	uint32_t n_rates, def_rate, n_affected;
+	bool freewheel = false, global_force_rate, global_force_quantum, full;
 	struct spa_list collect;
+	uint64_t t1;
 
 	pw_log_info("%p: busy:%d reason:%s", context, impl->recalc, reason);
 
@@ -1200,9 +1649,17 @@ int pw_context_recalc_graph(struct pw_context *context, const char *reason)
 
 again:
 	impl->recalc = true;
+	t1 = get_time_ns();
+
+	/* without changed nodes we can't know what to update */
+	full = impl->recalc_full || spa_list_is_empty(&impl->recalc_list);
+	impl->recalc_full = false;
+	n_affected = collect_affected(impl, full);
 
 	/* clean up the flags first */
-	spa_list_for_each(n, &context->node_list, link) {
+	pw_array_for_each(np, &impl->recalc_nodes) {
+		if ((n = *np) == NULL)
+			continue;
 		n->visited = false;
 		n->checked = 0;
 		n->runnable = n->always_process && n->active;
@@ -1259,6 +1716,18 @@ again:
 	if (target == NULL)
 		target = fallback;
 
+	/* the unassigned nodes of the other drivers need to move to the
+	 * new target, we need to evaluate everything again */
+	if (!full && target != impl->recalc_target) {
+		pw_log_debug("%p: target changed %p -> %p", context,
+				impl->recalc_target, target);
+		impl->recalc_target = target;
+		impl->recalc_full = true;
+		release_affected(impl);
+		goto again;
+	}
+	impl->recalc_target = target;
+
 	/* update the freewheel status */
 	if (context->freewheeling != freewheel)
 		context_set_freewheel(context, freewheel);
@@ -1292,6 +1761,7 @@ again:
 		}
 		if (driver != NULL) {
 			driver->runnable = true;
+			add_affected(impl, driver);
 			/* driver needed for this group */
 			move_to_driver(context, &collect, driver);
 		} else {
@@ -1300,6 +1770,14 @@ again:
 		}
 	}
 
+	/* we found linked nodes of drivers that were not evaluated, do
+	 * everything again */
+	if (!full && impl->recalc_full) {
+		pw_log_debug("%p: linked to unaffected nodes", context);
+		release_affected(impl);
+		goto again;
+	}
+
 	/* assign final quantum and set state for followers and drivers */
 	spa_list_for_each(n, &context->driver_list, driver_link) {
 		bool running = false, lock_quantum = false, lock_rate = false;
@@ -1313,7 +1791,7 @@ again:
 		uint32_t node_n_rates, node_def_rate;
 		uint32_t node_max_quantum, node_min_quantum, node_def_quantum, node_rate_quantum;
 
-		if (!n->driving || n->exported)
+		if (!n->driving || n->exported || !n->recalc_affected)
 			continue;
 
 		node_def_quantum = def_quantum;
@@ -1442,8 +1920,11 @@ again:
 			n->forced_rate = force_rate;
 			current_rate = target_rate;
 			/* we might be suspended now and the links need to be prepared again */
-			if (do_reconfigure)
+			if (do_reconfigure) {
+				impl->recalc_full = true;
+				release_affected(impl);
 				goto again;
+			}
 		}
 
 		if (node_rate_quantum != 0 && current_rate != node_rate_quantum) {
@@ -1512,6 +1993,9 @@ again:
 		/* now that all the followers are ready, start the driver */
 		ensure_state(n, running);
 	}
+	release_affected(impl);
+	update_recalc_stats(context, full, n_affected, get_time_ns() - t1);
+
 	impl->recalc = false;
 	if (impl->recalc_pending) {
 		impl->recalc_pending = false;
@@ -1521,6 +2005,19 @@ again:
 	return 0;
 }
 
+int pw_context_recalc_graph(struct pw_context *context, const char *reason)
+{
+	struct impl *impl = SPA_CONTAINER_OF(context, struct impl, this);
+	impl->recalc_full = true;
+	return recalc_graph(context, reason);
+}
+
+/** Recalculate the graph for the nodes marked with pw_context_recalc_graph_mark() */
+int pw_context_recalc_graph_changed(struct pw_context *context, const char *reason)
+{
+	return recalc_graph(context, reason);
+}
+
 SPA_EXPORT
 int pw_context_add_spa_lib(struct pw_context *context,
 		const char *factory_regexp, const char *lib)
@@ -9,7 +9,14 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <string.h>
+
 #include <spa/utils/defs.h>
+#include <spa/utils/atomic.h>
+#include <spa/utils/hook.h>
+#include <spa/utils/ringbuffer.h>
+#include <spa/node/io.h>
 
 /** \defgroup pw_profiler Profiler
  * Profiler interface
@@ -21,7 +28,7 @@ extern "C" {
  */
 #define PW_TYPE_INTERFACE_Profiler		PW_TYPE_INFO_INTERFACE_BASE "Profiler"
 
-#define PW_VERSION_PROFILER			3
+#define PW_VERSION_PROFILER			4
 struct pw_profiler;
 
 #define PW_EXTENSION_MODULE_PROFILER		PIPEWIRE_MODULE_PREFIX "module-profiler"
@@ -29,14 +36,28 @@ struct pw_profiler;
 #define PW_PROFILER_PERM_MASK			PW_PERM_R
 
 #define PW_PROFILER_EVENT_PROFILE		0
-#define PW_PROFILER_EVENT_NUM			1
+#define PW_PROFILER_EVENT_SHM			1
+#define PW_PROFILER_EVENT_NUM			2
 
 /** \ref pw_profiler events */
 struct pw_profiler_events {
-#define PW_VERSION_PROFILER_EVENTS		0
+#define PW_VERSION_PROFILER_EVENTS		1
 	uint32_t version;
 
 	void (*profile) (void *data, const struct spa_pod *pod);
+	/**
+	 * Shared memory with profiler data
+	 *
+	 * Sent to clients that bind version 4 or later of the profiler
+	 * instead of the profile event. The memory contains a
+	 * struct pw_profiler_shm and can be mapped read-only.
+	 *
+	 * \param fd a memfd with the profiler data
+	 * \param size the size of the memory
+	 *
+	 * Since version 1 of the events.
+	 */
+	void (*shm) (void *data, int fd, uint32_t size);
 };
 
 #define PW_PROFILER_METHOD_ADD_LISTENER		0
@@ -65,6 +86,393 @@ struct pw_profiler_methods {
 #define pw_profiler_add_listener(c,...)		pw_profiler_method(c,add_listener,0,__VA_ARGS__)
 
 #define PW_KEY_PROFILER_NAME		"profiler.name"
+#define PW_KEY_PROFILER_ALWAYS_ON	"profiler.always-on"	/**< keep collecting profiler data,
+								  *  also without clients */
+#define PW_KEY_PROFILER_WINDOW		"profiler.window"	/**< length of the statistics window
+								  *  in milliseconds */
+
+#define PW_PROFILER_SHM_MAGIC		0x46505750	/* "PWPF" */
+#define PW_PROFILER_SHM_VERSION		1
+#define PW_PROFILER_MAX_RECORD		(16 * 1024)	/**< largest record in the ring */
+
+#define PW_PROFILER_HIST_SUB_BITS	2	/**< 4 buckets per power of 2 */
+#define PW_PROFILER_HIST_MIN_SHIFT	10	/**< first bucket is below 1024 nsec */
+#define PW_PROFILER_HIST_BUCKETS	64	/**< the last bucket is above ~57 msec */
+
+/** Histogram with logarithmic buckets of durations in nanoseconds */
+struct pw_profiler_hist {
+	uint64_t count;			/**< number of values */
+	uint64_t total;			/**< sum of all values */
+	uint64_t max;			/**< largest value */
+	uint32_t buckets[PW_PROFILER_HIST_BUCKETS];
+};
+
+static inline uint32_t pw_profiler_hist_bucket(uint64_t nsec)
+{
+	uint32_t msb, sub, bucket;
+
+	if (nsec < (1ULL << PW_PROFILER_HIST_MIN_SHIFT))
+		return 0;
+
+	msb = 63 - __builtin_clzll(nsec);
+	sub = (nsec >> (msb - PW_PROFILER_HIST_SUB_BITS)) &
+		((1u << PW_PROFILER_HIST_SUB_BITS) - 1);
+	bucket = ((msb - PW_PROFILER_HIST_MIN_SHIFT) << PW_PROFILER_HIST_SUB_BITS) + sub + 1;
+	return SPA_MIN(bucket, PW_PROFILER_HIST_BUCKETS - 1u);
+}
+
+/** The upper limit of the values in bucket */
+static inline uint64_t pw_profiler_hist_bucket_limit(uint32_t bucket)
+{
+	uint32_t msb, sub;
+
+	if (bucket == 0)
+		return 1ULL << PW_PROFILER_HIST_MIN_SHIFT;
+
+	bucket--;
+	msb = (bucket >> PW_PROFILER_HIST_SUB_BITS) + PW_PROFILER_HIST_MIN_SHIFT;
+	sub = bucket & ((1u << PW_PROFILER_HIST_SUB_BITS) - 1);
+	return (1ULL << msb) + ((uint64_t)(sub + 1) << (msb - PW_PROFILER_HIST_SUB_BITS));
+}
+
+static inline void pw_profiler_hist_add(struct pw_profiler_hist *h, uint64_t nsec)
+{
+	h->count++;
+	h->total += nsec;
+	if (nsec > h->max)
+		h->max = nsec;
+	h->buckets[pw_profiler_hist_bucket(nsec)]++;
+}
+
+/** Get an estimate of the value below which \a perc percent of the values are */
+static inline uint64_t pw_profiler_hist_percentile(const struct pw_profiler_hist *h, float perc)
+{
+	uint64_t target, sum = 0;
+	uint32_t i;
+
+	if (h->count == 0)
+		return 0;
+
+	target = (uint64_t)(h->count * perc / 100.0f);
+	for (i = 0; i < PW_PROFILER_HIST_BUCKETS; i++) {
+		sum += h->buckets[i];
+		if (sum > target)
+			return SPA_MIN(pw_profiler_hist_bucket_limit(i), h->max);
+	}
+	return h->max;
+}
+
+#define PW_PROFILER_STATUS_NOT_TRIGGERED	0
+#define PW_PROFILER_STATUS_TRIGGERED		1
+#define PW_PROFILER_STATUS_AWAKE		2
+#define PW_PROFILER_STATUS_FINISHED		3
+
+/** Timings of a node in a cycle */
+struct pw_profiler_block {
+	uint32_t id;			/**< node id */
+	int32_t status;			/**< activation status, PW_PROFILER_STATUS_ */
+	uint64_t prev_signal_time;
+	uint64_t signal_time;
+	uint64_t awake_time;
+	uint64_t finish_time;
+	struct spa_fraction latency;
+	uint32_t xrun_count;
+	uint32_t padding;
+};
+
+/** Information about the driver in a cycle */
+struct pw_profiler_info {
+	int64_t count;			/**< cycle counter */
+	float cpu_load[3];
+	uint32_t xrun_count;
+	struct spa_io_clock clock;
+};
+
+/** A record in the ring, one for each driver cycle */
+struct pw_profiler_record {
+	uint32_t size;			/**< size of the record, including followers */
+	uint32_t n_followers;
+	struct pw_profiler_info info;
+	struct pw_profiler_block driver;
+	struct pw_profiler_block followers[];
+};
+
+/** Summary of a histogram */
+struct pw_profiler_stats {
+	uint64_t count;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t max;
+};
+
+static inline void pw_profiler_hist_stats(const struct pw_profiler_hist *h,
+		struct pw_profiler_stats *stats)
+{
+	stats->count = h->count;
+	stats->p50 = pw_profiler_hist_percentile(h, 50.0f);
+	stats->p99 = pw_profiler_hist_percentile(h, 99.0f);
+	stats->max = h->max;
+}
+
+/** Statistics of a node */
+struct pw_profiler_node {
+	uint32_t seq;			/**< odd while the writer updates the node */
+	uint32_t id;			/**< node id, SPA_ID_INVALID when unused */
+	uint32_t driver_id;		/**< driver id of the last cycle */
+	uint32_t padding;
+	char name[128];
+	struct pw_profiler_info info;	/**< last driver info, when driver */
+	struct pw_profiler_block last;	/**< last timings */
+	struct pw_profiler_hist wakeup;	/**< awake_time - signal_time */
+	struct pw_profiler_hist process;/**< finish_time - awake_time */
+	uint64_t window_start;		/**< start of the current window */
+	struct pw_profiler_hist window_wakeup;	/**< wakeup in the current window */
+	struct pw_profiler_hist window_process;	/**< process in the current window */
+	struct pw_profiler_stats wakeup_stats;	/**< wakeup in the last complete window */
+	struct pw_profiler_stats process_stats;	/**< process in the last complete window */
+};
+
+#define PW_PROFILER_XRUN_PATH		8
+
+/** A node on the critical path of a cycle */
+struct pw_profiler_path {
+	uint32_t id;			/**< node id */
+#define PW_PROFILER_PATH_FLAG_BUSY	(1<<0)	/**< the node did not finish in the cycle */
+	uint32_t flags;
+	uint64_t signal;		/**< signal_time relative to the driver start */
+	uint64_t wakeup;		/**< awake_time - signal_time */
+	uint64_t process;		/**< finish_time - awake_time */
+};
+
+static inline bool pw_profiler_block_finished(const struct pw_profiler_block *b)
+{
+	return b->status == PW_PROFILER_STATUS_FINISHED &&
+		b->finish_time >= b->awake_time &&
+		b->awake_time >= b->signal_time;
+}
+
+/**
+ * Find the critical path of the cycle in \a r.
+ *
+ * Walk back from the node that completed the graph. A node is triggered
+ * with the finish time of the last of its dependencies, so its
+ * predecessor on the critical path is the node that finished at the
+ * same time the node was signaled. Nodes that were still busy when the
+ * cycle completed are used as the start.
+ *
+ * Returns the number of nodes stored in \a path, at most \a max_path.
+ */
+static inline uint32_t pw_profiler_record_path(const struct pw_profiler_record *r,
+		struct pw_profiler_path *path, uint32_t max_path)
+{
+	const struct pw_profiler_block *b, *cur = NULL;
+	uint64_t start = r->driver.signal_time;
+	uint32_t i, n_path = 0;
+
+	for (i = 0; i < r->n_followers; i++) {
+		b = &r->followers[i];
+		if (b->status == PW_PROFILER_STATUS_TRIGGERED ||
+		    b->status == PW_PROFILER_STATUS_AWAKE) {
+			cur = b;
+			break;
+		}
+		if (pw_profiler_block_finished(b) &&
+		    (cur == NULL || b->finish_time > cur->finish_time))
+			cur = b;
+	}
+
+	while (cur != NULL && n_path < max_path) {
+		struct pw_profiler_path *p = &path[n_path++];
+		uint64_t signal = cur->signal_time;
+		bool finished = pw_profiler_block_finished(cur);
+
+		p->id = cur->id;
+		p->flags = finished ? 0 : PW_PROFILER_PATH_FLAG_BUSY;
+		p->signal = signal > start ? signal - start : 0;
+		p->wakeup = cur->awake_time > signal ? cur->awake_time - signal : 0;
+		p->process = finished ? cur->finish_time - cur->awake_time : 0;
+
+		/* triggered by the driver */
+		if (signal <= start)
+			break;
+
+		for (i = 0, cur = NULL; i < r->n_followers; i++) {
+			b = &r->followers[i];
+			if (b->finish_time == signal && pw_profiler_block_finished(b)) {
+				cur = b;
+				break;
+			}
+		}
+	}
+	return n_path;
+}
+
+/** The duration of the cycle in \a r in nanoseconds, 0 when unknown */
+static inline uint64_t pw_profiler_record_period(const struct pw_profiler_record *r)
+{
+	if (r->info.clock.rate.denom == 0)
+		return 0;
+	return r->info.clock.duration * SPA_NSEC_PER_SEC / r->info.clock.rate.denom;
+}
+
+/** A cycle with an xrun */
+struct pw_profiler_xrun {
+	uint32_t seq;			/**< odd while the writer updates the entry */
+	uint32_t index;			/**< the xrun index of the entry */
+	uint32_t driver_id;		/**< the driver of the cycle */
+	uint32_t n_path;		/**< number of nodes on the critical path */
+	uint64_t time;			/**< start of the cycle */
+	uint64_t duration;		/**< time from start until the driver finished */
+	uint64_t period;		/**< duration of the cycle */
+	/** The nodes that finished last, each triggered by the next one
+	 * in the array, the first node completed the graph */
+	struct pw_profiler_path path[PW_PROFILER_XRUN_PATH];
+};
+
+/** Layout of the shared memory */
+struct pw_profiler_shm {
+	uint32_t magic;			/**< PW_PROFILER_SHM_MAGIC */
+	uint32_t version;		/**< PW_PROFILER_SHM_VERSION */
+	uint32_t n_nodes;		/**< number of node slots */
+	uint32_t nodes_offset;		/**< offset of the node slots */
+	uint32_t ring_size;		/**< size of the record ring, a power of 2 */
+	uint32_t ring_offset;		/**< offset of the record ring */
+	uint32_t n_xruns;		/**< number of xrun entries */
+	uint32_t xruns_offset;		/**< offset of the xrun entries */
+	uint32_t xrun_index;		/**< index of the next xrun entry */
+	uint32_t window;		/**< length of the statistics window in msec */
+	struct spa_ringbuffer ring;	/**< the writer does not wait for readers,
+					  *  only the write index is used */
+};
+
+#define pw_profiler_shm_nodes(s)	SPA_PTROFF(s, (s)->nodes_offset, struct pw_profiler_node)
+#define pw_profiler_shm_xruns(s)	SPA_PTROFF(s, (s)->xruns_offset, struct pw_profiler_xrun)
+
+/** Check that \a shm of \a size bytes is profiler memory that can be read */
+static inline bool pw_profiler_shm_check(const struct pw_profiler_shm *shm, size_t size)
+{
+	return size >= sizeof(*shm) &&
+		shm->magic == PW_PROFILER_SHM_MAGIC &&
+		shm->version == PW_PROFILER_SHM_VERSION &&
+		(uint64_t)shm->nodes_offset + (uint64_t)shm->n_nodes *
+			sizeof(struct pw_profiler_node) <= size &&
+		(uint64_t)shm->xruns_offset + (uint64_t)shm->n_xruns *
+			sizeof(struct pw_profiler_xrun) <= size &&
+		(uint64_t)shm->ring_offset + shm->ring_size <= size &&
+		shm->ring_size > 0 && (shm->ring_size & (shm->ring_size - 1)) == 0;
+}
+
+/** How often a reader retries a slot that is being updated */
+#define PW_PROFILER_SHM_RETRIES	16
+
+/**
+ * Copy the node slot with \a id, returns -ENOENT when not found and
+ * -EAGAIN when the slot was updated during all the retries.
+ */
+static inline int pw_profiler_shm_get_node(const struct pw_profiler_shm *shm,
+		uint32_t id, struct pw_profiler_node *node)
+{
+	const struct pw_profiler_node *nodes = pw_profiler_shm_nodes(shm);
+	uint32_t i, retry, seq1, seq2;
+
+	for (i = 0; i < shm->n_nodes; i++) {
+		const struct pw_profiler_node *n = &nodes[(id + i) % shm->n_nodes];
+		if (n->id == SPA_ID_INVALID)
+			break;
+		if (n->id != id)
+			continue;
+		for (retry = 0; retry < PW_PROFILER_SHM_RETRIES; retry++) {
+			seq1 = SPA_SEQ_READ(n->seq);
+			memcpy(node, n, sizeof(*node));
+			seq2 = SPA_SEQ_READ(n->seq);
+			if (SPA_SEQ_READ_SUCCESS(seq1, seq2))
+				return node->id == id ? 0 : -ENOENT;
+		}
+		return -EAGAIN;
+	}
+	return -ENOENT;
+}
+
+/**
+ * Copy the xrun with \a index, returns -ENOENT when the entry was not
+ * written yet or was overwritten by a newer xrun and -EAGAIN when the
+ * entry was updated during all the retries.
+ */
+static inline int pw_profiler_shm_get_xrun(const struct pw_profiler_shm *shm,
+		uint32_t index, struct pw_profiler_xrun *xrun)
+{
+	const struct pw_profiler_xrun *x;
+	uint32_t retry, seq1, seq2;
+
+	if (shm->n_xruns == 0)
+		return -ENOENT;
+
+	x = &pw_profiler_shm_xruns(shm)[index % shm->n_xruns];
+	for (retry = 0; retry < PW_PROFILER_SHM_RETRIES; retry++) {
+		seq1 = SPA_SEQ_READ(x->seq);
+		memcpy(xrun, x, sizeof(*xrun));
+		seq2 = SPA_SEQ_READ(x->seq);
+		if (SPA_SEQ_READ_SUCCESS(seq1, seq2))
+			break;
+	}
+	if (retry == PW_PROFILER_SHM_RETRIES)
+		return -EAGAIN;
+
+	if (xrun->index != index || xrun->n_path > PW_PROFILER_XRUN_PATH)
+		return -ENOENT;
+	return 0;
+}
+
+/** Start reading the ring from the current write position */
+static inline uint32_t pw_profiler_shm_read_start(const struct pw_profiler_shm *shm)
+{
+	return SPA_ATOMIC_LOAD(shm->ring.writeindex);
+}
+
+/**
+ * Read the next record from the ring into \a data.
+ *
+ * \a index is the read position of the reader and is updated.
+ * Returns the size of the record, 0 when there is no new record and
+ * -EPIPE when the reader was too slow and records were lost.
+ */
+static inline int pw_profiler_shm_read(const struct pw_profiler_shm *shm,
+		uint32_t *index, void *data, uint32_t max)
+{
+	const void *ring = SPA_PTROFF(shm, shm->ring_offset, void);
+	uint32_t widx, size, mask = shm->ring_size - 1;
+	int32_t avail;
+
+	widx = SPA_ATOMIC_LOAD(shm->ring.writeindex);
+	avail = (int32_t)(widx - *index);
+	if (avail <= 0)
+		return 0;
+	if (avail > (int32_t)shm->ring_size)
+		goto overrun;
+
+	spa_ringbuffer_read_data(NULL, ring, shm->ring_size, *index & mask,
+			&size, sizeof(size));
+	if (size < sizeof(struct pw_profiler_record) || size > (uint32_t)avail)
+		goto overrun;
+	if (size > max) {
+		*index += size;
+		return -ENOSPC;
+	}
+	spa_ringbuffer_read_data(NULL, ring, shm->ring_size, *index & mask,
+			data, size);
+
+	/* the writer may not start writing more than a quarter of the ring
+	 * ahead, check that we were not overtaken while reading */
+	widx = SPA_ATOMIC_LOAD(shm->ring.writeindex);
+	if ((int32_t)(widx - *index) > (int32_t)(shm->ring_size - shm->ring_size / 4))
+		goto overrun;
+
+	*index += size;
+	return size;
+overrun:
+	*index = widx;
+	return -EPIPE;
+}
 
 /**
  * \}
@@ -389,6 +389,52 @@ static inline struct buffer *pop_queue(struct port *port, struct queue *queue)
 	return buffer;
 }
 
+/* push the buffers with one update of the write index */
+static inline int push_queue_many(struct port *port, struct queue *queue,
+		struct buffer **buffers, uint32_t n_buffers)
+{
+	uint32_t i, index;
+
+	/* set the flag while checking so that a buffer that is in the
+	 * array twice is refused */
+	for (i = 0; i < n_buffers; i++) {
+		if (SPA_FLAG_IS_SET(buffers[i]->flags, BUFFER_FLAG_QUEUED)) {
+			while (i > 0)
+				SPA_FLAG_CLEAR(buffers[--i]->flags, BUFFER_FLAG_QUEUED);
+			return -EINVAL;
+		}
+		SPA_FLAG_SET(buffers[i]->flags, BUFFER_FLAG_QUEUED);
+	}
+	spa_ringbuffer_get_write_index(&queue->ring, &index);
+	for (i = 0; i < n_buffers; i++) {
+		queue->ids[(index + i) & MASK_BUFFERS] = buffers[i]->id;
+	}
+	spa_ringbuffer_write_update(&queue->ring, index + n_buffers);
+
+	return 0;
+}
+
+/* pop up to max_buffers with one update of the read index */
+static inline uint32_t pop_queue_many(struct port *port, struct queue *queue,
+		struct buffer **buffers, uint32_t max_buffers)
+{
+	uint32_t i, index, n_buffers;
+	int32_t avail;
+
+	if ((avail = spa_ringbuffer_get_read_index(&queue->ring, &index)) < 1) {
+		errno = EPIPE;
+		return 0;
+	}
+	n_buffers = SPA_MIN((uint32_t)avail, max_buffers);
+	for (i = 0; i < n_buffers; i++) {
+		buffers[i] = &port->buffers[queue->ids[(index + i) & MASK_BUFFERS]];
+		SPA_FLAG_CLEAR(buffers[i]->flags, BUFFER_FLAG_QUEUED);
+	}
+	spa_ringbuffer_read_update(&queue->ring, index + n_buffers);
+
+	return n_buffers;
+}
+
 static inline void clear_queue(struct port *port, struct queue *queue)
 {
 	spa_ringbuffer_init(&queue->ring);
@@ -2014,6 +2060,67 @@ int pw_filter_queue_buffer(void *port_data, struct pw_buffer *buffer)
 	return push_queue(p, &p->queued, b);
 }
 
+SPA_EXPORT
+int pw_filter_dequeue_buffers(void *port_data, struct pw_buffer **buffers,
+		uint32_t max_buffers)
+{
+	struct port *p = SPA_CONTAINER_OF(port_data, struct port, user_data);
+	struct buffer *b[MAX_BUFFERS];
+	uint32_t i, n;
+
+	if (SPA_UNLIKELY((n = pop_queue_many(p, &p->dequeued, b,
+					SPA_MIN(max_buffers, (uint32_t)MAX_BUFFERS))) == 0)) {
+		pw_log_trace_fp("%p: no more buffers: %m", p->filter);
+		return -EPIPE;
+	}
+	for (i = 0; i < n; i++)
+		buffers[i] = &b[i]->this;
+
+	pw_log_trace_fp("%p: dequeue %u buffers", p->filter, n);
+	return n;
+}
+
+SPA_EXPORT
+int pw_filter_queue_buffers(void *port_data, struct pw_buffer **buffers,
+		uint32_t n_buffers)
+{
+	struct port *p = SPA_CONTAINER_OF(port_data, struct port, user_data);
+	struct buffer *b[MAX_BUFFERS];
+	uint32_t i;
+
+	if (n_buffers > MAX_BUFFERS)
+		return -EINVAL;
+
+	for (i = 0; i < n_buffers; i++)
+		b[i] = SPA_CONTAINER_OF(buffers[i], struct buffer, this);
+
+	pw_log_trace_fp("%p: queue %u buffers", p->filter, n_buffers);
+	return push_queue_many(p, &p->queued, b, n_buffers);
+}
+
+SPA_EXPORT
+struct pw_buffer *pw_filter_dequeue_latest_buffer(void *port_data)
+{
+	struct port *p = SPA_CONTAINER_OF(port_data, struct port, user_data);
+	struct pw_buffer *buffers[MAX_BUFFERS];
+	int n;
+
+	/* older buffers of an output port would be sent unfilled */
+	if (p->direction == SPA_DIRECTION_OUTPUT) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((n = pw_filter_dequeue_buffers(port_data, buffers, MAX_BUFFERS)) < 0) {
+		errno = -n;
+		return NULL;
+	}
+	if (n > 1)
+		pw_filter_queue_buffers(port_data, buffers, n - 1);
+
+	return buffers[n - 1];
+}
+
 SPA_EXPORT
 void *pw_filter_get_dsp_buffer(void *port_data, uint32_t n_samples)
 {
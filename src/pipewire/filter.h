@@ -221,6 +221,23 @@ struct pw_buffer *pw_filter_dequeue_buffer(void *port_data);
 /** Submit a buffer for playback or recycle a buffer for capture. */
 int pw_filter_queue_buffer(void *port_data, struct pw_buffer *buffer);
 
+/** Get up to \a max_buffers buffers at once, oldest first. This does one
+ * update of the queue instead of one for each buffer.
+ * Returns the number of buffers or -EPIPE when there are no buffers.
+ * Since 0.3.79 */
+int pw_filter_dequeue_buffers(void *port_data, struct pw_buffer **buffers,
+		uint32_t max_buffers);
+
+/** Queue \a n_buffers buffers at once, see pw_filter_queue_buffer().
+ * Since 0.3.79 */
+int pw_filter_queue_buffers(void *port_data, struct pw_buffer **buffers,
+		uint32_t n_buffers);
+
+/** Get the most recent buffer of an input port and recycle all older
+ * buffers. Returns NULL and sets errno when there are no buffers, errno is
+ * EINVAL for output ports. Since 0.3.79 */
+struct pw_buffer *pw_filter_dequeue_latest_buffer(void *port_data);
+
 /** Get a data pointer to the buffer data */
 void *pw_filter_get_dsp_buffer(void *port_data, uint32_t n_samples);
 
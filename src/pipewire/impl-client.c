@@ -191,9 +191,12 @@ static int update_properties(struct pw_impl_client *client, const struct spa_dic
 
 	pw_impl_client_emit_info_changed(client, &client->info);
 
-	if (client->global)
+	if (client->global) {
+		pw_context_broadcast_begin(client->context);
 		spa_list_for_each(resource, &client->global->resource_list, link)
 			pw_client_resource_info(resource, &client->info);
+		pw_context_broadcast_end(client->context);
+	}
 
 	client->info.change_mask = 0;
 
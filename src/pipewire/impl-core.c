@@ -558,9 +558,12 @@ int pw_impl_core_update_properties(struct pw_impl_core *core, const struct spa_d
 		return 0;
 
 	core->info.change_mask |= PW_CORE_CHANGE_MASK_PROPS;
-	if (core->global)
+	if (core->global) {
+		pw_context_broadcast_begin(core->context);
 		spa_list_for_each(resource, &core->global->resource_list, link)
 			pw_core_resource_info(resource, &core->info);
+		pw_context_broadcast_end(core->context);
+	}
 	core->info.change_mask = 0;
 
 	return changed;
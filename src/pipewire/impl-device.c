@@ -623,9 +623,12 @@ static void emit_info_changed(struct pw_impl_device *device)
 
 	pw_impl_device_emit_info_changed(device, &device->info);
 
-	if (device->global)
+	if (device->global) {
+		pw_context_broadcast_begin(device->context);
 		spa_list_for_each(resource, &device->global->resource_list, link)
 			pw_device_resource_info(resource, &device->info);
+		pw_context_broadcast_end(device->context);
+	}
 
 	device->info.change_mask = 0;
 }
@@ -673,6 +676,7 @@ static int notify_param(void *data, int seq, uint32_t id,
 	struct pw_impl_device *device = data;
 	struct pw_resource *resource;
 
+	pw_context_broadcast_begin(device->context);
 	spa_list_for_each(resource, &device->global->resource_list, link) {
 		if (!resource_is_subscribed(resource, id))
 			continue;
@@ -680,6 +684,7 @@ static int notify_param(void *data, int seq, uint32_t id,
 		pw_log_debug("%p: resource %p notify param %d", device, resource, id);
 		pw_device_resource_param(resource, seq, id, index, next, param);
 	}
+	pw_context_broadcast_end(device->context);
 	return 0;
 }
 
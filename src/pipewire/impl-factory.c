@@ -145,9 +145,12 @@ int pw_impl_factory_update_properties(struct pw_impl_factory *factory, const str
 		return 0;
 
 	factory->info.change_mask |= PW_FACTORY_CHANGE_MASK_PROPS;
-	if (factory->global)
+	if (factory->global) {
+		pw_context_broadcast_begin(factory->context);
 		spa_list_for_each(resource, &factory->global->resource_list, link)
 			pw_factory_resource_info(resource, &factory->info);
+		pw_context_broadcast_end(factory->context);
+	}
 	factory->info.change_mask = 0;
 
 	return changed;
@@ -8,9 +8,11 @@
 #include <time.h>
 
 #include <spa/node/utils.h>
+#include <spa/pod/builder.h>
 #include <spa/pod/parser.h>
 #include <spa/pod/compare.h>
 #include <spa/param/param.h>
+#include <spa/param/props.h>
 #include <spa/debug/types.h>
 
 #include "pipewire/impl-link.h"
@@ -133,13 +135,24 @@ static void info_changed(struct pw_impl_link *link)
 
 	pw_impl_link_emit_info_changed(link, &link->info);
 
-	if (link->global)
+	if (link->global) {
+		pw_context_broadcast_begin(link->context);
 		spa_list_for_each(resource, &link->global->resource_list, link)
 			pw_link_resource_info(resource, &link->info);
+		pw_context_broadcast_end(link->context);
+	}
 
 	link->info.change_mask = 0;
 }
 
+/* only the nodes of the link and their drivers need to be evaluated again */
+static void recalc_link_nodes(struct pw_impl_link *link, const char *reason)
+{
+	pw_context_recalc_graph_mark(link->context, link->output->node);
+	pw_context_recalc_graph_mark(link->context, link->input->node);
+	pw_context_recalc_graph_changed(link->context, reason);
+}
+
 static void link_update_state(struct pw_impl_link *link, enum pw_link_state state, int res, char *error)
 {
 	struct impl *impl = SPA_CONTAINER_OF(link, struct impl, this);
@@ -186,11 +199,11 @@ static void link_update_state(struct pw_impl_link *link, enum pw_link_state stat
 	if (old < PW_LINK_STATE_PAUSED && state == PW_LINK_STATE_PAUSED) {
 		link->prepared = true;
 		link->preparing = false;
-		pw_context_recalc_graph(link->context, "link prepared");
+		recalc_link_nodes(link, "link prepared");
 	} else if (old == PW_LINK_STATE_PAUSED && state < PW_LINK_STATE_PAUSED) {
 		link->prepared = false;
 		link->preparing = false;
-		pw_context_recalc_graph(link->context, "link unprepared");
+		recalc_link_nodes(link, "link unprepared");
 	} else if (state == PW_LINK_STATE_INIT) {
 		link->prepared = false;
 		link->preparing = false;
@@ -505,6 +518,40 @@ static int port_set_io(struct pw_impl_link *this, struct pw_impl_port *port, uin
 	return res;
 }
 
+static void port_set_volume(struct pw_impl_link *this, struct pw_impl_port *port,
+		struct pw_impl_port_mix *mix)
+{
+	uint8_t buffer[128];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	const char *str;
+	float volume;
+	int res;
+
+	/* only the port mixers apply a volume to each link */
+	if (port->mix_handle == NULL ||
+	    (str = pw_properties_get(this->properties, PW_KEY_LINK_VOLUME)) == NULL)
+		return;
+
+	if (!spa_atof(str, &volume) || volume < 0.0f) {
+		pw_log_warn("%p: invalid %s: %s", this, PW_KEY_LINK_VOLUME, str);
+		return;
+	}
+
+	pw_log_debug("%p: %s port %p %d.%d volume: %f", this,
+			pw_direction_as_string(port->direction),
+			port, port->port_id, mix->port.port_id, volume);
+
+	if ((res = spa_node_port_set_param(port->mix,
+			mix->port.direction, mix->port.port_id,
+			SPA_PARAM_Props, 0,
+			spa_pod_builder_add_object(&b,
+				SPA_TYPE_OBJECT_Props, SPA_PARAM_Props,
+				SPA_PROP_volume, SPA_POD_Float(volume)))) < 0 &&
+	    res != -ENOENT && res != -ENOTSUP)
+		pw_log_warn("%p: port %p can't set volume: %s", this, port,
+				spa_strerror(res));
+}
+
 static void select_io(struct pw_impl_link *this)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -659,6 +706,8 @@ int pw_impl_link_activate(struct pw_impl_link *this)
 		!impl->inode->runnable || !impl->onode->runnable)
 		return 0;
 
+	port_set_volume(this, this->input, &this->rt.in_mix);
+
 	if ((res = port_set_io(this, this->input, SPA_IO_Buffers, this->io,
 			sizeof(struct spa_io_buffers), &this->rt.in_mix)) < 0)
 		return res;
@@ -1549,7 +1598,7 @@ void pw_impl_link_destroy(struct pw_impl_link *link)
 	}
 
 	if (link->prepared)
-		pw_context_recalc_graph(link->context, "link destroy");
+		recalc_link_nodes(link, "link destroy");
 
 	pw_log_debug("%p: free", impl);
 	pw_impl_link_emit_free(link);
@@ -362,9 +362,12 @@ int pw_impl_module_update_properties(struct pw_impl_module *module, const struct
 		return 0;
 
 	module->info.change_mask |= PW_MODULE_CHANGE_MASK_PROPS;
-	if (module->global)
+	if (module->global) {
+		pw_context_broadcast_begin(module->context);
 		spa_list_for_each(resource, &module->global->resource_list, link)
 			pw_module_resource_info(resource, &module->info);
+		pw_context_broadcast_end(module->context);
+	}
 	module->info.change_mask = 0;
 
 	return changed;
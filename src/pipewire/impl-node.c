@@ -292,8 +292,10 @@ static void emit_info_changed(struct pw_impl_node *node, bool flags_changed)
 
 	if (node->global && node->info.change_mask != 0) {
 		struct pw_resource *resource;
+		pw_context_broadcast_begin(node->context);
 		spa_list_for_each(resource, &node->global->resource_list, link)
 			pw_node_resource_info(resource, &node->info);
+		pw_context_broadcast_end(node->context);
 	}
 
 	node->info.change_mask = 0;
@@ -317,6 +319,7 @@ static int notify_param(void *data, int seq, uint32_t id,
 	struct pw_impl_node *node = data;
 	struct pw_resource *resource;
 
+	pw_context_broadcast_begin(node->context);
 	spa_list_for_each(resource, &node->global->resource_list, link) {
 		if (!resource_is_subscribed(resource, id))
 			continue;
@@ -324,6 +327,7 @@ static int notify_param(void *data, int seq, uint32_t id,
 		pw_log_debug("%p: resource %p notify param %d", node, resource, id);
 		pw_node_resource_param(resource, seq, id, index, next, param);
 	}
+	pw_context_broadcast_end(node->context);
 	return 0;
 }
 
@@ -813,8 +817,10 @@ int pw_impl_node_register(struct pw_impl_node *this,
 	spa_list_for_each(port, &this->output_ports, link)
 		pw_impl_port_register(port, NULL);
 
-	if (this->active)
-		pw_context_recalc_graph(context, "register active node");
+	if (this->active) {
+		pw_context_recalc_graph_mark(context, this);
+		pw_context_recalc_graph_changed(context, "register active node");
+	}
 
 	return 0;
 
@@ -1075,8 +1081,10 @@ static void check_properties(struct pw_impl_node *node)
 	pw_log_debug("%p: driver:%d recalc:%s active:%d", node, node->driver,
 			recalc_reason, node->active);
 
-	if (recalc_reason != NULL && node->active)
-		pw_context_recalc_graph(context, recalc_reason);
+	if (recalc_reason != NULL && node->active) {
+		pw_context_recalc_graph_mark(context, node);
+		pw_context_recalc_graph_changed(context, recalc_reason);
+	}
 }
 
 static const char *str_status(uint32_t status)
@@ -1571,8 +1579,10 @@ static void node_info(void *data, const struct spa_node_info *info)
 	if (n_changed_ids > 0)
 		emit_params(node, changed_ids, n_changed_ids);
 
-	if (flags_changed)
-		pw_context_recalc_graph(node->context, "node flags changed");
+	if (flags_changed) {
+		pw_context_recalc_graph_mark(node->context, node);
+		pw_context_recalc_graph_changed(node->context, "node flags changed");
+	}
 }
 
 static void node_port_info(void *data, enum spa_direction direction, uint32_t port_id,
@@ -2031,6 +2041,7 @@ void pw_impl_node_destroy(struct pw_impl_node *node)
 	active = node->active;
 	node->active = false;
 	node->runnable = false;
+	node->destroying = true;
 
 	pw_log_debug("%p: destroy", impl);
 	pw_log_info("(%s-%u) destroy", node->name, node->info.id);
@@ -2044,6 +2055,10 @@ void pw_impl_node_destroy(struct pw_impl_node *node)
 	pw_log_debug("%p: driver node %p", impl, node->driver_node);
 	had_driver = node != node->driver_node;
 
+	/* we can't be evaluated anymore, our driver and followers need to be */
+	if (had_driver)
+		pw_context_recalc_graph_mark(context, node->driver_node);
+
 	/* remove ourself as a follower from the driver node */
 	spa_list_remove(&node->follower_link);
 	pw_impl_node_emit_peer_removed(node->driver_node, node);
@@ -2052,6 +2067,7 @@ void pw_impl_node_destroy(struct pw_impl_node *node)
 	spa_list_consume(follower, &node->follower_list, follower_link) {
 		pw_log_debug("%p: reassign follower %p", impl, follower);
 		pw_impl_node_set_driver(follower, NULL);
+		pw_context_recalc_graph_mark(context, follower);
 	}
 
 	if (node->registered) {
@@ -2076,8 +2092,11 @@ void pw_impl_node_destroy(struct pw_impl_node *node)
 		pw_global_destroy(node->global);
 	}
 
+	/* the links are gone now and can't mark us anymore */
+	pw_context_recalc_graph_forget(context, node);
+
 	if (active || had_driver)
-		pw_context_recalc_graph(context,
+		pw_context_recalc_graph_changed(context,
 				"active node destroy");
 
 	pw_log_debug("%p: free", node);
@@ -2450,9 +2469,11 @@ int pw_impl_node_set_active(struct pw_impl_node *node, bool active)
 		node->active = active;
 		pw_impl_node_emit_active_changed(node, active);
 
-		if (node->registered)
-			pw_context_recalc_graph(node->context,
+		if (node->registered) {
+			pw_context_recalc_graph_mark(node->context, node);
+			pw_context_recalc_graph_changed(node->context,
 					active ? "node activate" : "node deactivate");
+		}
 		else if (!active && node->exported)
 			pw_loop_invoke(node->data_loop, do_node_remove, 1, NULL, 0, true, node);
 	}
@@ -32,6 +32,10 @@ struct impl {
 	struct spa_list param_list;
 	struct spa_list pending_list;
 
+	struct spa_meta_busy **busy;	/**< busy meta of the tee buffers, owned by rt */
+	uint32_t n_busy;
+	uint32_t n_active_mix;		/**< mixes in mix_list, rt only */
+
 	unsigned int cache_params:1;
 };
 
@@ -63,9 +67,12 @@ static void emit_info_changed(struct pw_impl_port *port)
 	if (port->node)
 		pw_impl_node_emit_port_info_changed(port->node, port, &port->info);
 
-	if (port->global)
+	if (port->global) {
+		pw_context_broadcast_begin(port->global->context);
 		spa_list_for_each(resource, &port->global->resource_list, link)
 			pw_port_resource_info(resource, &port->info);
+		pw_context_broadcast_end(port->global->context);
+	}
 
 	port->info.change_mask = 0;
 }
@@ -135,20 +142,31 @@ do_add_mix(struct spa_loop *loop,
 	if (!mix->active) {
 		spa_list_append(&impl->mix_list, &mix->rt_link);
 		mix->active = true;
+		impl->n_active_mix++;
 	}
 	return 0;
 }
 
+static inline void tee_release_buffer(struct impl *impl, struct pw_impl_port_mix *mix)
+{
+	if (mix->busy_id < impl->n_busy && impl->busy[mix->busy_id] != NULL)
+		SPA_ATOMIC_DEC(impl->busy[mix->busy_id]->count);
+	mix->busy_id = SPA_ID_INVALID;
+}
+
 static int
 do_remove_mix(struct spa_loop *loop,
 		 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct pw_impl_port_mix *mix = user_data;
 	struct pw_impl_port *this = mix->p;
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	pw_log_trace("%p: remove mix %p", this, mix);
 	if (mix->active) {
+		tee_release_buffer(impl, mix);
 		spa_list_remove(&mix->rt_link);
 		mix->active = false;
+		impl->n_active_mix--;
 	}
 	return 0;
 }
@@ -185,12 +203,30 @@ static int tee_process(void *object)
 	struct pw_impl_port *this = &impl->this;
 	struct pw_impl_port_mix *mix;
 	struct spa_io_buffers *io = &this->rt.io;
+	bool hold;
+
+	/* a single consumer hands the buffer back to the producer itself,
+	 * only keep it busy when it is shared between consumers */
+	hold = io->status == SPA_STATUS_HAVE_DATA &&
+		impl->n_active_mix > 1 &&
+		io->buffer_id < impl->n_busy && impl->busy[io->buffer_id] != NULL;
 
 	pw_log_trace_fp("%p: tee input %d %d", this, io->status, io->buffer_id);
 	spa_list_for_each(mix, &impl->mix_list, rt_link) {
 		pw_log_trace_fp("%p: port %d %p->%p %d", this,
 				mix->port.port_id, io, mix->io, mix->io->buffer_id);
+		/* the previous buffer was either taken by the consumer, which
+		 * then holds its own reference, or it was never looked at and
+		 * is replaced with the latest one */
+		tee_release_buffer(impl, mix);
 		*mix->io = *io;
+
+		/* keep the buffer busy for the producer until this consumer
+		 * moved on */
+		if (hold) {
+			SPA_ATOMIC_INC(impl->busy[io->buffer_id]->count);
+			mix->busy_id = io->buffer_id;
+		}
 	}
 	io->status = SPA_STATUS_NEED_DATA;
 
@@ -207,10 +243,74 @@ static int tee_reuse_buffer(void *object, uint32_t port_id, uint32_t buffer_id)
 	return 0;
 }
 
+struct tee_busy {
+	struct spa_meta_busy **busy;
+	uint32_t n_busy;
+};
+
+static int
+do_tee_set_busy(struct spa_loop *loop,
+		 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	const struct tee_busy *b = data;
+	struct pw_impl_port_mix *mix;
+
+	/* references on the old buffers go away with the buffers */
+	spa_list_for_each(mix, &impl->mix_list, rt_link)
+		mix->busy_id = SPA_ID_INVALID;
+
+	impl->busy = b->busy;
+	impl->n_busy = b->n_busy;
+	return 0;
+}
+
+static int tee_use_buffers(void *object,
+		enum spa_direction direction, uint32_t port_id, uint32_t flags,
+		struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	struct impl *impl = object;
+	struct pw_impl_port *this = &impl->this;
+	struct tee_busy b = { NULL, 0 };
+	struct spa_meta_busy **old = impl->busy;
+	uint32_t i, n_busy = 0;
+
+	/* only the buffers of the node are shared with the consumers */
+	if (direction != pw_direction_reverse(this->direction) || port_id != 0)
+		return 0;
+
+	if (n_buffers > 0) {
+		b.busy = calloc(n_buffers, sizeof(struct spa_meta_busy *));
+		if (b.busy == NULL)
+			return -errno;
+		for (i = 0; i < n_buffers; i++) {
+			b.busy[i] = spa_buffer_find_meta_data(buffers[i], SPA_META_Busy,
+					sizeof(struct spa_meta_busy));
+			if (b.busy[i] != NULL)
+				n_busy++;
+		}
+		if (n_busy == 0) {
+			free(b.busy);
+			b.busy = NULL;
+		} else {
+			b.n_busy = n_buffers;
+		}
+	}
+	pw_log_debug("%p: tee %d buffers, %d with busy meta", this, n_buffers, n_busy);
+
+	if (b.busy != NULL || old != NULL) {
+		pw_loop_invoke(this->node->data_loop,
+		       do_tee_set_busy, SPA_ID_INVALID, &b, sizeof(b), true, impl);
+		free(old);
+	}
+	return 0;
+}
+
 static const struct spa_node_methods schedule_tee_node = {
 	SPA_VERSION_NODE_METHODS,
 	.process = tee_process,
 	.port_set_io = port_set_io,
+	.port_use_buffers = tee_use_buffers,
 	.port_reuse_buffer = tee_reuse_buffer,
 };
 
@@ -272,6 +372,7 @@ int pw_impl_port_init_mix(struct pw_impl_port *port, struct pw_impl_port_mix *mi
 	mix->port.direction = port->direction;
 	mix->port.port_id = port_id;
 	mix->p = port;
+	mix->busy_id = SPA_ID_INVALID;
 
 	if ((res = pw_impl_port_call_init_mix(port, mix)) < 0)
 		goto error_remove_port;
@@ -394,6 +495,7 @@ static int notify_param(void *data, int seq, uint32_t id,
 	struct pw_impl_port *port = data;
 	struct pw_resource *resource;
 
+	pw_context_broadcast_begin(port->global->context);
 	spa_list_for_each(resource, &port->global->resource_list, link) {
 		if (!resource_is_subscribed(resource, id))
 			continue;
@@ -401,6 +503,7 @@ static int notify_param(void *data, int seq, uint32_t id,
 		pw_log_debug("%p: resource %p notify param %d", port, resource, id);
 		pw_port_resource_param(resource, seq, id, index, next, param);
 	}
+	pw_context_broadcast_end(port->global->context);
 	return 0;
 }
 
@@ -1315,6 +1418,7 @@ void pw_impl_port_destroy(struct pw_impl_port *port)
 
 	pw_properties_free(port->properties);
 
+	free(impl->busy);
 	free(port);
 }
 
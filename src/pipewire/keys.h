@@ -212,6 +212,9 @@ extern "C" {
 #define PW_KEY_LINK_FEEDBACK		"link.feedback"		/**< indicate that a link is a feedback
 								  *  link and the target will receive data
 								  *  in the next cycle */
+#define PW_KEY_LINK_VOLUME		"link.volume"		/**< the volume applied to the data of
+								  *  the link by the input port mixer,
+								  *  since 0.3.79 */
 
 /** device properties */
 #define PW_KEY_DEVICE_ID		"device.id"		/**< device id */
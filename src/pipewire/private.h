@@ -375,6 +375,20 @@ int pw_loop_check(struct pw_loop *loop);
 #define pw_context_emit_driver_added(c,n)	pw_context_emit(c, driver_added, 1, n)
 #define pw_context_emit_driver_removed(c,n)	pw_context_emit(c, driver_removed, 1, n)
 
+#define PW_CONTEXT_RECALC_HIST_SIZE	24
+
+struct pw_context_recalc_stats {
+	uint64_t count;			/**< number of graph recalculations */
+	uint64_t full_count;		/**< number of complete graph recalculations */
+	uint64_t last_nodes;		/**< number of nodes in the last recalculation */
+	uint64_t last_time;		/**< duration of the last recalculation in nsec */
+	uint64_t max_time;		/**< longest recalculation in nsec */
+	uint64_t total_time;		/**< accumulated recalculation time in nsec */
+	uint32_t hist[PW_CONTEXT_RECALC_HIST_SIZE];	/**< log2 histogram of the recalculation
+							  *  time, bucket i counts durations
+							  *  below 2^i usec */
+};
+
 struct pw_context {
 	struct pw_impl_core *core;		/**< core object */
 
@@ -429,6 +443,11 @@ struct pw_context {
 	long sc_pagesize;
 	unsigned int freewheeling:1;
 
+	struct pw_context_recalc_stats recalc_stats;	/**< graph recalculation timings */
+
+	uint32_t broadcast_depth;	/**< > 0 while an event is broadcast to resources */
+	uint32_t broadcast_serial;	/**< changes for each broadcast */
+
 	void *user_data;		/**< extra user data */
 };
 
@@ -676,6 +695,9 @@ struct pw_impl_node {
 	unsigned int trigger:1;		/**< has the TRIGGER property and needs an extra
 					  *  trigger to start processing. */
 	unsigned int can_suspend:1;
+	unsigned int recalc_dirty:1;	/**< node is in the list of nodes to recalculate */
+	unsigned int recalc_affected:1;	/**< node is part of the current graph recalculation */
+	unsigned int destroying:1;	/**< node is being destroyed */
 	unsigned int checked;		/**< for sorting */
 
 	uint32_t port_user_data_size;	/**< extra size for port user data */
@@ -686,6 +708,7 @@ struct pw_impl_node {
 	struct spa_list follower_link;
 
 	struct spa_list sort_link;	/**< link used to sort nodes */
+	struct spa_list recalc_link;	/**< link in the list of dirty nodes */
 
 	struct spa_list peer_list;	/* list of peers */
 
@@ -746,6 +769,7 @@ struct pw_impl_port_mix {
 	struct spa_io_buffers *io;
 	uint32_t id;
 	uint32_t peer_id;
+	uint32_t busy_id;		/**< buffer this mix holds busy, rt only */
 	unsigned int have_buffers:1;
 	unsigned int active:1;
 };
@@ -1158,6 +1182,24 @@ int pw_proxy_init(struct pw_proxy *proxy, struct pw_core *core, const char *type
 void pw_proxy_remove(struct pw_proxy *proxy);
 
 int pw_context_recalc_graph(struct pw_context *context, const char *reason);
+int pw_context_recalc_graph_changed(struct pw_context *context, const char *reason);
+void pw_context_recalc_graph_mark(struct pw_context *context, struct pw_impl_node *node);
+void pw_context_recalc_graph_forget(struct pw_context *context, struct pw_impl_node *node);
+
+/** Start sending the same event with the same arguments to a set of
+ * resources. The protocol can marshal the event once and share the
+ * message between the resources until pw_context_broadcast_end(). */
+static inline void pw_context_broadcast_begin(struct pw_context *context)
+{
+	context->broadcast_depth++;
+	context->broadcast_serial++;
+}
+
+static inline void pw_context_broadcast_end(struct pw_context *context)
+{
+	context->broadcast_depth--;
+	context->broadcast_serial++;
+}
 
 void pw_impl_port_update_info(struct pw_impl_port *port, const struct spa_port_info *info);
 
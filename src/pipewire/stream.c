@@ -374,6 +374,76 @@ static inline struct buffer *queue_pop(struct stream *stream, struct queue *queu
 
 	return buffer;
 }
+
+/* push the buffers with one update of the write index */
+static inline int queue_push_many(struct stream *stream, struct queue *queue,
+		struct buffer **buffers, uint32_t n_buffers)
+{
+	uint32_t i, index;
+
+	/* set the flag while checking so that a buffer that is in the
+	 * array twice is refused */
+	for (i = 0; i < n_buffers; i++) {
+		if (SPA_FLAG_IS_SET(buffers[i]->flags, BUFFER_FLAG_QUEUED) ||
+		    buffers[i]->id >= stream->n_buffers) {
+			while (i > 0)
+				SPA_FLAG_CLEAR(buffers[--i]->flags, BUFFER_FLAG_QUEUED);
+			return -EINVAL;
+		}
+		SPA_FLAG_SET(buffers[i]->flags, BUFFER_FLAG_QUEUED);
+	}
+	spa_ringbuffer_get_write_index(&queue->ring, &index);
+	for (i = 0; i < n_buffers; i++) {
+		queue->incount += buffers[i]->this.size;
+		queue->ids[(index + i) & MASK_BUFFERS] = buffers[i]->id;
+	}
+	spa_ringbuffer_write_update(&queue->ring, index + n_buffers);
+
+	return 0;
+}
+
+/* get up to max_buffers without removing them from the queue, only the
+ * reader of the queue may call this */
+static inline uint32_t queue_peek_many(struct stream *stream, struct queue *queue,
+		struct buffer **buffers, uint32_t max_buffers)
+{
+	uint32_t i, index, n_buffers;
+	int32_t avail;
+
+	if ((avail = spa_ringbuffer_get_read_index(&queue->ring, &index)) < 1) {
+		errno = EPIPE;
+		return 0;
+	}
+	n_buffers = SPA_MIN((uint32_t)avail, max_buffers);
+	for (i = 0; i < n_buffers; i++)
+		buffers[i] = &stream->buffers[queue->ids[(index + i) & MASK_BUFFERS]];
+
+	return n_buffers;
+}
+
+/* pop up to max_buffers with one update of the read index */
+static inline uint32_t queue_pop_many(struct stream *stream, struct queue *queue,
+		struct buffer **buffers, uint32_t max_buffers)
+{
+	uint32_t i, index, n_buffers;
+	int32_t avail;
+
+	if ((avail = spa_ringbuffer_get_read_index(&queue->ring, &index)) < 1) {
+		errno = EPIPE;
+		return 0;
+	}
+	n_buffers = SPA_MIN((uint32_t)avail, max_buffers);
+	for (i = 0; i < n_buffers; i++) {
+		struct buffer *buffer = &stream->buffers[queue->ids[(index + i) & MASK_BUFFERS]];
+		queue->outcount += buffer->this.size;
+		SPA_FLAG_CLEAR(buffer->flags, BUFFER_FLAG_QUEUED);
+		buffers[i] = buffer;
+	}
+	spa_ringbuffer_read_update(&queue->ring, index + n_buffers);
+
+	return n_buffers;
+}
+
 static inline void clear_queue(struct stream *stream, struct queue *queue)
 {
 	spa_ringbuffer_init(&queue->ring);
@@ -2429,13 +2499,104 @@ int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
 	return res;
 }
 
+SPA_EXPORT
+int pw_stream_dequeue_buffers(struct pw_stream *stream, struct pw_buffer **buffers,
+		uint32_t max_buffers)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer *b[MAX_BUFFERS];
+	uint32_t i, n;
+
+	if ((n = queue_peek_many(impl, &impl->dequeued, b,
+					SPA_MIN(max_buffers, (uint32_t)MAX_BUFFERS))) == 0) {
+		pw_log_trace_fp("%p: no more buffers: %m", stream);
+		return -EPIPE;
+	}
+	/* only take the buffers before the first busy one, it and the ones
+	 * after it stay at the head of the queue */
+	for (i = 0; i < n; i++) {
+		if (b[i]->busy && impl->direction == SPA_DIRECTION_OUTPUT) {
+			if (SPA_ATOMIC_INC(b[i]->busy->count) > 1) {
+				SPA_ATOMIC_DEC(b[i]->busy->count);
+				pw_log_trace_fp("%p: buffer busy", stream);
+				if (i == 0)
+					return -EBUSY;
+				break;
+			}
+		}
+	}
+	n = queue_pop_many(impl, &impl->dequeued, b, i);
+	for (i = 0; i < n; i++)
+		buffers[i] = &b[i]->this;
+
+	pw_log_trace_fp("%p: dequeue %u buffers", stream, n);
+	return n;
+}
+
+SPA_EXPORT
+int pw_stream_queue_buffers(struct pw_stream *stream, struct pw_buffer **buffers,
+		uint32_t n_buffers)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer *b[MAX_BUFFERS];
+	uint32_t i;
+	int res;
+
+	if (n_buffers > MAX_BUFFERS)
+		return -EINVAL;
+
+	for (i = 0; i < n_buffers; i++)
+		b[i] = SPA_CONTAINER_OF(buffers[i], struct buffer, this);
+
+	pw_log_trace_fp("%p: queue %u buffers", stream, n_buffers);
+	if ((res = queue_push_many(impl, &impl->queued, b, n_buffers)) < 0)
+		return res;
+
+	for (i = 0; i < n_buffers; i++) {
+		if (b[i]->busy)
+			SPA_ATOMIC_DEC(b[i]->busy->count);
+	}
+
+	if (impl->direction == SPA_DIRECTION_OUTPUT &&
+	    impl->driving && !impl->using_trigger && n_buffers > 0) {
+		pw_log_debug("deprecated: use pw_stream_trigger_process() to drive the stream.");
+		res = pw_loop_invoke(impl->data_loop,
+			do_trigger_deprecated, 1, NULL, 0, false, impl);
+	}
+	return res;
+}
+
+SPA_EXPORT
+struct pw_buffer *pw_stream_dequeue_latest_buffer(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_buffer *buffers[MAX_BUFFERS];
+	int n;
+
+	/* older buffers of a playback stream would be played unfilled */
+	if (impl->direction == SPA_DIRECTION_OUTPUT) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((n = pw_stream_dequeue_buffers(stream, buffers, MAX_BUFFERS)) < 0) {
+		errno = -n;
+		return NULL;
+	}
+	if (n > 1)
+		pw_stream_queue_buffers(stream, buffers, n - 1);
+
+	return buffers[n - 1];
+}
+
 static int
 do_flush(struct spa_loop *loop,
                  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct stream *impl = user_data;
-	struct buffer *b;
+	struct buffer *b[MAX_BUFFERS];
 	struct queue *from, *to;
+	uint32_t n;
 
 	pw_log_trace_fp("%p: flush", impl);
 
@@ -2446,12 +2607,8 @@ do_flush(struct spa_loop *loop,
 		from = &impl->dequeued;
 		to = &impl->queued;
 	}
-	do {
-		b = queue_pop(impl, from);
-		if (b != NULL)
-			queue_push(impl, to, b);
-	}
-	while (b);
+	n = queue_pop_many(impl, from, b, MAX_BUFFERS);
+	queue_push_many(impl, to, b, n);
 
 	impl->queued.outcount = impl->dequeued.incount =
 		impl->dequeued.outcount = impl->queued.incount = 0;
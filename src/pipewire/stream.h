@@ -503,6 +503,24 @@ struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
 /** Submit a buffer for playback or recycle a buffer for capture. */
 int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer);
 
+/** Get up to \a max_buffers buffers at once, oldest first. This does one
+ * update of the queue instead of one for each buffer. For playback streams
+ * only the buffers before the first busy buffer are returned.
+ * Returns the number of buffers, -EPIPE when there are no buffers or
+ * -EBUSY when the first buffer is busy. Since 0.3.79 */
+int pw_stream_dequeue_buffers(struct pw_stream *stream, struct pw_buffer **buffers,
+		uint32_t max_buffers);
+
+/** Queue \a n_buffers buffers at once, see pw_stream_queue_buffer().
+ * Since 0.3.79 */
+int pw_stream_queue_buffers(struct pw_stream *stream, struct pw_buffer **buffers,
+		uint32_t n_buffers);
+
+/** Get the most recent buffer of a capture stream and recycle all older
+ * buffers. Returns NULL and sets errno when there are no buffers, errno is
+ * EINVAL for playback streams. Since 0.3.79 */
+struct pw_buffer *pw_stream_dequeue_latest_buffer(struct pw_stream *stream);
+
 /** Activate or deactivate the stream */
 int pw_stream_set_active(struct pw_stream *stream, bool active);
 
@@ -276,6 +276,7 @@ static void test_create_port(void)
 	int res;
 	struct port *port;
 	enum pw_filter_state state;
+	struct pw_buffer *buffers[4];
 
 	loop = pw_main_loop_new(NULL);
 	context = pw_context_new(pw_main_loop_get_loop(loop), NULL, 12);
@@ -326,6 +327,11 @@ static void test_create_port(void)
 	spa_assert_se(port_count == 1);
 	printf("port added\n");
 
+	/* no buffers before the port is linked */
+	spa_assert_se(pw_filter_dequeue_buffers(port, buffers, 4) == -EPIPE);
+	spa_assert_se(pw_filter_dequeue_latest_buffer(port) == NULL);
+	spa_assert_se(errno == EPIPE);
+
 	printf("remove port\n");
 	pw_filter_remove_port(port);
 	roundtrip(core, loop);
@@ -132,6 +132,7 @@ static void test_create(void)
 	struct spa_hook listener = { 0, };
 	const char *error = NULL;
 	struct pw_time tm;
+	struct pw_buffer *buffers[4];
 
 	loop = pw_main_loop_new(NULL);
 	context = pw_context_new(pw_main_loop_get_loop(loop), NULL, 12);
@@ -161,6 +162,10 @@ static void test_create(void)
 	spa_assert_se(tm.buffered == 0);
 
 	spa_assert_se(pw_stream_dequeue_buffer(stream) == NULL);
+	spa_assert_se(pw_stream_dequeue_buffers(stream, buffers, 4) == -EPIPE);
+	spa_assert_se(pw_stream_dequeue_latest_buffer(stream) == NULL);
+	spa_assert_se(errno == EPIPE);
+	spa_assert_se(pw_stream_queue_buffers(stream, buffers, 0) == 0);
 
 	/* check destroy */
 	destroy_count = 0;
@@ -0,0 +1,711 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <spa/utils/string.h>
+
+#include <pipewire/array.h>
+
+#include "profilerfile.h"
+
+/*
+ * The file starts with a header, followed by entries with the cycles and
+ * the topology changes in the order they were recorded. The file is
+ * written in chunks that are mapped one at a time, an entry never
+ * crosses a chunk boundary. When the file is closed, an index with a
+ * sync point for every SYNC_INTERVAL records and the offsets of all
+ * topology entries is appended. Files without an index, from a recorder
+ * that did not exit cleanly, are scanned to rebuild it.
+ */
+#define FILE_MAGIC	0x54505750	/* "PWPT" */
+#define FILE_VERSION	0
+
+#define HEADER_SIZE	64
+#define CHUNK_SIZE	(4u * 1024 * 1024)
+#define SYNC_INTERVAL	1024
+
+struct file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t start_time;
+	uint64_t end_time;
+	uint64_t n_records;
+	uint64_t index_offset;		/* 0 when the file has no index */
+	uint32_t n_sync;
+	uint32_t n_topology;
+};
+
+#define ENTRY_END	0		/* unused space at the end of the data */
+#define ENTRY_RECORD	1
+#define ENTRY_NODE	2
+#define ENTRY_LINK	3
+#define ENTRY_REMOVE	4
+#define ENTRY_PAD	5		/* skip to the next chunk */
+
+struct file_entry {
+	uint32_t type;
+	uint32_t size;			/* size of the payload */
+	uint64_t time;
+};
+
+#define REL_NONE	INT32_MIN
+
+/* times relative to the signal time of the driver, REL_NONE when 0 */
+struct file_block {
+	uint32_t id;
+	int32_t status;
+	int32_t signal;
+	int32_t awake;
+	int32_t finish;
+	uint32_t xrun_count;
+};
+
+struct file_record {
+	int64_t count;
+	float cpu_load[3];
+	uint32_t xrun_count;
+	uint64_t nsec;
+	uint64_t position;
+	uint64_t duration;
+	int64_t delay;
+	double rate_diff;
+	uint32_t clock_id;
+	uint32_t rate;
+	uint64_t prev_signal_time;
+	uint64_t signal_time;
+	struct file_block driver;
+	uint32_t n_followers;
+	uint32_t padding;
+	struct file_block followers[];
+};
+
+struct file_node {
+	uint32_t id;
+	char name[];
+};
+
+struct file_link {
+	uint32_t id;
+	uint32_t output_node;
+	uint32_t input_node;
+	uint32_t padding;
+};
+
+struct file_remove {
+	uint32_t id;
+	uint32_t padding;
+};
+
+struct file_sync {
+	uint64_t time;
+	uint64_t offset;
+};
+
+struct profiler_file {
+	int mode;
+	int fd;
+
+	struct file_header header;
+
+	/* read: the complete file, write: the current chunk */
+	uint8_t *data;
+	size_t size;
+	uint64_t offset;
+	uint64_t pos;
+	uint64_t end;
+
+	const struct file_sync *sync;
+	const uint64_t *topology;
+	struct pw_array sync_array;
+	struct pw_array topology_array;
+
+	/* topology entries before the seek position that still need to be read */
+	uint32_t topology_pos;
+	uint32_t topology_end;
+
+	uint8_t record[sizeof(struct pw_profiler_record) +
+		PROFILER_FILE_MAX_FOLLOWERS * sizeof(struct pw_profiler_block)] SPA_ALIGNED(8);
+};
+
+static inline uint64_t chunk_end(uint64_t pos)
+{
+	return (pos / CHUNK_SIZE + 1) * CHUNK_SIZE;
+}
+
+static inline int32_t to_rel(uint64_t time, uint64_t base)
+{
+	int64_t diff;
+	if (time == 0)
+		return REL_NONE;
+	diff = (int64_t)(time - base);
+	return (int32_t)SPA_CLAMP(diff, (int64_t)INT32_MIN + 1, (int64_t)INT32_MAX);
+}
+
+static inline uint64_t from_rel(int32_t rel, uint64_t base)
+{
+	return rel == REL_NONE ? 0 : base + rel;
+}
+
+static void block_to_file(struct file_block *f, const struct pw_profiler_block *b, uint64_t base)
+{
+	f->id = b->id;
+	f->status = b->status;
+	f->signal = to_rel(b->signal_time, base);
+	f->awake = to_rel(b->awake_time, base);
+	f->finish = to_rel(b->finish_time, base);
+	f->xrun_count = b->xrun_count;
+}
+
+static void block_from_file(struct pw_profiler_block *b, const struct file_block *f,
+		uint64_t base, uint64_t prev_signal)
+{
+	spa_zero(*b);
+	b->id = f->id;
+	b->status = f->status;
+	b->prev_signal_time = prev_signal;
+	b->signal_time = from_rel(f->signal, base);
+	b->awake_time = from_rel(f->awake, base);
+	b->finish_time = from_rel(f->finish, base);
+	b->xrun_count = f->xrun_count;
+}
+
+static int parse_record(struct profiler_file *pf, const struct file_entry *e,
+		struct profiler_file_event *event)
+{
+	const struct file_record *f = SPA_PTROFF(e, sizeof(*e), const struct file_record);
+	struct pw_profiler_record *r = (struct pw_profiler_record *)pf->record;
+	struct spa_io_clock *clock = &r->info.clock;
+	uint32_t i;
+
+	if (e->size < sizeof(*f) ||
+	    f->n_followers > (e->size - sizeof(*f)) / sizeof(struct file_block))
+		return -EINVAL;
+
+	spa_zero(r->info);
+	r->info.count = f->count;
+	memcpy(r->info.cpu_load, f->cpu_load, sizeof(r->info.cpu_load));
+	r->info.xrun_count = f->xrun_count;
+	clock->id = f->clock_id;
+	clock->nsec = f->nsec;
+	clock->rate = SPA_FRACTION(1, f->rate);
+	clock->position = f->position;
+	clock->duration = f->duration;
+	clock->delay = f->delay;
+	clock->rate_diff = f->rate_diff;
+
+	block_from_file(&r->driver, &f->driver, f->signal_time, f->prev_signal_time);
+
+	r->n_followers = SPA_MIN(f->n_followers, (uint32_t)PROFILER_FILE_MAX_FOLLOWERS);
+	for (i = 0; i < r->n_followers; i++)
+		block_from_file(&r->followers[i], &f->followers[i],
+				f->signal_time, f->signal_time);
+	r->size = sizeof(*r) + r->n_followers * sizeof(struct pw_profiler_block);
+
+	event->record = r;
+	return 0;
+}
+
+static int parse_entry(struct profiler_file *pf, const struct file_entry *e,
+		struct profiler_file_event *event)
+{
+	const void *payload = SPA_PTROFF(e, sizeof(*e), void);
+
+	event->time = e->time;
+
+	switch (e->type) {
+	case ENTRY_RECORD:
+		event->type = PROFILER_FILE_EVENT_RECORD;
+		return parse_record(pf, e, event);
+	case ENTRY_NODE:
+	{
+		const struct file_node *f = payload;
+		if (e->size <= sizeof(*f) ||
+		    memchr(f->name, '\0', e->size - sizeof(*f)) == NULL)
+			return -EINVAL;
+		event->type = PROFILER_FILE_EVENT_NODE;
+		event->node.id = f->id;
+		event->node.name = f->name;
+		return 0;
+	}
+	case ENTRY_LINK:
+	{
+		const struct file_link *f = payload;
+		if (e->size < sizeof(*f))
+			return -EINVAL;
+		event->type = PROFILER_FILE_EVENT_LINK;
+		event->link.id = f->id;
+		event->link.output_node = f->output_node;
+		event->link.input_node = f->input_node;
+		return 0;
+	}
+	case ENTRY_REMOVE:
+	{
+		const struct file_remove *f = payload;
+		if (e->size < sizeof(*f))
+			return -EINVAL;
+		event->type = PROFILER_FILE_EVENT_REMOVE;
+		event->remove.id = f->id;
+		return 0;
+	}
+	default:
+		return -ENOTSUP;
+	}
+}
+
+/* get the entry at *pos and move *pos to the next one, NULL at the end */
+static const struct file_entry *next_entry(struct profiler_file *pf, uint64_t *pos)
+{
+	const struct file_entry *e;
+	uint64_t size;
+
+	while (true) {
+		/* offsets from the index are not trusted */
+		if (*pos >= pf->end)
+			return NULL;
+		if (chunk_end(*pos) - *pos < sizeof(*e))
+			*pos = chunk_end(*pos);
+		if (*pos + sizeof(*e) > pf->end)
+			return NULL;
+
+		e = SPA_PTROFF(pf->data, *pos, const struct file_entry);
+		if (e->type == ENTRY_END)
+			return NULL;
+		if (e->type == ENTRY_PAD) {
+			*pos = chunk_end(*pos);
+			continue;
+		}
+		size = sizeof(*e) + SPA_ROUND_UP_N((uint64_t)e->size, 8);
+		if (*pos + size > pf->end || *pos + size > chunk_end(*pos))
+			return NULL;
+		*pos += size;
+		return e;
+	}
+}
+
+static int rebuild_index(struct profiler_file *pf)
+{
+	const struct file_entry *e;
+	uint64_t pos = HEADER_SIZE, offset;
+
+	pf->header.start_time = pf->header.end_time = 0;
+	pf->header.n_records = 0;
+
+	while (true) {
+		if ((e = next_entry(pf, &pos)) == NULL)
+			break;
+		offset = pos - sizeof(*e) - SPA_ROUND_UP_N((uint64_t)e->size, 8);
+
+		if (e->type == ENTRY_RECORD) {
+			if (pf->header.n_records % SYNC_INTERVAL == 0) {
+				struct file_sync *s = pw_array_add(&pf->sync_array, sizeof(*s));
+				if (s == NULL)
+					return -errno;
+				s->time = e->time;
+				s->offset = offset;
+			}
+			if (pf->header.n_records == 0)
+				pf->header.start_time = e->time;
+			pf->header.end_time = e->time;
+			pf->header.n_records++;
+		} else {
+			uint64_t *t = pw_array_add(&pf->topology_array, sizeof(*t));
+			if (t == NULL)
+				return -errno;
+			*t = offset;
+		}
+	}
+	pf->sync = pw_array_first(&pf->sync_array);
+	pf->header.n_sync = pw_array_get_len(&pf->sync_array, struct file_sync);
+	pf->topology = pw_array_first(&pf->topology_array);
+	pf->header.n_topology = pw_array_get_len(&pf->topology_array, uint64_t);
+	return 0;
+}
+
+static int open_read(struct profiler_file *pf, const char *filename, struct profiler_file_info *info)
+{
+	struct stat st;
+	uint64_t index_size;
+	int res;
+
+	if ((pf->fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) {
+		res = -errno;
+		goto exit;
+	}
+	if (fstat(pf->fd, &st) < 0) {
+		res = -errno;
+		goto exit_close;
+	}
+	pf->size = st.st_size;
+	if (pf->size < HEADER_SIZE) {
+		res = -EINVAL;
+		goto exit_close;
+	}
+
+	pf->data = mmap(NULL, pf->size, PROT_READ, MAP_SHARED, pf->fd, 0);
+	if (pf->data == MAP_FAILED) {
+		res = -errno;
+		goto exit_close;
+	}
+	/* the file is mostly read once from start to end, let the pages go */
+	madvise(pf->data, pf->size, MADV_SEQUENTIAL);
+
+	memcpy(&pf->header, pf->data, sizeof(pf->header));
+	if (pf->header.magic != FILE_MAGIC ||
+	    pf->header.version != FILE_VERSION) {
+		res = -EINVAL;
+		goto exit_unmap;
+	}
+
+	index_size = (uint64_t)pf->header.n_sync * sizeof(struct file_sync) +
+		(uint64_t)pf->header.n_topology * sizeof(uint64_t);
+
+	if (pf->header.index_offset >= HEADER_SIZE &&
+	    pf->header.index_offset % 8 == 0 &&
+	    index_size <= pf->size &&
+	    pf->header.index_offset <= pf->size - index_size) {
+		pf->end = pf->header.index_offset;
+		pf->sync = SPA_PTROFF(pf->data, pf->end, const struct file_sync);
+		pf->topology = SPA_PTROFF(pf->sync,
+				pf->header.n_sync * sizeof(struct file_sync), const uint64_t);
+		info->indexed = true;
+	} else {
+		pf->end = pf->size;
+		if ((res = rebuild_index(pf)) < 0)
+			goto exit_unmap;
+		info->indexed = false;
+	}
+	pf->pos = HEADER_SIZE;
+	pf->mode = 1;
+
+	info->start_time = pf->header.start_time;
+	info->end_time = pf->header.end_time;
+	info->n_records = pf->header.n_records;
+	return 0;
+
+exit_unmap:
+	munmap(pf->data, pf->size);
+exit_close:
+	close(pf->fd);
+exit:
+	return res;
+}
+
+static int map_chunk(struct profiler_file *pf, uint64_t offset)
+{
+	if (pf->data != NULL)
+		munmap(pf->data, CHUNK_SIZE);
+	pf->data = NULL;
+
+	if (ftruncate(pf->fd, offset + CHUNK_SIZE) < 0)
+		return -errno;
+
+	pf->data = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, pf->fd, offset);
+	if (pf->data == MAP_FAILED) {
+		pf->data = NULL;
+		return -errno;
+	}
+	pf->offset = offset;
+	pf->pos = 0;
+	return 0;
+}
+
+static int open_write(struct profiler_file *pf, const char *filename, struct profiler_file_info *info)
+{
+	int res;
+
+	if ((pf->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0660)) < 0) {
+		res = -errno;
+		goto exit;
+	}
+	if ((res = map_chunk(pf, 0)) < 0)
+		goto exit_close;
+
+	pf->header.magic = FILE_MAGIC;
+	pf->header.version = FILE_VERSION;
+	memcpy(pf->data, &pf->header, sizeof(pf->header));
+	pf->pos = HEADER_SIZE;
+	pf->mode = 2;
+
+	spa_zero(*info);
+	return 0;
+
+exit_close:
+	close(pf->fd);
+	unlink(filename);
+exit:
+	return res;
+}
+
+struct profiler_file *
+profiler_file_open(const char *filename, const char *mode, struct profiler_file_info *info)
+{
+	int res;
+	struct profiler_file *pf;
+
+	pf = calloc(1, sizeof(struct profiler_file));
+	if (pf == NULL)
+		return NULL;
+
+	pw_array_init(&pf->sync_array, 4096);
+	pw_array_init(&pf->topology_array, 1024);
+
+	if (spa_streq(mode, "r")) {
+		if ((res = open_read(pf, filename, info)) < 0)
+			goto exit_free;
+	} else if (spa_streq(mode, "w")) {
+		if ((res = open_write(pf, filename, info)) < 0)
+			goto exit_free;
+	} else {
+		res = -EINVAL;
+		goto exit_free;
+	}
+	return pf;
+
+exit_free:
+	pw_array_clear(&pf->sync_array);
+	pw_array_clear(&pf->topology_array);
+	free(pf);
+	errno = -res;
+	return NULL;
+}
+
+static inline int write_at(int fd, const void *buf, size_t count, uint64_t offset)
+{
+	return pwrite(fd, buf, count, offset) == (ssize_t)count ? 0 : -errno;
+}
+
+static int write_index(struct profiler_file *pf)
+{
+	uint64_t end = pf->offset + pf->pos;
+	size_t sync_size = pf->sync_array.size;
+	size_t topology_size = pf->topology_array.size;
+	int res;
+
+	munmap(pf->data, CHUNK_SIZE);
+	pf->data = NULL;
+
+	if ((res = write_at(pf->fd, pf->sync_array.data, sync_size, end)) < 0 ||
+	    (res = write_at(pf->fd, pf->topology_array.data, topology_size, end + sync_size)) < 0)
+		return res;
+	if (ftruncate(pf->fd, end + sync_size + topology_size) < 0)
+		return -errno;
+
+	pf->header.index_offset = end;
+	pf->header.n_sync = sync_size / sizeof(struct file_sync);
+	pf->header.n_topology = topology_size / sizeof(uint64_t);
+	return write_at(pf->fd, &pf->header, sizeof(pf->header), 0);
+}
+
+int profiler_file_close(struct profiler_file *pf)
+{
+	int res = 0;
+
+	if (pf->mode == 1) {
+		munmap(pf->data, pf->size);
+	} else if (pf->mode == 2) {
+		if (pf->data != NULL)
+			res = write_index(pf);
+	} else
+		return -EINVAL;
+
+	close(pf->fd);
+	pw_array_clear(&pf->sync_array);
+	pw_array_clear(&pf->topology_array);
+	free(pf);
+	return res;
+}
+
+int profiler_file_seek(struct profiler_file *pf, uint64_t time)
+{
+	uint32_t lo = 0, hi, mid;
+
+	if (pf->mode != 1)
+		return -EINVAL;
+
+	/* find the last sync point at or before time */
+	hi = pf->header.n_sync;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (pf->sync[mid].time <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	pf->pos = lo > 0 ? pf->sync[lo - 1].offset : HEADER_SIZE;
+
+	/* the topology entries before the new position are read first */
+	lo = 0;
+	hi = pf->header.n_topology;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (pf->topology[mid] < pf->pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	pf->topology_pos = 0;
+	pf->topology_end = lo;
+	return 0;
+}
+
+int profiler_file_read_event(struct profiler_file *pf, struct profiler_file_event *event)
+{
+	const struct file_entry *e;
+	uint64_t pos;
+
+	if (pf->mode != 1)
+		return -EINVAL;
+
+	while (pf->topology_pos < pf->topology_end) {
+		pos = pf->topology[pf->topology_pos++];
+		if ((e = next_entry(pf, &pos)) == NULL)
+			continue;
+		if (e->type != ENTRY_RECORD &&
+		    parse_entry(pf, e, event) == 0)
+			return 1;
+	}
+
+	while ((e = next_entry(pf, &pf->pos)) != NULL) {
+		/* skip unknown and broken entries */
+		if (parse_entry(pf, e, event) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void *add_entry(struct profiler_file *pf, uint32_t type, uint64_t time,
+		uint32_t size, uint64_t *offset)
+{
+	struct file_entry *e;
+	uint64_t need = sizeof(*e) + SPA_ROUND_UP_N((uint64_t)size, 8);
+	int res;
+
+	if (need > CHUNK_SIZE - HEADER_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (pf->pos + need > CHUNK_SIZE) {
+		if (CHUNK_SIZE - pf->pos >= sizeof(*e)) {
+			e = SPA_PTROFF(pf->data, pf->pos, struct file_entry);
+			e->type = ENTRY_PAD;
+			e->size = CHUNK_SIZE - pf->pos - sizeof(*e);
+			e->time = time;
+		}
+		if ((res = map_chunk(pf, pf->offset + CHUNK_SIZE)) < 0) {
+			errno = -res;
+			return NULL;
+		}
+	}
+	*offset = pf->offset + pf->pos;
+
+	e = SPA_PTROFF(pf->data, pf->pos, struct file_entry);
+	e->size = size;
+	e->time = time;
+	e->type = type;
+	pf->pos += need;
+
+	return SPA_PTROFF(e, sizeof(*e), void);
+}
+
+static int write_record(struct profiler_file *pf, uint64_t time,
+		const struct pw_profiler_record *r)
+{
+	struct file_record *f;
+	uint32_t i, n_followers;
+	uint64_t offset, base = r->driver.signal_time;
+
+	n_followers = SPA_MIN(r->n_followers, (uint32_t)PROFILER_FILE_MAX_FOLLOWERS);
+
+	f = add_entry(pf, ENTRY_RECORD, time,
+			sizeof(*f) + n_followers * sizeof(struct file_block), &offset);
+	if (f == NULL)
+		return -errno;
+
+	f->count = r->info.count;
+	memcpy(f->cpu_load, r->info.cpu_load, sizeof(f->cpu_load));
+	f->xrun_count = r->info.xrun_count;
+	f->nsec = r->info.clock.nsec;
+	f->position = r->info.clock.position;
+	f->duration = r->info.clock.duration;
+	f->delay = r->info.clock.delay;
+	f->rate_diff = r->info.clock.rate_diff;
+	f->clock_id = r->info.clock.id;
+	f->rate = r->info.clock.rate.denom;
+	f->prev_signal_time = r->driver.prev_signal_time;
+	f->signal_time = base;
+	block_to_file(&f->driver, &r->driver, base);
+	f->n_followers = n_followers;
+	f->padding = 0;
+	for (i = 0; i < n_followers; i++)
+		block_to_file(&f->followers[i], &r->followers[i], base);
+
+	if (pf->header.n_records % SYNC_INTERVAL == 0) {
+		struct file_sync *s = pw_array_add(&pf->sync_array, sizeof(*s));
+		if (s == NULL)
+			return -errno;
+		s->time = time;
+		s->offset = offset;
+	}
+	if (pf->header.n_records == 0)
+		pf->header.start_time = time;
+	pf->header.end_time = time;
+	pf->header.n_records++;
+	return 0;
+}
+
+int profiler_file_write_event(struct profiler_file *pf, const struct profiler_file_event *event)
+{
+	uint64_t offset, *t;
+	size_t len;
+
+	if (pf->mode != 2)
+		return -EINVAL;
+
+	switch (event->type) {
+	case PROFILER_FILE_EVENT_RECORD:
+		return write_record(pf, event->time, event->record);
+	case PROFILER_FILE_EVENT_NODE:
+	{
+		struct file_node *f;
+		len = strlen(event->node.name) + 1;
+		if ((f = add_entry(pf, ENTRY_NODE, event->time, sizeof(*f) + len, &offset)) == NULL)
+			return -errno;
+		f->id = event->node.id;
+		memcpy(f->name, event->node.name, len);
+		break;
+	}
+	case PROFILER_FILE_EVENT_LINK:
+	{
+		struct file_link *f;
+		if ((f = add_entry(pf, ENTRY_LINK, event->time, sizeof(*f), &offset)) == NULL)
+			return -errno;
+		f->id = event->link.id;
+		f->output_node = event->link.output_node;
+		f->input_node = event->link.input_node;
+		f->padding = 0;
+		break;
+	}
+	case PROFILER_FILE_EVENT_REMOVE:
+	{
+		struct file_remove *f;
+		if ((f = add_entry(pf, ENTRY_REMOVE, event->time, sizeof(*f), &offset)) == NULL)
+			return -errno;
+		f->id = event->remove.id;
+		f->padding = 0;
+		break;
+	}
+	default:
+		return -EINVAL;
+	}
+	if ((t = pw_array_add(&pf->topology_array, sizeof(*t))) == NULL)
+		return -errno;
+	*t = offset;
+	return 0;
+}
@@ -0,0 +1,60 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+
+#include <spa/utils/defs.h>
+
+#include <pipewire/extensions/profiler.h>
+
+struct profiler_file;
+
+/* as many followers as the server puts in a record */
+#define PROFILER_FILE_MAX_FOLLOWERS	((PW_PROFILER_MAX_RECORD - sizeof(struct pw_profiler_record)) \
+					 / sizeof(struct pw_profiler_block))
+
+enum profiler_file_event_type {
+	PROFILER_FILE_EVENT_RECORD,	/* a driver cycle */
+	PROFILER_FILE_EVENT_NODE,	/* a node was added */
+	PROFILER_FILE_EVENT_LINK,	/* a link was added */
+	PROFILER_FILE_EVENT_REMOVE,	/* a node or link was removed */
+};
+
+struct profiler_file_event {
+	enum profiler_file_event_type type;
+	uint64_t time;			/* monotonic time in nsec */
+	union {
+		const struct pw_profiler_record *record;
+		struct {
+			uint32_t id;
+			const char *name;
+		} node;
+		struct {
+			uint32_t id;
+			uint32_t output_node;
+			uint32_t input_node;
+		} link;
+		struct {
+			uint32_t id;
+		} remove;
+	};
+};
+
+struct profiler_file_info {
+	uint64_t start_time;		/* time of the first record */
+	uint64_t end_time;		/* time of the last record */
+	uint64_t n_records;
+	bool indexed;			/* false when the index was rebuilt */
+};
+
+struct profiler_file *
+profiler_file_open(const char *filename, const char *mode, struct profiler_file_info *info);
+
+int profiler_file_close(struct profiler_file *pf);
+
+int profiler_file_seek(struct profiler_file *pf, uint64_t time);
+
+int profiler_file_read_event(struct profiler_file *pf, struct profiler_file_event *event);
+
+int profiler_file_write_event(struct profiler_file *pf, const struct profiler_file_event *event);
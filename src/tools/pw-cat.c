@@ -21,7 +21,9 @@
 #include <spa/param/audio/format-utils.h>
 #include <spa/param/audio/type-info.h>
 #include <spa/param/props.h>
+#include <spa/utils/atomic.h>
 #include <spa/utils/result.h>
+#include <spa/utils/ringbuffer.h>
 #include <spa/utils/string.h>
 #include <spa/utils/json.h>
 #include <spa/debug/types.h>
@@ -55,6 +57,10 @@
 #define DEFAULT_FORMAT		"s16"
 #define DEFAULT_VOLUME		1.0
 #define DEFAULT_QUALITY		4
+#define DEFAULT_IO_BUFFER	1000
+
+#define IO_CHUNK_FRAMES		4096u
+#define MAX_TRACKS		64
 
 enum mode {
 	mode_none,
@@ -129,6 +135,23 @@ struct data {
 
 	fill_fn fill;
 
+	/* the file is read and written in the I/O thread, the process
+	 * callback only uses the ringbuffer */
+	unsigned int io_buffer;
+	struct {
+		struct pw_thread_loop *loop;
+		struct spa_source *event;
+		fill_fn fill;
+		struct spa_ringbuffer ring;
+		uint8_t *buffer;
+		uint32_t size;
+		uint8_t *tmp;
+		int eof;
+		uint32_t xruns;
+		uint32_t xrun_frames;
+		uint32_t reported;
+	} io;
+
 	struct spa_io_position *position;
 	bool drained;
 	uint64_t clock_time;
@@ -939,6 +962,8 @@ enum {
 	OPT_CHANNELMAP,
 	OPT_FORMAT,
 	OPT_VOLUME,
+	OPT_IO_BUFFER,
+	OPT_TRACK,
 };
 
 static const struct option long_options[] = {
@@ -965,6 +990,8 @@ static const struct option long_options[] = {
 	{ "format",		required_argument, NULL, OPT_FORMAT },
 	{ "volume",		required_argument, NULL, OPT_VOLUME },
 	{ "quality",		required_argument, NULL, 'q' },
+	{ "io-buffer",		required_argument, NULL, OPT_IO_BUFFER },
+	{ "track",		required_argument, NULL, OPT_TRACK },
 
 	{ NULL, 0, NULL, 0 }
 };
@@ -1009,12 +1036,17 @@ static void show_usage(const char *name, bool is_error)
              "      --format                          Sample format %s (req. for rec) (default %s)\n"
 	     "      --volume                          Stream volume 0-1.0 (default %.3f)\n"
 	     "  -q  --quality                         Resampler quality (0 - 15) (default %d)\n"
+	     "      --io-buffer                       Size in ms of the buffer between the file\n"
+	     "                                          and the stream, 0 disables (default %d)\n"
+	     "      --track                           Record <target>=<file> as another track,\n"
+	     "                                          can be given multiple times\n"
 	     "\n"),
 	     DEFAULT_RATE,
 	     DEFAULT_CHANNELS,
 	     STR_FMTS, DEFAULT_FORMAT,
 	     DEFAULT_VOLUME,
-	     DEFAULT_QUALITY);
+	     DEFAULT_QUALITY,
+	     DEFAULT_IO_BUFFER);
 
 	if (spa_streq(name, "pw-cat")) {
 		fputs(
@@ -1497,6 +1529,188 @@ static int setup_sndfile(struct data *data)
 	return 0;
 }
 
+static inline void io_xrun(struct data *d, uint32_t n_frames)
+{
+	SPA_ATOMIC_STORE(d->io.xrun_frames, d->io.xrun_frames + n_frames);
+	SPA_ATOMIC_INC(d->io.xruns);
+}
+
+static void io_report_xruns(struct data *d)
+{
+	uint32_t xruns = SPA_ATOMIC_LOAD(d->io.xruns);
+
+	if (xruns == d->io.reported)
+		return;
+
+	fprintf(stderr, "%s: %u %s, %u frames %s in total\n", d->filename,
+			xruns - d->io.reported,
+			d->mode == mode_playback ? "underruns" : "overruns",
+			SPA_ATOMIC_LOAD(d->io.xrun_frames),
+			d->mode == mode_playback ? "missing" : "dropped");
+	d->io.reported = xruns;
+}
+
+/* called from the I/O thread, read from the file until the ringbuffer is full */
+static void io_playback_refill(struct data *d)
+{
+	uint32_t index, avail, n_frames;
+	bool null_frame = false;
+	int n;
+
+	while (!d->io.eof) {
+		avail = d->io.size - spa_ringbuffer_get_write_index(&d->io.ring, &index);
+		n_frames = SPA_MIN(avail / d->stride, IO_CHUNK_FRAMES);
+		if (n_frames == 0)
+			break;
+
+		if ((n = d->io.fill(d, d->io.tmp, n_frames, &null_frame)) <= 0) {
+			/* after the last data is in the ringbuffer */
+			SPA_ATOMIC_STORE(d->io.eof, true);
+			break;
+		}
+		spa_ringbuffer_write_data(&d->io.ring, d->io.buffer, d->io.size,
+				index & (d->io.size - 1), d->io.tmp, n * d->stride);
+		spa_ringbuffer_write_update(&d->io.ring, index + n * d->stride);
+	}
+}
+
+/* called from the I/O thread, write everything in the ringbuffer to the file */
+static void io_record_flush(struct data *d)
+{
+	uint32_t index, avail, n_frames;
+	bool null_frame = false;
+
+	while (true) {
+		avail = spa_ringbuffer_get_read_index(&d->io.ring, &index);
+		n_frames = SPA_MIN(avail / d->stride, IO_CHUNK_FRAMES);
+		if (n_frames == 0)
+			break;
+
+		spa_ringbuffer_read_data(&d->io.ring, d->io.buffer, d->io.size,
+				index & (d->io.size - 1), d->io.tmp, n_frames * d->stride);
+		spa_ringbuffer_read_update(&d->io.ring, index + n_frames * d->stride);
+
+		if (d->io.fill(d, d->io.tmp, n_frames, &null_frame) < (int)n_frames)
+			fprintf(stderr, "%s: write error: %s\n", d->filename,
+					sf_strerror(d->file));
+	}
+}
+
+static void on_io_event(void *userdata, uint64_t count)
+{
+	struct data *d = userdata;
+
+	if (d->mode == mode_playback)
+		io_playback_refill(d);
+	else
+		io_record_flush(d);
+
+	io_report_xruns(d);
+}
+
+static int io_playback_fill(struct data *d, void *dest, unsigned int n_frames, bool *null_frame)
+{
+	uint32_t index, avail, n;
+	bool eof;
+
+	/* load eof first, all data is in the ringbuffer when it is set */
+	eof = SPA_ATOMIC_LOAD(d->io.eof);
+	avail = spa_ringbuffer_get_read_index(&d->io.ring, &index);
+
+	n = SPA_MIN(n_frames, avail / d->stride);
+	if (n < n_frames && !eof) {
+		io_xrun(d, n_frames - n);
+		/* keep streaming, this is not the end of the file */
+		if (n == 0)
+			*null_frame = true;
+	}
+	if (n > 0) {
+		spa_ringbuffer_read_data(&d->io.ring, d->io.buffer, d->io.size,
+				index & (d->io.size - 1), dest, n * d->stride);
+		spa_ringbuffer_read_update(&d->io.ring, index + n * d->stride);
+	}
+	if (!eof && avail - n * d->stride < d->io.size / 2)
+		pw_loop_signal_event(pw_thread_loop_get_loop(d->io.loop), d->io.event);
+
+	return n;
+}
+
+static int io_record_fill(struct data *d, void *src, unsigned int n_frames, bool *null_frame)
+{
+	uint32_t index, filled, n;
+
+	filled = spa_ringbuffer_get_write_index(&d->io.ring, &index);
+
+	n = SPA_MIN(n_frames, (d->io.size - filled) / d->stride);
+	if (n < n_frames)
+		io_xrun(d, n_frames - n);
+	if (n > 0) {
+		spa_ringbuffer_write_data(&d->io.ring, d->io.buffer, d->io.size,
+				index & (d->io.size - 1), src, n * d->stride);
+		spa_ringbuffer_write_update(&d->io.ring, index + n * d->stride);
+	}
+	if (filled + n * d->stride >= d->io.size / 8)
+		pw_loop_signal_event(pw_thread_loop_get_loop(d->io.loop), d->io.event);
+
+	return n;
+}
+
+static int setup_io(struct data *data, struct pw_thread_loop *loop)
+{
+	uint64_t need;
+	uint32_t size = 1;
+
+	need = (uint64_t)data->rate * data->stride * data->io_buffer / 1000;
+	need = SPA_MAX(need, 2ull * IO_CHUNK_FRAMES * data->stride);
+	while (size < need) {
+		if (size >= (1u << 30))
+			return -EINVAL;
+		size <<= 1;
+	}
+
+	data->io.size = size;
+	data->io.buffer = calloc(1, size);
+	data->io.tmp = calloc(IO_CHUNK_FRAMES, data->stride);
+	if (data->io.buffer == NULL || data->io.tmp == NULL)
+		return -errno;
+
+	spa_ringbuffer_init(&data->io.ring);
+	data->io.fill = data->fill;
+	data->fill = data->mode == mode_playback ? io_playback_fill : io_record_fill;
+
+	/* have the start of the file ready before the stream starts */
+	if (data->mode == mode_playback)
+		io_playback_refill(data);
+
+	data->io.loop = loop;
+	pw_thread_loop_lock(loop);
+	data->io.event = pw_loop_add_event(pw_thread_loop_get_loop(loop),
+			on_io_event, data);
+	pw_thread_loop_unlock(loop);
+	if (data->io.event == NULL)
+		return -errno;
+
+	if (data->verbose)
+		printf("I/O: %u bytes ringbuffer (%.3fs)\n", size,
+				(double)size / data->stride / data->rate);
+	return 0;
+}
+
+/* called with the I/O thread stopped */
+static void cleanup_io(struct data *data)
+{
+	if (data->io.event) {
+		if (data->mode == mode_record)
+			io_record_flush(data);
+		io_report_xruns(data);
+		pw_loop_destroy_source(pw_thread_loop_get_loop(data->io.loop), data->io.event);
+		data->io.event = NULL;
+	}
+	free(data->io.buffer);
+	free(data->io.tmp);
+	data->io.buffer = data->io.tmp = NULL;
+}
+
 static int setup_properties(struct data *data)
 {
 	const char *s;
@@ -1565,13 +1779,162 @@ static int setup_properties(struct data *data)
 	return 0;
 }
 
-int main(int argc, char *argv[])
+static int setup_track(struct data *data, const char *prog, enum pw_stream_flags flags,
+		struct pw_thread_loop *io_loop)
 {
-	struct data data = { 0, };
-	struct pw_loop *l;
 	const struct spa_pod *params[1];
 	uint8_t buffer[1024];
 	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	int ret;
+
+	if (pw_properties_get(data->props, PW_KEY_MEDIA_FILENAME) == NULL)
+		pw_properties_set(data->props, PW_KEY_MEDIA_FILENAME, data->filename);
+	if (pw_properties_get(data->props, PW_KEY_MEDIA_NAME) == NULL)
+		pw_properties_set(data->props, PW_KEY_MEDIA_NAME, data->filename);
+	if (pw_properties_get(data->props, PW_KEY_TARGET_OBJECT) == NULL)
+		pw_properties_set(data->props, PW_KEY_TARGET_OBJECT, data->target);
+
+	if (spa_streq(data->filename, "-")) {
+		ret = setup_pipe(data);
+	} else {
+		switch (data->data_type) {
+		case TYPE_PCM:
+			ret = setup_sndfile(data);
+			break;
+		case TYPE_MIDI:
+			ret = setup_midifile(data);
+			break;
+		case TYPE_DSD:
+			ret = setup_dsffile(data);
+			break;
+#ifdef HAVE_PW_CAT_FFMPEG_INTEGRATION
+		case TYPE_ENCODED:
+			ret = setup_encodedfile(data);
+			break;
+#endif
+		default:
+			ret = -ENOTSUP;
+			break;
+		}
+	}
+	if (ret < 0) {
+		fprintf(stderr, "error: open failed: %s\n", spa_strerror(ret));
+		return ret == -EIO ? ret : -EINVAL;
+	}
+	ret = setup_properties(data);
+
+	switch (data->data_type) {
+#ifdef HAVE_PW_CAT_FFMPEG_INTEGRATION
+	case TYPE_ENCODED:
+	{
+		struct spa_audio_info info;
+
+		spa_zero(info);
+		info.media_type = SPA_MEDIA_TYPE_audio;
+
+		ret = av_codec_params_to_audio_info(data, data->encoded.audio_stream->codecpar, &info);
+		if (ret < 0)
+			return -EIO;
+		params[0] = spa_format_audio_build(&b, SPA_PARAM_EnumFormat, &info);
+		break;
+	}
+#endif
+	case TYPE_PCM:
+	{
+		struct spa_audio_info_raw info;
+		info = SPA_AUDIO_INFO_RAW_INIT(
+			.flags = data->channelmap.n_channels ? 0 : SPA_AUDIO_FLAG_UNPOSITIONED,
+			.format = data->spa_format,
+			.rate = data->rate,
+			.channels = data->channels);
+
+		if (data->channelmap.n_channels)
+			memcpy(info.position, data->channelmap.channels, data->channels * sizeof(int));
+
+		params[0] = spa_format_audio_raw_build(&b, SPA_PARAM_EnumFormat, &info);
+		break;
+	}
+	case TYPE_MIDI:
+		params[0] = spa_pod_builder_add_object(&b,
+				SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
+				SPA_FORMAT_mediaType,		SPA_POD_Id(SPA_MEDIA_TYPE_application),
+				SPA_FORMAT_mediaSubtype,	SPA_POD_Id(SPA_MEDIA_SUBTYPE_control));
+
+		pw_properties_set(data->props, PW_KEY_FORMAT_DSP, "8 bit raw midi");
+		break;
+	case TYPE_DSD:
+	{
+		struct spa_audio_info_dsd info;
+
+		spa_zero(info);
+		info.channels = data->dsf.info.channels;
+		info.rate = data->dsf.info.rate / 8;
+
+		SPA_FOR_EACH_ELEMENT_VAR(dsd_layouts, i) {
+			if (i->type != data->dsf.info.channel_type)
+				continue;
+			info.channels = i->info.n_channels;
+			memcpy(info.position, i->info.position,
+					info.channels * sizeof(uint32_t));
+		}
+		params[0] = spa_format_audio_dsd_build(&b, SPA_PARAM_EnumFormat, &info);
+		break;
+	}
+	default:
+		return -ENOTSUP;
+	}
+
+	if (io_loop != NULL && (ret = setup_io(data, io_loop)) < 0) {
+		fprintf(stderr, "error: can't set up I/O: %s\n", spa_strerror(ret));
+		return ret;
+	}
+
+	data->stream = pw_stream_new(data->core, prog, data->props);
+	data->props = NULL;
+
+	if (data->stream == NULL) {
+		fprintf(stderr, "error: failed to create stream: %m\n");
+		return -errno;
+	}
+	pw_stream_add_listener(data->stream, &data->stream_listener, &stream_events, data);
+
+	if (data->verbose)
+		printf("connecting %s stream; target=%s\n",
+				data->mode == mode_playback ? "playback" : "record",
+				data->target);
+
+	ret = pw_stream_connect(data->stream,
+			  data->mode == mode_playback ? PW_DIRECTION_OUTPUT : PW_DIRECTION_INPUT,
+			  PW_ID_ANY,
+			  flags |
+			  PW_STREAM_FLAG_MAP_BUFFERS,
+			  params, 1);
+	if (ret < 0) {
+		fprintf(stderr, "error: failed connect: %s\n", spa_strerror(ret));
+		return ret;
+	}
+	return 0;
+}
+
+static void cleanup_stream(struct data *data)
+{
+	if (data->stream) {
+		spa_hook_remove(&data->stream_listener);
+		pw_stream_destroy(data->stream);
+		data->stream = NULL;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0, };
+	struct pw_loop *l;
+	struct pw_thread_loop *io_loop = NULL;
+	struct {
+		const char *spec;
+		struct data *data;
+	} tracks[MAX_TRACKS];
+	uint32_t i, n_tracks = 0;
 	const char *prog;
 	int exit_code = EXIT_FAILURE, c, ret;
 	enum pw_stream_flags flags = 0;
@@ -1618,6 +1981,7 @@ int main(int argc, char *argv[])
 	/* negative means no volume adjustment */
 	data.volume = -1.0;
 	data.quality = -1;
+	data.io_buffer = DEFAULT_IO_BUFFER;
 	data.props = pw_properties_new(
 			PW_KEY_APP_NAME, prog,
 			PW_KEY_NODE_NAME, prog,
@@ -1740,6 +2104,24 @@ int main(int argc, char *argv[])
 		case OPT_VOLUME:
 			data.volume = atof(optarg);
 			break;
+
+		case OPT_IO_BUFFER:
+			ret = atoi(optarg);
+			if (ret < 0) {
+				fprintf(stderr, "error: bad io-buffer %d\n", ret);
+				goto error_usage;
+			}
+			data.io_buffer = (unsigned int)ret;
+			break;
+
+		case OPT_TRACK:
+			if (n_tracks >= MAX_TRACKS) {
+				fprintf(stderr, "error: too many tracks\n");
+				goto error_usage;
+			}
+			tracks[n_tracks].spec = optarg;
+			tracks[n_tracks++].data = NULL;
+			break;
 		default:
 			goto error_usage;
 		}
@@ -1799,12 +2181,35 @@ int main(int argc, char *argv[])
 		pw_properties_set(data.props, PW_KEY_MEDIA_CATEGORY, data.media_category);
 	if (pw_properties_get(data.props, PW_KEY_MEDIA_ROLE) == NULL)
 		pw_properties_set(data.props, PW_KEY_MEDIA_ROLE, data.media_role);
-	if (pw_properties_get(data.props, PW_KEY_MEDIA_FILENAME) == NULL)
-		pw_properties_set(data.props, PW_KEY_MEDIA_FILENAME, data.filename);
-	if (pw_properties_get(data.props, PW_KEY_MEDIA_NAME) == NULL)
-		pw_properties_set(data.props, PW_KEY_MEDIA_NAME, data.filename);
-	if (pw_properties_get(data.props, PW_KEY_TARGET_OBJECT) == NULL)
-		pw_properties_set(data.props, PW_KEY_TARGET_OBJECT, data.target);
+
+	/* every track records one target into its own file */
+	for (i = 0; i < n_tracks; i++) {
+		struct data *t;
+		const char *sep;
+
+		if (data.mode != mode_record || data.data_type != TYPE_PCM) {
+			fprintf(stderr, "error: tracks can only be used to record PCM\n");
+			goto error_usage;
+		}
+		if ((sep = strchr(tracks[i].spec, '=')) == NULL || sep[1] == '\0') {
+			fprintf(stderr, "error: bad track \"%s\", expected <target>=<file>\n",
+					tracks[i].spec);
+			goto error_usage;
+		}
+		if ((t = calloc(1, sizeof(*t))) == NULL) {
+			fprintf(stderr, "error: can't allocate track: %m\n");
+			goto error_no_props;
+		}
+		*t = data;
+		t->target = strndup(tracks[i].spec, sep - tracks[i].spec);
+		t->filename = sep + 1;
+		t->props = pw_properties_copy(data.props);
+		tracks[i].data = t;
+		if (t->target == NULL || t->props == NULL) {
+			fprintf(stderr, "error: can't allocate track: %m\n");
+			goto error_no_props;
+		}
+	}
 
 	/* make a main loop. If you already have another main loop, you can add
 	 * the fd of this pipewire mainloop to it. */
@@ -1839,127 +2244,30 @@ int main(int argc, char *argv[])
 	}
 	pw_core_add_listener(data.core, &data.core_listener, &core_events, &data);
 
-	if (spa_streq(data.filename, "-")) {
-		ret = setup_pipe(&data);
-	} else {
-		switch (data.data_type) {
-		case TYPE_PCM:
-			ret = setup_sndfile(&data);
-			break;
-		case TYPE_MIDI:
-			ret = setup_midifile(&data);
-			break;
-		case TYPE_DSD:
-			ret = setup_dsffile(&data);
-			break;
-#ifdef HAVE_PW_CAT_FFMPEG_INTEGRATION
-		case TYPE_ENCODED:
-			ret = setup_encodedfile(&data);
-			break;
-#endif
-		default:
-			ret = -ENOTSUP;
-			break;
-		}
-	}
-	if (ret < 0) {
-		fprintf(stderr, "error: open failed: %s\n", spa_strerror(ret));
-		switch (ret) {
-		case -EIO:
-			goto error_bad_file;
-		case -EINVAL:
-		default:
-			goto error_usage;
-		}
-	}
-	ret = setup_properties(&data);
-
-	switch (data.data_type) {
-#ifdef HAVE_PW_CAT_FFMPEG_INTEGRATION
-	case TYPE_ENCODED:
-	{
-		struct spa_audio_info info;
-
-		spa_zero(info);
-		info.media_type = SPA_MEDIA_TYPE_audio;
-
-		ret = av_codec_params_to_audio_info(&data, data.encoded.audio_stream->codecpar, &info);
-		if (ret < 0)
-			goto error_bad_file;
-		params[0] = spa_format_audio_build(&b, SPA_PARAM_EnumFormat, &info);
-		break;
-	}
-#endif
-	case TYPE_PCM:
-	{
-		struct spa_audio_info_raw info;
-		info = SPA_AUDIO_INFO_RAW_INIT(
-			.flags = data.channelmap.n_channels ? 0 : SPA_AUDIO_FLAG_UNPOSITIONED,
-			.format = data.spa_format,
-			.rate = data.rate,
-			.channels = data.channels);
-
-		if (data.channelmap.n_channels)
-			memcpy(info.position, data.channelmap.channels, data.channels * sizeof(int));
-
-		params[0] = spa_format_audio_raw_build(&b, SPA_PARAM_EnumFormat, &info);
-		break;
-	}
-	case TYPE_MIDI:
-		params[0] = spa_pod_builder_add_object(&b,
-				SPA_TYPE_OBJECT_Format, SPA_PARAM_EnumFormat,
-				SPA_FORMAT_mediaType,		SPA_POD_Id(SPA_MEDIA_TYPE_application),
-				SPA_FORMAT_mediaSubtype,	SPA_POD_Id(SPA_MEDIA_SUBTYPE_control));
-
-		pw_properties_set(data.props, PW_KEY_FORMAT_DSP, "8 bit raw midi");
-		break;
-	case TYPE_DSD:
-	{
-		struct spa_audio_info_dsd info;
-
-		spa_zero(info);
-		info.channels = data.dsf.info.channels;
-		info.rate = data.dsf.info.rate / 8;
-
-		SPA_FOR_EACH_ELEMENT_VAR(dsd_layouts, i) {
-			if (i->type != data.dsf.info.channel_type)
-				continue;
-			info.channels = i->info.n_channels;
-			memcpy(info.position, i->info.position,
-					info.channels * sizeof(uint32_t));
+	/* sound files are read and written from a separate thread */
+	if (data.io_buffer > 0 && data.data_type == TYPE_PCM &&
+	    !spa_streq(data.filename, "-")) {
+		io_loop = pw_thread_loop_new("pw-cat-io", NULL);
+		if (io_loop == NULL || (ret = pw_thread_loop_start(io_loop)) < 0) {
+			fprintf(stderr, "error: can't start I/O thread: %m\n");
+			goto error_no_stream;
 		}
-		params[0] = spa_format_audio_dsd_build(&b, SPA_PARAM_EnumFormat, &info);
-		break;
-	}
-	}
-
-	data.stream = pw_stream_new(data.core, prog, data.props);
-	data.props = NULL;
-
-	if (data.stream == NULL) {
-		fprintf(stderr, "error: failed to create stream: %m\n");
-		goto error_no_stream;
 	}
-	pw_stream_add_listener(data.stream, &data.stream_listener, &stream_events, &data);
-
-	if (data.verbose)
-		printf("connecting %s stream; target=%s\n",
-				data.mode == mode_playback ? "playback" : "record",
-				data.target);
 
 	if (data.verbose)
 		data.timer = pw_loop_add_timer(l, do_print_delay, &data);
 
-	ret = pw_stream_connect(data.stream,
-			  data.mode == mode_playback ? PW_DIRECTION_OUTPUT : PW_DIRECTION_INPUT,
-			  PW_ID_ANY,
-			  flags |
-			  PW_STREAM_FLAG_MAP_BUFFERS,
-			  params, 1);
-	if (ret < 0) {
-		fprintf(stderr, "error: failed connect: %s\n", spa_strerror(ret));
-		goto error_connect_fail;
+	ret = setup_track(&data, prog, flags, io_loop);
+	for (i = 0; i < n_tracks && ret >= 0; i++) {
+		tracks[i].data->loop = data.loop;
+		tracks[i].data->core = data.core;
+		tracks[i].data->timer = data.timer;
+		ret = setup_track(tracks[i].data, prog, flags, io_loop);
 	}
+	if (ret == -EINVAL)
+		goto error_usage;
+	else if (ret < 0)
+		goto error_no_stream;
 
 	if (data.verbose) {
 		const struct pw_properties *props;
@@ -1983,13 +2291,19 @@ int main(int argc, char *argv[])
 	if (data.drained)
 		exit_code = EXIT_SUCCESS;
 
-error_connect_fail:
-	if (data.stream) {
-		spa_hook_remove(&data.stream_listener);
-		pw_stream_destroy(data.stream);
-	}
 error_no_stream:
-error_bad_file:
+	cleanup_stream(&data);
+	for (i = 0; i < n_tracks; i++)
+		if (tracks[i].data)
+			cleanup_stream(tracks[i].data);
+	/* write out what is left in the ringbuffers */
+	if (io_loop)
+		pw_thread_loop_stop(io_loop);
+	cleanup_io(&data);
+	for (i = 0; i < n_tracks; i++)
+		if (tracks[i].data)
+			cleanup_io(tracks[i].data);
+
 	spa_hook_remove(&data.core_listener);
 	pw_core_disconnect(data.core);
 error_ctx_connect_failed:
@@ -2009,6 +2323,18 @@ error_no_main_loop:
 	if (data.encoded.format_context)
 		avformat_close_input(&data.encoded.format_context);
 #endif
+	for (i = 0; i < n_tracks; i++) {
+		struct data *t = tracks[i].data;
+		if (t == NULL)
+			continue;
+		pw_properties_free(t->props);
+		if (t->file)
+			sf_close(t->file);
+		free((char*)t->target);
+		free(t);
+	}
+	if (io_loop)
+		pw_thread_loop_destroy(io_loop);
 	pw_deinit();
 	return exit_code;
 
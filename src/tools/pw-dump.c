@@ -12,6 +12,7 @@
 #include <math.h>
 #include <fnmatch.h>
 #include <locale.h>
+#include <sys/mman.h>
 
 #if !defined(FNM_EXTMATCH)
 #define FNM_EXTMATCH 0
@@ -26,7 +27,9 @@
 #include <spa/utils/string.h>
 
 #include <pipewire/pipewire.h>
+#include <pipewire/impl.h>
 #include <pipewire/extensions/metadata.h>
+#include <pipewire/extensions/profiler.h>
 
 #define INDENT 2
 
@@ -64,6 +67,7 @@ struct data {
 	uint32_t state;
 
 	unsigned int monitor:1;
+	unsigned int profiler:1;
 };
 
 struct param {
@@ -1257,6 +1261,156 @@ static const struct class metadata_class = {
 	.name_key = PW_KEY_METADATA_NAME,
 };
 
+/* profiler */
+struct profiler_info {
+	struct pw_profiler_shm *shm;
+	uint32_t size;
+};
+
+static void put_stats(struct data *d, const char *key, const struct pw_profiler_stats *s)
+{
+	put_begin(d, key, "{", STATE_SIMPLE);
+	put_int(d, "count", s->count);
+	put_int(d, "p50", s->p50);
+	put_int(d, "p99", s->p99);
+	put_int(d, "max", s->max);
+	put_end(d, "}", STATE_SIMPLE);
+}
+
+static void profiler_dump(struct object *o)
+{
+	struct data *d = o->data;
+	struct profiler_info *i = o->info;
+	struct pw_profiler_shm *shm = i ? i->shm : NULL;
+	const struct pw_profiler_node *nodes;
+	struct pw_profiler_node n;
+	struct pw_profiler_xrun x;
+	uint32_t j, k, index, n_xruns;
+
+	put_dict(d, "props", &o->props->dict);
+	if (shm == NULL)
+		return;
+
+	put_begin(d, "info", "{", 0);
+	put_int(d, "window", shm->window);
+	put_begin(d, "nodes", "[", 0);
+	nodes = pw_profiler_shm_nodes(shm);
+	for (j = 0; j < shm->n_nodes; j++) {
+		uint32_t id = SPA_ATOMIC_LOAD(nodes[j].id);
+		if (id == SPA_ID_INVALID ||
+		    pw_profiler_shm_get_node(shm, id, &n) < 0)
+			continue;
+		n.name[sizeof(n.name) - 1] = '\0';
+		put_begin(d, NULL, "{", 0);
+		put_int(d, "id", n.id);
+		put_value(d, "name", n.name);
+		put_int(d, "driver-id", n.driver_id);
+		put_int(d, "xrun-count", n.last.xrun_count);
+		put_stats(d, "wait", &n.wakeup_stats);
+		put_stats(d, "busy", &n.process_stats);
+		put_end(d, "}", 0);
+	}
+	put_end(d, "]", 0);
+
+	put_begin(d, "xruns", "[", 0);
+	index = SPA_ATOMIC_LOAD(shm->xrun_index);
+	n_xruns = SPA_MIN(index, shm->n_xruns);
+	for (j = index - n_xruns; j != index; j++) {
+		if (pw_profiler_shm_get_xrun(shm, j, &x) < 0)
+			continue;
+		put_begin(d, NULL, "{", 0);
+		put_int(d, "index", x.index);
+		put_int(d, "driver-id", x.driver_id);
+		put_int(d, "time", x.time);
+		put_int(d, "duration", x.duration);
+		put_int(d, "period", x.period);
+		put_begin(d, "critical-path", "[", 0);
+		for (k = 0; k < x.n_path; k++) {
+			const struct pw_profiler_path *p = &x.path[k];
+			put_begin(d, NULL, "{", STATE_SIMPLE);
+			put_int(d, "id", p->id);
+			put_value(d, "busy", p->flags & PW_PROFILER_PATH_FLAG_BUSY ?
+					"true" : "false");
+			put_int(d, "signal", p->signal);
+			put_int(d, "wait", p->wakeup);
+			put_int(d, "process", p->process);
+			put_end(d, "}", STATE_SIMPLE);
+		}
+		put_end(d, "]", 0);
+		put_end(d, "}", 0);
+	}
+	put_end(d, "]", 0);
+	put_end(d, "}", 0);
+}
+
+static struct profiler_info *profiler_get_info(struct object *o)
+{
+	if (o->info == NULL) {
+		o->info = calloc(1, sizeof(struct profiler_info));
+		if (o->info != NULL) {
+			o->changed++;
+			core_sync(o->data);
+		}
+	}
+	return o->info;
+}
+
+static void profiler_event_profile(void *data, const struct spa_pod *pod)
+{
+	/* the server has no shared memory, only dump the props */
+	profiler_get_info(data);
+}
+
+static void profiler_event_shm(void *data, int fd, uint32_t size)
+{
+	struct object *o = data;
+	struct profiler_info *i;
+	void *shm;
+
+	shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		pw_log_error("can't map profiler memory: %m");
+		return;
+	}
+	if (!pw_profiler_shm_check(shm, size) ||
+	    (i = profiler_get_info(o)) == NULL) {
+		munmap(shm, size);
+		return;
+	}
+	if (i->shm != NULL)
+		munmap(i->shm, i->size);
+	i->shm = shm;
+	i->size = size;
+	o->changed++;
+}
+
+static const struct pw_profiler_events profiler_events = {
+	PW_VERSION_PROFILER_EVENTS,
+	.profile = profiler_event_profile,
+	.shm = profiler_event_shm,
+};
+
+static void profiler_destroy(struct object *o)
+{
+	struct profiler_info *i = o->info;
+	if (i) {
+		if (i->shm != NULL)
+			munmap(i->shm, i->size);
+		free(i);
+		o->info = NULL;
+	}
+}
+
+static const struct class profiler_class = {
+	.type = PW_TYPE_INTERFACE_Profiler,
+	.version = PW_VERSION_PROFILER,
+	.events = &profiler_events,
+	.destroy = profiler_destroy,
+	.dump = profiler_dump,
+	.name_key = PW_KEY_PROFILER_NAME,
+};
+
 static const struct class *classes[] =
 {
 	&core_class,
@@ -1268,6 +1422,7 @@ static const struct class *classes[] =
 	&port_class,
 	&link_class,
 	&metadata_class,
+	&profiler_class,
 };
 
 static const struct class *find_class(const char *type, uint32_t version)
@@ -1331,6 +1486,9 @@ static void registry_event_global(void *data, uint32_t id,
 	spa_list_init(&o->data_list);
 
 	o->class = find_class(type, version);
+	/* binding the profiler enables profiling on the server */
+	if (o->class == &profiler_class && !d->profiler)
+		o->class = NULL;
 	if (o->class != NULL) {
 		o->proxy = pw_registry_bind(d->registry,
 				id, type, o->class->version, 0);
@@ -1515,6 +1673,7 @@ static void show_help(struct data *data, const char *name, bool error)
 		"      --version                         Show version\n"
 		"  -r, --remote                          Remote daemon name\n"
 		"  -m, --monitor                         monitor changes\n"
+		"  -P, --profiler                        include profiler data\n"
 		"  -N, --no-colors                       disable color output\n"
 		"  -C, --color[=WHEN]                    whether to enable color support. WHEN is `never`, `always`, or `auto`\n",
 		name);
@@ -1531,6 +1690,7 @@ int main(int argc, char *argv[])
 		{ "version",	no_argument,		NULL, 'V' },
 		{ "remote",	required_argument,	NULL, 'r' },
 		{ "monitor",	no_argument,		NULL, 'm' },
+		{ "profiler",	no_argument,		NULL, 'P' },
 		{ "no-colors",	no_argument,		NULL, 'N' },
 		{ "color",	optional_argument,	NULL, 'C' },
 		{ NULL, 0, NULL, 0}
@@ -1545,7 +1705,7 @@ int main(int argc, char *argv[])
 		colors = true;
 	setlinebuf(data.out);
 
-	while ((c = getopt_long(argc, argv, "hVr:mNC", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "hVr:mPNC", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'h' :
 			show_help(&data, argv[0], false);
@@ -1564,6 +1724,9 @@ int main(int argc, char *argv[])
 		case 'm' :
 			data.monitor = true;
 			break;
+		case 'P' :
+			data.profiler = true;
+			break;
 		case 'N' :
 			colors = false;
 			break;
@@ -1606,6 +1769,10 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* for the profiler protocol extension */
+	if (data.profiler)
+		pw_context_load_module(data.context, PW_EXTENSION_MODULE_PROFILER, NULL, NULL);
+
 	data.core = pw_context_connect(data.context,
 			pw_properties_new(
 				PW_KEY_REMOTE_NAME, opt_remote,
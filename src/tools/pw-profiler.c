@@ -6,6 +6,9 @@
 #include <signal.h>
 #include <getopt.h>
 #include <locale.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #include <spa/utils/result.h>
 #include <spa/utils/string.h>
@@ -15,15 +18,30 @@
 #include <pipewire/impl.h>
 #include <pipewire/extensions/profiler.h>
 
+#include "profilerfile.h"
+
 #define MAX_NAME		128
 #define MAX_FOLLOWERS		64
 #define DEFAULT_FILENAME	"profiler.log"
+#define DEFAULT_THRESHOLD	100.0
 
 struct follower {
 	uint32_t id;
 	char name[MAX_NAME];
 };
 
+/* a node or link in a replayed trace */
+struct object {
+	struct spa_list link;
+	uint32_t id;
+	enum profiler_file_event_type type;
+	char name[MAX_NAME];
+	uint32_t output_node;
+	uint32_t input_node;
+	uint32_t xrun_count;
+	unsigned int xrun_valid:1;
+};
+
 struct data {
 	struct pw_main_loop *loop;
 	struct pw_context *context;
@@ -45,10 +63,28 @@ struct data {
 	struct spa_hook profiler_listener;
 	int check_profiler;
 
+	struct pw_profiler_shm *shm;
+	uint32_t shm_size;
+	uint32_t shm_index;
+	struct spa_source *timer;
+
 	uint32_t driver_id;
 
 	int n_followers;
 	struct follower followers[MAX_FOLLOWERS];
+
+	struct profiler_file *trace;
+	bool trace_warned;
+	bool followers_warned;
+
+	struct spa_list objects;
+	uint64_t start_time;
+	double threshold;
+	uint64_t n_cycles;
+	uint64_t n_reported;
+	uint64_t n_xruns;
+	double util_total;
+	double util_max;
 };
 
 struct measurement {
@@ -181,6 +217,7 @@ static void dump_point(struct data *d, struct point *point)
 	int i;
 	int64_t d1, d2;
 	int64_t delay, period_usecs;
+	double util;
 
 #define CLOCK_AS_USEC(cl,val) (val * (float)SPA_USEC_PER_SEC / (cl)->rate.denom)
 #define CLOCK_AS_SUSEC(cl,val) (val * (float)SPA_USEC_PER_SEC / ((cl)->rate.denom * (cl)->rate_diff))
@@ -190,6 +227,7 @@ static void dump_point(struct data *d, struct point *point)
 
 	d1 = (point->driver.signal - point->driver.prev_signal) / 1000;
 	d2 = (point->driver.finish - point->driver.signal) / 1000;
+	util = (d2 > 0 && period_usecs > 0) ? d2 * 100.0 / period_usecs : 0.0;
 
 	if (d1 > period_usecs * 1.3 ||
 	    d2 > period_usecs * 1.3)
@@ -218,7 +256,8 @@ static void dump_point(struct data *d, struct point *point)
 					point->follower[i].status);
 		}
 	}
-	fprintf(d->output, "\n");
+	/* quantum utilization in the last column */
+	fprintf(d->output, "%f\n", util);
 	if (d->count == 0) {
 		d->start_status = point->clock.nsec;
 		d->last_status = point->clock.nsec;
@@ -361,6 +400,24 @@ static void dump_scripts(struct data *d)
 			"unset output\n");
 		fclose(out);
 	}
+
+	out = fopen("Timing6.plot", "we");
+	if (out == NULL) {
+		pw_log_error("Can't open Timing6.plot: %m");
+	} else {
+		fprintf(out,
+			"set output 'Timing6.svg\n"
+			"set terminal svg\n"
+			"set grid\n"
+			"set title \"Quantum utilization\"\n"
+			"set xlabel \"audio cycles\"\n"
+			"set ylabel \"percent\"\n"
+			/* absent followers are blank fields, don't merge them */
+			"set datafile separator \"\\t\"\n"
+			"plot  \"%s\" using %d title \"Graph duration / quantum\" with lines \n"
+			"unset output\n", d->filename, 4 + (MAX_FOLLOWERS * 8) + 1);
+		fclose(out);
+	}
 	out = fopen("Timings.html", "we");
 	if (out == NULL) {
 		pw_log_error("Can't open Timings.html: %m");
@@ -384,6 +441,7 @@ static void dump_scripts(struct data *d)
 			"    <div class='center'><object class='center' type='image/svg+xml' data='Timing3.svg'>Timing3</object></div>"
 			"    <div class='center'><object class='center' type='image/svg+xml' data='Timing4.svg'>Timing4</object></div>"
 			"    <div class='center'><object class='center' type='image/svg+xml' data='Timing5.svg'>Timing5</object></div>"
+			"    <div class='center'><object class='center' type='image/svg+xml' data='Timing6.svg'>Timing6</object></div>"
 			"  </body>\n"
 			"</html>\n");
 		fclose(out);
@@ -398,7 +456,8 @@ static void dump_scripts(struct data *d)
 			"gnuplot Timing2.plot\n"
 			"gnuplot Timing3.plot\n"
 			"gnuplot Timing4.plot\n"
-			"gnuplot Timing5.plot\n");
+			"gnuplot Timing5.plot\n"
+			"gnuplot Timing6.plot\n");
 		fclose(out);
 	}
 	printf("run 'sh generate_timings.sh' and load Timings.html in a browser\n");
@@ -411,6 +470,11 @@ static void profiler_profile(void *data, const struct spa_pod *pod)
 	struct spa_pod_prop *p;
 	struct point point;
 
+	if (d->trace != NULL && !d->trace_warned) {
+		fprintf(stderr, "The server has no shared memory profiler, not writing a trace\n");
+		d->trace_warned = true;
+	}
+
 	SPA_POD_STRUCT_FOREACH(pod, o) {
 		int res = 0;
 		if (!spa_pod_is_object_type(o, SPA_TYPE_OBJECT_Profiler))
@@ -444,11 +508,350 @@ static void profiler_profile(void *data, const struct spa_pod *pod)
 	}
 }
 
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static struct object *find_object(struct data *d, uint32_t id)
+{
+	struct object *o;
+	spa_list_for_each(o, &d->objects, link) {
+		if (o->id == id)
+			return o;
+	}
+	return NULL;
+}
+
+static void free_object(struct object *o)
+{
+	spa_list_remove(&o->link);
+	free(o);
+}
+
+static const char *get_node_name(struct data *d, uint32_t id, struct pw_profiler_node *node)
+{
+	struct object *o;
+
+	if (d->shm != NULL)
+		return pw_profiler_shm_get_node(d->shm, id, node) >= 0 ? node->name : "";
+	if ((o = find_object(d, id)) != NULL)
+		return o->name;
+	return "";
+}
+
+static void copy_block(struct measurement *m, const struct pw_profiler_block *b)
+{
+	m->prev_signal = b->prev_signal_time;
+	m->signal = b->signal_time;
+	m->awake = b->awake_time;
+	m->finish = b->finish_time;
+	m->status = b->status;
+}
+
+static int process_record(struct data *d, const struct pw_profiler_record *r, struct point *point)
+{
+	struct pw_profiler_node node;
+	uint32_t i;
+	int idx;
+
+	point->count = r->info.count;
+	memcpy(point->cpu_load, r->info.cpu_load, sizeof(point->cpu_load));
+	point->clock = r->info.clock;
+
+	if (d->driver_id == 0) {
+		d->driver_id = r->driver.id;
+		printf("logging driver %u\n", r->driver.id);
+	}
+	else if (d->driver_id != r->driver.id)
+		return -1;
+
+	copy_block(&point->driver, &r->driver);
+
+	for (i = 0; i < r->n_followers; i++) {
+		const struct pw_profiler_block *b = &r->followers[i];
+		const char *name = get_node_name(d, b->id, &node);
+
+		if ((idx = find_follower(d, b->id, name)) < 0) {
+			if ((idx = add_follower(d, b->id, name)) < 0) {
+				if (!d->followers_warned)
+					fprintf(stderr, "more than %d followers, follower %u "
+							"(\"%s\") and later ones are not logged\n",
+							MAX_FOLLOWERS, b->id, name);
+				d->followers_warned = true;
+				continue;
+			}
+		}
+		copy_block(&point->follower[idx], b);
+	}
+	return 0;
+}
+
+static void on_shm_timeout(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+	uint8_t buffer[PW_PROFILER_MAX_RECORD] SPA_ALIGNED(8);
+	const struct pw_profiler_record *r;
+	struct point point;
+	int res;
+
+	while (true) {
+		res = pw_profiler_shm_read(d->shm, &d->shm_index, buffer, sizeof(buffer));
+		if (res == 0)
+			break;
+		if (res == -ENOSPC)
+			continue;
+		if (res < 0) {
+			printf("profiler records lost, restarting\n");
+			d->shm_index = pw_profiler_shm_read_start(d->shm);
+			break;
+		}
+		r = (const struct pw_profiler_record *)buffer;
+		if (sizeof(*r) + r->n_followers * sizeof(struct pw_profiler_block) > (uint32_t)res)
+			continue;
+
+		if (d->trace != NULL) {
+			struct profiler_file_event ev = {
+				.type = PROFILER_FILE_EVENT_RECORD,
+				.time = r->driver.signal_time,
+				.record = r,
+			};
+			if ((res = profiler_file_write_event(d->trace, &ev)) < 0)
+				pw_log_warn("can't write trace: %s", spa_strerror(res));
+		}
+		spa_zero(point);
+		if (process_record(d, r, &point) < 0)
+			continue;
+
+		dump_point(d, &point);
+	}
+}
+
+static void profiler_shm(void *data, int fd, uint32_t size)
+{
+	struct data *d = data;
+	struct pw_profiler_shm *shm;
+	struct pw_loop *l = pw_main_loop_get_loop(d->loop);
+	struct timespec value, interval;
+
+	shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		pw_log_error("can't map profiler memory: %m");
+		return;
+	}
+	if (!pw_profiler_shm_check(shm, size)) {
+		pw_log_error("unknown profiler memory %08x:%u", shm->magic, shm->version);
+		munmap(shm, size);
+		return;
+	}
+	if (d->shm != NULL)
+		munmap(d->shm, d->shm_size);
+	d->shm = shm;
+	d->shm_size = size;
+	d->shm_index = pw_profiler_shm_read_start(shm);
+
+	printf("Using shared memory profiler\n");
+
+	if (d->timer == NULL) {
+		d->timer = pw_loop_add_timer(l, on_shm_timeout, d);
+		value.tv_sec = 0;
+		value.tv_nsec = 1;
+		interval.tv_sec = 0;
+		interval.tv_nsec = 10 * SPA_NSEC_PER_MSEC;
+		pw_loop_update_timer(l, d->timer, &value, &interval, false);
+	}
+}
+
 static const struct pw_profiler_events profiler_events = {
 	PW_VERSION_PROFILER_EVENTS,
         .profile = profiler_profile,
+        .shm = profiler_shm,
 };
 
+static void apply_topology(struct data *d, const struct profiler_file_event *ev, bool show)
+{
+	struct object *o;
+
+	switch (ev->type) {
+	case PROFILER_FILE_EVENT_NODE:
+	case PROFILER_FILE_EVENT_LINK:
+	{
+		uint32_t id = ev->type == PROFILER_FILE_EVENT_NODE ? ev->node.id : ev->link.id;
+
+		if ((o = find_object(d, id)) == NULL) {
+			if ((o = calloc(1, sizeof(*o))) == NULL)
+				return;
+			o->id = id;
+			spa_list_append(&d->objects, &o->link);
+		}
+		o->type = ev->type;
+		if (ev->type == PROFILER_FILE_EVENT_NODE) {
+			snprintf(o->name, sizeof(o->name), "%s", ev->node.name);
+			if (show)
+				printf("node %u (\"%s\") added\n", id, o->name);
+		} else {
+			o->output_node = ev->link.output_node;
+			o->input_node = ev->link.input_node;
+			if (show)
+				printf("link %u added: %u -> %u\n", id,
+						o->output_node, o->input_node);
+		}
+		break;
+	}
+	case PROFILER_FILE_EVENT_REMOVE:
+		if ((o = find_object(d, ev->remove.id)) == NULL)
+			return;
+		if (show)
+			printf("%s %u removed\n", o->type == PROFILER_FILE_EVENT_NODE ?
+					"node" : "link", o->id);
+		free_object(o);
+		break;
+	default:
+		break;
+	}
+}
+
+/* print the critical path of cycles that had an xrun or used more than
+ * the threshold of the quantum */
+static void report_cycle(struct data *d, const struct pw_profiler_record *r)
+{
+	struct pw_profiler_path path[PW_PROFILER_XRUN_PATH];
+	struct pw_profiler_node node;
+	struct object *driver;
+	uint64_t period, busy, start = r->driver.signal_time;
+	uint32_t i, n_path;
+	double util;
+	bool xrun = false;
+
+	period = pw_profiler_record_period(r);
+	busy = r->driver.finish_time > start ? r->driver.finish_time - start : 0;
+	util = period ? busy * 100.0 / period : 0.0;
+
+	if ((driver = find_object(d, r->driver.id)) != NULL) {
+		xrun = driver->xrun_valid && driver->xrun_count != r->info.xrun_count;
+		driver->xrun_count = r->info.xrun_count;
+		driver->xrun_valid = true;
+	}
+	if (util > 100.0)
+		xrun = true;
+
+	d->n_cycles++;
+	d->util_total += util;
+	d->util_max = SPA_MAX(d->util_max, util);
+	if (xrun)
+		d->n_xruns++;
+
+	if (!xrun && util < d->threshold)
+		return;
+
+	d->n_reported++;
+	printf("cycle %"PRIi64" at %.6fs driver %u (\"%s\") quantum %"PRIu64"/%u used %.1f%%%s\n",
+			r->info.count,
+			(double)(start - d->start_time) / SPA_NSEC_PER_SEC,
+			r->driver.id, get_node_name(d, r->driver.id, &node),
+			r->info.clock.duration, r->info.clock.rate.denom,
+			util, xrun ? " xrun" : "");
+
+	n_path = pw_profiler_record_path(r, path, SPA_N_ELEMENTS(path));
+	for (i = 0; i < n_path; i++) {
+		printf("  %5u %-32.32s signal %8.1fus wakeup %8.1fus process %8.1fus%s\n",
+				path[i].id, get_node_name(d, path[i].id, &node),
+				path[i].signal / 1000.0,
+				path[i].wakeup / 1000.0,
+				path[i].process / 1000.0,
+				path[i].flags & PW_PROFILER_PATH_FLAG_BUSY ? " busy" : "");
+	}
+}
+
+static int replay_trace(struct data *d, const char *filename, double start, double end)
+{
+	struct profiler_file *pf;
+	struct profiler_file_info info;
+	struct profiler_file_event ev;
+	struct object *o;
+	struct point point;
+	uint64_t start_time, end_time;
+	int res;
+
+	if ((pf = profiler_file_open(filename, "r", &info)) == NULL) {
+		res = -errno;
+		fprintf(stderr, "Can't open trace %s: %m\n", filename);
+		return res;
+	}
+	if (!info.indexed)
+		fprintf(stderr, "Trace %s was not closed, rebuilt the index\n", filename);
+
+	printf("Replaying %"PRIu64" cycles, %.3f seconds\n", info.n_records,
+			(double)(info.end_time - info.start_time) / SPA_NSEC_PER_SEC);
+
+	d->start_time = info.start_time;
+	start_time = info.start_time + (uint64_t)(start * SPA_NSEC_PER_SEC);
+	end_time = end > 0.0 ? info.start_time + (uint64_t)(end * SPA_NSEC_PER_SEC) : UINT64_MAX;
+
+	/* the nodes and links before start_time are replayed first */
+	profiler_file_seek(pf, start_time);
+
+	while ((res = profiler_file_read_event(pf, &ev)) > 0) {
+		if (ev.type != PROFILER_FILE_EVENT_RECORD) {
+			apply_topology(d, &ev, ev.time >= start_time);
+			continue;
+		}
+		if (ev.time < start_time)
+			continue;
+		if (ev.time > end_time)
+			break;
+
+		report_cycle(d, ev.record);
+
+		spa_zero(point);
+		if (process_record(d, ev.record, &point) < 0)
+			continue;
+
+		dump_point(d, &point);
+	}
+
+	printf("\n%"PRIu64" cycles, %"PRIu64" xruns, %"PRIu64" reported, "
+			"quantum used %.1f%% average %.1f%% max\n",
+			d->n_cycles, d->n_xruns, d->n_reported,
+			d->n_cycles ? d->util_total / d->n_cycles : 0.0, d->util_max);
+
+	spa_list_consume(o, &d->objects, link)
+		free_object(o);
+
+	profiler_file_close(pf);
+	return res;
+}
+
+static void trace_global(struct data *d, uint32_t id, const char *type,
+		const struct spa_dict *props)
+{
+	struct profiler_file_event ev = { .time = get_time_ns() };
+	const char *str;
+	int res;
+
+	if (spa_streq(type, PW_TYPE_INTERFACE_Node)) {
+		str = props ? spa_dict_lookup(props, PW_KEY_NODE_NAME) : NULL;
+		ev.type = PROFILER_FILE_EVENT_NODE;
+		ev.node.id = id;
+		ev.node.name = str ? str : "";
+	} else if (spa_streq(type, PW_TYPE_INTERFACE_Link)) {
+		ev.type = PROFILER_FILE_EVENT_LINK;
+		ev.link.id = id;
+		ev.link.output_node = ev.link.input_node = SPA_ID_INVALID;
+		if (props && (str = spa_dict_lookup(props, PW_KEY_LINK_OUTPUT_NODE)) != NULL)
+			spa_atou32(str, &ev.link.output_node, 0);
+		if (props && (str = spa_dict_lookup(props, PW_KEY_LINK_INPUT_NODE)) != NULL)
+			spa_atou32(str, &ev.link.input_node, 0);
+	} else {
+		return;
+	}
+	if ((res = profiler_file_write_event(d->trace, &ev)) < 0)
+		pw_log_warn("can't write trace: %s", spa_strerror(res));
+}
+
 static void registry_event_global(void *data, uint32_t id,
 				  uint32_t permissions, const char *type, uint32_t version,
 				  const struct spa_dict *props)
@@ -456,6 +859,9 @@ static void registry_event_global(void *data, uint32_t id,
 	struct data *d = data;
 	struct pw_proxy *proxy;
 
+	if (d->trace != NULL)
+		trace_global(d, id, type, props);
+
 	if (!spa_streq(type, PW_TYPE_INTERFACE_Profiler))
 		return;
 
@@ -479,9 +885,26 @@ error_proxy:
 	return;
 }
 
+static void registry_event_global_remove(void *data, uint32_t id)
+{
+	struct data *d = data;
+	struct profiler_file_event ev = {
+		.type = PROFILER_FILE_EVENT_REMOVE,
+		.time = get_time_ns(),
+		.remove.id = id,
+	};
+	int res;
+
+	if (d->trace == NULL)
+		return;
+	if ((res = profiler_file_write_event(d->trace, &ev)) < 0)
+		pw_log_warn("can't write trace: %s", spa_strerror(res));
+}
+
 static const struct pw_registry_events registry_events = {
 	PW_VERSION_REGISTRY_EVENTS,
 	.global = registry_event_global,
+	.global_remove = registry_event_global_remove,
 };
 
 static void on_core_error(void *_data, uint32_t id, int seq, int res, const char *message)
@@ -526,9 +949,15 @@ static void show_help(const char *name, bool error)
 		"  -h, --help                            Show this help\n"
 		"      --version                         Show version\n"
 		"  -r, --remote                          Remote daemon name\n"
-		"  -o, --output                          Profiler output name (default \"%s\")\n",
+		"  -o, --output                          Profiler output name (default \"%s\")\n"
+		"  -w, --write                           Also record a trace to FILE\n"
+		"  -i, --input                           Replay the trace in FILE\n"
+		"  -s, --start                           Start the replay at SECONDS\n"
+		"  -e, --end                             End the replay at SECONDS\n"
+		"  -t, --threshold                       Show the critical path of cycles that use\n"
+		"                                        more than PERCENT of the quantum (default %.0f)\n",
 		name,
-		DEFAULT_FILENAME);
+		DEFAULT_FILENAME, DEFAULT_THRESHOLD);
 }
 
 int main(int argc, char *argv[])
@@ -537,19 +966,31 @@ int main(int argc, char *argv[])
 	struct pw_loop *l;
 	const char *opt_remote = NULL;
 	const char *opt_output = DEFAULT_FILENAME;
+	const char *opt_write = NULL;
+	const char *opt_input = NULL;
+	double opt_start = 0.0, opt_end = 0.0;
 	static const struct option long_options[] = {
 		{ "help",	no_argument,		NULL, 'h' },
 		{ "version",	no_argument,		NULL, 'V' },
 		{ "remote",	required_argument,	NULL, 'r' },
 		{ "output",	required_argument,	NULL, 'o' },
+		{ "write",	required_argument,	NULL, 'w' },
+		{ "input",	required_argument,	NULL, 'i' },
+		{ "start",	required_argument,	NULL, 's' },
+		{ "end",	required_argument,	NULL, 'e' },
+		{ "threshold",	required_argument,	NULL, 't' },
 		{ NULL, 0, NULL, 0}
 	};
-	int c;
+	struct profiler_file_info info;
+	int c, res = 0;
+
+	data.threshold = DEFAULT_THRESHOLD;
+	spa_list_init(&data.objects);
 
 	setlocale(LC_ALL, "");
 	pw_init(&argc, &argv);
 
-	while ((c = getopt_long(argc, argv, "hVr:o:", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "hVr:o:w:i:s:e:t:", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'h':
 			show_help(argv[0], false);
@@ -568,12 +1009,46 @@ int main(int argc, char *argv[])
 		case 'r':
 			opt_remote = optarg;
 			break;
+		case 'w':
+			opt_write = optarg;
+			break;
+		case 'i':
+			opt_input = optarg;
+			break;
+		case 's':
+			opt_start = atof(optarg);
+			break;
+		case 'e':
+			opt_end = atof(optarg);
+			break;
+		case 't':
+			data.threshold = atof(optarg);
+			break;
 		default:
 			show_help(argv[0], true);
 			return -1;
 		}
 	}
 
+	data.filename = opt_output;
+
+	if (opt_input != NULL) {
+		data.output = fopen(data.filename, "we");
+		if (data.output == NULL) {
+			fprintf(stderr, "Can't open file %s: %m\n", data.filename);
+			return -1;
+		}
+		res = replay_trace(&data, opt_input, opt_start, opt_end);
+		fclose(data.output);
+
+		if (res >= 0)
+			dump_scripts(&data);
+
+		pw_deinit();
+
+		return res < 0 ? -1 : 0;
+	}
+
 	data.loop = pw_main_loop_new(NULL);
 	if (data.loop == NULL) {
 		fprintf(stderr, "Can't create data loop: %m\n");
@@ -602,8 +1077,6 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	data.filename = opt_output;
-
 	data.output = fopen(data.filename, "we");
 	if (data.output == NULL) {
 		fprintf(stderr, "Can't open file %s: %m\n", data.filename);
@@ -612,6 +1085,15 @@ int main(int argc, char *argv[])
 
 	printf("Logging to %s\n", data.filename);
 
+	if (opt_write != NULL) {
+		data.trace = profiler_file_open(opt_write, "w", &info);
+		if (data.trace == NULL) {
+			fprintf(stderr, "Can't open trace %s: %m\n", opt_write);
+			return -1;
+		}
+		printf("Recording trace to %s\n", opt_write);
+	}
+
 	pw_core_add_listener(data.core,
 				   &data.core_listener,
 				   &core_events, &data);
@@ -625,6 +1107,10 @@ int main(int argc, char *argv[])
 
 	pw_main_loop_run(data.loop);
 
+	if (data.timer)
+		pw_loop_destroy_source(l, data.timer);
+	if (data.shm)
+		munmap(data.shm, data.shm_size);
 	if (data.profiler) {
 		spa_hook_remove(&data.profiler_listener);
 		pw_proxy_destroy((struct pw_proxy*)data.profiler);
@@ -637,6 +1123,10 @@ int main(int argc, char *argv[])
 
 	fclose(data.output);
 
+	if (data.trace != NULL &&
+	    (res = profiler_file_close(data.trace)) < 0)
+		fprintf(stderr, "Can't write trace %s: %s\n", opt_write, spa_strerror(res));
+
 	dump_scripts(&data);
 
 	pw_deinit();
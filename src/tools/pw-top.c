@@ -6,6 +6,8 @@
 #include <signal.h>
 #include <getopt.h>
 #include <locale.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <ncurses.h>
 
 #include <spa/utils/result.h>
@@ -24,6 +26,8 @@
 
 #define XRUN_INVALID	(uint32_t)-1
 
+#define MAX_XRUNS	8
+
 struct driver {
 	int64_t count;
 	float cpu_load[3];
@@ -50,6 +54,8 @@ struct node {
 	char name[MAX_NAME+1];
 	enum pw_node_state state;
 	struct measurement measurement;
+	struct pw_profiler_stats wakeup_stats;
+	struct pw_profiler_stats process_stats;
 	struct driver info;
 	struct node *driver;
 	uint32_t generation;
@@ -74,6 +80,12 @@ struct data {
 	struct spa_hook profiler_listener;
 	int check_profiler;
 
+	struct pw_profiler_shm *shm;
+	uint32_t shm_size;
+	uint32_t xrun_index;
+	uint32_t n_xruns;
+	struct pw_profiler_xrun xruns[MAX_XRUNS];
+
 	struct spa_source *timer;
 
 	int n_nodes;
@@ -84,6 +96,7 @@ struct data {
 	WINDOW *win;
 
 	unsigned int batch_mode:1;
+	unsigned int latency_view:1;
 	int iterations;
 };
 
@@ -498,37 +511,105 @@ static void print_node(struct data *d, struct driver *i, struct node *n, int y)
 			n->name);
 }
 
+static void print_node_latency(struct data *d, struct driver *i, struct node *n, int y)
+{
+	char buf[6][64];
+	bool active;
+
+	active = d->shm != NULL &&
+		(n->state == PW_NODE_STATE_RUNNING || n->state == PW_NODE_STATE_IDLE) &&
+		n->wakeup_stats.count > 0;
+
+	print_mode_dependent(d, y, 0, "%s %4.1u %s %s %s %s %s %s  %3.1u %s%s",
+			state_as_string(n->state),
+			n->id,
+			print_time(buf[0], active, 64, n->wakeup_stats.p50),
+			print_time(buf[1], active, 64, n->wakeup_stats.p99),
+			print_time(buf[2], active, 64, n->wakeup_stats.max),
+			print_time(buf[3], active, 64, n->process_stats.p50),
+			print_time(buf[4], active, 64, n->process_stats.p99),
+			print_time(buf[5], active, 64, n->process_stats.max),
+			n->measurement.xrun_count == XRUN_INVALID ?
+					i->xrun_count : n->measurement.xrun_count,
+			n->driver == n ? "" : " + ",
+			n->name);
+}
+
+static void print_xrun(struct data *d, const struct pw_profiler_xrun *x, int y)
+{
+	char buf1[64], buf2[64], path[512];
+	struct spa_strbuf b;
+	uint32_t i;
+
+	spa_strbuf_init(&b, path, sizeof(path));
+	for (i = 0; i < x->n_path; i++) {
+		const struct pw_profiler_path *p = &x->path[i];
+		struct node *n = find_node(d, p->id);
+		char buf[64];
+
+		spa_strbuf_append(&b, "%s%s(%u) %s", i == 0 ? "" : " <- ",
+				n ? n->name : "", p->id,
+				print_time(buf, true, sizeof(buf),
+					p->flags & PW_PROFILER_PATH_FLAG_BUSY ?
+						(uint64_t)-2 : p->process));
+	}
+	if (x->n_path == 0)
+		spa_strbuf_append(&b, "driver");
+
+	print_mode_dependent(d, y, 0, "  %4.1u %s %s  %s",
+			x->driver_id,
+			print_time(buf1, true, 64, x->duration),
+			print_time(buf2, x->period != 0, 64, x->period),
+			path);
+}
+
 static void clear_node(struct node *n)
 {
 	n->driver = n;
 	spa_zero(n->measurement);
 	spa_zero(n->info);
+	spa_zero(n->wakeup_stats);
+	spa_zero(n->process_stats);
 }
 
 #define HEADER	"S   ID  QUANT   RATE    WAIT    BUSY   W/Q   B/Q  ERR FORMAT           NAME "
+#define HEADER_LATENCY \
+		"S   ID   W-P50   W-P99   W-MAX   B-P50   B-P99   B-MAX  ERR NAME "
+#define HEADER_XRUNS \
+		"DRIVER    TIME  PERIOD  CRITICAL PATH "
+
+static void print_header(struct data *d, const char *header)
+{
+	if (!d->batch_mode) {
+		wattron(d->win, A_REVERSE);
+		wprintw(d->win, "%-*.*s", COLS, COLS, header);
+		wattroff(d->win, A_REVERSE);
+		wprintw(d->win, "\n");
+	} else
+		printf("%s\n", header);
+}
 
 static void do_refresh(struct data *d, bool force_refresh)
 {
 	struct node *n, *t, *f;
+	void (*print) (struct data *d, struct driver *i, struct node *n, int y);
 	int y = 1;
+	uint32_t i;
 
 	if (!d->pending_refresh && !force_refresh)
 		return;
 
-	if (!d->batch_mode) {
+	print = d->latency_view ? print_node_latency : print_node;
+
+	if (!d->batch_mode)
 		wclear(d->win);
-		wattron(d->win, A_REVERSE);
-		wprintw(d->win, "%-*.*s", COLS, COLS, HEADER);
-		wattroff(d->win, A_REVERSE);
-		wprintw(d->win, "\n");
-	} else
-		printf(HEADER "\n");
+	print_header(d, d->latency_view ? HEADER_LATENCY : HEADER);
 
 	spa_list_for_each_safe(n, t, &d->node_list, link) {
 		if (n->driver != n)
 			continue;
 
-		print_node(d, &n->info, n, y++);
+		print(d, &n->info, n, y++);
 		if(!d->batch_mode && y > LINES)
 			break;
 
@@ -539,13 +620,27 @@ static void do_refresh(struct data *d, bool force_refresh)
 			if (f->driver != n || f == n)
 				continue;
 
-			print_node(d, &n->info, f, y++);
+			print(d, &n->info, f, y++);
 			if(y > LINES)
 				break;
 
 		}
 	}
 
+	if (d->latency_view && d->n_xruns > 0 &&
+	    (d->batch_mode || y + 2 < LINES)) {
+		if (!d->batch_mode)
+			wmove(d->win, ++y, 0);
+		print_header(d, HEADER_XRUNS);
+		y++;
+		/* newest first */
+		for (i = 0; i < d->n_xruns; i++) {
+			if (!d->batch_mode && y >= LINES)
+				break;
+			print_xrun(d, &d->xruns[(d->xrun_index - 1 - i) % MAX_XRUNS], y++);
+		}
+	}
+
 	if (!d->batch_mode) {
 		// Clear from last line to the end of the window to hide text wrapping from the last node
 		wmove(d->win, y, 0);
@@ -563,10 +658,75 @@ static void do_refresh(struct data *d, bool force_refresh)
 		pw_main_loop_quit(d->loop);
 }
 
+static void update_from_shm(struct data *d)
+{
+	struct pw_profiler_node s;
+	struct node *n;
+
+	spa_list_for_each(n, &d->node_list, link) {
+		struct measurement m;
+
+		if (pw_profiler_shm_get_node(d->shm, n->id, &s) < 0)
+			continue;
+
+		n->wakeup_stats = s.wakeup_stats;
+		n->process_stats = s.process_stats;
+
+		/* no new cycle since the last update */
+		if ((int64_t)s.last.signal_time == n->measurement.signal)
+			continue;
+
+		spa_zero(m);
+		m.status = s.last.status;
+		m.prev_signal = s.last.prev_signal_time;
+		m.signal = s.last.signal_time;
+		m.awake = s.last.awake_time;
+		m.finish = s.last.finish_time;
+		m.latency = s.last.latency;
+		m.xrun_count = s.last.xrun_count;
+		n->measurement = m;
+
+		if (s.driver_id == n->id) {
+			n->info.count = s.info.count;
+			n->info.cpu_load[0] = s.info.cpu_load[0];
+			n->info.cpu_load[1] = s.info.cpu_load[1];
+			n->info.cpu_load[2] = s.info.cpu_load[2];
+			n->info.xrun_count = s.info.xrun_count;
+			n->info.clock = s.info.clock;
+			n->driver = n;
+		} else {
+			struct node *driver = find_node(d, s.driver_id);
+			n->driver = driver ? driver : n;
+		}
+		n->generation = d->generation;
+	}
+}
+
+static void update_xruns(struct data *d)
+{
+	uint32_t index = SPA_ATOMIC_LOAD(d->shm->xrun_index);
+
+	if (index - d->xrun_index > MAX_XRUNS)
+		d->xrun_index = index - MAX_XRUNS;
+
+	for (; d->xrun_index != index; d->xrun_index++) {
+		struct pw_profiler_xrun *x = &d->xruns[d->xrun_index % MAX_XRUNS];
+		if (pw_profiler_shm_get_xrun(d->shm, d->xrun_index, x) < 0) {
+			spa_zero(*x);
+			x->index = d->xrun_index;
+		}
+		d->n_xruns = SPA_MIN(d->n_xruns + 1, (uint32_t)MAX_XRUNS);
+	}
+}
+
 static void do_timeout(void *data, uint64_t expirations)
 {
 	struct data *d = data;
 	d->generation++;
+	if (d->shm != NULL) {
+		update_from_shm(d);
+		update_xruns(d);
+	}
 	do_refresh(d, true);
 }
 
@@ -610,9 +770,35 @@ static void profiler_profile(void *data, const struct spa_pod *pod)
 	do_refresh(d, false);
 }
 
+static void profiler_shm(void *data, int fd, uint32_t size)
+{
+        struct data *d = data;
+	struct pw_profiler_shm *shm;
+
+	shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		pw_log_error("can't map profiler memory: %m");
+		return;
+	}
+	if (!pw_profiler_shm_check(shm, size)) {
+		pw_log_error("unknown profiler memory %08x:%u", shm->magic, shm->version);
+		munmap(shm, size);
+		return;
+	}
+	if (d->shm != NULL)
+		munmap(d->shm, d->shm_size);
+	d->shm = shm;
+	d->shm_size = size;
+	/* only show the xruns that happen from now on */
+	d->xrun_index = SPA_ATOMIC_LOAD(shm->xrun_index);
+	d->n_xruns = 0;
+}
+
 static const struct pw_profiler_events profiler_events = {
 	PW_VERSION_PROFILER_EVENTS,
         .profile = profiler_profile,
+        .shm = profiler_shm,
 };
 
 static void registry_event_global(void *data, uint32_t id,
@@ -724,6 +910,7 @@ static void show_help(const char *name, bool error)
 		"  -b, --batch-mode		         run in non-interactive batch_mode mode\n"
 		"  -n, --iterations = NUMBER             exit on maximum iterations NUMBER\n"
 		"  -r, --remote                          Remote daemon name\n"
+		"  -l, --latency                         show the latency view\n"
 		"\n"
 		"  -h, --help                            Show this help\n"
 		"  -V  --version                         Show version\n",
@@ -754,6 +941,10 @@ static void do_handle_io(void *data, int fd, uint32_t mask)
 		case 'q':
 			pw_main_loop_quit(d->loop);
 			break;
+		case 'l':
+			d->latency_view = !d->latency_view;
+			do_refresh(d, true);
+			break;
 		default:
 			do_refresh(d, !d->batch_mode);
 			break;
@@ -770,6 +961,7 @@ int main(int argc, char *argv[])
 		{ "batch-mode",	no_argument,		NULL, 'b' },
 		{ "iterations",	required_argument,	NULL, 'n' },
 		{ "remote",	required_argument,	NULL, 'r' },
+		{ "latency",	no_argument,		NULL, 'l' },
 		{ "help",	no_argument,		NULL, 'h' },
 		{ "version",	no_argument,		NULL, 'V' },
 		{ NULL, 0, NULL, 0}
@@ -785,7 +977,7 @@ int main(int argc, char *argv[])
 
 	spa_list_init(&data.node_list);
 
-	while ((c = getopt_long(argc, argv, "hVr:o:bn:", long_options, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "hVr:o:bn:l", long_options, NULL)) != -1) {
 		switch (c) {
 		case 'h':
 			show_help(argv[0], false);
@@ -807,6 +999,9 @@ int main(int argc, char *argv[])
 		case 'n':
 			spa_atoi32(optarg, &data.iterations, 10);
 			break;
+		case 'l':
+			data.latency_view = 1;
+			break;
 		default:
 			show_help(argv[0], true);
 			return -1;
@@ -881,6 +1076,8 @@ int main(int argc, char *argv[])
 		spa_hook_remove(&data.profiler_listener);
 		pw_proxy_destroy((struct pw_proxy*)data.profiler);
 	}
+	if (data.shm)
+		munmap(data.shm, data.shm_size);
 	spa_hook_remove(&data.registry_listener);
 	pw_proxy_destroy((struct pw_proxy*)data.registry);
 	spa_hook_remove(&data.core_listener);
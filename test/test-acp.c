@@ -0,0 +1,156 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include <stdio.h>
+#include <dirent.h>
+#include <alsa/asoundlib.h>
+
+#include "pwtest.h"
+
+#include <spa/utils/string.h>
+
+#include "acp/acp.h"
+
+#define MAX_PROFILES	128
+
+struct probe {
+	uint32_t n_profiles;
+	char *names[MAX_PROFILES];
+	enum acp_available available[MAX_PROFILES];
+};
+
+/* the probe cache is only meaningful on a card without UCM, snd-dummy is
+ * always there when the module is loaded */
+static int find_dummy_card(void)
+{
+	int card = -1;
+
+	while (snd_card_next(&card) == 0 && card >= 0) {
+		snd_ctl_card_info_t *info;
+		snd_ctl_t *ctl;
+		char name[32];
+		bool found;
+
+		spa_scnprintf(name, sizeof(name), "hw:%d", card);
+		if (snd_ctl_open(&ctl, name, 0) < 0)
+			continue;
+		snd_ctl_card_info_alloca(&info);
+		found = snd_ctl_card_info(ctl, info) >= 0 &&
+			spa_streq(snd_ctl_card_info_get_driver(info), "Dummy");
+		snd_ctl_close(ctl);
+		if (found)
+			return card;
+	}
+	return -1;
+}
+
+static void probe_card(int card, const char *dir, struct probe *p)
+{
+	struct acp_dict_item items[3];
+	struct acp_dict props;
+	struct acp_card *c;
+	uint32_t i;
+
+	items[0] = ACP_DICT_ITEM_INIT("use-ucm", "false");
+	items[1] = ACP_DICT_ITEM_INIT("api.acp.probe-cache", "true");
+	items[2] = ACP_DICT_ITEM_INIT("api.acp.probe-cache-dir", dir);
+	props = ACP_DICT_INIT(items, 3);
+
+	c = acp_card_new(card, &props);
+	pwtest_ptr_notnull(c);
+
+	p->n_profiles = SPA_MIN(c->n_profiles, (uint32_t)MAX_PROFILES);
+	for (i = 0; i < p->n_profiles; i++) {
+		p->names[i] = strdup(c->profiles[i]->name);
+		p->available[i] = c->profiles[i]->available;
+	}
+	acp_card_destroy(c);
+}
+
+static void probe_clear(struct probe *p)
+{
+	uint32_t i;
+	for (i = 0; i < p->n_profiles; i++)
+		free(p->names[i]);
+	spa_zero(*p);
+}
+
+static int find_cache_file(const char *dir, char path[PATH_MAX])
+{
+	struct dirent *d;
+	DIR *dp;
+	int n = 0;
+
+	if ((dp = opendir(dir)) == NULL)
+		return -errno;
+	while ((d = readdir(dp)) != NULL) {
+		if (spa_strendswith(d->d_name, ".cache")) {
+			spa_scnprintf(path, PATH_MAX, "%s/%s", dir, d->d_name);
+			n++;
+		}
+	}
+	closedir(dp);
+	return n;
+}
+
+PWTEST(acp_probe_cache)
+{
+	struct probe p1 = { 0 }, p2 = { 0 }, p3 = { 0 };
+	char dir[PATH_MAX], path[PATH_MAX], line[1024];
+	const char *tmpdir = getenv("TMPDIR");
+	uint32_t i;
+	FILE *f;
+	int card;
+
+	if ((card = find_dummy_card()) < 0)
+		return PWTEST_SKIP;
+
+	pwtest_ptr_notnull(tmpdir);
+	spa_scnprintf(dir, sizeof(dir), "%s/acp", tmpdir);
+
+	/* first probe opens everything and writes the cache */
+	probe_card(card, dir, &p1);
+	pwtest_int_gt(p1.n_profiles, 0u);
+	pwtest_int_eq(find_cache_file(dir, path), 1);
+
+	/* the second probe skips the cached profiles and gives the same result */
+	probe_card(card, dir, &p2);
+	pwtest_int_eq(p1.n_profiles, p2.n_profiles);
+	for (i = 0; i < p1.n_profiles; i++) {
+		pwtest_str_eq(p1.names[i], p2.names[i]);
+		pwtest_int_eq(p1.available[i], p2.available[i]);
+	}
+
+	/* a cache with the wrong key is not used and is replaced */
+	f = fopen(path, "we");
+	pwtest_ptr_notnull(f);
+	fprintf(f, "key 0000000000000000\n");
+	for (i = 0; i < p1.n_profiles; i++)
+		fprintf(f, "unsupported %s\n", p1.names[i]);
+	fclose(f);
+
+	probe_card(card, dir, &p3);
+	pwtest_int_eq(p1.n_profiles, p3.n_profiles);
+	for (i = 0; i < p1.n_profiles; i++)
+		pwtest_int_eq(p1.available[i], p3.available[i]);
+
+	f = fopen(path, "re");
+	pwtest_ptr_notnull(f);
+	while (fgets(line, sizeof(line), f) != NULL)
+		pwtest_bool_false(spa_streq(line, "key 0000000000000000\n"));
+	fclose(f);
+
+	probe_clear(&p1);
+	probe_clear(&p2);
+	probe_clear(&p3);
+
+	return PWTEST_PASS;
+}
+
+PWTEST_SUITE(acp)
+{
+	pwtest_add(acp_probe_cache, PWTEST_NOARG);
+
+	return PWTEST_PASS;
+}
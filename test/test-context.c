@@ -4,12 +4,15 @@
 
 #include "pwtest.h"
 
+#include <spa/utils/names.h>
 #include <spa/utils/string.h>
 #include <spa/support/dbus.h>
 #include <spa/support/cpu.h>
 
 #include <pipewire/pipewire.h>
 #include <pipewire/global.h>
+#include <pipewire/impl.h>
+#include <pipewire/private.h>
 
 #define TEST_FUNC(a,b,func)	\
 do {				\
@@ -259,12 +262,303 @@ PWTEST(context_support)
 	return PWTEST_PASS;
 }
 
+static struct pw_impl_node *create_driver(struct pw_context *context,
+		const char *name, struct spa_handle **handle)
+{
+	struct spa_dict_item items[] = {
+		{ SPA_KEY_LIBRARY_NAME, "support/libspa-support" },
+	};
+	struct pw_impl_node *node;
+	void *iface;
+
+	*handle = pw_context_load_spa_handle(context, SPA_NAME_SUPPORT_NODE_DRIVER,
+			&SPA_DICT_INIT_ARRAY(items));
+	pwtest_ptr_notnull(*handle);
+	pwtest_neg_errno_ok(spa_handle_get_interface(*handle,
+				SPA_TYPE_INTERFACE_Node, &iface));
+
+	node = pw_context_create_node(context,
+			pw_properties_new(
+				PW_KEY_NODE_NAME, name,
+				PW_KEY_NODE_DRIVER, "true",
+				NULL), 0);
+	pwtest_ptr_notnull(node);
+	pwtest_neg_errno_ok(pw_impl_node_set_implementation(node, iface));
+	pwtest_neg_errno_ok(pw_impl_node_register(node, NULL));
+	pwtest_neg_errno_ok(pw_impl_node_set_active(node, true));
+
+	return node;
+}
+
+PWTEST(context_recalc_graph)
+{
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+	struct pw_impl_node *n1, *n2;
+	struct spa_handle *h1, *h2;
+	const struct pw_properties *props;
+	struct pw_loop *l;
+	uint64_t count, full_count;
+	const char *str;
+	int i;
+
+	pw_init(0, NULL);
+
+	loop = pw_main_loop_new(NULL);
+	l = pw_main_loop_get_loop(loop);
+	context = pw_context_new(l,
+			pw_properties_new(
+				PW_KEY_CONFIG_NAME, "null",
+				NULL), 0);
+	pwtest_ptr_notnull(context);
+
+	n1 = create_driver(context, "driver-1", &h1);
+	n2 = create_driver(context, "driver-2", &h2);
+
+	/* a change in one driver only evaluates that driver */
+	count = context->recalc_stats.count;
+	full_count = context->recalc_stats.full_count;
+	pwtest_neg_errno_ok(pw_impl_node_set_active(n1, false));
+	pwtest_int_eq(context->recalc_stats.count, count + 1);
+	pwtest_int_eq(context->recalc_stats.full_count, full_count);
+	pwtest_int_eq(context->recalc_stats.last_nodes, 1u);
+
+	pwtest_neg_errno_ok(pw_impl_node_set_active(n1, true));
+	pwtest_int_eq(context->recalc_stats.count, count + 2);
+	pwtest_int_eq(context->recalc_stats.last_nodes, 1u);
+
+	/* a destroyed node is not evaluated anymore */
+	pw_impl_node_destroy(n1);
+	pw_unload_spa_handle(h1);
+
+	count = context->recalc_stats.count;
+	pwtest_neg_errno_ok(pw_impl_node_set_active(n2, false));
+	pwtest_int_eq(context->recalc_stats.count, count + 1);
+	pwtest_int_eq(context->recalc_stats.last_nodes, 1u);
+
+	/* the stats are published on the core object */
+	props = pw_impl_core_get_properties(context->core);
+	pw_loop_enter(l);
+	for (i = 0; i < 30 && pw_properties_get(props, "graph.recalc.count") == NULL; i++)
+		pw_loop_iterate(l, 100);
+	pw_loop_leave(l);
+	pwtest_ptr_notnull((str = pw_properties_get(props, "graph.recalc.count")));
+	pwtest_int_eq((uint64_t)atoll(str), context->recalc_stats.count);
+	pwtest_ptr_notnull(pw_properties_get(props, "graph.recalc.histogram"));
+
+	pw_impl_node_destroy(n2);
+	pw_unload_spa_handle(h2);
+
+	pw_context_destroy(context);
+	pw_main_loop_destroy(loop);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
+static struct pw_impl_port *create_control_port(struct pw_context *context,
+		struct pw_impl_node *node, enum pw_direction direction)
+{
+	struct pw_impl_port *port;
+
+	port = pw_context_create_port(context, direction, 0, NULL, 0);
+	pwtest_ptr_notnull(port);
+	/* control ports are linked without negotiating a format */
+	SPA_FLAG_SET(port->flags, PW_IMPL_PORT_FLAG_CONTROL);
+	pwtest_neg_errno_ok(pw_impl_port_add(port, node));
+
+	return port;
+}
+
+PWTEST(context_recalc_graph_linked)
+{
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+	struct pw_impl_node *n1, *n2;
+	struct pw_impl_port *out, *in;
+	struct pw_impl_link *link;
+	struct spa_handle *h1, *h2;
+	uint64_t count, full_count;
+	int i;
+
+	pw_init(0, NULL);
+
+	loop = pw_main_loop_new(NULL);
+	context = pw_context_new(pw_main_loop_get_loop(loop),
+			pw_properties_new(
+				PW_KEY_CONFIG_NAME, "null",
+				NULL), 0);
+	pwtest_ptr_notnull(context);
+
+	n1 = create_driver(context, "driver-1", &h1);
+	n2 = create_driver(context, "driver-2", &h2);
+	out = create_control_port(context, n1, PW_DIRECTION_OUTPUT);
+	in = create_control_port(context, n2, PW_DIRECTION_INPUT);
+
+	link = pw_context_create_link(context, out, in, NULL, NULL, 0);
+	pwtest_ptr_notnull(link);
+	pwtest_neg_errno_ok(pw_impl_link_register(link, NULL));
+	pwtest_neg_errno_ok(pw_impl_link_prepare(link));
+
+	pw_loop_enter(pw_main_loop_get_loop(loop));
+	for (i = 0; i < 16 && !link->prepared; i++)
+		pw_loop_iterate(pw_main_loop_get_loop(loop), 0);
+	pw_loop_leave(pw_main_loop_get_loop(loop));
+	pwtest_bool_true(link->prepared);
+
+	/* linked nodes are scheduled by the same driver */
+	pwtest_ptr_eq(n1->driver_node, n2->driver_node);
+
+	/* n2 drives itself while it is inactive */
+	pwtest_neg_errno_ok(pw_impl_node_set_active(n2, false));
+
+	/* when n2 is active again, the driver of its peer is evaluated
+	 * with it and they end up with the same driver again */
+	count = context->recalc_stats.count;
+	full_count = context->recalc_stats.full_count;
+	pwtest_neg_errno_ok(pw_impl_node_set_active(n2, true));
+	pwtest_int_gt(context->recalc_stats.count, count);
+	pwtest_int_eq(context->recalc_stats.full_count, full_count);
+	pwtest_ptr_eq(n1->driver_node, n2->driver_node);
+
+	pw_impl_link_destroy(link);
+	pw_impl_node_destroy(n1);
+	pw_impl_node_destroy(n2);
+	pw_unload_spa_handle(h1);
+	pw_unload_spa_handle(h2);
+
+	pw_context_destroy(context);
+	pw_main_loop_destroy(loop);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
+static int do_tee_process(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct pw_impl_port *port = user_data;
+	const uint32_t *buffer_id = data;
+
+	port->rt.io.status = SPA_STATUS_HAVE_DATA;
+	port->rt.io.buffer_id = *buffer_id;
+	spa_node_process(port->mix);
+	return 0;
+}
+
+static void tee_process(struct pw_impl_port *port, uint32_t buffer_id)
+{
+	pw_loop_invoke(port->node->data_loop, do_tee_process, 0,
+			&buffer_id, sizeof(buffer_id), true, port);
+}
+
+static void tee_set_io(struct pw_impl_port *port, struct pw_impl_port_mix *mix,
+		struct spa_io_buffers *io)
+{
+	spa_node_port_set_io(port->mix, port->direction, mix->port.port_id,
+			SPA_IO_Buffers, io, io ? sizeof(*io) : 0);
+	/* wait for the mix to be added on the data loop */
+	pw_loop_invoke(port->node->data_loop, NULL, 0, NULL, 0, true, NULL);
+}
+
+PWTEST(context_port_tee_busy)
+{
+	struct pw_main_loop *loop;
+	struct pw_context *context;
+	struct pw_impl_node *node;
+	struct pw_impl_port *port;
+	struct pw_impl_port_mix mix[2];
+	struct spa_io_buffers io[2];
+	struct spa_handle *handle;
+	struct spa_meta_busy busy[2];
+	struct spa_meta metas[2];
+	struct spa_buffer buffers[2], *bufs[2];
+	uint32_t i;
+
+	pw_init(0, NULL);
+
+	loop = pw_main_loop_new(NULL);
+	context = pw_context_new(pw_main_loop_get_loop(loop),
+			pw_properties_new(
+				PW_KEY_CONFIG_NAME, "null",
+				NULL), 0);
+	pwtest_ptr_notnull(context);
+
+	node = create_driver(context, "tee-node", &handle);
+
+	port = pw_context_create_port(context, PW_DIRECTION_OUTPUT, 0, NULL, 0);
+	pwtest_ptr_notnull(port);
+	pwtest_neg_errno_ok(pw_impl_port_add(port, node));
+
+	for (i = 0; i < 2; i++) {
+		busy[i] = (struct spa_meta_busy) { 0, };
+		metas[i] = (struct spa_meta) { SPA_META_Busy, sizeof(busy[i]), &busy[i] };
+		buffers[i] = (struct spa_buffer) { .n_metas = 1, .metas = &metas[i] };
+		bufs[i] = &buffers[i];
+	}
+	/* the tee finds the busy meta in the buffers of the node */
+	pwtest_neg_errno_ok(spa_node_port_use_buffers(port->mix,
+				pw_direction_reverse(port->direction), 0, 0, bufs, 2));
+
+	spa_zero(mix);
+	spa_zero(io);
+	pwtest_neg_errno_ok(pw_impl_port_init_mix(port, &mix[0]));
+	pwtest_neg_errno_ok(pw_impl_port_init_mix(port, &mix[1]));
+
+	/* with one consumer the buffer is not held */
+	tee_set_io(port, &mix[0], &io[0]);
+	tee_process(port, 0);
+	pwtest_int_eq(io[0].buffer_id, 0u);
+	pwtest_int_eq(busy[0].count, 0u);
+
+	/* with two consumers each holds the buffer until the next cycle */
+	tee_set_io(port, &mix[1], &io[1]);
+	tee_process(port, 1);
+	pwtest_int_eq(io[0].buffer_id, 1u);
+	pwtest_int_eq(io[1].buffer_id, 1u);
+	pwtest_int_eq(busy[1].count, 2u);
+
+	tee_process(port, 0);
+	pwtest_int_eq(busy[0].count, 2u);
+	pwtest_int_eq(busy[1].count, 0u);
+
+	/* a consumer that goes away releases its reference */
+	tee_set_io(port, &mix[1], NULL);
+	pwtest_int_eq(busy[0].count, 1u);
+
+	/* and the remaining consumer does not hold the next buffer */
+	tee_process(port, 1);
+	pwtest_int_eq(busy[0].count, 0u);
+	pwtest_int_eq(busy[1].count, 0u);
+
+	tee_set_io(port, &mix[0], NULL);
+	pw_impl_port_release_mix(port, &mix[0]);
+	pw_impl_port_release_mix(port, &mix[1]);
+	pwtest_neg_errno_ok(spa_node_port_use_buffers(port->mix,
+				pw_direction_reverse(port->direction), 0, 0, NULL, 0));
+
+	pw_impl_node_destroy(node);
+	pw_unload_spa_handle(handle);
+
+	pw_context_destroy(context);
+	pw_main_loop_destroy(loop);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
 PWTEST_SUITE(context)
 {
 	pwtest_add(context_abi, PWTEST_NOARG);
 	pwtest_add(context_create, PWTEST_NOARG);
 	pwtest_add(context_properties, PWTEST_NOARG);
 	pwtest_add(context_support, PWTEST_NOARG);
+	pwtest_add(context_recalc_graph, PWTEST_NOARG);
+	pwtest_add(context_recalc_graph_linked, PWTEST_NOARG);
+	pwtest_add(context_port_tee_busy, PWTEST_NOARG);
 
 	return PWTEST_PASS;
 }
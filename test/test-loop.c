@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/eventfd.h>
 
 #include "pwtest.h"
@@ -435,6 +436,201 @@ PWTEST(cancel_thread_while_dispatching)
 	return PWTEST_PASS;
 }
 
+#define MP_THREADS	8
+#define MP_ITEMS	5000
+
+struct mp_data;
+
+struct mp_thread {
+	struct mp_data *data;
+	pthread_t thread;
+	uint32_t index;
+};
+
+struct mp_data {
+	struct pw_loop *l;
+	struct mp_thread thread[MP_THREADS];
+	uint32_t next[MP_THREADS];
+	uint32_t count;
+	bool error;
+};
+
+struct mp_item {
+	uint32_t thread;
+	uint32_t seq;
+};
+
+static int mp_invoke(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *d, size_t size, void *user_data)
+{
+	struct mp_data *data = user_data;
+	const struct mp_item *item = d;
+
+	/* items from one thread arrive in order without gaps */
+	if (size != sizeof(*item) || item->thread >= MP_THREADS ||
+	    item->seq != data->next[item->thread])
+		data->error = true;
+	else
+		data->next[item->thread]++;
+	data->count++;
+	return item->seq;
+}
+
+static void *mp_thread(void *d)
+{
+	struct mp_thread *t = d;
+	struct mp_data *data = t->data;
+	struct mp_item item;
+	uint32_t i;
+	int res;
+
+	item.thread = t->index;
+
+	for (i = 0; i < MP_ITEMS; i++) {
+		bool block = (i % 500) == 0;
+
+		item.seq = i;
+		while ((res = pw_loop_invoke(data->l, mp_invoke, 1, &item, sizeof(item),
+					block, data)) == -EPIPE)
+			usleep(100);
+		if (block && res != (int)i)
+			data->error = true;
+	}
+	return NULL;
+}
+
+PWTEST(invoke_multiple_producers)
+{
+	struct mp_data data;
+	struct pw_data_loop *dl;
+	uint32_t i;
+
+	pw_init(NULL, NULL);
+
+	spa_zero(data);
+	dl = pw_data_loop_new(NULL);
+	pwtest_ptr_notnull(dl);
+	data.l = pw_data_loop_get_loop(dl);
+
+	pwtest_neg_errno_ok(pw_data_loop_start(dl));
+
+	for (i = 0; i < MP_THREADS; i++) {
+		struct mp_thread *t = &data.thread[i];
+
+		t->data = &data;
+		t->index = i;
+		pwtest_int_eq(pthread_create(&t->thread, NULL, mp_thread, t), 0);
+	}
+	for (i = 0; i < MP_THREADS; i++)
+		pwtest_int_eq(pthread_join(data.thread[i].thread, NULL), 0);
+
+	/* a blocking invoke is handled after everything before it */
+	pw_loop_invoke(data.l, NULL, 0, NULL, 0, true, NULL);
+
+	pwtest_bool_false(data.error);
+	pwtest_int_eq(data.count, (uint32_t)(MP_THREADS * MP_ITEMS));
+	for (i = 0; i < MP_THREADS; i++)
+		pwtest_int_eq(data.next[i], (uint32_t)MP_ITEMS);
+
+	pwtest_neg_errno_ok(pw_data_loop_stop(dl));
+	pw_data_loop_destroy(dl);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
+struct shared_timer_data {
+	struct pw_loop *l;
+	struct spa_source *a, *b, *c, *p;
+	int a_count, b_count, c_count;
+	uint64_t p_count;
+};
+
+static void on_timer_a(void *data, uint64_t expirations)
+{
+	struct shared_timer_data *d = data;
+	d->a_count++;
+}
+
+static void on_timer_b(void *data, uint64_t expirations)
+{
+	struct shared_timer_data *d = data;
+	d->b_count++;
+	pw_loop_destroy_source(d->l, d->c);
+}
+
+static void on_timer_c(void *data, uint64_t expirations)
+{
+	struct shared_timer_data *d = data;
+	d->c_count++;
+}
+
+static void on_timer_p(void *data, uint64_t expirations)
+{
+	struct shared_timer_data *d = data;
+	d->p_count += expirations;
+}
+
+PWTEST(shared_timers)
+{
+	struct shared_timer_data data;
+	struct timespec value, interval;
+
+	pw_init(NULL, NULL);
+
+	spa_zero(data);
+	data.l = pw_loop_new(NULL);
+	pwtest_ptr_notnull(data.l);
+
+	pw_loop_enter(data.l);
+
+	/* a can wait for b, they expire in the same wakeup */
+	data.a = pw_loop_add_shared_timer(data.l, 20 * SPA_NSEC_PER_MSEC, on_timer_a, &data);
+	pwtest_ptr_notnull(data.a);
+	data.b = pw_loop_add_shared_timer(data.l, 0, on_timer_b, &data);
+	pwtest_ptr_notnull(data.b);
+	data.c = pw_loop_add_shared_timer(data.l, 0, on_timer_c, &data);
+	pwtest_ptr_notnull(data.c);
+
+	value.tv_sec = 0;
+	value.tv_nsec = 10 * SPA_NSEC_PER_MSEC;
+	pwtest_neg_errno_ok(pw_loop_update_timer(data.l, data.a, &value, NULL, false));
+	value.tv_nsec = 15 * SPA_NSEC_PER_MSEC;
+	pwtest_neg_errno_ok(pw_loop_update_timer(data.l, data.b, &value, NULL, false));
+	value.tv_nsec = 200 * SPA_NSEC_PER_MSEC;
+	pwtest_neg_errno_ok(pw_loop_update_timer(data.l, data.c, &value, NULL, false));
+
+	pwtest_int_eq(pw_loop_iterate(data.l, -1), 1);
+	pwtest_int_eq(data.a_count, 1);
+	pwtest_int_eq(data.b_count, 1);
+
+	/* periodic timer */
+	data.p = pw_loop_add_shared_timer(data.l, 0, on_timer_p, &data);
+	pwtest_ptr_notnull(data.p);
+	interval.tv_sec = 0;
+	interval.tv_nsec = 5 * SPA_NSEC_PER_MSEC;
+	pwtest_neg_errno_ok(pw_loop_update_timer(data.l, data.p, &interval, &interval, false));
+	while (data.p_count < 4)
+		pw_loop_iterate(data.l, -1);
+
+	/* disarming the last timer disarms the timerfd, c was destroyed */
+	pwtest_neg_errno_ok(pw_loop_update_timer(data.l, data.p, NULL, NULL, false));
+	pwtest_int_eq(pw_loop_iterate(data.l, 300), 0);
+	pwtest_int_eq(data.c_count, 0);
+
+	pw_loop_destroy_source(data.l, data.a);
+	pw_loop_destroy_source(data.l, data.b);
+	pw_loop_destroy_source(data.l, data.p);
+
+	pw_loop_leave(data.l);
+	pw_loop_destroy(data.l);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
 PWTEST_SUITE(support)
 {
 	pwtest_add(pwtest_loop_destroy2, PWTEST_NOARG);
@@ -443,6 +639,8 @@ PWTEST_SUITE(support)
 	pwtest_add(destroy_managed_source_before_dispatch, PWTEST_NOARG);
 	pwtest_add(destroy_managed_source_before_dispatch_recurse, PWTEST_NOARG);
 	pwtest_add(cancel_thread_while_dispatching, PWTEST_NOARG);
+	pwtest_add(invoke_multiple_producers, PWTEST_NOARG);
+	pwtest_add(shared_timers, PWTEST_NOARG);
 
 	return PWTEST_PASS;
 }
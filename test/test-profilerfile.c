@@ -0,0 +1,260 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pwtest.h"
+
+#include <spa/utils/string.h>
+
+#include "profilerfile.h"
+
+/* enough records for a few sync points and, with the followers, more
+ * than one chunk */
+#define N_RECORDS	5000
+#define N_FOLLOWERS	64
+#define REMOVE_AT	2500
+
+#define RECORD_TIME(i)	(1000 + (uint64_t)(i) * SPA_NSEC_PER_MSEC)
+
+static void make_record(struct pw_profiler_record *r, uint32_t i)
+{
+	uint64_t base = RECORD_TIME(i);
+	uint32_t j;
+
+	memset(r, 0, sizeof(*r) + N_FOLLOWERS * sizeof(struct pw_profiler_block));
+	r->n_followers = N_FOLLOWERS;
+	r->size = sizeof(*r) + N_FOLLOWERS * sizeof(struct pw_profiler_block);
+	r->info.count = i;
+	r->info.clock.rate = SPA_FRACTION(1, 48000);
+	r->info.clock.duration = 1024;
+	r->info.clock.position = (uint64_t)i * 1024;
+	r->driver.id = 1;
+	r->driver.signal_time = base;
+	r->driver.awake_time = base + 10;
+	r->driver.finish_time = base + 20;
+	for (j = 0; j < N_FOLLOWERS; j++) {
+		r->followers[j].id = 100 + j;
+		r->followers[j].signal_time = base + j;
+		r->followers[j].awake_time = base + j + 100;
+		/* a follower that did not finish */
+		r->followers[j].finish_time = j % 2 ? base + j + 200 : 0;
+	}
+}
+
+static void check_record(const struct pw_profiler_record *r, uint32_t i)
+{
+	uint64_t base = RECORD_TIME(i);
+	uint32_t j;
+
+	pwtest_int_eq(r->info.count, (int64_t)i);
+	pwtest_int_eq(r->info.clock.rate.denom, 48000u);
+	pwtest_int_eq(r->info.clock.position, (uint64_t)i * 1024);
+	pwtest_int_eq(r->driver.id, 1u);
+	pwtest_int_eq(r->driver.signal_time, base);
+	pwtest_int_eq(r->driver.finish_time, base + 20);
+	pwtest_int_eq(r->n_followers, (uint32_t)N_FOLLOWERS);
+	for (j = 0; j < N_FOLLOWERS; j++) {
+		pwtest_int_eq(r->followers[j].id, 100 + j);
+		pwtest_int_eq(r->followers[j].awake_time, base + j + 100);
+		pwtest_int_eq(r->followers[j].finish_time, j % 2 ? base + j + 200 : 0);
+	}
+}
+
+static void write_trace(const char *path)
+{
+	uint8_t data[sizeof(struct pw_profiler_record) +
+		N_FOLLOWERS * sizeof(struct pw_profiler_block)] SPA_ALIGNED(8);
+	struct pw_profiler_record *r = (struct pw_profiler_record *)data;
+	struct profiler_file_info info;
+	struct profiler_file_event ev;
+	struct profiler_file *pf;
+	uint32_t i;
+
+	pf = profiler_file_open(path, "w", &info);
+	pwtest_ptr_notnull(pf);
+
+	spa_zero(ev);
+	ev.type = PROFILER_FILE_EVENT_NODE;
+	ev.node.id = 1;
+	ev.node.name = "driver";
+	pwtest_neg_errno_ok(profiler_file_write_event(pf, &ev));
+	ev.node.id = 100;
+	ev.node.name = "follower";
+	pwtest_neg_errno_ok(profiler_file_write_event(pf, &ev));
+
+	spa_zero(ev);
+	ev.type = PROFILER_FILE_EVENT_LINK;
+	ev.link.id = 200;
+	ev.link.output_node = 1;
+	ev.link.input_node = 100;
+	pwtest_neg_errno_ok(profiler_file_write_event(pf, &ev));
+
+	for (i = 0; i < N_RECORDS; i++) {
+		if (i == REMOVE_AT) {
+			spa_zero(ev);
+			ev.type = PROFILER_FILE_EVENT_REMOVE;
+			ev.time = RECORD_TIME(i);
+			ev.remove.id = 200;
+			pwtest_neg_errno_ok(profiler_file_write_event(pf, &ev));
+		}
+		make_record(r, i);
+		spa_zero(ev);
+		ev.type = PROFILER_FILE_EVENT_RECORD;
+		ev.time = RECORD_TIME(i);
+		ev.record = r;
+		pwtest_neg_errno_ok(profiler_file_write_event(pf, &ev));
+	}
+	pwtest_neg_errno_ok(profiler_file_close(pf));
+}
+
+/* read to the end, the first record is returned in first */
+static uint32_t read_trace(struct profiler_file *pf, uint32_t *first,
+		uint32_t *n_nodes, uint32_t *n_links, uint32_t *n_removes)
+{
+	struct profiler_file_event ev;
+	uint32_t n_records = 0, next = 0;
+	int res;
+
+	*n_nodes = *n_links = *n_removes = 0;
+
+	while ((res = profiler_file_read_event(pf, &ev)) > 0) {
+		switch (ev.type) {
+		case PROFILER_FILE_EVENT_RECORD:
+			if (n_records == 0)
+				next = *first = ev.record->info.count;
+			pwtest_int_eq(ev.time, RECORD_TIME(next));
+			check_record(ev.record, next);
+			next++;
+			n_records++;
+			break;
+		case PROFILER_FILE_EVENT_NODE:
+			pwtest_bool_true(ev.node.id == 1 ?
+					spa_streq(ev.node.name, "driver") :
+					spa_streq(ev.node.name, "follower"));
+			(*n_nodes)++;
+			break;
+		case PROFILER_FILE_EVENT_LINK:
+			pwtest_int_eq(ev.link.id, 200u);
+			pwtest_int_eq(ev.link.output_node, 1u);
+			pwtest_int_eq(ev.link.input_node, 100u);
+			(*n_links)++;
+			break;
+		case PROFILER_FILE_EVENT_REMOVE:
+			pwtest_int_eq(ev.remove.id, 200u);
+			if (n_records > 0)
+				pwtest_int_eq(next, (uint32_t)REMOVE_AT);
+			(*n_removes)++;
+			break;
+		}
+	}
+	pwtest_neg_errno_ok(res);
+	return n_records;
+}
+
+PWTEST(profilerfile_roundtrip)
+{
+	struct profiler_file_info info;
+	struct profiler_file *pf;
+	uint32_t first = 0, n_nodes, n_links, n_removes;
+	const char *tmpdir = getenv("TMPDIR");
+	char path[PATH_MAX];
+
+	pwtest_ptr_notnull(tmpdir);
+	spa_scnprintf(path, sizeof(path), "%s/trace.pwprof", tmpdir);
+
+	write_trace(path);
+
+	pf = profiler_file_open(path, "r", &info);
+	pwtest_ptr_notnull(pf);
+	pwtest_bool_true(info.indexed);
+	pwtest_int_eq(info.n_records, (uint64_t)N_RECORDS);
+	pwtest_int_eq(info.start_time, RECORD_TIME(0));
+	pwtest_int_eq(info.end_time, RECORD_TIME(N_RECORDS - 1));
+
+	pwtest_int_eq(read_trace(pf, &first, &n_nodes, &n_links, &n_removes),
+			(uint32_t)N_RECORDS);
+	pwtest_int_eq(first, 0u);
+	pwtest_int_eq(n_nodes, 2u);
+	pwtest_int_eq(n_links, 1u);
+	pwtest_int_eq(n_removes, 1u);
+
+	/* seeking starts at the sync point before the time and first gives
+	 * the topology that was recorded before it */
+	pwtest_neg_errno_ok(profiler_file_seek(pf, RECORD_TIME(3000)));
+	pwtest_int_eq(read_trace(pf, &first, &n_nodes, &n_links, &n_removes),
+			(uint32_t)N_RECORDS - first);
+	pwtest_int_le(first, 3000u);
+	pwtest_int_gt(first, 3000u - 1024);
+	pwtest_int_eq(n_nodes, 2u);
+	pwtest_int_eq(n_links, 1u);
+	pwtest_int_eq(n_removes, 1u);
+
+	/* before the first record everything is read again */
+	pwtest_neg_errno_ok(profiler_file_seek(pf, 0));
+	pwtest_int_eq(read_trace(pf, &first, &n_nodes, &n_links, &n_removes),
+			(uint32_t)N_RECORDS);
+	pwtest_int_eq(first, 0u);
+
+	pwtest_neg_errno_ok(profiler_file_close(pf));
+
+	return PWTEST_PASS;
+}
+
+PWTEST(profilerfile_bad_index)
+{
+	struct profiler_file_info info;
+	struct profiler_file *pf;
+	uint32_t first = 0, n_nodes, n_links, n_removes;
+	const char *tmpdir = getenv("TMPDIR");
+	char path[PATH_MAX];
+	uint64_t index_offset;
+	uint32_t n_sync;
+	int fd;
+
+	pwtest_ptr_notnull(tmpdir);
+	spa_scnprintf(path, sizeof(path), "%s/bad-index.pwprof", tmpdir);
+
+	write_trace(path);
+
+	/* drop the index and make the header point past the end of the
+	 * file with an offset that wraps around */
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	pwtest_errno_ok(fd);
+	pwtest_int_eq(pread(fd, &index_offset, sizeof(index_offset), 32), (ssize_t)sizeof(index_offset));
+	pwtest_errno_ok(ftruncate(fd, index_offset));
+
+	index_offset = UINT64_MAX - 7;
+	n_sync = 1;
+	pwtest_int_eq(pwrite(fd, &index_offset, sizeof(index_offset), 32), (ssize_t)sizeof(index_offset));
+	pwtest_int_eq(pwrite(fd, &n_sync, sizeof(n_sync), 40), (ssize_t)sizeof(n_sync));
+	close(fd);
+
+	/* the index is rebuilt from the entries */
+	pf = profiler_file_open(path, "r", &info);
+	pwtest_ptr_notnull(pf);
+	pwtest_bool_false(info.indexed);
+	pwtest_int_eq(info.n_records, (uint64_t)N_RECORDS);
+
+	pwtest_neg_errno_ok(profiler_file_seek(pf, RECORD_TIME(3000)));
+	pwtest_int_eq(read_trace(pf, &first, &n_nodes, &n_links, &n_removes),
+			(uint32_t)N_RECORDS - first);
+	pwtest_int_le(first, 3000u);
+	pwtest_int_eq(n_nodes, 2u);
+
+	pwtest_neg_errno_ok(profiler_file_close(pf));
+
+	return PWTEST_PASS;
+}
+
+PWTEST_SUITE(profilerfile)
+{
+	pwtest_add(profilerfile_roundtrip, PWTEST_NOARG);
+	pwtest_add(profilerfile_bad_index, PWTEST_NOARG);
+
+	return PWTEST_PASS;
+}
@@ -7,6 +7,7 @@
 
 #include <spa/buffer/alloc.h>
 #include <spa/buffer/buffer.h>
+#include <spa/buffer/damage.h>
 #include <spa/buffer/meta.h>
 
 PWTEST(buffer_abi_types)
@@ -120,11 +121,67 @@ PWTEST(buffer_alloc)
 	return PWTEST_PASS;
 }
 
+PWTEST(buffer_damage_copy)
+{
+#define W 16
+#define H 8
+	uint32_t src[H][W], dst[H][W + 4];
+	struct spa_meta_region regions[4];
+	struct spa_meta damage;
+	uint32_t x, y;
+	size_t res;
+
+	for (y = 0; y < H; y++)
+		for (x = 0; x < W; x++)
+			src[y][x] = y << 16 | x;
+	memset(dst, 0, sizeof(dst));
+
+	damage.type = SPA_META_VideoDamage;
+	damage.size = sizeof(regions);
+	damage.data = regions;
+
+	/* two regions, the second one clipped, then an end marker */
+	regions[0].region = SPA_REGION(1, 1, 2, 3);
+	regions[1].region = SPA_REGION(W - 2, H - 1, 10, 10);
+	regions[2].region = SPA_REGION(0, 0, 0, 0);
+	regions[3].region = SPA_REGION(0, 0, W, H);
+
+	res = spa_damage_copy(dst, sizeof(dst[0]), src, sizeof(src[0]),
+			W, H, sizeof(uint32_t), &damage);
+	pwtest_int_eq(res, (2 * 3 + 2 * 1) * sizeof(uint32_t));
+
+	for (y = 0; y < H; y++) {
+		for (x = 0; x < W; x++) {
+			bool damaged = (x >= 1 && x < 3 && y >= 1 && y < 4) ||
+				(x >= W - 2 && y == H - 1);
+			pwtest_int_eq(dst[y][x], damaged ? src[y][x] : 0u);
+		}
+	}
+
+	/* no damage copies nothing */
+	regions[0].region = SPA_REGION(0, 0, 0, 0);
+	res = spa_damage_copy(dst, sizeof(dst[0]), src, sizeof(src[0]),
+			W, H, sizeof(uint32_t), &damage);
+	pwtest_int_eq(res, 0u);
+
+	/* unknown damage copies the frame */
+	res = spa_damage_copy(dst, sizeof(dst[0]), src, sizeof(src[0]),
+			W, H, sizeof(uint32_t), NULL);
+	pwtest_int_eq(res, sizeof(src));
+	for (y = 0; y < H; y++)
+		pwtest_int_eq(memcmp(dst[y], src[y], sizeof(src[y])), 0);
+#undef W
+#undef H
+
+	return PWTEST_PASS;
+}
+
 PWTEST_SUITE(spa_buffer)
 {
 	pwtest_add(buffer_abi_types, PWTEST_NOARG);
 	pwtest_add(buffer_abi_sizes, PWTEST_NOARG);
 	pwtest_add(buffer_alloc, PWTEST_NOARG);
+	pwtest_add(buffer_damage_copy, PWTEST_NOARG);
 
 	return PWTEST_PASS;
 }
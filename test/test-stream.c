@@ -0,0 +1,321 @@
+/* PipeWire */
+/* SPDX-FileCopyrightText: Copyright © 2023 Wim Taymans */
+/* SPDX-License-Identifier: MIT */
+
+#include "config.h"
+
+#include <time.h>
+
+#include "pwtest.h"
+
+#include <spa/param/video/format-utils.h>
+#include <spa/pod/builder.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/filter.h>
+
+#define N_BUFFERS	16
+#define QUANTUM		64
+/* cycles the consumer lets the buffers pile up before it takes the latest */
+#define HOLD		4
+#define N_ROUNDS	250
+
+struct data {
+	struct pw_thread_loop *loop;
+	struct pw_context *context;
+	struct pw_core *core;
+
+	struct pw_filter *source;
+	struct spa_hook source_listener;
+	void *port;
+	uint32_t seq;
+	bool source_checked;
+
+	struct pw_stream *sink;
+	struct spa_hook sink_listener;
+	uint32_t cycle;
+	uint32_t last_seq;
+	uint32_t rounds;
+	bool sink_checked;
+	bool finished;
+
+	uint64_t latest_nsec;
+	uint32_t latest_count;
+	uint64_t loop_nsec;
+	uint32_t loop_count;
+	uint32_t loop_buffers;
+
+	bool done;
+};
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_NSEC(&ts);
+}
+
+static inline uint32_t buffer_seq(struct pw_buffer *b)
+{
+	return *(uint32_t*)b->buffer->datas[0].data;
+}
+
+static void source_state_changed(void *userdata, enum pw_filter_state old,
+		enum pw_filter_state state, const char *error)
+{
+	struct data *d = userdata;
+	pw_thread_loop_signal(d->loop, false);
+}
+
+static void source_process(void *userdata, struct spa_io_position *position)
+{
+	struct data *d = userdata;
+	struct pw_buffer *b, *dup[2];
+	struct spa_data *sd;
+
+	if (!d->source_checked) {
+		/* the older buffers of an output port can't be recycled */
+		errno = 0;
+		pwtest_ptr_null(pw_filter_dequeue_latest_buffer(d->port));
+		pwtest_int_eq(errno, EINVAL);
+	}
+
+	if ((b = pw_filter_dequeue_buffer(d->port)) == NULL)
+		return;
+
+	sd = &b->buffer->datas[0];
+	pwtest_ptr_notnull(sd->data);
+	*(uint32_t*)sd->data = ++d->seq;
+	sd->chunk->offset = 0;
+	sd->chunk->size = sizeof(uint32_t);
+	sd->chunk->stride = 0;
+
+	if (!d->source_checked) {
+		/* the same buffer twice is refused and leaves the queue alone */
+		dup[0] = dup[1] = b;
+		pwtest_neg_errno(pw_filter_queue_buffers(d->port, dup, 2), -EINVAL);
+		d->source_checked = true;
+	}
+	pwtest_neg_errno_ok(pw_filter_queue_buffers(d->port, &b, 1));
+}
+
+static const struct pw_filter_events source_events = {
+	PW_VERSION_FILTER_EVENTS,
+	.state_changed = source_state_changed,
+	.process = source_process,
+};
+
+static void sink_state_changed(void *userdata, enum pw_stream_state old,
+		enum pw_stream_state state, const char *error)
+{
+	struct data *d = userdata;
+	pw_thread_loop_signal(d->loop, false);
+}
+
+static int do_finish(struct spa_loop *loop, bool async, uint32_t seq,
+		const void *data, size_t size, void *user_data)
+{
+	struct data *d = user_data;
+	d->done = true;
+	pw_thread_loop_signal(d->loop, false);
+	return 0;
+}
+
+static bool sink_check(struct data *d)
+{
+	struct pw_buffer *buffers[N_BUFFERS], *dup[2];
+	int i, n;
+
+	n = pw_stream_dequeue_buffers(d->sink, buffers, N_BUFFERS);
+	pwtest_int_gt(n, 0);
+
+	/* the oldest buffer comes first */
+	for (i = 0; i < n; i++) {
+		pwtest_int_gt(buffer_seq(buffers[i]), d->last_seq);
+		d->last_seq = buffer_seq(buffers[i]);
+	}
+	if (n >= 2) {
+		dup[0] = dup[1] = buffers[0];
+		pwtest_neg_errno(pw_stream_queue_buffers(d->sink, dup, 2), -EINVAL);
+	}
+	pwtest_neg_errno_ok(pw_stream_queue_buffers(d->sink, buffers, n));
+
+	return n >= 2;
+}
+
+static void sink_process(void *userdata)
+{
+	struct data *d = userdata;
+	struct pw_buffer *b, *t;
+	uint64_t start;
+	uint32_t seq;
+
+	if (d->finished || ++d->cycle % HOLD != 0)
+		return;
+
+	if (!d->sink_checked) {
+		d->sink_checked = sink_check(d);
+		return;
+	}
+
+	/* take the latest buffer, alternating between the batch call and
+	 * the loop the modules used before */
+	start = get_time_ns();
+	if (d->rounds % 2) {
+		b = pw_stream_dequeue_latest_buffer(d->sink);
+		d->latest_nsec += get_time_ns() - start;
+		d->latest_count++;
+	} else {
+		b = NULL;
+		while ((t = pw_stream_dequeue_buffer(d->sink)) != NULL) {
+			if (b != NULL)
+				pw_stream_queue_buffer(d->sink, b);
+			b = t;
+			d->loop_buffers++;
+		}
+		d->loop_nsec += get_time_ns() - start;
+		d->loop_count++;
+	}
+	pwtest_ptr_notnull(b);
+
+	seq = buffer_seq(b);
+	pwtest_int_gt(seq, d->last_seq);
+	d->last_seq = seq;
+	pwtest_neg_errno_ok(pw_stream_queue_buffer(d->sink, b));
+
+	if (++d->rounds == N_ROUNDS) {
+		d->finished = true;
+		pw_loop_invoke(pw_thread_loop_get_loop(d->loop),
+				do_finish, 1, NULL, 0, false, d);
+	}
+}
+
+static const struct pw_stream_events sink_events = {
+	PW_VERSION_STREAM_EVENTS,
+	.state_changed = sink_state_changed,
+	.process = sink_process,
+};
+
+static uint32_t build_params(struct spa_pod_builder *b, const struct spa_pod *params[2])
+{
+	params[0] = spa_format_video_raw_build(b, SPA_PARAM_EnumFormat,
+			&SPA_VIDEO_INFO_RAW_INIT(
+				.format = SPA_VIDEO_FORMAT_RGBA,
+				.size = SPA_RECTANGLE(16, 16),
+				.framerate = SPA_FRACTION(0, 1)));
+	params[1] = spa_pod_builder_add_object(b,
+			SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+			SPA_PARAM_BUFFERS_buffers, SPA_POD_Int(N_BUFFERS),
+			SPA_PARAM_BUFFERS_blocks,  SPA_POD_Int(1),
+			SPA_PARAM_BUFFERS_size,    SPA_POD_Int(16 * 16 * 4),
+			SPA_PARAM_BUFFERS_stride,  SPA_POD_Int(16 * 4));
+	return 2;
+}
+
+PWTEST(stream_queue_buffers)
+{
+	struct data d;
+	const struct spa_pod *params[2];
+	uint8_t buffer[1024];
+	struct spa_pod_builder b;
+	struct pw_properties *props;
+	struct pw_proxy *link;
+	uint32_t n_params;
+
+	pw_init(0, NULL);
+
+	spa_zero(d);
+	d.loop = pw_thread_loop_new("test", NULL);
+	pwtest_ptr_notnull(d.loop);
+	d.context = pw_context_new(pw_thread_loop_get_loop(d.loop), NULL, 0);
+	pwtest_ptr_notnull(d.context);
+
+	pwtest_neg_errno_ok(pw_thread_loop_start(d.loop));
+	pw_thread_loop_lock(d.loop);
+
+	d.core = pw_context_connect(d.context, NULL, 0);
+	pwtest_ptr_notnull(d.core);
+
+	spa_pod_builder_init(&b, buffer, sizeof(buffer));
+	n_params = build_params(&b, params);
+
+	/* the producer is a filter and the consumer a stream so that the
+	 * batch calls of both are used */
+	d.source = pw_filter_new(d.core, "batch-source",
+			pw_properties_new(
+				PW_KEY_MEDIA_TYPE, "Video",
+				PW_KEY_MEDIA_CATEGORY, "Source",
+				NULL));
+	pwtest_ptr_notnull(d.source);
+	pw_filter_add_listener(d.source, &d.source_listener, &source_events, &d);
+
+	d.port = pw_filter_add_port(d.source, SPA_DIRECTION_OUTPUT,
+			PW_FILTER_PORT_FLAG_MAP_BUFFERS, 0,
+			pw_properties_new(PW_KEY_PORT_NAME, "output", NULL),
+			params, n_params);
+	pwtest_ptr_notnull(d.port);
+	pwtest_neg_errno_ok(pw_filter_connect(d.source, PW_FILTER_FLAG_RT_PROCESS, NULL, 0));
+
+	d.sink = pw_stream_new(d.core, "batch-sink",
+			pw_properties_new(
+				PW_KEY_MEDIA_TYPE, "Video",
+				PW_KEY_MEDIA_CATEGORY, "Capture",
+				PW_KEY_NODE_FORCE_QUANTUM, SPA_STRINGIFY(QUANTUM),
+				NULL));
+	pwtest_ptr_notnull(d.sink);
+	pw_stream_add_listener(d.sink, &d.sink_listener, &sink_events, &d);
+
+	pwtest_neg_errno_ok(pw_stream_connect(d.sink, SPA_DIRECTION_INPUT, PW_ID_ANY,
+			PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS,
+			params, n_params));
+
+	while (pw_filter_get_node_id(d.source) == SPA_ID_INVALID ||
+	    pw_stream_get_node_id(d.sink) == SPA_ID_INVALID)
+		pw_thread_loop_wait(d.loop);
+
+	/* there is no session manager, link the nodes ourselves */
+	props = pw_properties_new(NULL, NULL);
+	pw_properties_setf(props, PW_KEY_LINK_OUTPUT_NODE, "%u",
+			pw_filter_get_node_id(d.source));
+	pw_properties_setf(props, PW_KEY_LINK_INPUT_NODE, "%u",
+			pw_stream_get_node_id(d.sink));
+	link = pw_core_create_object(d.core, "link-factory",
+			PW_TYPE_INTERFACE_Link, PW_VERSION_LINK,
+			&props->dict, 0);
+	pw_properties_free(props);
+	pwtest_ptr_notnull(link);
+
+	while (!d.done)
+		pw_thread_loop_wait(d.loop);
+
+	pwtest_bool_true(d.source_checked);
+	pwtest_bool_true(d.sink_checked);
+	pwtest_int_gt(d.latest_count, 0u);
+	pwtest_int_gt(d.loop_count, 0u);
+
+	printf("quantum %d, %u buffers per call: dequeue latest %"PRIu64" nsec, "
+			"dequeue loop %"PRIu64" nsec\n", QUANTUM,
+			d.loop_buffers / d.loop_count,
+			d.latest_nsec / d.latest_count,
+			d.loop_nsec / d.loop_count);
+
+	pw_proxy_destroy(link);
+	pw_stream_destroy(d.sink);
+	pw_filter_destroy(d.source);
+	pw_core_disconnect(d.core);
+	pw_thread_loop_unlock(d.loop);
+	pw_thread_loop_stop(d.loop);
+	pw_context_destroy(d.context);
+	pw_thread_loop_destroy(d.loop);
+
+	pw_deinit();
+
+	return PWTEST_PASS;
+}
+
+PWTEST_SUITE(stream)
+{
+	pwtest_add(stream_queue_buffers, PWTEST_ARG_DAEMON);
+
+	return PWTEST_PASS;
+}